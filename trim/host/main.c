@@ -0,0 +1,26 @@
+// Entry point for the host build: converts the UTF-8 arguments and runs trim's wmain.
+#include "windows.h"
+
+#include <stdlib.h>
+
+int wmain(int argc, wchar_t** argv);
+
+int main(int argc, char** argv) {
+  wchar_t** wideArgs = (wchar_t**) calloc((size_t) argc + 1, sizeof(wchar_t*));
+  if (!wideArgs) {
+    return 1;
+  }
+  for (int i = 0; i < argc; ++i) {
+    int units = MultiByteToWideChar(CP_UTF8, 0, argv[i], -1, NULL, 0);
+    wideArgs[i] = units > 0 ? (wchar_t*) malloc((size_t) units * sizeof(wchar_t)) : NULL;
+    if (!wideArgs[i] || MultiByteToWideChar(CP_UTF8, 0, argv[i], -1, wideArgs[i], units) <= 0) {
+      return 1;
+    }
+  }
+  int exitCode = wmain(argc, wideArgs);
+  for (int i = 0; i < argc; ++i) {
+    free(wideArgs[i]);
+  }
+  free(wideArgs);
+  return exitCode;
+}
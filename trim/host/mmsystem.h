@@ -0,0 +1,13 @@
+// The one sound call trim.c makes; the host build is silent.
+#ifndef TRIM_HOST_MMSYSTEM_H
+#define TRIM_HOST_MMSYSTEM_H
+
+#include "windows.h"
+
+#define SND_ASYNC 0x1u
+#define SND_NODEFAULT 0x2u
+#define SND_ALIAS 0x10000u
+
+BOOL PlaySoundW(LPCWSTR sound, HINSTANCE module, DWORD flags);
+
+#endif
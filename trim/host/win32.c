@@ -0,0 +1,1822 @@
+// POSIX implementation of the Win32 subset declared in windows.h. Handles are heap objects; everything that can be
+// waited on shares one lock and condition variable, which keeps WaitForMultipleObjects simple at the cost of spurious
+// wake-ups nobody here can measure.
+#define _GNU_SOURCE
+#include "windows.h"
+#include "mmsystem.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+typedef enum {
+  HOST_EVENT,
+  HOST_MUTEX,
+  HOST_THREAD,
+  HOST_FILE,
+  HOST_DIRECTORY,
+  HOST_MEMORY,
+  HOST_RESOURCE,
+} HostKind;
+
+struct HostObject {
+  HostKind kind;
+  bool manualReset;
+  bool signaled;
+  // HOST_THREAD
+  pthread_t thread;
+  LPTHREAD_START_ROUTINE start;
+  LPVOID parameter;
+  bool closed;
+  // HOST_FILE and HOST_DIRECTORY
+  int fd;
+  bool borrowedFd;
+  // HOST_DIRECTORY: one outstanding ReadDirectoryChangesW, completed by the inotify thread
+  int inotifyFd;
+  int stopPipe[2];
+  pthread_t watcher;
+  bool watcherRunning;
+  bool armed;
+  bool missedChanges;
+  bool completed;
+  bool cancelled;
+  OVERLAPPED* overlapped;
+  unsigned char* notifyBuffer;
+  DWORD notifyLength;
+  DWORD notifyBytes;
+  // HOST_MEMORY
+  unsigned char* data;
+  size_t size;
+};
+
+struct HostWork {
+  PTP_WORK_CALLBACK callback;
+  PVOID context;
+  size_t running;
+};
+
+struct HostWindow {
+  WNDPROC proc;
+  wchar_t className[64];
+  bool alive;
+  struct HostWindow* next;
+};
+
+static pthread_mutex_t g_hostLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t g_hostCond;
+static pthread_once_t g_hostOnce = PTHREAD_ONCE_INIT;
+static _Thread_local DWORD g_lastError = 0;
+
+static void host_initialize(void) {
+  pthread_condattr_t attributes;
+  pthread_condattr_init(&attributes);
+  pthread_condattr_setclock(&attributes, CLOCK_MONOTONIC);
+  pthread_cond_init(&g_hostCond, &attributes);
+  pthread_condattr_destroy(&attributes);
+}
+
+static void host_lock(void) {
+  pthread_once(&g_hostOnce, host_initialize);
+  pthread_mutex_lock(&g_hostLock);
+}
+
+static void host_unlock(void) {
+  pthread_mutex_unlock(&g_hostLock);
+}
+
+static DWORD error_from_errno(int error) {
+  switch (error) {
+  case 0:
+    return ERROR_SUCCESS;
+  case ENOENT:
+    return ERROR_FILE_NOT_FOUND;
+  case ENOTDIR:
+    return ERROR_PATH_NOT_FOUND;
+  case EACCES:
+  case EPERM:
+  case EISDIR:
+    return ERROR_ACCESS_DENIED;
+  case EROFS:
+    return ERROR_WRITE_PROTECT;
+  case EEXIST:
+    return ERROR_FILE_EXISTS;
+  case ENOMEM:
+    return ERROR_NOT_ENOUGH_MEMORY;
+  case EPIPE:
+    return ERROR_BROKEN_PIPE;
+  case EBADF:
+    return ERROR_INVALID_HANDLE;
+  default:
+    return ERROR_INVALID_PARAMETER;
+  }
+}
+
+static HANDLE new_object(HostKind kind) {
+  HANDLE object = (HANDLE) calloc(1, sizeof(struct HostObject));
+  if (!object) {
+    SetLastError(ERROR_NOT_ENOUGH_MEMORY);
+    return NULL;
+  }
+  object->kind = kind;
+  object->fd = -1;
+  object->inotifyFd = -1;
+  object->stopPipe[0] = -1;
+  object->stopPipe[1] = -1;
+  return object;
+}
+
+DWORD GetLastError(void) {
+  return g_lastError;
+}
+
+void SetLastError(DWORD error) {
+  g_lastError = error;
+}
+
+// ---------------------------------------------------------------------------------------------------------------
+// Wide strings
+
+size_t host_wcslen(const wchar_t* text) {
+  size_t length = 0;
+  while (text[length]) {
+    length++;
+  }
+  return length;
+}
+
+int host_wcscmp(const wchar_t* lhs, const wchar_t* rhs) {
+  while (*lhs && *lhs == *rhs) {
+    lhs++;
+    rhs++;
+  }
+  return (int) *lhs - (int) *rhs;
+}
+
+int host_wcsncmp(const wchar_t* lhs, const wchar_t* rhs, size_t count) {
+  for (size_t i = 0; i < count; ++i) {
+    if (lhs[i] != rhs[i] || !lhs[i]) {
+      return (int) lhs[i] - (int) rhs[i];
+    }
+  }
+  return 0;
+}
+
+static wchar_t fold_ascii(wchar_t c) {
+  return c >= L'A' && c <= L'Z' ? (wchar_t) (c + 32) : c;
+}
+
+int host_wcsnicmp(const wchar_t* lhs, const wchar_t* rhs, size_t count) {
+  for (size_t i = 0; i < count; ++i) {
+    wchar_t l = fold_ascii(lhs[i]);
+    wchar_t r = fold_ascii(rhs[i]);
+    if (l != r || !l) {
+      return (int) l - (int) r;
+    }
+  }
+  return 0;
+}
+
+int host_wcsicmp(const wchar_t* lhs, const wchar_t* rhs) {
+  return host_wcsnicmp(lhs, rhs, (size_t) -1);
+}
+
+wchar_t* host_wmemchr(const wchar_t* text, wchar_t c, size_t count) {
+  for (size_t i = 0; i < count; ++i) {
+    if (text[i] == c) {
+      return (wchar_t*) text + i;
+    }
+  }
+  return NULL;
+}
+
+int host_wmemcmp(const wchar_t* lhs, const wchar_t* rhs, size_t count) {
+  for (size_t i = 0; i < count; ++i) {
+    if (lhs[i] != rhs[i]) {
+      return lhs[i] < rhs[i] ? -1 : 1;
+    }
+  }
+  return 0;
+}
+
+wchar_t* host_wmemcpy(wchar_t* destination, const wchar_t* source, size_t count) {
+  return (wchar_t*) memcpy(destination, source, count * sizeof(wchar_t));
+}
+
+wchar_t* host_wmemmove(wchar_t* destination, const wchar_t* source, size_t count) {
+  return (wchar_t*) memmove(destination, source, count * sizeof(wchar_t));
+}
+
+// The C1_SPACE set the Windows CRT classifies with.
+int host_iswspace(unsigned int c) {
+  return (c >= 0x09 && c <= 0x0D) || c == 0x20 || c == 0x85 || c == 0xA0 || c == 0x1680 ||
+         (c >= 0x2000 && c <= 0x200A) || c == 0x2028 || c == 0x2029 || c == 0x202F || c == 0x205F || c == 0x3000;
+}
+
+// ---------------------------------------------------------------------------------------------------------------
+// Text conversion
+
+static bool decode_utf8(const unsigned char* text, size_t length, size_t* position, uint32_t* codePoint) {
+  unsigned char lead = text[*position];
+  size_t trail = 0;
+  uint32_t value = 0;
+  uint32_t minimum = 0;
+  if (lead < 0x80) {
+    *codePoint = lead;
+    (*position)++;
+    return true;
+  } else if (lead >= 0xC2 && lead <= 0xDF) {
+    trail = 1;
+    value = lead & 0x1Fu;
+    minimum = 0x80;
+  } else if (lead >= 0xE0 && lead <= 0xEF) {
+    trail = 2;
+    value = lead & 0x0Fu;
+    minimum = 0x800;
+  } else if (lead >= 0xF0 && lead <= 0xF4) {
+    trail = 3;
+    value = lead & 0x07u;
+    minimum = 0x10000;
+  } else {
+    (*position)++;
+    return false;
+  }
+  size_t cursor = *position + 1;
+  for (size_t i = 0; i < trail; ++i, ++cursor) {
+    if (cursor >= length || (text[cursor] & 0xC0u) != 0x80u) {
+      *position = cursor;
+      return false;
+    }
+    value = value << 6 | (text[cursor] & 0x3Fu);
+  }
+  *position = cursor;
+  if (value < minimum || value > 0x10FFFF || (value >= 0xD800 && value <= 0xDFFF)) {
+    return false;
+  }
+  *codePoint = value;
+  return true;
+}
+
+int MultiByteToWideChar(UINT codePage, DWORD flags, const char* text, int length, wchar_t* out, int outLength) {
+  (void) codePage;
+  if (!text || length == 0 || outLength < 0) {
+    SetLastError(ERROR_INVALID_PARAMETER);
+    return 0;
+  }
+  size_t byteCount = length < 0 ? strlen(text) + 1 : (size_t) length;
+  const unsigned char* bytes = (const unsigned char*) text;
+  size_t position = 0;
+  size_t written = 0;
+  while (position < byteCount) {
+    uint32_t codePoint = 0xFFFD;
+    if (!decode_utf8(bytes, byteCount, &position, &codePoint)) {
+      if (flags & MB_ERR_INVALID_CHARS) {
+        SetLastError(ERROR_NO_UNICODE_TRANSLATION);
+        return 0;
+      }
+      codePoint = 0xFFFD;
+    }
+    size_t units = codePoint >= 0x10000 ? 2 : 1;
+    if (outLength > 0) {
+      if (written + units > (size_t) outLength) {
+        SetLastError(ERROR_INSUFFICIENT_BUFFER);
+        return 0;
+      }
+      if (units == 2) {
+        out[written] = (wchar_t) (0xD800 + ((codePoint - 0x10000) >> 10));
+        out[written + 1] = (wchar_t) (0xDC00 + ((codePoint - 0x10000) & 0x3FF));
+      } else {
+        out[written] = (wchar_t) codePoint;
+      }
+    }
+    written += units;
+  }
+  return (int) written;
+}
+
+int WideCharToMultiByte(UINT codePage, DWORD flags, const wchar_t* text, int length, char* out, int outLength,
+                        const char* defaultChar, BOOL* usedDefaultChar) {
+  (void) codePage;
+  (void) flags;
+  (void) defaultChar;
+  if (usedDefaultChar) {
+    *usedDefaultChar = FALSE;
+  }
+  if (!text || length == 0 || outLength < 0) {
+    SetLastError(ERROR_INVALID_PARAMETER);
+    return 0;
+  }
+  size_t unitCount = length < 0 ? host_wcslen(text) + 1 : (size_t) length;
+  size_t written = 0;
+  for (size_t i = 0; i < unitCount; ++i) {
+    uint32_t codePoint = text[i];
+    if (codePoint >= 0xD800 && codePoint <= 0xDBFF && i + 1 < unitCount && text[i + 1] >= 0xDC00 &&
+        text[i + 1] <= 0xDFFF) {
+      codePoint = 0x10000 + ((codePoint - 0xD800) << 10) + (text[i + 1] - 0xDC00u);
+      i++;
+    } else if (codePoint >= 0xD800 && codePoint <= 0xDFFF) {
+      codePoint = 0xFFFD;
+    }
+    unsigned char encoded[4];
+    size_t bytes = 0;
+    if (codePoint < 0x80) {
+      encoded[bytes++] = (unsigned char) codePoint;
+    } else if (codePoint < 0x800) {
+      encoded[bytes++] = (unsigned char) (0xC0 | codePoint >> 6);
+      encoded[bytes++] = (unsigned char) (0x80 | (codePoint & 0x3F));
+    } else if (codePoint < 0x10000) {
+      encoded[bytes++] = (unsigned char) (0xE0 | codePoint >> 12);
+      encoded[bytes++] = (unsigned char) (0x80 | (codePoint >> 6 & 0x3F));
+      encoded[bytes++] = (unsigned char) (0x80 | (codePoint & 0x3F));
+    } else {
+      encoded[bytes++] = (unsigned char) (0xF0 | codePoint >> 18);
+      encoded[bytes++] = (unsigned char) (0x80 | (codePoint >> 12 & 0x3F));
+      encoded[bytes++] = (unsigned char) (0x80 | (codePoint >> 6 & 0x3F));
+      encoded[bytes++] = (unsigned char) (0x80 | (codePoint & 0x3F));
+    }
+    if (outLength > 0) {
+      if (written + bytes > (size_t) outLength) {
+        SetLastError(ERROR_INSUFFICIENT_BUFFER);
+        return 0;
+      }
+      memcpy(out + written, encoded, bytes);
+    }
+    written += bytes;
+  }
+  return (int) written;
+}
+
+// Paths arrive as UTF-16 with Windows separators; POSIX wants UTF-8 and forward slashes.
+static char* host_path(LPCWSTR path) {
+  if (!path) {
+    SetLastError(ERROR_INVALID_PARAMETER);
+    return NULL;
+  }
+  int bytes = WideCharToMultiByte(CP_UTF8, 0, path, -1, NULL, 0, NULL, NULL);
+  char* converted = bytes > 0 ? (char*) malloc((size_t) bytes) : NULL;
+  if (!converted || WideCharToMultiByte(CP_UTF8, 0, path, -1, converted, bytes, NULL, NULL) <= 0) {
+    free(converted);
+    SetLastError(ERROR_NOT_ENOUGH_MEMORY);
+    return NULL;
+  }
+  for (char* c = converted; *c; ++c) {
+    if (*c == '\\') {
+      *c = '/';
+    }
+  }
+  return converted;
+}
+
+static DWORD copy_wide_result(const char* utf8, wchar_t* buffer, DWORD length) {
+  int units = MultiByteToWideChar(CP_UTF8, 0, utf8, -1, NULL, 0);
+  if (units <= 0) {
+    return 0;
+  }
+  if (!buffer || (DWORD) units > length) {
+    SetLastError(ERROR_INSUFFICIENT_BUFFER);
+    return (DWORD) units;
+  }
+  MultiByteToWideChar(CP_UTF8, 0, utf8, -1, buffer, units);
+  return (DWORD) units - 1;
+}
+
+// ---------------------------------------------------------------------------------------------------------------
+// Waitable objects
+
+HANDLE CreateEventW(void* attributes, BOOL manualReset, BOOL initialState, LPCWSTR name) {
+  (void) attributes;
+  (void) name;
+  HANDLE event = new_object(HOST_EVENT);
+  if (event) {
+    event->manualReset = manualReset != 0;
+    event->signaled = initialState != 0;
+  }
+  return event;
+}
+
+static BOOL set_event_state(HANDLE event, bool signaled) {
+  if (!event || event->kind != HOST_EVENT) {
+    SetLastError(ERROR_INVALID_HANDLE);
+    return FALSE;
+  }
+  host_lock();
+  event->signaled = signaled;
+  pthread_cond_broadcast(&g_hostCond);
+  host_unlock();
+  return TRUE;
+}
+
+BOOL SetEvent(HANDLE event) {
+  return set_event_state(event, true);
+}
+
+BOOL ResetEvent(HANDLE event) {
+  return set_event_state(event, false);
+}
+
+// Process-local: the host build never runs two instances against each other.
+HANDLE CreateMutexW(void* attributes, BOOL initialOwner, LPCWSTR name) {
+  (void) attributes;
+  (void) name;
+  HANDLE mutex = new_object(HOST_MUTEX);
+  if (mutex) {
+    mutex->signaled = !initialOwner;
+    SetLastError(ERROR_SUCCESS);
+  }
+  return mutex;
+}
+
+BOOL ReleaseMutex(HANDLE mutex) {
+  if (!mutex || mutex->kind != HOST_MUTEX) {
+    SetLastError(ERROR_INVALID_HANDLE);
+    return FALSE;
+  }
+  host_lock();
+  mutex->signaled = true;
+  pthread_cond_broadcast(&g_hostCond);
+  host_unlock();
+  return TRUE;
+}
+
+static bool object_signaled(HANDLE object) {
+  return object->signaled;
+}
+
+// Called with the host lock held once `object` satisfied a wait.
+static void consume_signal(HANDLE object) {
+  if ((object->kind == HOST_EVENT && !object->manualReset) || object->kind == HOST_MUTEX) {
+    object->signaled = false;
+  }
+}
+
+static struct timespec deadline_after(DWORD milliseconds) {
+  struct timespec deadline;
+  clock_gettime(CLOCK_MONOTONIC, &deadline);
+  deadline.tv_sec += milliseconds / 1000u;
+  deadline.tv_nsec += (long) (milliseconds % 1000u) * 1000000L;
+  if (deadline.tv_nsec >= 1000000000L) {
+    deadline.tv_sec++;
+    deadline.tv_nsec -= 1000000000L;
+  }
+  return deadline;
+}
+
+DWORD WaitForMultipleObjects(DWORD count, const HANDLE* handles, BOOL waitAll, DWORD milliseconds) {
+  if (count == 0 || !handles) {
+    SetLastError(ERROR_INVALID_PARAMETER);
+    return WAIT_FAILED;
+  }
+  for (DWORD i = 0; i < count; ++i) {
+    if (!handles[i]) {
+      SetLastError(ERROR_INVALID_HANDLE);
+      return WAIT_FAILED;
+    }
+  }
+  struct timespec deadline = deadline_after(milliseconds == INFINITE ? 0 : milliseconds);
+  host_lock();
+  for (;;) {
+    if (waitAll) {
+      bool all = true;
+      for (DWORD i = 0; i < count && all; ++i) {
+        all = object_signaled(handles[i]);
+      }
+      if (all) {
+        for (DWORD i = 0; i < count; ++i) {
+          consume_signal(handles[i]);
+        }
+        host_unlock();
+        return WAIT_OBJECT_0;
+      }
+    } else {
+      for (DWORD i = 0; i < count; ++i) {
+        if (object_signaled(handles[i])) {
+          consume_signal(handles[i]);
+          host_unlock();
+          return WAIT_OBJECT_0 + i;
+        }
+      }
+    }
+    if (milliseconds == 0) {
+      break;
+    }
+    if (milliseconds == INFINITE) {
+      pthread_cond_wait(&g_hostCond, &g_hostLock);
+    } else if (pthread_cond_timedwait(&g_hostCond, &g_hostLock, &deadline) == ETIMEDOUT) {
+      break;
+    }
+  }
+  host_unlock();
+  return WAIT_TIMEOUT;
+}
+
+DWORD WaitForSingleObject(HANDLE handle, DWORD milliseconds) {
+  return WaitForMultipleObjects(1, &handle, FALSE, milliseconds);
+}
+
+static void* thread_trampoline(void* parameter) {
+  HANDLE thread = (HANDLE) parameter;
+  thread->start(thread->parameter);
+  host_lock();
+  thread->signaled = true;
+  bool closed = thread->closed;
+  pthread_cond_broadcast(&g_hostCond);
+  host_unlock();
+  if (closed) {
+    free(thread);
+  }
+  return NULL;
+}
+
+HANDLE CreateThread(void* attributes, size_t stackSize, LPTHREAD_START_ROUTINE start, LPVOID parameter, DWORD flags,
+                    DWORD* threadId) {
+  (void) attributes;
+  (void) stackSize;
+  (void) flags;
+  HANDLE thread = new_object(HOST_THREAD);
+  if (!thread) {
+    return NULL;
+  }
+  thread->manualReset = true;
+  thread->start = start;
+  thread->parameter = parameter;
+  if (pthread_create(&thread->thread, NULL, thread_trampoline, thread) != 0) {
+    free(thread);
+    SetLastError(ERROR_NOT_ENOUGH_MEMORY);
+    return NULL;
+  }
+  if (threadId) {
+    *threadId = 0;
+  }
+  return thread;
+}
+
+void Sleep(DWORD milliseconds) {
+  struct timespec delay = {(time_t) (milliseconds / 1000u), (long) (milliseconds % 1000u) * 1000000L};
+  while (nanosleep(&delay, &delay) != 0 && errno == EINTR) {
+  }
+}
+
+DWORD GetCurrentProcessId(void) {
+  return (DWORD) getpid();
+}
+
+void InitializeSRWLock(SRWLOCK* lock) {
+  pthread_mutex_init(lock, NULL);
+}
+
+void AcquireSRWLockExclusive(SRWLOCK* lock) {
+  pthread_mutex_lock(lock);
+}
+
+void ReleaseSRWLockExclusive(SRWLOCK* lock) {
+  pthread_mutex_unlock(lock);
+}
+
+// ---------------------------------------------------------------------------------------------------------------
+// Thread pool
+
+typedef struct {
+  PTP_WORK work;
+} HostWorkRun;
+
+static void* work_trampoline(void* parameter) {
+  PTP_WORK work = (PTP_WORK) parameter;
+  work->callback(NULL, work->context, work);
+  host_lock();
+  work->running--;
+  pthread_cond_broadcast(&g_hostCond);
+  host_unlock();
+  return NULL;
+}
+
+PTP_WORK CreateThreadpoolWork(PTP_WORK_CALLBACK callback, PVOID context, void* environment) {
+  (void) environment;
+  PTP_WORK work = (PTP_WORK) calloc(1, sizeof(struct HostWork));
+  if (!work) {
+    SetLastError(ERROR_NOT_ENOUGH_MEMORY);
+    return NULL;
+  }
+  work->callback = callback;
+  work->context = context;
+  return work;
+}
+
+void SubmitThreadpoolWork(PTP_WORK work) {
+  host_lock();
+  work->running++;
+  host_unlock();
+  pthread_t thread;
+  if (pthread_create(&thread, NULL, work_trampoline, work) != 0) {
+    // Like a pool that is out of threads: run it on the caller rather than lose it.
+    work_trampoline(work);
+    return;
+  }
+  pthread_detach(thread);
+}
+
+void WaitForThreadpoolWorkCallbacks(PTP_WORK work, BOOL cancelPending) {
+  (void) cancelPending;
+  host_lock();
+  while (work->running > 0) {
+    pthread_cond_wait(&g_hostCond, &g_hostLock);
+  }
+  host_unlock();
+}
+
+void CloseThreadpoolWork(PTP_WORK work) {
+  WaitForThreadpoolWorkCallbacks(work, FALSE);
+  free(work);
+}
+
+// ---------------------------------------------------------------------------------------------------------------
+// Time
+
+#define FILETIME_UNIX_EPOCH 116444736000000000ull
+
+BOOL QueryPerformanceCounter(LARGE_INTEGER* counter) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  counter->QuadPart = (long long) now.tv_sec * 1000000000LL + now.tv_nsec;
+  return TRUE;
+}
+
+BOOL QueryPerformanceFrequency(LARGE_INTEGER* frequency) {
+  frequency->QuadPart = 1000000000LL;
+  return TRUE;
+}
+
+ULONGLONG GetTickCount64(void) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (ULONGLONG) now.tv_sec * 1000u + (ULONGLONG) now.tv_nsec / 1000000u;
+}
+
+DWORD GetTickCount(void) {
+  return (DWORD) (GetTickCount64() & 0xFFFFFFFFu);
+}
+
+static FILETIME filetime_from_timespec(struct timespec time) {
+  ULONGLONG value = FILETIME_UNIX_EPOCH + (ULONGLONG) time.tv_sec * 10000000u + (ULONGLONG) time.tv_nsec / 100u;
+  FILETIME result = {(DWORD) (value & 0xFFFFFFFFu), (DWORD) (value >> 32)};
+  return result;
+}
+
+static ULONGLONG filetime_value(const FILETIME* time) {
+  return (ULONGLONG) time->dwHighDateTime << 32 | time->dwLowDateTime;
+}
+
+void GetSystemTimeAsFileTime(FILETIME* time) {
+  struct timespec now;
+  clock_gettime(CLOCK_REALTIME, &now);
+  *time = filetime_from_timespec(now);
+}
+
+BOOL FileTimeToLocalFileTime(const FILETIME* time, FILETIME* localTime) {
+  ULONGLONG value = filetime_value(time);
+  time_t seconds = (time_t) ((value - FILETIME_UNIX_EPOCH) / 10000000u);
+  struct tm local;
+  localtime_r(&seconds, &local);
+  value += (ULONGLONG) ((long long) local.tm_gmtoff * 10000000LL);
+  localTime->dwLowDateTime = (DWORD) (value & 0xFFFFFFFFu);
+  localTime->dwHighDateTime = (DWORD) (value >> 32);
+  return TRUE;
+}
+
+BOOL FileTimeToSystemTime(const FILETIME* time, SYSTEMTIME* systemTime) {
+  ULONGLONG value = filetime_value(time) - FILETIME_UNIX_EPOCH;
+  time_t seconds = (time_t) (value / 10000000u);
+  struct tm parts;
+  gmtime_r(&seconds, &parts);
+  systemTime->wYear = (WORD) (parts.tm_year + 1900);
+  systemTime->wMonth = (WORD) (parts.tm_mon + 1);
+  systemTime->wDayOfWeek = (WORD) parts.tm_wday;
+  systemTime->wDay = (WORD) parts.tm_mday;
+  systemTime->wHour = (WORD) parts.tm_hour;
+  systemTime->wMinute = (WORD) parts.tm_min;
+  systemTime->wSecond = (WORD) parts.tm_sec;
+  systemTime->wMilliseconds = (WORD) (value / 10000u % 1000u);
+  return TRUE;
+}
+
+void GetSystemTime(SYSTEMTIME* systemTime) {
+  FILETIME now;
+  GetSystemTimeAsFileTime(&now);
+  FileTimeToSystemTime(&now, systemTime);
+}
+
+static DWORD g_processorCountOverride = 0;
+
+void host_set_processor_count(DWORD count) {
+  g_processorCountOverride = count;
+}
+
+void GetSystemInfo(SYSTEM_INFO* info) {
+  long processors = sysconf(_SC_NPROCESSORS_ONLN);
+  info->dwNumberOfProcessors = processors > 0 ? (DWORD) processors : 1u;
+  if (g_processorCountOverride != 0) {
+    info->dwNumberOfProcessors = g_processorCountOverride;
+  }
+  info->dwPageSize = (DWORD) sysconf(_SC_PAGESIZE);
+}
+
+// ---------------------------------------------------------------------------------------------------------------
+// Files
+
+static struct HostObject g_stdHandles[3] = {
+    {.kind = HOST_FILE, .fd = 0, .borrowedFd = true},
+    {.kind = HOST_FILE, .fd = 1, .borrowedFd = true},
+    {.kind = HOST_FILE, .fd = 2, .borrowedFd = true},
+};
+
+HANDLE GetStdHandle(DWORD which) {
+  if (which == STD_INPUT_HANDLE) {
+    return &g_stdHandles[0];
+  } else if (which == STD_OUTPUT_HANDLE) {
+    return &g_stdHandles[1];
+  } else if (which == STD_ERROR_HANDLE) {
+    return &g_stdHandles[2];
+  }
+  SetLastError(ERROR_INVALID_PARAMETER);
+  return INVALID_HANDLE_VALUE;
+}
+
+HANDLE CreateFileW(LPCWSTR path, DWORD access, DWORD share, void* security, DWORD disposition, DWORD flags,
+                   HANDLE templateFile) {
+  (void) share;
+  (void) security;
+  (void) templateFile;
+  char* hostPath = host_path(path);
+  if (!hostPath) {
+    return INVALID_HANDLE_VALUE;
+  }
+
+  bool directory = (flags & FILE_FLAG_BACKUP_SEMANTICS) != 0;
+  int openFlags = O_CLOEXEC;
+  if (directory) {
+    openFlags |= O_RDONLY | O_DIRECTORY;
+  } else {
+    bool reads = (access & GENERIC_READ) != 0;
+    bool writes = (access & (GENERIC_WRITE | FILE_APPEND_DATA)) != 0;
+    openFlags |= reads && writes ? O_RDWR : writes ? O_WRONLY : O_RDONLY;
+    if ((access & FILE_APPEND_DATA) && !(access & GENERIC_WRITE)) {
+      openFlags |= O_APPEND;
+    }
+    switch (disposition) {
+    case CREATE_NEW:
+      openFlags |= O_CREAT | O_EXCL;
+      break;
+    case CREATE_ALWAYS:
+      openFlags |= O_CREAT | O_TRUNC;
+      break;
+    case OPEN_ALWAYS:
+      openFlags |= O_CREAT;
+      break;
+    default:
+      break;
+    }
+  }
+
+  int fd = open(hostPath, openFlags, 0644);
+  int openError = errno;
+  free(hostPath);
+  if (fd < 0) {
+    SetLastError(error_from_errno(openError));
+    return INVALID_HANDLE_VALUE;
+  }
+  HANDLE file = new_object(directory ? HOST_DIRECTORY : HOST_FILE);
+  if (!file) {
+    close(fd);
+    return INVALID_HANDLE_VALUE;
+  }
+  file->fd = fd;
+  file->manualReset = true;
+  SetLastError(ERROR_SUCCESS);
+  return file;
+}
+
+BOOL ReadFile(HANDLE file, void* buffer, DWORD bytesToRead, DWORD* bytesRead, OVERLAPPED* overlapped) {
+  (void) overlapped;
+  *bytesRead = 0;
+  if (!file || file == INVALID_HANDLE_VALUE || file->kind != HOST_FILE) {
+    SetLastError(ERROR_INVALID_HANDLE);
+    return FALSE;
+  }
+  ssize_t count;
+  do {
+    count = read(file->fd, buffer, bytesToRead);
+  } while (count < 0 && errno == EINTR);
+  if (count < 0) {
+    SetLastError(error_from_errno(errno));
+    return FALSE;
+  }
+  *bytesRead = (DWORD) count;
+  return TRUE;
+}
+
+BOOL WriteFile(HANDLE file, const void* buffer, DWORD bytesToWrite, DWORD* bytesWritten, OVERLAPPED* overlapped) {
+  (void) overlapped;
+  *bytesWritten = 0;
+  if (!file || file == INVALID_HANDLE_VALUE || file->kind != HOST_FILE) {
+    SetLastError(ERROR_INVALID_HANDLE);
+    return FALSE;
+  }
+  ssize_t count;
+  do {
+    count = write(file->fd, buffer, bytesToWrite);
+  } while (count < 0 && errno == EINTR);
+  if (count < 0) {
+    SetLastError(error_from_errno(errno));
+    return FALSE;
+  }
+  *bytesWritten = (DWORD) count;
+  return TRUE;
+}
+
+BOOL GetFileSizeEx(HANDLE file, LARGE_INTEGER* size) {
+  struct stat status;
+  if (!file || file == INVALID_HANDLE_VALUE || fstat(file->fd, &status) != 0) {
+    SetLastError(file ? error_from_errno(errno) : ERROR_INVALID_HANDLE);
+    return FALSE;
+  }
+  size->QuadPart = (long long) status.st_size;
+  return TRUE;
+}
+
+BOOL MoveFileExW(LPCWSTR existing, LPCWSTR replacement, DWORD flags) {
+  char* from = host_path(existing);
+  char* to = host_path(replacement);
+  bool ok = false;
+  if (from && to) {
+    struct stat status;
+    if (!(flags & MOVEFILE_REPLACE_EXISTING) && stat(to, &status) == 0) {
+      errno = EEXIST;
+    } else {
+      ok = rename(from, to) == 0;
+    }
+  }
+  int moveError = errno;
+  free(from);
+  free(to);
+  if (!ok) {
+    SetLastError(error_from_errno(moveError));
+  }
+  return ok;
+}
+
+BOOL DeleteFileW(LPCWSTR path) {
+  char* hostPath = host_path(path);
+  bool ok = hostPath && unlink(hostPath) == 0;
+  int deleteError = errno;
+  free(hostPath);
+  if (!ok) {
+    SetLastError(error_from_errno(deleteError));
+  }
+  return ok;
+}
+
+BOOL GetFileAttributesExW(LPCWSTR path, GET_FILEEX_INFO_LEVELS level, void* information) {
+  (void) level;
+  char* hostPath = host_path(path);
+  struct stat status;
+  bool ok = hostPath && stat(hostPath, &status) == 0;
+  int statError = errno;
+  free(hostPath);
+  if (!ok) {
+    SetLastError(error_from_errno(statError));
+    return FALSE;
+  }
+  WIN32_FILE_ATTRIBUTE_DATA* attributes = (WIN32_FILE_ATTRIBUTE_DATA*) information;
+  memset(attributes, 0, sizeof(*attributes));
+  attributes->dwFileAttributes = S_ISDIR(status.st_mode) ? 0x10u : FILE_ATTRIBUTE_NORMAL;
+  attributes->ftCreationTime = filetime_from_timespec(status.st_ctim);
+  attributes->ftLastAccessTime = filetime_from_timespec(status.st_atim);
+  attributes->ftLastWriteTime = filetime_from_timespec(status.st_mtim);
+  attributes->nFileSizeHigh = (DWORD) ((unsigned long long) status.st_size >> 32);
+  attributes->nFileSizeLow = (DWORD) ((unsigned long long) status.st_size & 0xFFFFFFFFu);
+  return TRUE;
+}
+
+DWORD GetCurrentDirectoryW(DWORD length, wchar_t* buffer) {
+  char cwd[PATH_MAX];
+  if (!getcwd(cwd, sizeof(cwd))) {
+    SetLastError(error_from_errno(errno));
+    return 0;
+  }
+  return copy_wide_result(cwd, buffer, length);
+}
+
+BOOL CreateDirectoryW(LPCWSTR path, void* security) {
+  (void) security;
+  char* hostPath = host_path(path);
+  bool ok = hostPath && mkdir(hostPath, 0755) == 0;
+  int mkdirError = errno;
+  free(hostPath);
+  if (!ok) {
+    SetLastError(mkdirError == EEXIST ? ERROR_ALREADY_EXISTS : error_from_errno(mkdirError));
+  }
+  return ok;
+}
+
+DWORD GetEnvironmentVariableW(LPCWSTR name, wchar_t* buffer, DWORD length) {
+  char* hostName = host_path(name); // a name holds no separators, so this is a plain conversion
+  const char* value = hostName ? getenv(hostName) : NULL;
+  free(hostName);
+  if (!value) {
+    SetLastError(ERROR_ENVVAR_NOT_FOUND);
+    return 0;
+  }
+  return copy_wide_result(value, buffer, length);
+}
+
+DWORD GetModuleFileNameW(HINSTANCE module, wchar_t* buffer, DWORD length) {
+  (void) module;
+  char path[PATH_MAX];
+  ssize_t bytes = readlink("/proc/self/exe", path, sizeof(path) - 1);
+  if (bytes <= 0) {
+    SetLastError(error_from_errno(errno));
+    return 0;
+  }
+  path[bytes] = '\0';
+  DWORD result = copy_wide_result(path, buffer, length);
+  return result >= length ? length : result;
+}
+
+// ---------------------------------------------------------------------------------------------------------------
+// Directory watching through inotify
+
+#define HOST_INOTIFY_MASK (IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_CLOSE_WRITE | IN_MODIFY)
+
+static DWORD notify_action(uint32_t mask) {
+  if (mask & (IN_CREATE | IN_MOVED_TO)) {
+    return mask & IN_MOVED_TO ? FILE_ACTION_RENAMED_NEW_NAME : FILE_ACTION_ADDED;
+  }
+  if (mask & (IN_DELETE | IN_MOVED_FROM)) {
+    return mask & IN_MOVED_FROM ? FILE_ACTION_RENAMED_OLD_NAME : FILE_ACTION_REMOVED;
+  }
+  return FILE_ACTION_MODIFIED;
+}
+
+// Appends one FILE_NOTIFY_INFORMATION record; returns false when the caller's buffer is full, which Win32 reports
+// as a completion with zero bytes.
+static bool append_notification(HANDLE directory, size_t* previous, uint32_t mask, const char* name) {
+  int units = MultiByteToWideChar(CP_UTF8, 0, name, (int) strlen(name), NULL, 0);
+  if (units <= 0) {
+    return true;
+  }
+  size_t recordBytes = offsetof(FILE_NOTIFY_INFORMATION, FileName) + (size_t) units * sizeof(wchar_t);
+  recordBytes = (recordBytes + 3u) & ~(size_t) 3u;
+  if (directory->notifyBytes + recordBytes > directory->notifyLength) {
+    return false;
+  }
+  FILE_NOTIFY_INFORMATION* info = (FILE_NOTIFY_INFORMATION*) (directory->notifyBuffer + directory->notifyBytes);
+  memset(info, 0, recordBytes);
+  info->Action = notify_action(mask);
+  info->FileNameLength = (DWORD) units * sizeof(wchar_t);
+  MultiByteToWideChar(CP_UTF8, 0, name, (int) strlen(name), info->FileName, units);
+  if (*previous != (size_t) -1) {
+    ((FILE_NOTIFY_INFORMATION*) (directory->notifyBuffer + *previous))->NextEntryOffset =
+        (DWORD) (directory->notifyBytes - *previous);
+  }
+  *previous = directory->notifyBytes;
+  directory->notifyBytes += (DWORD) recordBytes;
+  return true;
+}
+
+// Called with the host lock held.
+static void complete_directory_watch(HANDLE directory, bool overflowed) {
+  if (overflowed) {
+    directory->notifyBytes = 0;
+  }
+  directory->armed = false;
+  directory->completed = true;
+  if (directory->overlapped) {
+    directory->overlapped->InternalHigh = directory->notifyBytes;
+    if (directory->overlapped->hEvent) {
+      directory->overlapped->hEvent->signaled = true;
+    }
+  }
+  pthread_cond_broadcast(&g_hostCond);
+}
+
+static void* directory_watcher_main(void* parameter) {
+  HANDLE directory = (HANDLE) parameter;
+  _Alignas(struct inotify_event) char events[16384];
+  for (;;) {
+    struct pollfd fds[2] = {{directory->inotifyFd, POLLIN, 0}, {directory->stopPipe[0], POLLIN, 0}};
+    if (poll(fds, 2, -1) < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return NULL;
+    }
+    if (fds[1].revents) {
+      return NULL;
+    }
+    ssize_t bytes = read(directory->inotifyFd, events, sizeof(events));
+    if (bytes <= 0) {
+      continue;
+    }
+
+    host_lock();
+    if (!directory->armed) {
+      // Win32 buffers changes between two reads; all this needs to remember is that something happened.
+      directory->missedChanges = true;
+      host_unlock();
+      continue;
+    }
+    size_t previous = (size_t) -1;
+    bool overflowed = false;
+    for (char* cursor = events; cursor < events + bytes;) {
+      const struct inotify_event* event = (const struct inotify_event*) cursor;
+      if (event->mask & IN_Q_OVERFLOW) {
+        overflowed = true;
+      } else if (event->len > 0 && !append_notification(directory, &previous, event->mask, event->name)) {
+        overflowed = true;
+      }
+      cursor += sizeof(struct inotify_event) + event->len;
+    }
+    complete_directory_watch(directory, overflowed);
+    host_unlock();
+  }
+}
+
+BOOL ReadDirectoryChangesW(HANDLE directory, void* buffer, DWORD length, BOOL watchSubtree, DWORD filter,
+                           DWORD* bytesReturned, OVERLAPPED* overlapped, void* completion) {
+  (void) watchSubtree;
+  (void) filter;
+  (void) bytesReturned;
+  (void) completion;
+  if (!directory || directory == INVALID_HANDLE_VALUE || directory->kind != HOST_DIRECTORY || !overlapped) {
+    SetLastError(ERROR_INVALID_PARAMETER);
+    return FALSE;
+  }
+  if (!directory->watcherRunning) {
+    char path[64];
+    snprintf(path, sizeof(path), "/proc/self/fd/%d", directory->fd);
+    directory->inotifyFd = inotify_init1(IN_CLOEXEC | IN_NONBLOCK);
+    if (directory->inotifyFd < 0 || inotify_add_watch(directory->inotifyFd, path, HOST_INOTIFY_MASK) < 0 ||
+        pipe(directory->stopPipe) != 0) {
+      SetLastError(error_from_errno(errno));
+      return FALSE;
+    }
+    if (pthread_create(&directory->watcher, NULL, directory_watcher_main, directory) != 0) {
+      SetLastError(ERROR_NOT_ENOUGH_MEMORY);
+      return FALSE;
+    }
+    directory->watcherRunning = true;
+  }
+
+  host_lock();
+  directory->overlapped = overlapped;
+  directory->notifyBuffer = (unsigned char*) buffer;
+  directory->notifyLength = length;
+  directory->notifyBytes = 0;
+  directory->completed = false;
+  directory->cancelled = false;
+  directory->armed = true;
+  if (overlapped->hEvent) {
+    overlapped->hEvent->signaled = false;
+  }
+  if (directory->missedChanges) {
+    directory->missedChanges = false;
+    complete_directory_watch(directory, true);
+  }
+  host_unlock();
+  return TRUE;
+}
+
+BOOL GetOverlappedResult(HANDLE file, OVERLAPPED* overlapped, DWORD* bytesTransferred, BOOL wait) {
+  (void) overlapped;
+  if (!file || file == INVALID_HANDLE_VALUE || file->kind != HOST_DIRECTORY) {
+    SetLastError(ERROR_INVALID_HANDLE);
+    return FALSE;
+  }
+  host_lock();
+  while (wait && file->armed) {
+    pthread_cond_wait(&g_hostCond, &g_hostLock);
+  }
+  BOOL result = FALSE;
+  if (file->cancelled) {
+    SetLastError(ERROR_OPERATION_ABORTED);
+  } else if (!file->completed) {
+    SetLastError(ERROR_IO_INCOMPLETE);
+  } else {
+    *bytesTransferred = file->notifyBytes;
+    result = TRUE;
+  }
+  host_unlock();
+  return result;
+}
+
+BOOL CancelIoEx(HANDLE file, OVERLAPPED* overlapped) {
+  (void) overlapped;
+  if (!file || file == INVALID_HANDLE_VALUE || file->kind != HOST_DIRECTORY) {
+    SetLastError(ERROR_INVALID_HANDLE);
+    return FALSE;
+  }
+  host_lock();
+  bool wasArmed = file->armed;
+  if (wasArmed) {
+    file->cancelled = true;
+    complete_directory_watch(file, true);
+  }
+  host_unlock();
+  return wasArmed;
+}
+
+static void close_directory(HANDLE directory) {
+  if (directory->watcherRunning) {
+    char stop = 1;
+    ssize_t written = write(directory->stopPipe[1], &stop, 1);
+    (void) written;
+    pthread_join(directory->watcher, NULL);
+  }
+  if (directory->inotifyFd >= 0) {
+    close(directory->inotifyFd);
+  }
+  for (int i = 0; i < 2; ++i) {
+    if (directory->stopPipe[i] >= 0) {
+      close(directory->stopPipe[i]);
+    }
+  }
+}
+
+BOOL CloseHandle(HANDLE handle) {
+  if (!handle || handle == INVALID_HANDLE_VALUE) {
+    SetLastError(ERROR_INVALID_HANDLE);
+    return FALSE;
+  }
+  switch (handle->kind) {
+  case HOST_THREAD: {
+    host_lock();
+    bool finished = handle->signaled;
+    handle->closed = !finished;
+    host_unlock();
+    if (finished) {
+      pthread_join(handle->thread, NULL);
+      free(handle);
+    } else {
+      pthread_detach(handle->thread);
+    }
+    return TRUE;
+  }
+  case HOST_DIRECTORY:
+    close_directory(handle);
+    close(handle->fd);
+    break;
+  case HOST_FILE:
+    if (handle->borrowedFd) {
+      return TRUE;
+    }
+    close(handle->fd);
+    break;
+  default:
+    break;
+  }
+  free(handle);
+  return TRUE;
+}
+
+// ---------------------------------------------------------------------------------------------------------------
+// Global memory
+
+HGLOBAL GlobalAlloc(UINT flags, size_t bytes) {
+  HGLOBAL block = new_object(HOST_MEMORY);
+  if (!block) {
+    return NULL;
+  }
+  block->data = (unsigned char*) ((flags & GMEM_ZEROINIT) ? calloc(1, bytes ? bytes : 1) : malloc(bytes ? bytes : 1));
+  if (!block->data) {
+    free(block);
+    SetLastError(ERROR_NOT_ENOUGH_MEMORY);
+    return NULL;
+  }
+  block->size = bytes;
+  return block;
+}
+
+HGLOBAL GlobalReAlloc(HGLOBAL block, size_t bytes, UINT flags) {
+  (void) flags;
+  unsigned char* grown = (unsigned char*) realloc(block->data, bytes ? bytes : 1);
+  if (!grown) {
+    SetLastError(ERROR_NOT_ENOUGH_MEMORY);
+    return NULL;
+  }
+  block->data = grown;
+  block->size = bytes;
+  return block;
+}
+
+HGLOBAL GlobalFree(HGLOBAL block) {
+  if (block) {
+    free(block->data);
+    free(block);
+  }
+  return NULL;
+}
+
+void* GlobalLock(HGLOBAL block) {
+  return block ? block->data : NULL;
+}
+
+BOOL GlobalUnlock(HGLOBAL block) {
+  (void) block;
+  return FALSE; // the lock count reached zero, as for every block here
+}
+
+size_t GlobalSize(HGLOBAL block) {
+  return block ? block->size : 0;
+}
+
+// ---------------------------------------------------------------------------------------------------------------
+// Windows and the message queue
+
+typedef struct {
+  wchar_t name[64];
+  WNDPROC proc;
+} HostClass;
+
+typedef struct HostMessage {
+  MSG msg;
+  struct HostMessage* next;
+} HostMessage;
+
+typedef struct {
+  HWND hwnd;
+  uintptr_t id;
+  UINT elapse;
+  ULONGLONG due;
+  bool active;
+} HostTimer;
+
+static pthread_mutex_t g_queueLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t g_queueCond = PTHREAD_COND_INITIALIZER;
+static HostMessage* g_queueHead = NULL;
+static HostMessage* g_queueTail = NULL;
+static bool g_quitPosted = false;
+static HostTimer g_timers[16];
+static HostClass g_classes[8];
+static size_t g_classCount = 0;
+static struct HostWindow* g_windows = NULL;
+
+static void copy_name(wchar_t* destination, size_t capacity, LPCWSTR source) {
+  size_t length = source ? host_wcslen(source) : 0;
+  if (length >= capacity) {
+    length = capacity - 1;
+  }
+  if (length > 0) {
+    memcpy(destination, source, length * sizeof(wchar_t));
+  }
+  destination[length] = 0;
+}
+
+UINT RegisterClassExW(const WNDCLASSEXW* windowClass) {
+  if (g_classCount >= sizeof(g_classes) / sizeof(g_classes[0])) {
+    SetLastError(ERROR_NOT_ENOUGH_MEMORY);
+    return 0;
+  }
+  copy_name(g_classes[g_classCount].name, 64, windowClass->lpszClassName);
+  g_classes[g_classCount].proc = windowClass->lpfnWndProc;
+  return (UINT) ++g_classCount;
+}
+
+HWND CreateWindowExW(DWORD exStyle, LPCWSTR className, LPCWSTR windowName, DWORD style, int x, int y, int width,
+                     int height, HWND parent, void* menu, HINSTANCE instance, LPVOID parameter) {
+  (void) exStyle, (void) windowName, (void) style, (void) x, (void) y, (void) width, (void) height, (void) parent;
+  (void) menu, (void) instance, (void) parameter;
+  const HostClass* windowClass = NULL;
+  for (size_t i = 0; i < g_classCount && !windowClass; ++i) {
+    if (host_wcscmp(g_classes[i].name, className) == 0) {
+      windowClass = &g_classes[i];
+    }
+  }
+  if (!windowClass) {
+    SetLastError(ERROR_INVALID_PARAMETER);
+    return NULL;
+  }
+  HWND hwnd = (HWND) calloc(1, sizeof(struct HostWindow));
+  if (!hwnd) {
+    SetLastError(ERROR_NOT_ENOUGH_MEMORY);
+    return NULL;
+  }
+  hwnd->proc = windowClass->proc;
+  copy_name(hwnd->className, 64, className);
+  hwnd->alive = true;
+  hwnd->next = g_windows;
+  g_windows = hwnd;
+  if (hwnd->proc(hwnd, WM_CREATE, 0, 0) == -1) {
+    hwnd->alive = false;
+    return NULL;
+  }
+  return hwnd;
+}
+
+BOOL IsWindow(HWND hwnd) {
+  for (struct HostWindow* window = g_windows; window; window = window->next) {
+    if (window == hwnd) {
+      return window->alive;
+    }
+  }
+  return FALSE;
+}
+
+HWND FindWindowW(LPCWSTR className, LPCWSTR windowName) {
+  (void) windowName;
+  for (struct HostWindow* window = g_windows; window; window = window->next) {
+    if (window->alive && host_wcscmp(window->className, className) == 0) {
+      return window;
+    }
+  }
+  return NULL;
+}
+
+DWORD GetWindowThreadProcessId(HWND hwnd, DWORD* processId) {
+  (void) hwnd;
+  if (processId) {
+    *processId = GetCurrentProcessId();
+  }
+  return 1;
+}
+
+LRESULT DefWindowProcW(HWND hwnd, UINT message, WPARAM wParam, LPARAM lParam) {
+  (void) hwnd, (void) message, (void) wParam, (void) lParam;
+  return 0;
+}
+
+// Windows run on the thread that pumps the queue, and so does SendMessage: cross-thread sends are not modelled.
+LRESULT SendMessageW(HWND hwnd, UINT message, WPARAM wParam, LPARAM lParam) {
+  if (!IsWindow(hwnd)) {
+    return 0;
+  }
+  return hwnd->proc(hwnd, message, wParam, lParam);
+}
+
+BOOL PostMessageW(HWND hwnd, UINT message, WPARAM wParam, LPARAM lParam) {
+  if (hwnd && !IsWindow(hwnd)) {
+    SetLastError(ERROR_INVALID_HANDLE);
+    return FALSE;
+  }
+  HostMessage* posted = (HostMessage*) calloc(1, sizeof(HostMessage));
+  if (!posted) {
+    SetLastError(ERROR_NOT_ENOUGH_MEMORY);
+    return FALSE;
+  }
+  posted->msg.hwnd = hwnd;
+  posted->msg.message = message;
+  posted->msg.wParam = wParam;
+  posted->msg.lParam = lParam;
+  pthread_mutex_lock(&g_queueLock);
+  if (g_queueTail) {
+    g_queueTail->next = posted;
+  } else {
+    g_queueHead = posted;
+  }
+  g_queueTail = posted;
+  pthread_cond_broadcast(&g_queueCond);
+  pthread_mutex_unlock(&g_queueLock);
+  return TRUE;
+}
+
+void PostQuitMessage(int exitCode) {
+  (void) exitCode;
+  pthread_mutex_lock(&g_queueLock);
+  g_quitPosted = true;
+  pthread_cond_broadcast(&g_queueCond);
+  pthread_mutex_unlock(&g_queueLock);
+}
+
+// Called with the queue lock held. Returns the milliseconds until the next timer, or INFINITE.
+static DWORD take_message(MSG* msg, bool* found) {
+  *found = false;
+  if (g_queueHead) {
+    HostMessage* head = g_queueHead;
+    g_queueHead = head->next;
+    if (!g_queueHead) {
+      g_queueTail = NULL;
+    }
+    *msg = head->msg;
+    free(head);
+    *found = true;
+    return 0;
+  }
+  ULONGLONG now = GetTickCount64();
+  DWORD wait = INFINITE;
+  for (size_t i = 0; i < sizeof(g_timers) / sizeof(g_timers[0]); ++i) {
+    HostTimer* timer = &g_timers[i];
+    if (!timer->active) {
+      continue;
+    }
+    if (timer->due <= now) {
+      timer->due = now + timer->elapse;
+      msg->hwnd = timer->hwnd;
+      msg->message = WM_TIMER;
+      msg->wParam = timer->id;
+      msg->lParam = 0;
+      *found = true;
+      return 0;
+    }
+    if (timer->due - now < wait) {
+      wait = (DWORD) (timer->due - now);
+    }
+  }
+  return wait;
+}
+
+BOOL GetMessageW(MSG* msg, HWND hwnd, UINT filterMin, UINT filterMax) {
+  (void) hwnd, (void) filterMin, (void) filterMax;
+  pthread_mutex_lock(&g_queueLock);
+  for (;;) {
+    bool found = false;
+    DWORD wait = take_message(msg, &found);
+    if (found) {
+      pthread_mutex_unlock(&g_queueLock);
+      return TRUE;
+    }
+    if (g_quitPosted) {
+      g_quitPosted = false;
+      pthread_mutex_unlock(&g_queueLock);
+      msg->message = WM_QUIT;
+      return FALSE;
+    }
+    if (wait == INFINITE) {
+      pthread_cond_wait(&g_queueCond, &g_queueLock);
+    } else {
+      struct timespec deadline;
+      clock_gettime(CLOCK_REALTIME, &deadline);
+      deadline.tv_sec += wait / 1000u;
+      deadline.tv_nsec += (long) (wait % 1000u) * 1000000L;
+      if (deadline.tv_nsec >= 1000000000L) {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000L;
+      }
+      pthread_cond_timedwait(&g_queueCond, &g_queueLock, &deadline);
+    }
+  }
+}
+
+BOOL PeekMessageW(MSG* msg, HWND hwnd, UINT filterMin, UINT filterMax, UINT remove) {
+  (void) hwnd, (void) filterMin, (void) filterMax, (void) remove;
+  pthread_mutex_lock(&g_queueLock);
+  bool found = false;
+  take_message(msg, &found);
+  pthread_mutex_unlock(&g_queueLock);
+  return found;
+}
+
+BOOL TranslateMessage(const MSG* msg) {
+  (void) msg;
+  return FALSE;
+}
+
+LRESULT DispatchMessageW(const MSG* msg) {
+  return SendMessageW(msg->hwnd, msg->message, msg->wParam, msg->lParam);
+}
+
+void host_pump_messages(void) {
+  MSG msg;
+  while (PeekMessageW(&msg, NULL, 0, 0, PM_REMOVE)) {
+    DispatchMessageW(&msg);
+  }
+}
+
+uintptr_t SetTimer(HWND hwnd, uintptr_t id, UINT elapse, void* timerProc) {
+  (void) timerProc;
+  pthread_mutex_lock(&g_queueLock);
+  HostTimer* slot = NULL;
+  for (size_t i = 0; i < sizeof(g_timers) / sizeof(g_timers[0]); ++i) {
+    HostTimer* timer = &g_timers[i];
+    if (timer->active && timer->hwnd == hwnd && timer->id == id) {
+      slot = timer;
+      break;
+    }
+    if (!timer->active && !slot) {
+      slot = timer;
+    }
+  }
+  if (slot) {
+    slot->hwnd = hwnd;
+    slot->id = id;
+    slot->elapse = elapse;
+    slot->due = GetTickCount64() + elapse;
+    slot->active = true;
+    pthread_cond_broadcast(&g_queueCond);
+  }
+  pthread_mutex_unlock(&g_queueLock);
+  return slot ? id : 0;
+}
+
+BOOL KillTimer(HWND hwnd, uintptr_t id) {
+  bool killed = false;
+  pthread_mutex_lock(&g_queueLock);
+  for (size_t i = 0; i < sizeof(g_timers) / sizeof(g_timers[0]); ++i) {
+    if (g_timers[i].active && g_timers[i].hwnd == hwnd && g_timers[i].id == id) {
+      g_timers[i].active = false;
+      killed = true;
+    }
+  }
+  pthread_mutex_unlock(&g_queueLock);
+  return killed;
+}
+
+BOOL RegisterHotKey(HWND hwnd, int id, UINT modifiers, UINT key) {
+  (void) hwnd, (void) id, (void) modifiers, (void) key;
+  return TRUE;
+}
+
+BOOL UnregisterHotKey(HWND hwnd, int id) {
+  (void) hwnd, (void) id;
+  return TRUE;
+}
+
+HINSTANCE GetModuleHandleW(LPCWSTR name) {
+  (void) name;
+  static struct HostObject module = {.kind = HOST_RESOURCE};
+  return &module;
+}
+
+HCURSOR LoadCursorW(HINSTANCE instance, LPCWSTR name) {
+  (void) instance, (void) name;
+  return GetModuleHandleW(NULL);
+}
+
+HANDLE LoadImageW(HINSTANCE instance, LPCWSTR name, UINT type, int width, int height, UINT flags) {
+  (void) instance, (void) name, (void) type, (void) width, (void) height, (void) flags;
+  return GetModuleHandleW(NULL);
+}
+
+BOOL MessageBeep(UINT type) {
+  (void) type;
+  return TRUE;
+}
+
+BOOL PlaySoundW(LPCWSTR sound, HINSTANCE module, DWORD flags) {
+  (void) sound, (void) module, (void) flags;
+  return TRUE;
+}
+
+BOOL SetConsoleCtrlHandler(PHANDLER_ROUTINE handler, BOOL add) {
+  (void) handler, (void) add;
+  return TRUE;
+}
+
+BOOL SetConsoleOutputCP(UINT codePage) {
+  (void) codePage;
+  return TRUE;
+}
+
+// ---------------------------------------------------------------------------------------------------------------
+// Clipboard
+
+#define HOST_CLIPBOARD_FORMATS 32u
+#define HOST_CLIPBOARD_LISTENERS 8u
+
+typedef struct {
+  UINT format;
+  HANDLE data; // NULL while the owner has only promised the format
+} HostClipboardFormat;
+
+static struct {
+  pthread_mutex_t lock;
+  bool open;
+  HWND openedBy;
+  HWND owner;
+  bool changed;
+  bool rendering;
+  DWORD sequence;
+  HostClipboardFormat formats[HOST_CLIPBOARD_FORMATS];
+  size_t formatCount;
+  HWND listeners[HOST_CLIPBOARD_LISTENERS];
+  size_t listenerCount;
+} g_clipboard = {PTHREAD_MUTEX_INITIALIZER, false, NULL, NULL, false, false, 1, {{0}}, 0, {0}, 0};
+
+static void clear_clipboard_formats(void) {
+  for (size_t i = 0; i < g_clipboard.formatCount; ++i) {
+    GlobalFree(g_clipboard.formats[i].data);
+  }
+  g_clipboard.formatCount = 0;
+}
+
+void host_clipboard_reset(void) {
+  pthread_mutex_lock(&g_clipboard.lock);
+  clear_clipboard_formats();
+  g_clipboard.open = false;
+  g_clipboard.openedBy = NULL;
+  g_clipboard.owner = NULL;
+  g_clipboard.changed = false;
+  pthread_mutex_unlock(&g_clipboard.lock);
+}
+
+BOOL OpenClipboard(HWND owner) {
+  pthread_mutex_lock(&g_clipboard.lock);
+  bool opened = !g_clipboard.open;
+  if (opened) {
+    g_clipboard.open = true;
+    g_clipboard.openedBy = owner;
+  }
+  pthread_mutex_unlock(&g_clipboard.lock);
+  if (!opened) {
+    SetLastError(ERROR_ACCESS_DENIED);
+  }
+  return opened;
+}
+
+BOOL CloseClipboard(void) {
+  pthread_mutex_lock(&g_clipboard.lock);
+  if (!g_clipboard.open) {
+    pthread_mutex_unlock(&g_clipboard.lock);
+    SetLastError(ERROR_CLIPBOARD_NOT_OPEN);
+    return FALSE;
+  }
+  g_clipboard.open = false;
+  bool changed = g_clipboard.changed;
+  g_clipboard.changed = false;
+  HWND listeners[HOST_CLIPBOARD_LISTENERS];
+  size_t listenerCount = g_clipboard.listenerCount;
+  memcpy(listeners, g_clipboard.listeners, sizeof(listeners));
+  pthread_mutex_unlock(&g_clipboard.lock);
+  if (changed) {
+    for (size_t i = 0; i < listenerCount; ++i) {
+      PostMessageW(listeners[i], WM_CLIPBOARDUPDATE, 0, 0);
+    }
+  }
+  return TRUE;
+}
+
+BOOL EmptyClipboard(void) {
+  pthread_mutex_lock(&g_clipboard.lock);
+  if (!g_clipboard.open) {
+    pthread_mutex_unlock(&g_clipboard.lock);
+    SetLastError(ERROR_CLIPBOARD_NOT_OPEN);
+    return FALSE;
+  }
+  HWND previousOwner = g_clipboard.owner;
+  pthread_mutex_unlock(&g_clipboard.lock);
+  if (previousOwner) {
+    SendMessageW(previousOwner, WM_DESTROYCLIPBOARD, 0, 0);
+  }
+  pthread_mutex_lock(&g_clipboard.lock);
+  clear_clipboard_formats();
+  g_clipboard.owner = g_clipboard.openedBy;
+  g_clipboard.sequence++;
+  g_clipboard.changed = true;
+  pthread_mutex_unlock(&g_clipboard.lock);
+  return TRUE;
+}
+
+static HostClipboardFormat* find_clipboard_format(UINT format) {
+  for (size_t i = 0; i < g_clipboard.formatCount; ++i) {
+    if (g_clipboard.formats[i].format == format) {
+      return &g_clipboard.formats[i];
+    }
+  }
+  return NULL;
+}
+
+HANDLE SetClipboardData(UINT format, HANDLE data) {
+  pthread_mutex_lock(&g_clipboard.lock);
+  // Inside WM_RENDERFORMAT the owner renders into a clipboard the pasting application holds open.
+  if (!g_clipboard.open && !g_clipboard.rendering) {
+    pthread_mutex_unlock(&g_clipboard.lock);
+    SetLastError(ERROR_CLIPBOARD_NOT_OPEN);
+    return NULL;
+  }
+  HostClipboardFormat* entry = find_clipboard_format(format);
+  if (!entry) {
+    if (g_clipboard.formatCount >= HOST_CLIPBOARD_FORMATS) {
+      pthread_mutex_unlock(&g_clipboard.lock);
+      SetLastError(ERROR_NOT_ENOUGH_MEMORY);
+      return NULL;
+    }
+    entry = &g_clipboard.formats[g_clipboard.formatCount++];
+    entry->format = format;
+    entry->data = NULL;
+  }
+  GlobalFree(entry->data);
+  entry->data = data;
+  if (!g_clipboard.rendering) {
+    g_clipboard.sequence++;
+    g_clipboard.changed = true;
+  }
+  pthread_mutex_unlock(&g_clipboard.lock);
+  return data;
+}
+
+HANDLE GetClipboardData(UINT format) {
+  pthread_mutex_lock(&g_clipboard.lock);
+  if (!g_clipboard.open) {
+    pthread_mutex_unlock(&g_clipboard.lock);
+    SetLastError(ERROR_CLIPBOARD_NOT_OPEN);
+    return NULL;
+  }
+  HostClipboardFormat* entry = find_clipboard_format(format);
+  if (entry && !entry->data && g_clipboard.owner) {
+    HWND owner = g_clipboard.owner;
+    g_clipboard.rendering = true;
+    pthread_mutex_unlock(&g_clipboard.lock);
+    SendMessageW(owner, WM_RENDERFORMAT, format, 0);
+    pthread_mutex_lock(&g_clipboard.lock);
+    g_clipboard.rendering = false;
+    entry = find_clipboard_format(format);
+  }
+  HANDLE data = entry ? entry->data : NULL;
+  pthread_mutex_unlock(&g_clipboard.lock);
+  return data;
+}
+
+UINT EnumClipboardFormats(UINT format) {
+  pthread_mutex_lock(&g_clipboard.lock);
+  UINT next = 0;
+  if (!g_clipboard.open) {
+    SetLastError(ERROR_CLIPBOARD_NOT_OPEN);
+  } else {
+    size_t index = 0;
+    if (format != 0) {
+      while (index < g_clipboard.formatCount && g_clipboard.formats[index].format != format) {
+        index++;
+      }
+      index++;
+    }
+    next = index < g_clipboard.formatCount ? g_clipboard.formats[index].format : 0;
+    SetLastError(ERROR_SUCCESS);
+  }
+  pthread_mutex_unlock(&g_clipboard.lock);
+  return next;
+}
+
+BOOL IsClipboardFormatAvailable(UINT format) {
+  pthread_mutex_lock(&g_clipboard.lock);
+  bool available = find_clipboard_format(format) != NULL;
+  pthread_mutex_unlock(&g_clipboard.lock);
+  return available;
+}
+
+DWORD GetClipboardSequenceNumber(void) {
+  pthread_mutex_lock(&g_clipboard.lock);
+  DWORD sequence = g_clipboard.sequence;
+  pthread_mutex_unlock(&g_clipboard.lock);
+  return sequence;
+}
+
+HWND GetClipboardOwner(void) {
+  pthread_mutex_lock(&g_clipboard.lock);
+  HWND owner = g_clipboard.owner;
+  pthread_mutex_unlock(&g_clipboard.lock);
+  return owner;
+}
+
+BOOL AddClipboardFormatListener(HWND hwnd) {
+  pthread_mutex_lock(&g_clipboard.lock);
+  bool added = g_clipboard.listenerCount < HOST_CLIPBOARD_LISTENERS;
+  if (added) {
+    g_clipboard.listeners[g_clipboard.listenerCount++] = hwnd;
+  }
+  pthread_mutex_unlock(&g_clipboard.lock);
+  return added;
+}
+
+BOOL RemoveClipboardFormatListener(HWND hwnd) {
+  pthread_mutex_lock(&g_clipboard.lock);
+  bool removed = false;
+  for (size_t i = 0; i < g_clipboard.listenerCount; ++i) {
+    if (g_clipboard.listeners[i] == hwnd) {
+      g_clipboard.listeners[i] = g_clipboard.listeners[--g_clipboard.listenerCount];
+      removed = true;
+      break;
+    }
+  }
+  pthread_mutex_unlock(&g_clipboard.lock);
+  return removed;
+}
+
+BOOL DestroyWindow(HWND hwnd) {
+  if (!IsWindow(hwnd)) {
+    SetLastError(ERROR_INVALID_HANDLE);
+    return FALSE;
+  }
+  // An owner going away renders whatever it still only promised, then loses the clipboard.
+  if (GetClipboardOwner() == hwnd) {
+    SendMessageW(hwnd, WM_RENDERALLFORMATS, 0, 0);
+  }
+  SendMessageW(hwnd, WM_DESTROY, 0, 0);
+  pthread_mutex_lock(&g_clipboard.lock);
+  if (g_clipboard.owner == hwnd) {
+    size_t kept = 0;
+    for (size_t i = 0; i < g_clipboard.formatCount; ++i) {
+      if (g_clipboard.formats[i].data) {
+        g_clipboard.formats[kept++] = g_clipboard.formats[i];
+      }
+    }
+    g_clipboard.formatCount = kept;
+    g_clipboard.owner = NULL;
+  }
+  pthread_mutex_unlock(&g_clipboard.lock);
+  hwnd->alive = false;
+  return TRUE;
+}
@@ -0,0 +1,388 @@
+// Just enough of the Win32 API, on top of POSIX threads and files, to build trim.c with the host compiler so its
+// engine can be tested and benchmarked on Linux. Build with -fshort-wchar: wchar_t must be a UTF-16 code unit, as on
+// Windows, so the wide-string functions below replace the C library's, which assume a 32-bit wchar_t.
+#ifndef TRIM_HOST_WINDOWS_H
+#define TRIM_HOST_WINDOWS_H
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <wchar.h>
+#include <wctype.h>
+
+_Static_assert(sizeof(wchar_t) == 2, "the host build needs -fshort-wchar");
+
+#define WINAPI
+#define CALLBACK
+#define VOID void
+#define TRUE 1
+#define FALSE 0
+
+typedef int BOOL;
+typedef unsigned char BYTE;
+typedef unsigned short WORD;
+typedef unsigned int UINT;
+typedef unsigned long DWORD;
+typedef long LONG;
+typedef unsigned long ULONG;
+typedef long long LONG64;
+typedef unsigned long long ULONGLONG;
+typedef void* PVOID;
+typedef void* LPVOID;
+typedef uintptr_t WPARAM;
+typedef intptr_t LPARAM;
+typedef intptr_t LRESULT;
+typedef const wchar_t* LPCWSTR;
+
+typedef struct HostObject* HANDLE;
+typedef HANDLE HGLOBAL;
+typedef HANDLE HINSTANCE;
+typedef HANDLE HICON;
+typedef HANDLE HCURSOR;
+typedef struct HostWindow* HWND;
+typedef struct HostWork* PTP_WORK;
+typedef void* PTP_CALLBACK_INSTANCE;
+typedef pthread_mutex_t SRWLOCK;
+#define SRWLOCK_INIT PTHREAD_MUTEX_INITIALIZER
+
+#define INVALID_HANDLE_VALUE ((HANDLE) (intptr_t) -1)
+#define INFINITE 0xFFFFFFFFul
+#define MAXDWORD 0xFFFFFFFFul
+#define MAX_PATH 260
+#define WAIT_OBJECT_0 0ul
+#define WAIT_ABANDONED 0x80ul
+#define WAIT_TIMEOUT 258ul
+#define WAIT_FAILED 0xFFFFFFFFul
+
+#define ERROR_SUCCESS 0ul
+#define ERROR_FILE_NOT_FOUND 2ul
+#define ERROR_PATH_NOT_FOUND 3ul
+#define ERROR_ACCESS_DENIED 5ul
+#define ERROR_INVALID_HANDLE 6ul
+#define ERROR_NOT_ENOUGH_MEMORY 8ul
+#define ERROR_WRITE_PROTECT 19ul
+#define ERROR_FILE_EXISTS 80ul
+#define ERROR_INVALID_PARAMETER 87ul
+#define ERROR_BROKEN_PIPE 109ul
+#define ERROR_INSUFFICIENT_BUFFER 122ul
+#define ERROR_ALREADY_EXISTS 183ul
+#define ERROR_ENVVAR_NOT_FOUND 203ul
+#define ERROR_OPERATION_ABORTED 995ul
+#define ERROR_IO_INCOMPLETE 996ul
+#define ERROR_CLIPBOARD_NOT_OPEN 1418ul
+#define ERROR_NO_UNICODE_TRANSLATION 1113ul
+
+typedef union {
+  struct {
+    DWORD LowPart;
+    LONG HighPart;
+  } u;
+  long long QuadPart;
+} LARGE_INTEGER;
+
+typedef struct {
+  DWORD dwLowDateTime;
+  DWORD dwHighDateTime;
+} FILETIME;
+
+typedef struct {
+  WORD wYear;
+  WORD wMonth;
+  WORD wDayOfWeek;
+  WORD wDay;
+  WORD wHour;
+  WORD wMinute;
+  WORD wSecond;
+  WORD wMilliseconds;
+} SYSTEMTIME;
+
+typedef struct {
+  DWORD dwNumberOfProcessors;
+  DWORD dwPageSize;
+} SYSTEM_INFO;
+
+typedef struct {
+  DWORD dwFileAttributes;
+  FILETIME ftCreationTime;
+  FILETIME ftLastAccessTime;
+  FILETIME ftLastWriteTime;
+  DWORD nFileSizeHigh;
+  DWORD nFileSizeLow;
+} WIN32_FILE_ATTRIBUTE_DATA;
+
+typedef enum { GetFileExInfoStandard } GET_FILEEX_INFO_LEVELS;
+
+typedef struct {
+  uintptr_t Internal;
+  uintptr_t InternalHigh;
+  HANDLE hEvent;
+} OVERLAPPED;
+
+typedef struct {
+  DWORD NextEntryOffset;
+  DWORD Action;
+  DWORD FileNameLength;
+  wchar_t FileName[1];
+} FILE_NOTIFY_INFORMATION;
+
+#define FILE_ACTION_ADDED 1ul
+#define FILE_ACTION_REMOVED 2ul
+#define FILE_ACTION_MODIFIED 3ul
+#define FILE_ACTION_RENAMED_OLD_NAME 4ul
+#define FILE_ACTION_RENAMED_NEW_NAME 5ul
+
+#define GENERIC_READ 0x80000000ul
+#define GENERIC_WRITE 0x40000000ul
+#define FILE_APPEND_DATA 0x0004ul
+#define FILE_LIST_DIRECTORY 0x0001ul
+#define FILE_SHARE_READ 0x1ul
+#define FILE_SHARE_WRITE 0x2ul
+#define FILE_SHARE_DELETE 0x4ul
+#define CREATE_NEW 1ul
+#define CREATE_ALWAYS 2ul
+#define OPEN_EXISTING 3ul
+#define OPEN_ALWAYS 4ul
+#define FILE_ATTRIBUTE_NORMAL 0x80ul
+#define FILE_FLAG_BACKUP_SEMANTICS 0x02000000ul
+#define FILE_FLAG_OVERLAPPED 0x40000000ul
+#define FILE_FLAG_SEQUENTIAL_SCAN 0x08000000ul
+#define FILE_NOTIFY_CHANGE_FILE_NAME 0x1ul
+#define FILE_NOTIFY_CHANGE_LAST_WRITE 0x10ul
+#define FILE_NOTIFY_CHANGE_SIZE 0x8ul
+#define MOVEFILE_REPLACE_EXISTING 0x1ul
+#define STD_INPUT_HANDLE ((DWORD) -10)
+#define STD_OUTPUT_HANDLE ((DWORD) -11)
+#define STD_ERROR_HANDLE ((DWORD) -12)
+
+#define CP_ACP 0u
+#define CP_UTF8 65001u
+#define MB_ERR_INVALID_CHARS 0x8ul
+
+#define GMEM_MOVEABLE 0x2u
+#define GMEM_ZEROINIT 0x40u
+
+#define CF_TEXT 1u
+#define CF_BITMAP 2u
+#define CF_METAFILEPICT 3u
+#define CF_OEMTEXT 7u
+#define CF_DIB 8u
+#define CF_PALETTE 9u
+#define CF_UNICODETEXT 13u
+#define CF_ENHMETAFILE 14u
+#define CF_HDROP 15u
+#define CF_LOCALE 16u
+#define CF_DIBV5 17u
+#define CF_OWNERDISPLAY 0x80u
+#define CF_DSPTEXT 0x81u
+#define CF_DSPBITMAP 0x82u
+#define CF_DSPMETAFILEPICT 0x83u
+#define CF_DSPENHMETAFILE 0x8Eu
+#define CF_PRIVATEFIRST 0x200u
+#define CF_PRIVATELAST 0x2FFu
+#define CF_GDIOBJFIRST 0x300u
+#define CF_GDIOBJLAST 0x3FFu
+
+#define WM_CREATE 0x0001u
+#define WM_DESTROY 0x0002u
+#define WM_TIMER 0x0113u
+#define WM_RENDERFORMAT 0x0305u
+#define WM_RENDERALLFORMATS 0x0306u
+#define WM_DESTROYCLIPBOARD 0x0307u
+#define WM_HOTKEY 0x0312u
+#define WM_CLIPBOARDUPDATE 0x031Du
+#define WM_QUIT 0x0012u
+#define WM_APP 0x8000u
+
+#define MOD_ALT 0x1u
+#define MOD_CONTROL 0x2u
+#define MOD_SHIFT 0x4u
+#define MOD_NOREPEAT 0x4000u
+#define WS_POPUP 0x80000000ul
+#define WS_EX_TOOLWINDOW 0x80ul
+#define CW_USEDEFAULT ((int) 0x80000000)
+#define IMAGE_ICON 1u
+#define LR_DEFAULTSIZE 0x40u
+#define MAKEINTRESOURCEW(id) ((LPCWSTR) (uintptr_t) (WORD) (id))
+#define IDC_ARROW MAKEINTRESOURCEW(32512)
+#define MB_ICONASTERISK 0x40u
+
+typedef LRESULT(CALLBACK* WNDPROC)(HWND, UINT, WPARAM, LPARAM);
+
+typedef struct {
+  UINT cbSize;
+  UINT style;
+  WNDPROC lpfnWndProc;
+  HINSTANCE hInstance;
+  HICON hIcon;
+  HCURSOR hCursor;
+  LPCWSTR lpszClassName;
+  HICON hIconSm;
+} WNDCLASSEXW;
+
+typedef struct {
+  HWND hwnd;
+  UINT message;
+  WPARAM wParam;
+  LPARAM lParam;
+} MSG;
+
+typedef DWORD(WINAPI* LPTHREAD_START_ROUTINE)(LPVOID);
+typedef BOOL(WINAPI* PHANDLER_ROUTINE)(DWORD);
+typedef VOID(CALLBACK* PTP_WORK_CALLBACK)(PTP_CALLBACK_INSTANCE, PVOID, PTP_WORK);
+
+// Handles, events, threads and mutexes.
+DWORD GetLastError(void);
+void SetLastError(DWORD error);
+BOOL CloseHandle(HANDLE handle);
+HANDLE CreateEventW(void* attributes, BOOL manualReset, BOOL initialState, LPCWSTR name);
+BOOL SetEvent(HANDLE event);
+BOOL ResetEvent(HANDLE event);
+HANDLE CreateMutexW(void* attributes, BOOL initialOwner, LPCWSTR name);
+BOOL ReleaseMutex(HANDLE mutex);
+DWORD WaitForSingleObject(HANDLE handle, DWORD milliseconds);
+DWORD WaitForMultipleObjects(DWORD count, const HANDLE* handles, BOOL waitAll, DWORD milliseconds);
+HANDLE CreateThread(void* attributes, size_t stackSize, LPTHREAD_START_ROUTINE start, LPVOID parameter, DWORD flags,
+                    DWORD* threadId);
+void Sleep(DWORD milliseconds);
+DWORD GetCurrentProcessId(void);
+
+void InitializeSRWLock(SRWLOCK* lock);
+void AcquireSRWLockExclusive(SRWLOCK* lock);
+void ReleaseSRWLockExclusive(SRWLOCK* lock);
+
+#define InterlockedIncrement(target) __atomic_add_fetch((target), 1, __ATOMIC_SEQ_CST)
+#define InterlockedDecrement(target) __atomic_sub_fetch((target), 1, __ATOMIC_SEQ_CST)
+#define InterlockedExchange(target, value) __atomic_exchange_n((target), (value), __ATOMIC_SEQ_CST)
+#define InterlockedExchange64(target, value) __atomic_exchange_n((target), (value), __ATOMIC_SEQ_CST)
+#define InterlockedExchangePointer(target, value) __atomic_exchange_n((target), (value), __ATOMIC_SEQ_CST)
+#define InterlockedCompareExchange(target, exchange, comparand)                                                        \
+  __sync_val_compare_and_swap((target), (comparand), (exchange))
+#define InterlockedCompareExchange64(target, exchange, comparand)                                                      \
+  __sync_val_compare_and_swap((target), (comparand), (exchange))
+
+// Thread pool: every submission runs on a thread of its own.
+PTP_WORK CreateThreadpoolWork(PTP_WORK_CALLBACK callback, PVOID context, void* environment);
+void SubmitThreadpoolWork(PTP_WORK work);
+void WaitForThreadpoolWorkCallbacks(PTP_WORK work, BOOL cancelPending);
+void CloseThreadpoolWork(PTP_WORK work);
+
+// Time.
+BOOL QueryPerformanceCounter(LARGE_INTEGER* counter);
+BOOL QueryPerformanceFrequency(LARGE_INTEGER* frequency);
+ULONGLONG GetTickCount64(void);
+DWORD GetTickCount(void);
+void GetSystemTimeAsFileTime(FILETIME* time);
+BOOL FileTimeToLocalFileTime(const FILETIME* time, FILETIME* localTime);
+BOOL FileTimeToSystemTime(const FILETIME* time, SYSTEMTIME* systemTime);
+void GetSystemTime(SYSTEMTIME* systemTime);
+void GetSystemInfo(SYSTEM_INFO* info);
+
+// Text. Every code page is UTF-8, as on a system with the UTF-8 ANSI code page.
+int MultiByteToWideChar(UINT codePage, DWORD flags, const char* text, int length, wchar_t* out, int outLength);
+int WideCharToMultiByte(UINT codePage, DWORD flags, const wchar_t* text, int length, char* out, int outLength,
+                        const char* defaultChar, BOOL* usedDefaultChar);
+
+// Files. Paths are UTF-16 with either separator; directories opened with FILE_FLAG_BACKUP_SEMANTICS are watched
+// through inotify by ReadDirectoryChangesW.
+HANDLE CreateFileW(LPCWSTR path, DWORD access, DWORD share, void* security, DWORD disposition, DWORD flags,
+                   HANDLE templateFile);
+BOOL ReadFile(HANDLE file, void* buffer, DWORD bytesToRead, DWORD* bytesRead, OVERLAPPED* overlapped);
+BOOL WriteFile(HANDLE file, const void* buffer, DWORD bytesToWrite, DWORD* bytesWritten, OVERLAPPED* overlapped);
+BOOL GetFileSizeEx(HANDLE file, LARGE_INTEGER* size);
+BOOL MoveFileExW(LPCWSTR existing, LPCWSTR replacement, DWORD flags);
+BOOL DeleteFileW(LPCWSTR path);
+BOOL GetFileAttributesExW(LPCWSTR path, GET_FILEEX_INFO_LEVELS level, void* information);
+DWORD GetCurrentDirectoryW(DWORD length, wchar_t* buffer);
+BOOL CreateDirectoryW(LPCWSTR path, void* security);
+DWORD GetEnvironmentVariableW(LPCWSTR name, wchar_t* buffer, DWORD length);
+DWORD GetModuleFileNameW(HINSTANCE module, wchar_t* buffer, DWORD length);
+HANDLE GetStdHandle(DWORD which);
+BOOL ReadDirectoryChangesW(HANDLE directory, void* buffer, DWORD length, BOOL watchSubtree, DWORD filter,
+                           DWORD* bytesReturned, OVERLAPPED* overlapped, void* completion);
+BOOL GetOverlappedResult(HANDLE file, OVERLAPPED* overlapped, DWORD* bytesTransferred, BOOL wait);
+BOOL CancelIoEx(HANDLE file, OVERLAPPED* overlapped);
+
+// Movable global memory.
+HGLOBAL GlobalAlloc(UINT flags, size_t bytes);
+HGLOBAL GlobalReAlloc(HGLOBAL block, size_t bytes, UINT flags);
+HGLOBAL GlobalFree(HGLOBAL block);
+void* GlobalLock(HGLOBAL block);
+BOOL GlobalUnlock(HGLOBAL block);
+size_t GlobalSize(HGLOBAL block);
+
+// A process-local clipboard with the Win32 ownership, delayed-rendering and listener semantics.
+BOOL OpenClipboard(HWND owner);
+BOOL CloseClipboard(void);
+BOOL EmptyClipboard(void);
+HANDLE GetClipboardData(UINT format);
+HANDLE SetClipboardData(UINT format, HANDLE data);
+UINT EnumClipboardFormats(UINT format);
+BOOL IsClipboardFormatAvailable(UINT format);
+DWORD GetClipboardSequenceNumber(void);
+HWND GetClipboardOwner(void);
+BOOL AddClipboardFormatListener(HWND hwnd);
+BOOL RemoveClipboardFormatListener(HWND hwnd);
+
+// Windows and messages, all on one message queue per process.
+UINT RegisterClassExW(const WNDCLASSEXW* windowClass);
+HWND CreateWindowExW(DWORD exStyle, LPCWSTR className, LPCWSTR windowName, DWORD style, int x, int y, int width,
+                     int height, HWND parent, void* menu, HINSTANCE instance, LPVOID parameter);
+BOOL DestroyWindow(HWND hwnd);
+BOOL IsWindow(HWND hwnd);
+HWND FindWindowW(LPCWSTR className, LPCWSTR windowName);
+DWORD GetWindowThreadProcessId(HWND hwnd, DWORD* processId);
+LRESULT DefWindowProcW(HWND hwnd, UINT message, WPARAM wParam, LPARAM lParam);
+LRESULT SendMessageW(HWND hwnd, UINT message, WPARAM wParam, LPARAM lParam);
+BOOL PostMessageW(HWND hwnd, UINT message, WPARAM wParam, LPARAM lParam);
+void PostQuitMessage(int exitCode);
+BOOL GetMessageW(MSG* msg, HWND hwnd, UINT filterMin, UINT filterMax);
+BOOL PeekMessageW(MSG* msg, HWND hwnd, UINT filterMin, UINT filterMax, UINT remove);
+BOOL TranslateMessage(const MSG* msg);
+LRESULT DispatchMessageW(const MSG* msg);
+uintptr_t SetTimer(HWND hwnd, uintptr_t id, UINT elapse, void* timerProc);
+BOOL KillTimer(HWND hwnd, uintptr_t id);
+BOOL RegisterHotKey(HWND hwnd, int id, UINT modifiers, UINT key);
+BOOL UnregisterHotKey(HWND hwnd, int id);
+HINSTANCE GetModuleHandleW(LPCWSTR name);
+HCURSOR LoadCursorW(HINSTANCE instance, LPCWSTR name);
+HANDLE LoadImageW(HINSTANCE instance, LPCWSTR name, UINT type, int width, int height, UINT flags);
+BOOL MessageBeep(UINT type);
+BOOL SetConsoleCtrlHandler(PHANDLER_ROUTINE handler, BOOL add);
+BOOL SetConsoleOutputCP(UINT codePage);
+
+#define PM_REMOVE 0x1u
+#define DefWindowProc DefWindowProcW
+#define GetMessage GetMessageW
+#define DispatchMessage DispatchMessageW
+#define GetModuleHandle GetModuleHandleW
+
+// UTF-16 replacements for the wide-string functions trim.c uses.
+size_t host_wcslen(const wchar_t* text);
+int host_wcscmp(const wchar_t* lhs, const wchar_t* rhs);
+int host_wcsncmp(const wchar_t* lhs, const wchar_t* rhs, size_t count);
+int host_wcsicmp(const wchar_t* lhs, const wchar_t* rhs);
+int host_wcsnicmp(const wchar_t* lhs, const wchar_t* rhs, size_t count);
+wchar_t* host_wmemchr(const wchar_t* text, wchar_t c, size_t count);
+int host_wmemcmp(const wchar_t* lhs, const wchar_t* rhs, size_t count);
+wchar_t* host_wmemcpy(wchar_t* destination, const wchar_t* source, size_t count);
+wchar_t* host_wmemmove(wchar_t* destination, const wchar_t* source, size_t count);
+int host_iswspace(unsigned int c);
+
+#define wcslen host_wcslen
+#define wcscmp host_wcscmp
+#define wcsncmp host_wcsncmp
+#define _wcsicmp host_wcsicmp
+#define _wcsnicmp host_wcsnicmp
+#define wmemchr host_wmemchr
+#define wmemcmp host_wmemcmp
+#define wmemcpy host_wmemcpy
+#define wmemmove host_wmemmove
+#define iswspace host_iswspace
+
+// Hooks for tests driving the shim directly.
+void host_clipboard_reset(void);
+void host_pump_messages(void);
+void host_set_processor_count(DWORD count); // what GetSystemInfo reports from now on; 0 goes back to the real count
+
+#endif
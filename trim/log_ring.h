@@ -0,0 +1,157 @@
+#pragma once
+
+// The log queue behind log_info and friends, in plain C11 so it builds and is stress-tested anywhere: producers on
+// any thread format into a ring slot and never wait, and one consumer writes the lines out. Waking the consumer and
+// turning timestamps into local time are left to the caller.
+
+#include <stdarg.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#ifndef LOG_RING_SLOTS
+#define LOG_RING_SLOTS 256u // power of two
+#endif
+#ifndef LOG_MESSAGE_BYTES
+#define LOG_MESSAGE_BYTES 512u
+#endif
+#define LOG_PREFIX_BYTES 24u
+
+// One message waiting for the consumer. `sequence` follows the bounded-queue scheme: a slot is free for the producer
+// claiming position p when it equals p, and holds that producer's message once it equals p + 1.
+typedef struct {
+  atomic_uint sequence;
+  uint64_t time; // 100 ns ticks, taken by the producer; turned into text only by whoever writes the line
+  size_t length;
+  char text[LOG_MESSAGE_BYTES];
+} LogSlot;
+
+// Producers claim slots with one compare-exchange; when the ring is full the message is counted as dropped instead.
+typedef struct {
+  LogSlot slots[LOG_RING_SLOTS];
+  atomic_uint enqueuePosition;
+  atomic_uint dequeuePosition; // written by the consumer only
+  atomic_uint dropped;
+  atomic_bool consumerIdle; // set while the consumer sleeps, so only the producer that ends the sleep wakes it
+} LogRing;
+
+// The local time of day for a tick count, supplied by the platform.
+typedef void (*LogLocalTimeFunction)(uint64_t ticks, unsigned* hour, unsigned* minute, unsigned* second);
+
+// Remembers the "[hh:mm:ss" of the last second formatted, so local time is looked up once per second of log time.
+typedef struct {
+  uint64_t second;
+  char prefix[LOG_PREFIX_BYTES];
+} LogTimeCache;
+
+typedef void (*LogLineFunction)(void* context, uint64_t time, const char* text, size_t length);
+
+static inline void log_ring_init(LogRing* ring) {
+  for (unsigned i = 0; i < LOG_RING_SLOTS; ++i) {
+    atomic_init(&ring->slots[i].sequence, i);
+  }
+  atomic_init(&ring->enqueuePosition, 0u);
+  atomic_init(&ring->dequeuePosition, 0u);
+  atomic_init(&ring->dropped, 0u);
+  atomic_init(&ring->consumerIdle, false);
+}
+
+// Formats into a LOG_MESSAGE_BYTES buffer, marking a truncated message with "...".
+static inline size_t log_format_message(char* text, const char* fmt, va_list args) {
+  int written = vsnprintf(text, LOG_MESSAGE_BYTES, fmt, args);
+  if (written < 0) {
+    text[0] = '\0';
+    return 0;
+  }
+  if ((size_t) written >= LOG_MESSAGE_BYTES) {
+    memcpy(text + LOG_MESSAGE_BYTES - 4, "...", 4);
+    return LOG_MESSAGE_BYTES - 1;
+  }
+  return (size_t) written;
+}
+
+// Queues one message. Returns false when the ring was full and the message was counted as dropped. `*outWake` tells
+// the caller to wake the consumer, which announced it was about to sleep.
+static inline bool log_ring_push(LogRing* ring, uint64_t time, const char* fmt, va_list args, bool* outWake) {
+  *outWake = false;
+  unsigned position = atomic_load(&ring->enqueuePosition);
+  LogSlot* slot = NULL;
+  for (;;) {
+    slot = &ring->slots[position & (LOG_RING_SLOTS - 1)];
+    int difference = (int) (atomic_load(&slot->sequence) - position);
+    if (difference == 0) {
+      if (atomic_compare_exchange_weak(&ring->enqueuePosition, &position, position + 1)) {
+        break;
+      }
+    } else if (difference < 0) {
+      // The consumer has not freed this slot yet: the ring is full.
+      atomic_fetch_add(&ring->dropped, 1u);
+      *outWake = atomic_exchange(&ring->consumerIdle, false);
+      return false;
+    } else {
+      position = atomic_load(&ring->enqueuePosition);
+    }
+  }
+
+  slot->time = time;
+  slot->length = log_format_message(slot->text, fmt, args);
+  atomic_store(&slot->sequence, position + 1);
+  *outWake = atomic_exchange(&ring->consumerIdle, false);
+  return true;
+}
+
+// Hands every published message to `writeLine` in order, then reports drops since the last drain through
+// `*outDropped`. Returns how many messages it handed over. Only the consumer calls this.
+static inline size_t log_ring_drain(LogRing* ring, LogLineFunction writeLine, void* context, unsigned* outDropped) {
+  size_t drained = 0;
+  for (;;) {
+    unsigned position = atomic_load(&ring->dequeuePosition);
+    LogSlot* slot = &ring->slots[position & (LOG_RING_SLOTS - 1)];
+    if (atomic_load(&slot->sequence) != position + 1) {
+      break;
+    }
+    writeLine(context, slot->time, slot->text, slot->length);
+    atomic_store(&ring->dequeuePosition, position + 1);
+    atomic_store(&slot->sequence, position + LOG_RING_SLOTS);
+    drained++;
+  }
+  *outDropped = atomic_exchange(&ring->dropped, 0u);
+  return drained;
+}
+
+// Called by the consumer before it sleeps. Announces the sleep first and then re-checks, so a message published in
+// between is either seen here or wakes the consumer. Returns false, and cancels the announcement, if there is work.
+static inline bool log_ring_prepare_sleep(LogRing* ring) {
+  atomic_store(&ring->consumerIdle, true);
+  unsigned position = atomic_load(&ring->dequeuePosition);
+  LogSlot* next = &ring->slots[position & (LOG_RING_SLOTS - 1)];
+  if (atomic_load(&next->sequence) == position + 1 || atomic_load(&ring->dropped) != 0) {
+    atomic_store(&ring->consumerIdle, false);
+    return false;
+  }
+  return true;
+}
+
+static inline bool log_ring_empty(LogRing* ring) {
+  return atomic_load(&ring->dequeuePosition) == atomic_load(&ring->enqueuePosition);
+}
+
+// Writes "[hh:mm:ss.mmm] " for `ticks` into `prefix`, which holds LOG_PREFIX_BYTES.
+static inline size_t log_format_prefix(LogTimeCache* cache, uint64_t ticks, LogLocalTimeFunction localTime,
+                                       char* prefix) {
+  uint64_t second = ticks / 10000000u;
+  if (second != cache->second || cache->prefix[0] == '\0') {
+    unsigned hour = 0;
+    unsigned minute = 0;
+    unsigned secondOfMinute = 0;
+    localTime(ticks, &hour, &minute, &secondOfMinute);
+    snprintf(cache->prefix, sizeof(cache->prefix), "[%02u:%02u:%02u", hour % 100u, minute % 100u,
+             secondOfMinute % 100u);
+    cache->second = second;
+  }
+  int length = snprintf(prefix, LOG_PREFIX_BYTES, "%s.%03u] ", cache->prefix, (unsigned) (ticks / 10000u % 1000u));
+  return length > 0 ? (size_t) length : 0;
+}
@@ -0,0 +1,81 @@
+// Shared by the host tests. Each test is one translation unit that includes trim.c first, so it can reach the
+// engine's static functions, and then this header.
+#ifndef TRIM_TEST_H
+#define TRIM_TEST_H
+
+static int g_testFailures = 0;
+
+#define CHECK(condition)                                                                                               \
+  do {                                                                                                                 \
+    if (!(condition)) {                                                                                                \
+      fprintf(stderr, "%s:%d: CHECK failed: %s\n", __FILE__, __LINE__, #condition);                                 \
+      g_testFailures++;                                                                                                \
+    }                                                                                                                  \
+  } while (0)
+
+// Prints at most the first 200 units, which is where a short test's mismatch shows.
+static void print_wide_text(const char* label, const wchar_t* text, size_t length) {
+  fprintf(stderr, "  %s (%zu units): \"", label, length);
+  for (size_t i = 0; i < length && i < 200; ++i) {
+    unsigned c = text[i];
+    if (c >= 0x20 && c < 0x7F && c != '"' && c != '\\') {
+      fputc((int) c, stderr);
+    } else {
+      fprintf(stderr, "\\u%04X", c);
+    }
+  }
+  fprintf(stderr, "\"\n");
+}
+
+static inline bool check_text(const char* file, int line, const wchar_t* actual, size_t actualLength,
+                              const wchar_t* expected) {
+  size_t expectedLength = wcslen(expected);
+  if (actual && actualLength == expectedLength && wmemcmp(actual, expected, expectedLength) == 0) {
+    return true;
+  }
+  fprintf(stderr, "%s:%d: text mismatch\n", file, line);
+  print_wide_text("expected", expected, expectedLength);
+  if (actual) {
+    print_wide_text("actual", actual, actualLength);
+  }
+  g_testFailures++;
+  return false;
+}
+
+#define CHECK_TEXT(actual, actualLength, expected) check_text(__FILE__, __LINE__, (actual), (actualLength), (expected))
+
+// Installs rules given as UTF-8 rules-file text as the active rules, the way a loaded trim.rules would be.
+static inline bool use_rules(const char* rulesText) {
+  clear_active_rule_config();
+  RuleSet ruleSet = {0};
+  RuleLoadError error = {0};
+  if (!load_rule_set_from_utf8(rulesText, &ruleSet, &error)) {
+    fprintf(stderr, "rules failed to load at line %zu: %s\n", error.lineNumber, error.message);
+    g_testFailures++;
+    return false;
+  }
+  g_ruleConfig.activeRules = ruleSet;
+  g_ruleConfig.hasActiveFile = true;
+  return true;
+}
+
+// Normalizes `input` with the active rules and checks the result.
+#define CHECK_NORMALIZED(input, expected)                                                                              \
+  do {                                                                                                                 \
+    const wchar_t* checkInput = (input);                                                                               \
+    NormalizedBuffer checkResult = normalize_clipboard_text(checkInput, wcslen(checkInput), NULL);                    \
+    CHECK_TEXT(checkResult.text, checkResult.length, (expected));                                                      \
+    free(checkResult.text);                                                                                            \
+  } while (0)
+
+static int finish_tests(const char* name) {
+  clear_active_rule_config();
+  if (g_testFailures > 0) {
+    fprintf(stderr, "%s: %d check%s failed\n", name, g_testFailures, g_testFailures == 1 ? "" : "s");
+    return 1;
+  }
+  fprintf(stderr, "%s: ok\n", name);
+  return 0;
+}
+
+#endif
@@ -0,0 +1,163 @@
+// Match budgets end to end: a pattern that blows its match limit or its time limit skips the rest of its rule for
+// that clipboard, logs the rule and pattern lines, and leaves every other rule to run. A compacting replacement keeps
+// what it wrote over the text before the budget ran out; a growing one, which writes to scratch, keeps nothing.
+#include "../trim.c"
+#include "test.h"
+
+// 28 `c`s take (?:c+c+)+d far past a 2000-step match limit; 30 take the interpreter many seconds, so with no match
+// limit only the deadline can stop it.
+#define MATCH_LIMIT_TAIL L"cccccccccccccccccccccccccccc"
+#define TIME_LIMIT_TAIL L"cccccccccccccccccccccccccccccc"
+
+// Normalizes `input` with the active rules and INFO logging into a temporary file, whose text lands in `log`.
+static NormalizedBuffer normalize_logged(const wchar_t* input, char* log, size_t logSize) {
+  FILE* stream = tmpfile();
+  CHECK(stream != NULL);
+  g_logStream = stream;
+  g_logLevel = LOG_LEVEL_INFO;
+  NormalizedBuffer result = normalize_clipboard_text(input, wcslen(input), NULL);
+  g_logLevel = LOG_LEVEL_ERROR;
+  g_logStream = NULL;
+  log[0] = '\0';
+  if (stream) {
+    rewind(stream);
+    log[fread(log, 1, logSize - 1, stream)] = '\0';
+    fclose(stream);
+  }
+  return result;
+}
+
+// After the budget lines comes the rule that blows its budget, whose second pattern (`q`) must not run, and then the
+// rule that must (`z`). With one budget line the first rule is on line 2 and its patterns on lines 3 and 6.
+static bool use_budget_rules(const char* budget, const char* replacement) {
+  char rulesText[512];
+  snprintf(rulesText, sizeof(rulesText),
+           "%s\n"
+           "rule\n"
+           "pattern <<EOF\n"
+           "b|(?:c+c+)+d\n"
+           "EOF\n"
+           "pattern <<EOF\n"
+           "q\n"
+           "EOF\n"
+           "replace <<EOF\n"
+           "%s\n"
+           "EOF\n"
+           "\n"
+           "rule\n"
+           "pattern <<EOF\n"
+           "z\n"
+           "EOF\n"
+           "replace <<EOF\n"
+           "Z\n"
+           "EOF\n",
+           budget, replacement);
+  return use_rules(rulesText);
+}
+
+// `skipped` is the whole expected log line after its time prefix.
+static void check_skip_logged(const char* log, const char* skipped) {
+  const char* first = strstr(log, skipped);
+  CHECK(first != NULL);
+  // Logged once: neither the rule's second pattern nor the next rule trips anything.
+  CHECK(first && strstr(first + 1, "Skipped rule") == NULL && strstr(log, "Skipped rule") == first);
+  CHECK(strstr(log, "Regex replacement failed") == NULL);
+}
+
+static void test_match_limit_compacting(void) {
+  if (!use_budget_rules("match-limit 2000", "")) {
+    return;
+  }
+  char log[4096];
+  NormalizedBuffer result = normalize_logged(L"bbbbz q " MATCH_LIMIT_TAIL, log, sizeof(log));
+  // The `b`s went before the limit hit; `q` belongs to the skipped part of the rule; the next rule still ran.
+  CHECK_TEXT(result.text, result.length, L"Z q " MATCH_LIMIT_TAIL);
+  CHECK(result.replacementStats.patternsIncomplete == 2);
+  CHECK(result.replacementStats.substitutionsApplied == 5);
+  CHECK(result.replacementStats.rulesTouched == 2);
+  check_skip_logged(log, "Skipped rule on line 2 for this clipboard: pattern on line 3: match limit exceeded\n");
+  free(result.text);
+}
+
+static void test_match_limit_growing(void) {
+  if (!use_budget_rules("match-limit 2000", "bee")) {
+    return;
+  }
+  char log[4096];
+  NormalizedBuffer result = normalize_logged(L"bbbbz q " MATCH_LIMIT_TAIL, log, sizeof(log));
+  CHECK_TEXT(result.text, result.length, L"bbbbZ q " MATCH_LIMIT_TAIL);
+  CHECK(result.replacementStats.patternsIncomplete == 2);
+  CHECK(result.replacementStats.substitutionsApplied == 1);
+  CHECK(result.replacementStats.rulesTouched == 1);
+  check_skip_logged(log, "Skipped rule on line 2 for this clipboard: pattern on line 3: match limit exceeded\n");
+  free(result.text);
+
+  // Text the pattern gets through within its budget is replaced as usual.
+  CHECK_NORMALIZED(L"bbz q ccd", L"beebeeZ bee bee");
+}
+
+static void test_time_limit_compacting(void) {
+  if (!use_budget_rules("match-limit 4294967295\ntime-limit 20", "")) {
+    return;
+  }
+  char log[4096];
+  NormalizedBuffer result = normalize_logged(L"bbbbz q " TIME_LIMIT_TAIL, log, sizeof(log));
+  CHECK_TEXT(result.text, result.length, L"Z q " TIME_LIMIT_TAIL);
+  CHECK(result.replacementStats.patternsIncomplete == 2);
+  CHECK(result.replacementStats.substitutionsApplied == 5);
+  check_skip_logged(log,
+                    "Skipped rule on line 3 for this clipboard: pattern on line 4: Time limit of 20 ms exceeded\n");
+  free(result.text);
+}
+
+static void test_time_limit_growing(void) {
+  if (!use_budget_rules("match-limit 4294967295\ntime-limit 20", "bee")) {
+    return;
+  }
+  char log[4096];
+  NormalizedBuffer result = normalize_logged(L"bbbbz q " TIME_LIMIT_TAIL, log, sizeof(log));
+  CHECK_TEXT(result.text, result.length, L"bbbbZ q " TIME_LIMIT_TAIL);
+  CHECK(result.replacementStats.patternsIncomplete == 2);
+  CHECK(result.replacementStats.substitutionsApplied == 1);
+  check_skip_logged(log,
+                    "Skipped rule on line 3 for this clipboard: pattern on line 4: Time limit of 20 ms exceeded\n");
+  free(result.text);
+}
+
+static void test_rule_budget_overrides_global(void) {
+  // The global limit is generous; only the rule's own limit can stop it.
+  if (!use_rules("match-limit 4294967295\n"
+                 "rule\n"
+                 "match-limit 2000\n"
+                 "pattern <<EOF\n"
+                 "b|(?:c+c+)+d\n"
+                 "EOF\n"
+                 "replace <<EOF\n"
+                 "EOF\n"
+                 "\n"
+                 "rule\n"
+                 "pattern <<EOF\n"
+                 "z\n"
+                 "EOF\n"
+                 "replace <<EOF\n"
+                 "Z\n"
+                 "EOF\n")) {
+    return;
+  }
+  char log[4096];
+  NormalizedBuffer result = normalize_logged(L"z " MATCH_LIMIT_TAIL, log, sizeof(log));
+  CHECK_TEXT(result.text, result.length, L"Z " MATCH_LIMIT_TAIL);
+  CHECK(result.replacementStats.patternsIncomplete == 1);
+  check_skip_logged(log, "Skipped rule on line 2 for this clipboard: pattern on line 4: match limit exceeded\n");
+  free(result.text);
+}
+
+int main(void) {
+  g_logLevel = LOG_LEVEL_ERROR;
+  test_match_limit_compacting();
+  test_match_limit_growing();
+  test_time_limit_compacting();
+  test_time_limit_growing();
+  test_rule_budget_overrides_global();
+  return finish_tests("test_budgets");
+}
@@ -0,0 +1,182 @@
+// The clipboard pipeline against the shim's clipboard: a job the clipboard has moved past is abandoned, a result that
+// arrives after someone else wrote is discarded, only a current result is written back, and only a pass that ran every
+// pattern marks its text as already normalized.
+#define _DEFAULT_SOURCE // mkdtemp
+#include "../trim.c"
+#include "test.h"
+
+#include <stdlib.h>
+#include <unistd.h>
+
+static const char kPipelineRules[] = "rule\n"
+                                     "pattern <<EOF\n"
+                                     "(?m)[ \\t]+$\n"
+                                     "EOF\n"
+                                     "replace <<EOF\n"
+                                     "EOF\n";
+
+static LRESULT CALLBACK pipeline_window_proc(HWND hwnd, UINT msg, WPARAM wParam, LPARAM lParam) {
+  switch (msg) {
+  case WM_APP_NORMALIZED:
+    handle_normalization_result(hwnd, (NormalizationResult*) lParam);
+    return 0;
+  case WM_DESTROYCLIPBOARD:
+    handle_destroy_clipboard();
+    return 0;
+  default:
+    return DefWindowProcW(hwnd, msg, wParam, lParam);
+  }
+}
+
+// Plays the application that copies: replaces the clipboard with `text` and returns the new sequence number.
+static DWORD copy_text(const wchar_t* text) {
+  size_t length = wcslen(text);
+  HGLOBAL data = GlobalAlloc(GMEM_MOVEABLE, (length + 1) * sizeof(wchar_t));
+  wchar_t* locked = (wchar_t*) GlobalLock(data);
+  wmemcpy(locked, text, length + 1);
+  GlobalUnlock(data);
+  CHECK(OpenClipboard(NULL));
+  CHECK(EmptyClipboard());
+  CHECK(SetClipboardData(CF_UNICODETEXT, data) != NULL);
+  DWORD sequence = GetClipboardSequenceNumber();
+  CloseClipboard();
+  return sequence;
+}
+
+static void check_clipboard_text(int line, const wchar_t* expected) {
+  if (!OpenClipboard(NULL)) {
+    fprintf(stderr, "%s:%d: clipboard busy\n", __FILE__, line);
+    g_testFailures++;
+    return;
+  }
+  HANDLE data = GetClipboardData(CF_UNICODETEXT);
+  const wchar_t* text = data ? (const wchar_t*) GlobalLock(data) : NULL;
+  check_text(__FILE__, line, text, text ? wcslen(text) : 0, expected);
+  if (text) {
+    GlobalUnlock(data);
+  }
+  CloseClipboard();
+}
+
+#define CHECK_CLIPBOARD(expected) check_clipboard_text(__LINE__, (expected))
+
+// Reads the clipboard the way a WM_CLIPBOARDUPDATE does and runs the job on this thread.
+static void run_job(HWND hwnd, LONG latestSequence) {
+  ClipboardBuffer original = {0};
+  DWORD sequence = 0;
+  CHECK(fetch_clipboard_text(hwnd, &original, NULL, &sequence, NULL));
+  g_worker.latestSequence = latestSequence != 0 ? latestSequence : (LONG) sequence;
+  process_normalization_job(hwnd, &original, sequence);
+  free_clipboard_buffer(&original);
+}
+
+static void test_current_result_is_written(HWND hwnd) {
+  copy_text(L"keep  \nthis\t");
+  run_job(hwnd, 0);
+  host_pump_messages();
+  CHECK_CLIPBOARD(L"keep\nthis");
+  CHECK(GetClipboardOwner() == hwnd);
+  CHECK(g_lastWrittenSequence == GetClipboardSequenceNumber());
+}
+
+static void test_cancelled_job_is_abandoned(HWND hwnd) {
+  // A pass that finds the clipboard moved on gives up before it substitutes anything.
+  LONG latest = 2;
+  NormalizationCancel cancel = {&latest, 1};
+  NormalizedBuffer cancelled = normalize_clipboard_text(L"a  \nb  ", 7, &cancel);
+  CHECK(cancelled.cancelled);
+  CHECK(cancelled.replacementStats.substitutionsApplied == 0);
+  free_normalized_buffer(&cancelled);
+
+  DWORD sequence = copy_text(L"stale  ");
+  run_job(hwnd, (LONG) sequence + 1);
+  host_pump_messages();
+  CHECK(GetClipboardSequenceNumber() == sequence);
+  CHECK_CLIPBOARD(L"stale  ");
+}
+
+static void test_stale_result_is_discarded(HWND hwnd) {
+  copy_text(L"first  ");
+  run_job(hwnd, 0);
+  // The result is queued for the window thread, but another copy lands before it is handled.
+  DWORD sequence = copy_text(L"second  ");
+  host_pump_messages();
+  CHECK(GetClipboardSequenceNumber() == sequence);
+  CHECK_CLIPBOARD(L"second  ");
+}
+
+static void test_only_complete_passes_vouch(HWND hwnd) {
+  copy_text(L"clean");
+  run_job(hwnd, 0);
+  CHECK(load_normalized_fingerprint() == fingerprint_text(L"clean", 5));
+
+  // Under `surrogates reject` the regex never ran, so the text is not known to be normalized.
+  static const wchar_t kUnpaired[] = {L'x', 0xD800, L' ', L'\0'};
+  copy_text(kUnpaired);
+  run_job(hwnd, 0);
+  host_pump_messages();
+  CHECK(load_normalized_fingerprint() == 0);
+  CHECK_CLIPBOARD(kUnpaired);
+}
+
+static void test_worker_writes_only_latest(HWND hwnd) {
+  if (!start_normalization_worker(hwnd)) {
+    CHECK(!"worker failed to start");
+    return;
+  }
+  // Two copies in a row: whichever of the jobs the worker gets to, only the second may reach the clipboard.
+  for (int i = 0; i < 2; ++i) {
+    ClipboardBuffer original = {0};
+    DWORD sequence = 0;
+    copy_text(i == 0 ? L"older  " : L"newer  ");
+    CHECK(fetch_clipboard_text(hwnd, &original, NULL, &sequence, NULL));
+    submit_normalization_job(&original, sequence);
+  }
+  for (int waited = 0; waited < 500 && GetClipboardOwner() != hwnd; ++waited) {
+    Sleep(10);
+    host_pump_messages();
+  }
+  stop_normalization_worker();
+  host_pump_messages();
+  CHECK_CLIPBOARD(L"newer");
+}
+
+int main(void) {
+  g_logLevel = LOG_LEVEL_ERROR;
+  char directory[] = "/tmp/trim-pipeline-XXXXXX";
+  if (!mkdtemp(directory) || chdir(directory) != 0) {
+    CHECK(!"temporary directory unavailable");
+    return finish_tests("test_cancellation");
+  }
+  // Jobs re-read trim.rules from the current directory, as they do without a rules watcher.
+  FILE* file = fopen("trim.rules", "wb");
+  CHECK(file != NULL);
+  if (file) {
+    fputs(kPipelineRules, file);
+    fclose(file);
+  }
+
+  WNDCLASSEXW wc = {0};
+  wc.cbSize = sizeof(wc);
+  wc.lpfnWndProc = pipeline_window_proc;
+  wc.lpszClassName = L"TrimPipelineTest";
+  RegisterClassExW(&wc);
+  HWND hwnd = CreateWindowExW(0, wc.lpszClassName, L"", 0, 0, 0, 0, 0, NULL, NULL, NULL, NULL);
+  CHECK(hwnd != NULL);
+  if (hwnd) {
+    test_current_result_is_written(hwnd);
+    test_cancelled_job_is_abandoned(hwnd);
+    test_stale_result_is_discarded(hwnd);
+    test_only_complete_passes_vouch(hwnd);
+    test_worker_writes_only_latest(hwnd);
+    DestroyWindow(hwnd);
+  }
+  host_clipboard_reset();
+
+  remove("trim.rules");
+  remove("trim.rules.cache");
+  if (chdir("/tmp") == 0) {
+    rmdir(directory);
+  }
+  return finish_tests("test_cancellation");
+}
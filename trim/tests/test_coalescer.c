@@ -0,0 +1,64 @@
+// The update coalescer is a pure state machine over the ticks it is handed, so a made-up clock drives it exactly.
+#include "../trim.c"
+#include "test.h"
+
+static const DWORD kQuietMs = 50;
+
+static void test_burst_runs_once(void) {
+  UpdateCoalescer coalescer = {0};
+  DWORD now = 1000;
+  // Five notifications 10 ms apart: each one pushes the deadline out again.
+  for (DWORD sequence = 1; sequence <= 5; ++sequence) {
+    CHECK(coalescer_on_event(&coalescer, now, sequence, kQuietMs) == kQuietMs);
+    CHECK(coalescer_on_timer(&coalescer, now + 10, kQuietMs) == kQuietMs - 10);
+    now += 10;
+  }
+  CHECK(coalescer.lastSequence == 5);
+  // A timer set for the first event fires early for the last one and is re-armed for the rest.
+  CHECK(coalescer_on_timer(&coalescer, now + 20, kQuietMs) == 20);
+  CHECK(coalescer.armed);
+  CHECK(coalescer_on_timer(&coalescer, now + 40, kQuietMs) == 0);
+  CHECK(!coalescer.armed);
+  CHECK(coalescer_take_burst(&coalescer) == 4);
+  CHECK(coalescer.coalescedTotal == 4);
+
+  // A lone notification afterwards is its own burst and absorbs nothing.
+  CHECK(coalescer_on_event(&coalescer, now + 500, 6, kQuietMs) == kQuietMs);
+  CHECK(coalescer_on_timer(&coalescer, now + 550, kQuietMs) == 0);
+  CHECK(coalescer_take_burst(&coalescer) == 0);
+  CHECK(coalescer.coalescedTotal == 4);
+}
+
+static void test_zero_window_runs_immediately(void) {
+  UpdateCoalescer coalescer = {0};
+  CHECK(coalescer_on_event(&coalescer, 7, 1, 0) == 0);
+  CHECK(!coalescer.armed);
+  CHECK(coalescer_take_burst(&coalescer) == 0);
+}
+
+static void test_stray_timer_does_nothing(void) {
+  // A WM_TIMER already queued when the burst ran must not run it a second time with a stale count.
+  UpdateCoalescer coalescer = {0};
+  coalescer_on_event(&coalescer, 0, 1, kQuietMs);
+  CHECK(coalescer_on_timer(&coalescer, kQuietMs, kQuietMs) == 0);
+  coalescer_take_burst(&coalescer);
+  CHECK(coalescer_on_timer(&coalescer, kQuietMs + 1, kQuietMs) == 0);
+  CHECK(coalescer_take_burst(&coalescer) == 0);
+}
+
+static void test_tick_wraparound(void) {
+  // GetTickCount wraps after 49.7 days; the elapsed time is still measured across the wrap.
+  UpdateCoalescer coalescer = {0};
+  coalescer_on_event(&coalescer, 0xFFFFFFF0u, 1, kQuietMs);
+  CHECK(coalescer_on_timer(&coalescer, 0x10u, kQuietMs) == kQuietMs - 0x20u);
+  CHECK(coalescer_on_timer(&coalescer, 0x22u, kQuietMs) == 0);
+}
+
+int main(void) {
+  g_logLevel = LOG_LEVEL_ERROR;
+  test_burst_runs_once();
+  test_zero_window_runs_immediately();
+  test_stray_timer_does_nothing();
+  test_tick_wraparound();
+  return finish_tests("test_coalescer");
+}
@@ -0,0 +1,46 @@
+// Filter input is decoded strictly: malformed bytes fail the run unless --lossy asks for U+FFFD in their place.
+#include "../trim.c"
+#include "test.h"
+
+static bool decode(const char* bytes, size_t byteLength, StreamEncoding encoding, size_t* outLength) {
+  FilterStream stream = {0};
+  stream.encoding = encoding;
+  stream.bytes = (char*) bytes;
+  stream.byteCount = byteLength;
+  stream.bytesRead = byteLength;
+  bool decoded = filter_decode_segment(&stream, byteLength, 0, outLength);
+  if (decoded && *outLength > 0 && stream.wide[*outLength - 1] == 0xFFFD) {
+    *outLength = (size_t) -1; // marks a replaced tail for the checks below
+  }
+  free(stream.wide);
+  return decoded;
+}
+
+static void test_invalid_utf8(void) {
+  static const char kInvalid[] = "ok\n\xC3";
+  size_t length = 0;
+  g_filterOptions.lossy = false;
+  CHECK(decode("ok\n\xC3\xA9", 5, STREAM_ENCODING_UTF8, &length) && length == 4);
+  CHECK(!decode(kInvalid, sizeof(kInvalid) - 1, STREAM_ENCODING_UTF8, &length));
+  g_filterOptions.lossy = true;
+  CHECK(decode(kInvalid, sizeof(kInvalid) - 1, STREAM_ENCODING_UTF8, &length) && length == (size_t) -1);
+  g_filterOptions.lossy = false;
+}
+
+static void test_odd_utf16_length(void) {
+  static const char kOdd[] = "a\0b";
+  size_t length = 0;
+  CHECK(!decode(kOdd, 3, STREAM_ENCODING_UTF16LE, &length));
+  g_filterOptions.lossy = true;
+  CHECK(decode(kOdd, 3, STREAM_ENCODING_UTF16LE, &length) && length == 1);
+  g_filterOptions.lossy = false;
+}
+
+int main(void) {
+  g_logLevel = LOG_LEVEL_ERROR;
+  // The whole input is one subject unless --segment-kib asks for segments.
+  CHECK(g_filterOptions.segmentBytes == 0);
+  test_invalid_utf8();
+  test_odd_utf16_length();
+  return finish_tests("test_filter_decode");
+}
@@ -0,0 +1,143 @@
+// Patterns are checked when the rules load but compiled on first use or by the idle pre-warm.
+#define _DEFAULT_SOURCE // mkdtemp
+#include "../trim.c"
+#include "test.h"
+
+#include <stdlib.h>
+#include <unistd.h>
+
+static void check_rejected(const char* pattern) {
+  char rules[256];
+  snprintf(rules, sizeof(rules), "rule\npattern <<EOF\n%s\nEOF\nreplace <<EOF\nx\nEOF\n", pattern);
+  RuleSet ruleSet = {0};
+  RuleLoadError error = {0};
+  if (load_rule_set_from_utf8(rules, &ruleSet, &error)) {
+    fprintf(stderr, "pattern %s loaded, but should not have\n", pattern);
+    g_testFailures++;
+    free_rule_set(&ruleSet);
+  }
+}
+
+static void test_syntax_errors_fail_the_load(void) {
+  check_rejected("a(b");
+  check_rejected("a)b");
+  check_rejected("[abc");
+  check_rejected("abc\\");
+  check_rejected("(?#comment");
+  // What the scan must not mistake for errors.
+  CHECK(use_rules("rule\npattern <<EOF\n[]()]\\Q(\\E\\c([[:alpha:]]+(?#)\nEOF\nreplace <<EOF\nx\nEOF\n"));
+  CHECK(use_rules("rule\npattern <<EOF\n(?x) a # ( unbalanced in a comment\nEOF\nreplace <<EOF\nx\nEOF\n"));
+}
+
+static void test_patterns_compile_on_first_use(void) {
+  if (!use_rules("rule\n"
+                 "pattern <<EOF\n"
+                 "b+\n"
+                 "EOF\n"
+                 "replace <<EOF\n"
+                 "B\n"
+                 "EOF\n"
+                 "\n"
+                 "rule\n"
+                 "min-length 1000\n"
+                 "pattern <<EOF\n"
+                 "c+\n"
+                 "EOF\n"
+                 "replace <<EOF\n"
+                 "C\n"
+                 "EOF\n")) {
+    return;
+  }
+  RuleSet* rules = &g_ruleConfig.activeRules;
+  CHECK(rules->compilePendingCount == 2);
+  CHECK(rules->rules[0].patterns[0].code == NULL);
+  CHECK_NORMALIZED(L"abbc", L"aBc");
+  // The guard kept the second rule from being reached, so only the first pattern paid for compiling.
+  CHECK(rules->compilePendingCount == 1);
+  CHECK(rules->rules[0].patterns[0].code != NULL);
+  CHECK(rules->rules[1].patterns[0].compilePending);
+
+  while (prewarm_next_pattern(rules)) {
+  }
+  CHECK(rules->compilePendingCount == 0);
+  CHECK(rules->rules[1].patterns[0].code != NULL);
+  CHECK(rules->compileContext == NULL);
+}
+
+static void test_late_compile_error_disables_pattern(void) {
+  // Numbers out of order in a quantifier are left for pcre2_compile to find.
+  if (!use_rules("rule\n"
+                 "pattern <<EOF\n"
+                 "a{2,1}\n"
+                 "EOF\n"
+                 "pattern <<EOF\n"
+                 "b\n"
+                 "EOF\n"
+                 "replace <<EOF\n"
+                 "x\n"
+                 "EOF\n")) {
+    return;
+  }
+  NormalizedBuffer normalized = normalize_clipboard_text(L"aab", 3, NULL);
+  CHECK_TEXT(normalized.text, normalized.length, L"aax");
+  CHECK(normalized.replacementStats.patternsIncomplete == 1);
+  free(normalized.text);
+  RuleSet* rules = &g_ruleConfig.activeRules;
+  CHECK(rules->rules[0].patterns[0].disabled);
+  CHECK(rules->compileFailureCount == 1);
+  CHECK_NORMALIZED(L"ab", L"ax");
+}
+
+static bool file_exists(const char* path) {
+  return access(path, F_OK) == 0;
+}
+
+static void test_cache_written_once_compiled(void) {
+  char directory[] = "/tmp/trim-lazy-XXXXXX";
+  if (!mkdtemp(directory)) {
+    CHECK(!"mkdtemp failed");
+    return;
+  }
+  char rulesPath[64];
+  char cachePath[80];
+  snprintf(rulesPath, sizeof(rulesPath), "%s/trim.rules", directory);
+  snprintf(cachePath, sizeof(cachePath), "%s.cache", rulesPath);
+  FILE* file = fopen(rulesPath, "wb");
+  CHECK(file != NULL);
+  if (!file) {
+    return;
+  }
+  fputs("rule\npattern <<EOF\nfo+\nEOF\npattern <<EOF\nba+r\nEOF\nreplace <<EOF\nx\nEOF\n", file);
+  fclose(file);
+
+  wchar_t widePath[64];
+  MultiByteToWideChar(CP_UTF8, 0, rulesPath, -1, widePath, 64);
+  RuleSet ruleSet = {0};
+  RuleLoadError error = {0};
+  CHECK(load_rule_set_from_file(widePath, &ruleSet, &error));
+  CHECK(!file_exists(cachePath));
+  CHECK(prewarm_next_pattern(&ruleSet));
+  CHECK(!file_exists(cachePath));
+  CHECK(!prewarm_next_pattern(&ruleSet));
+  CHECK(file_exists(cachePath));
+  free_rule_set(&ruleSet);
+
+  // A current cache hands its codes over at load; they still finish on first use, but nothing is written again.
+  CHECK(load_rule_set_from_file(widePath, &ruleSet, &error));
+  CHECK(ruleSet.rules[0].patterns[0].code != NULL);
+  CHECK(ruleSet.cachePath == NULL);
+  free_rule_set(&ruleSet);
+
+  remove(cachePath);
+  remove(rulesPath);
+  rmdir(directory);
+}
+
+int main(void) {
+  g_logLevel = LOG_LEVEL_ERROR;
+  test_syntax_errors_fail_the_load();
+  test_patterns_compile_on_first_use();
+  test_late_compile_error_disables_pattern();
+  test_cache_written_once_compiled();
+  return finish_tests("test_lazy_compile");
+}
@@ -0,0 +1,201 @@
+// The log queue under many producers and one consumer on plain pthreads: every message arrives once and in its
+// producer's order, drops are counted rather than lost, and a consumer that goes to sleep is always woken.
+#include "../log_ring.h" // first, so it has to stand on its own without windows.h
+#include "../trim.c"
+#include "test.h"
+
+#include <pthread.h>
+#include <time.h>
+
+#define STRESS_PRODUCERS 8u
+#define STRESS_MESSAGES 100000u
+
+typedef struct {
+  LogRing ring;
+  pthread_mutex_t lock;
+  pthread_cond_t wake;
+  bool wakePending;
+  atomic_bool producersDone;
+  unsigned nextExpected[STRESS_PRODUCERS];
+  size_t received;
+  size_t dropped;
+  size_t malformed;
+  size_t outOfOrder;
+  size_t missedWakes;
+} StressState;
+
+static StressState g_stress;
+
+static void signal_consumer(void) {
+  pthread_mutex_lock(&g_stress.lock);
+  g_stress.wakePending = true;
+  pthread_cond_signal(&g_stress.wake);
+  pthread_mutex_unlock(&g_stress.lock);
+}
+
+static bool push_message(LogRing* ring, const char* fmt, ...) {
+  va_list args;
+  va_start(args, fmt);
+  bool wake = false;
+  bool queued = log_ring_push(ring, 0, fmt, args, &wake);
+  va_end(args);
+  if (wake && ring == &g_stress.ring) {
+    signal_consumer();
+  }
+  return queued;
+}
+
+static void check_message(void* context, uint64_t time, const char* text, size_t length) {
+  (void) context;
+  (void) time;
+  unsigned producer = 0;
+  unsigned counter = 0;
+  char tail = 0;
+  if (strlen(text) != length || sscanf(text, "producer %u message %u%c", &producer, &counter, &tail) != 2 ||
+      producer >= STRESS_PRODUCERS) {
+    g_stress.malformed++;
+    return;
+  }
+  // Drops leave gaps, but a producer's messages never arrive twice or out of order.
+  if (counter < g_stress.nextExpected[producer]) {
+    g_stress.outOfOrder++;
+  }
+  g_stress.nextExpected[producer] = counter + 1;
+  g_stress.received++;
+}
+
+static void drain_stress_ring(void) {
+  unsigned dropped = 0;
+  log_ring_drain(&g_stress.ring, check_message, NULL, &dropped);
+  g_stress.dropped += dropped;
+}
+
+static void* run_producer(void* parameter) {
+  unsigned producer = (unsigned) (uintptr_t) parameter;
+  for (unsigned i = 0; i < STRESS_MESSAGES; ++i) {
+    push_message(&g_stress.ring, "producer %u message %u", producer, i);
+  }
+  return NULL;
+}
+
+static void* run_consumer(void* parameter) {
+  (void) parameter;
+  for (;;) {
+    drain_stress_ring();
+    if (atomic_load(&g_stress.producersDone) && log_ring_empty(&g_stress.ring)) {
+      drain_stress_ring(); // drops counted after the last message
+      return NULL;
+    }
+    if (!log_ring_prepare_sleep(&g_stress.ring)) {
+      continue;
+    }
+    pthread_mutex_lock(&g_stress.lock);
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += 2;
+    bool timedOut = false;
+    while (!g_stress.wakePending && !timedOut) {
+      timedOut = pthread_cond_timedwait(&g_stress.wake, &g_stress.lock, &deadline) != 0;
+    }
+    g_stress.wakePending = false;
+    pthread_mutex_unlock(&g_stress.lock);
+    // Nothing else wakes the consumer, so a timeout with work waiting is a wake-up that got lost.
+    if (timedOut && !log_ring_empty(&g_stress.ring)) {
+      g_stress.missedWakes++;
+    }
+  }
+}
+
+static void test_many_producers(void) {
+  memset(&g_stress, 0, sizeof(g_stress));
+  log_ring_init(&g_stress.ring);
+  pthread_mutex_init(&g_stress.lock, NULL);
+  pthread_cond_init(&g_stress.wake, NULL);
+  atomic_init(&g_stress.producersDone, false);
+
+  pthread_t consumer;
+  pthread_t producers[STRESS_PRODUCERS];
+  CHECK(pthread_create(&consumer, NULL, run_consumer, NULL) == 0);
+  for (unsigned i = 0; i < STRESS_PRODUCERS; ++i) {
+    CHECK(pthread_create(&producers[i], NULL, run_producer, (void*) (uintptr_t) i) == 0);
+  }
+  for (unsigned i = 0; i < STRESS_PRODUCERS; ++i) {
+    pthread_join(producers[i], NULL);
+  }
+  atomic_store(&g_stress.producersDone, true);
+  signal_consumer();
+  pthread_join(consumer, NULL);
+
+  CHECK(g_stress.received + g_stress.dropped == (size_t) STRESS_PRODUCERS * STRESS_MESSAGES);
+  CHECK(g_stress.received > 0);
+  CHECK(g_stress.malformed == 0);
+  CHECK(g_stress.outOfOrder == 0);
+  CHECK(g_stress.missedWakes == 0);
+  pthread_cond_destroy(&g_stress.wake);
+  pthread_mutex_destroy(&g_stress.lock);
+}
+
+static void count_message(void* context, uint64_t time, const char* text, size_t length) {
+  (void) time;
+  (void) text;
+  (void) length;
+  ++*(size_t*) context;
+}
+
+static void test_full_ring_drops(void) {
+  static LogRing ring;
+  log_ring_init(&ring);
+  // With no consumer running, exactly one ring's worth fits.
+  size_t queued = 0;
+  for (unsigned i = 0; i < LOG_RING_SLOTS + 10; ++i) {
+    queued += push_message(&ring, "message %u", i) ? 1 : 0;
+  }
+  CHECK(queued == LOG_RING_SLOTS);
+  size_t written = 0;
+  unsigned dropped = 0;
+  CHECK(log_ring_drain(&ring, count_message, &written, &dropped) == LOG_RING_SLOTS);
+  CHECK(written == LOG_RING_SLOTS && dropped == 10);
+  CHECK(log_ring_empty(&ring));
+  CHECK(log_ring_prepare_sleep(&ring));
+
+  // Long messages are cut with a marker rather than overflowing the slot.
+  char longText[LOG_MESSAGE_BYTES * 2];
+  memset(longText, 'x', sizeof(longText) - 1);
+  longText[sizeof(longText) - 1] = '\0';
+  CHECK(push_message(&ring, "%s", longText)); // position LOG_RING_SLOTS wraps to the first slot
+  CHECK(ring.slots[0].length == LOG_MESSAGE_BYTES - 1);
+  CHECK(strcmp(ring.slots[0].text + LOG_MESSAGE_BYTES - 4, "...") == 0);
+}
+
+static size_t g_localTimeCalls = 0;
+
+static void fixed_local_time(uint64_t ticks, unsigned* hour, unsigned* minute, unsigned* second) {
+  g_localTimeCalls++;
+  uint64_t seconds = ticks / 10000000u;
+  *hour = (unsigned) (seconds / 3600u % 24u);
+  *minute = (unsigned) (seconds / 60u % 60u);
+  *second = (unsigned) (seconds % 60u);
+}
+
+static void test_prefix_format(void) {
+  LogTimeCache cache = {0};
+  char prefix[LOG_PREFIX_BYTES];
+  uint64_t ticks = (uint64_t) (3600u + 2u * 60u + 3u) * 10000000u + 4560000u;
+  CHECK(log_format_prefix(&cache, ticks, fixed_local_time, prefix) == 15);
+  CHECK(strcmp(prefix, "[01:02:03.456] ") == 0);
+  // Within the same second only the milliseconds are formatted again.
+  log_format_prefix(&cache, ticks + 1000000u, fixed_local_time, prefix);
+  CHECK(strcmp(prefix, "[01:02:03.556] ") == 0);
+  CHECK(g_localTimeCalls == 1);
+  log_format_prefix(&cache, ticks + 10000000u, fixed_local_time, prefix);
+  CHECK(strcmp(prefix, "[01:02:04.456] ") == 0);
+  CHECK(g_localTimeCalls == 2);
+}
+
+int main(void) {
+  g_logLevel = LOG_LEVEL_ERROR;
+  test_many_producers();
+  test_full_ring_drops();
+  test_prefix_format();
+  return finish_tests("test_log_ring");
+}
@@ -0,0 +1,92 @@
+// The presence map may skip a pattern only when the text cannot hold a match, including text earlier patterns of
+// the same rule have just written.
+#include "../trim.c"
+#include "test.h"
+
+static const char kChainedRule[] = "rule\n"
+                                   "%s"
+                                   "pattern <<EOF\n"
+                                   "foo\n"
+                                   "EOF\n"
+                                   "pattern <<EOF\n"
+                                   "xx\n"
+                                   "EOF\n"
+                                   "replace <<EOF\n"
+                                   "x\n"
+                                   "EOF\n";
+
+static bool use_chained_rule(const char* scope) {
+  char rules[256];
+  snprintf(rules, sizeof(rules), kChainedRule, scope);
+  return use_rules(rules);
+}
+
+static void test_replacement_feeds_next_pattern(void) {
+  if (!use_chained_rule("")) {
+    return;
+  }
+  // `xx` only exists once `foo` has been replaced; the text as copied holds no x at all.
+  CHECK_NORMALIZED(L"foofoo", L"x");
+  CHECK_NORMALIZED(L"foo bar", L"x bar");
+  CHECK_NORMALIZED(L"bar", L"bar");
+}
+
+static void test_segmented_replacement_feeds_next_pattern(void) {
+  if (!use_chained_rule("scope line\n")) {
+    return;
+  }
+  // Large enough to be split between the four lanes.
+  host_set_processor_count(4);
+  size_t lineCount = 3 * SEGMENT_MIN_UNITS / 7;
+  wchar_t* input = (wchar_t*) malloc((lineCount * 7 + 1) * sizeof(wchar_t));
+  wchar_t* expected = (wchar_t*) malloc((lineCount * 2 + 1) * sizeof(wchar_t));
+  CHECK(input && expected);
+  if (!input || !expected) {
+    free(input);
+    free(expected);
+    return;
+  }
+  for (size_t i = 0; i < lineCount; ++i) {
+    wmemcpy(input + i * 7, L"foofoo\n", 7);
+    wmemcpy(expected + i * 2, L"x\n", 2);
+  }
+  input[lineCount * 7] = L'\0';
+  expected[lineCount * 2] = L'\0';
+  CHECK_NORMALIZED(input, expected);
+  free(input);
+  free(expected);
+  host_set_processor_count(0);
+}
+
+// `^\C` splits the emoji's surrogate pair; the repair writes a U+FFFD the text as copied never held.
+static const char kRepairRules[] = "surrogates repair\n"
+                                   "rule\n"
+                                   "pattern <<EOF\n"
+                                   "^\\C\n"
+                                   "EOF\n"
+                                   "replace <<EOF\n"
+                                   "EOF\n"
+                                   "\n"
+                                   "rule\n"
+                                   "pattern <<EOF\n"
+                                   "\\x{FFFD}\n"
+                                   "EOF\n"
+                                   "replace <<EOF\n"
+                                   "?\n"
+                                   "EOF\n";
+
+static void test_repair_feeds_next_rule(void) {
+  if (!use_rules(kRepairRules)) {
+    return;
+  }
+  CHECK(g_ruleConfig.activeRules.rules[0].mayBreakUtf);
+  CHECK_NORMALIZED(L"\xD83D\xDE00 ok", L"? ok");
+}
+
+int main(void) {
+  g_logLevel = LOG_LEVEL_ERROR;
+  test_replacement_feeds_next_pattern();
+  test_segmented_replacement_feeds_next_pattern();
+  test_repair_feeds_next_rule();
+  return finish_tests("test_prefilter");
+}
@@ -0,0 +1,165 @@
+// --on-paste against the shim's clipboard: only a text-only copy is taken over with a promise, and a paste always
+// gets text, normalized when the worker delivers in time and as copied when there is no worker or it does not.
+#define _DEFAULT_SOURCE // mkdtemp
+#include "../trim.c"
+#include "test.h"
+
+#include <stdlib.h>
+#include <unistd.h>
+
+static const char kPasteRules[] = "rule\n"
+                                  "pattern <<EOF\n"
+                                  "(?m)[ \\t]+$\n"
+                                  "EOF\n"
+                                  "replace <<EOF\n"
+                                  "EOF\n";
+
+static LRESULT CALLBACK paste_window_proc(HWND hwnd, UINT msg, WPARAM wParam, LPARAM lParam) {
+  switch (msg) {
+  case WM_RENDERFORMAT:
+    handle_render_format((UINT) wParam);
+    return 0;
+  case WM_DESTROYCLIPBOARD:
+    handle_destroy_clipboard();
+    return 0;
+  default:
+    return DefWindowProcW(hwnd, msg, wParam, lParam);
+  }
+}
+
+static HGLOBAL make_block(const void* bytes, size_t size) {
+  HGLOBAL data = GlobalAlloc(GMEM_MOVEABLE, size);
+  memcpy(GlobalLock(data), bytes, size);
+  GlobalUnlock(data);
+  return data;
+}
+
+// Plays the application that copies, optionally offering an image alongside the text.
+static void copy_text(const wchar_t* text, bool withImage) {
+  CHECK(OpenClipboard(NULL));
+  CHECK(EmptyClipboard());
+  CHECK(SetClipboardData(CF_UNICODETEXT, make_block(text, (wcslen(text) + 1) * sizeof(wchar_t))) != NULL);
+  if (withImage) {
+    static const unsigned char kPixels[16] = {0};
+    CHECK(SetClipboardData(CF_DIB, make_block(kPixels, sizeof(kPixels))) != NULL);
+  }
+  CloseClipboard();
+}
+
+// Plays the application that pastes; asking for the text renders a promise through WM_RENDERFORMAT.
+static void check_paste(int line, const wchar_t* expected) {
+  CHECK(OpenClipboard(NULL));
+  HANDLE data = GetClipboardData(CF_UNICODETEXT);
+  const wchar_t* text = data ? (const wchar_t*) GlobalLock(data) : NULL;
+  check_text(__FILE__, line, text, text ? wcslen(text) : 0, expected);
+  if (text) {
+    GlobalUnlock(data);
+  }
+  CloseClipboard();
+}
+
+#define CHECK_PASTE(expected) check_paste(__LINE__, (expected))
+
+static void test_other_formats_are_not_taken_over(HWND hwnd) {
+  copy_text(L"picture  ", true);
+  handle_clipboard_update(hwnd);
+  CHECK(!g_deferredRender.pending);
+  CHECK(IsClipboardFormatAvailable(CF_DIB));
+  // Normalized the usual way instead; with no worker running, the job waits for one.
+  CHECK(g_worker.hasPendingJob);
+  free_clipboard_buffer(&g_worker.pendingText);
+  g_worker.hasPendingJob = false;
+}
+
+static void test_paste_without_worker_gets_copied_text(HWND hwnd) {
+  copy_text(L"plain  ", false);
+  handle_clipboard_update(hwnd);
+  CHECK(g_deferredRender.pending);
+  CHECK(GetClipboardOwner() == hwnd);
+  CHECK_PASTE(L"plain  ");
+  CHECK(!g_deferredRender.pending);
+}
+
+static void test_paste_gets_normalized_text(HWND hwnd) {
+  if (!start_normalization_worker(hwnd)) {
+    CHECK(!"worker failed to start");
+    return;
+  }
+  copy_text(L"plain  \ntext\t", false);
+  handle_clipboard_update(hwnd);
+  CHECK(g_deferredRender.pending);
+  CHECK_PASTE(L"plain\ntext");
+  stop_normalization_worker();
+}
+
+static void test_slow_worker_falls_back(HWND hwnd) {
+  // A worker that never picks the job up: the paste gives up after RENDER_WAIT_MS and takes the job back.
+  g_worker.thread = CreateEventW(NULL, TRUE, FALSE, NULL);
+  g_worker.wakeEvent = CreateEventW(NULL, FALSE, FALSE, NULL);
+  g_worker.renderDoneEvent = CreateEventW(NULL, FALSE, FALSE, NULL);
+  copy_text(L"slow  ", false);
+  handle_clipboard_update(hwnd);
+  CHECK_PASTE(L"slow  ");
+  CHECK(!g_worker.hasRenderJob && g_worker.renderText.text == NULL);
+  CHECK(!g_worker.renderAbandoned);
+
+  // A worker already rendering when the paste gives up frees the late result itself.
+  CHECK(abandon_render_job() == NULL);
+  CHECK(g_worker.renderAbandoned);
+  g_worker.renderAbandoned = false;
+
+  // One that finished between the timeout and the check hands its result over.
+  HGLOBAL late = copy_to_clipboard_block(L"late", 4);
+  g_worker.renderedData = late;
+  SetEvent(g_worker.renderDoneEvent);
+  CHECK(abandon_render_job() == late);
+  CHECK(g_worker.renderedData == NULL && !g_worker.renderAbandoned);
+  GlobalFree(late);
+
+  CloseHandle(g_worker.thread);
+  CloseHandle(g_worker.wakeEvent);
+  CloseHandle(g_worker.renderDoneEvent);
+  g_worker.thread = NULL;
+  g_worker.wakeEvent = NULL;
+  g_worker.renderDoneEvent = NULL;
+}
+
+int main(void) {
+  g_logLevel = LOG_LEVEL_ERROR;
+  char directory[] = "/tmp/trim-paste-XXXXXX";
+  if (!mkdtemp(directory) || chdir(directory) != 0) {
+    CHECK(!"temporary directory unavailable");
+    return finish_tests("test_render_on_paste");
+  }
+  // Jobs re-read trim.rules from the current directory, as they do without a rules watcher.
+  FILE* file = fopen("trim.rules", "wb");
+  CHECK(file != NULL);
+  if (file) {
+    fputs(kPasteRules, file);
+    fclose(file);
+  }
+
+  g_renderOnPaste = true;
+  InitializeSRWLock(&g_worker.lock);
+  WNDCLASSEXW wc = {0};
+  wc.cbSize = sizeof(wc);
+  wc.lpfnWndProc = paste_window_proc;
+  wc.lpszClassName = L"TrimPasteTest";
+  RegisterClassExW(&wc);
+  HWND hwnd = CreateWindowExW(0, wc.lpszClassName, L"", 0, 0, 0, 0, 0, NULL, NULL, NULL, NULL);
+  CHECK(hwnd != NULL);
+  if (hwnd) {
+    test_other_formats_are_not_taken_over(hwnd);
+    test_paste_without_worker_gets_copied_text(hwnd);
+    test_paste_gets_normalized_text(hwnd);
+    test_slow_worker_falls_back(hwnd);
+    DestroyWindow(hwnd);
+  }
+  host_clipboard_reset();
+  remove("trim.rules");
+  remove("trim.rules.cache");
+  if (chdir("/tmp") == 0) {
+    rmdir(directory);
+  }
+  return finish_tests("test_render_on_paste");
+}
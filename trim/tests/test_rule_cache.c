@@ -0,0 +1,248 @@
+// The compiled-rule cache: codes that come back from pcre2_serialize_decode behave like freshly compiled ones, stale or
+// damaged images are refused, and a rules directory that refuses the cache sends it to %LOCALAPPDATA%.
+#define _DEFAULT_SOURCE // mkdtemp, setenv
+#include "../trim.c"
+#include "test.h"
+
+#include <sys/stat.h>
+#include <unistd.h>
+
+static const char kCachedRules[] = "rule\n"
+                                   "pattern <<EOF\n"
+                                   "(?i)colou?r\n"
+                                   "EOF\n"
+                                   "pattern <<EOF\n"
+                                   "(?<=\\d)px\\b\n"
+                                   "EOF\n"
+                                   "replace <<EOF\n"
+                                   "_\n"
+                                   "EOF\n"
+                                   "\n"
+                                   "rule\n"
+                                   "engine dfa\n"
+                                   "pattern <<EOF\n"
+                                   "[[:space:]]+$\n"
+                                   "EOF\n"
+                                   "replace <<EOF\n"
+                                   "EOF\n";
+
+static const wchar_t* const kCachedInputs[] = {L"Color 12px COLOUR  \nwidth 3px; pxx", L"nothing here", L"12px\t"};
+
+static void compile_all(RuleSet* ruleSet) {
+  while (prewarm_next_pattern(ruleSet)) {
+  }
+}
+
+// Normalizes every input with `ruleSet` as the active rules, leaving the outputs in `outputs`.
+static void normalize_inputs(RuleSet* ruleSet, NormalizedBuffer outputs[3]) {
+  g_ruleConfig.activeRules = *ruleSet;
+  g_ruleConfig.hasActiveFile = true;
+  for (size_t i = 0; i < 3; ++i) {
+    outputs[i] = normalize_clipboard_text(kCachedInputs[i], wcslen(kCachedInputs[i]), NULL);
+  }
+  *ruleSet = g_ruleConfig.activeRules;
+  memset(&g_ruleConfig.activeRules, 0, sizeof(g_ruleConfig.activeRules));
+  g_ruleConfig.hasActiveFile = false;
+}
+
+static void test_round_trip(void) {
+  RuleSet original = {0};
+  RuleLoadError error = {0};
+  CHECK(load_rule_set_from_utf8(kCachedRules, &original, &error));
+  compile_all(&original);
+  uint8_t* image = NULL;
+  size_t imageLength = 0;
+  CHECK(encode_rule_cache(&original, 42, &image, &imageLength));
+  if (!image) {
+    free_rule_set(&original);
+    return;
+  }
+  size_t patternCount = count_rule_set_patterns(&original);
+  CHECK(patternCount == 3);
+
+  // A different content hash, pattern count or damaged header all mean the image is not for these rules.
+  CHECK(decode_rule_cache(image, imageLength, 43, patternCount) == NULL);
+  CHECK(decode_rule_cache(image, imageLength, 42, patternCount + 1) == NULL);
+  CHECK(decode_rule_cache(image, imageLength - 1, 42, patternCount) == NULL);
+  image[0] ^= 1;
+  CHECK(decode_rule_cache(image, imageLength, 42, patternCount) == NULL);
+  image[0] ^= 1;
+  // So does a damaged payload, which pcre2_serialize_decode would otherwise accept as bytecode.
+  image[imageLength - 1] ^= 1;
+  CHECK(decode_rule_cache(image, imageLength, 42, patternCount) == NULL);
+  image[imageLength - 1] ^= 1;
+
+  pcre2_code** codes = decode_rule_cache(image, imageLength, 42, patternCount);
+  CHECK(codes != NULL);
+  free(image);
+  if (!codes) {
+    free_rule_set(&original);
+    return;
+  }
+
+  // Parse the same text again and adopt the decoded codes, the way load_rule_set_from_file does on a cache hit.
+  wchar_t* text = NULL;
+  int units = MultiByteToWideChar(CP_UTF8, 0, kCachedRules, -1, NULL, 0);
+  text = (wchar_t*) malloc((size_t) units * sizeof(wchar_t));
+  MultiByteToWideChar(CP_UTF8, 0, kCachedRules, -1, text, units);
+  RuleSet restored = {0};
+  CHECK(parse_rule_set_text(text, (size_t) units - 1, &restored, &error));
+  CHECK(compile_rule_set(&restored, codes, &error));
+  free(text);
+  for (size_t i = 0; i < patternCount; ++i) {
+    CHECK(codes[i] == NULL); // adopted
+  }
+  free(codes);
+
+  NormalizedBuffer expected[3];
+  NormalizedBuffer actual[3];
+  normalize_inputs(&original, expected);
+  normalize_inputs(&restored, actual);
+  for (size_t i = 0; i < 3; ++i) {
+    CHECK_TEXT(actual[i].text, actual[i].length, expected[i].text);
+    free(expected[i].text);
+    free(actual[i].text);
+  }
+  CHECK(restored.dfaPatternCount == 1);
+  free_rule_set(&original);
+  free_rule_set(&restored);
+}
+
+static bool file_exists(const char* path) {
+  return access(path, F_OK) == 0;
+}
+
+static void write_text_file(const char* path, const char* text) {
+  FILE* file = fopen(path, "wb");
+  CHECK(file != NULL);
+  if (file) {
+    fputs(text, file);
+    fclose(file);
+  }
+}
+
+// Flips a bit in the cache file's last byte, inside the last pattern's bytecode, where PCRE2's own checks do not look.
+static void damage_cache_payload(const char* path) {
+  FILE* file = fopen(path, "r+b");
+  CHECK(file != NULL);
+  if (!file) {
+    return;
+  }
+  CHECK(fseek(file, -1, SEEK_END) == 0);
+  int byte = fgetc(file);
+  CHECK(byte != EOF);
+  CHECK(fseek(file, -1, SEEK_END) == 0);
+  fputc(byte ^ 0x01, file);
+  fclose(file);
+}
+
+static void test_damaged_payload_compiles_fresh(void) {
+  char root[] = "/tmp/trim-cache-XXXXXX";
+  if (!mkdtemp(root)) {
+    CHECK(!"mkdtemp failed");
+    return;
+  }
+  char rulesPath[96];
+  char cachePath[112];
+  snprintf(rulesPath, sizeof(rulesPath), "%s/trim.rules", root);
+  snprintf(cachePath, sizeof(cachePath), "%s.cache", rulesPath);
+  write_text_file(rulesPath, kCachedRules);
+  wchar_t widePath[96];
+  MultiByteToWideChar(CP_UTF8, 0, rulesPath, -1, widePath, 96);
+
+  RuleSet ruleSet = {0};
+  RuleLoadError error = {0};
+  CHECK(load_rule_set_from_file(widePath, &ruleSet, &error));
+  compile_all(&ruleSet);
+  free_rule_set(&ruleSet);
+  CHECK(file_exists(cachePath));
+  damage_cache_payload(cachePath);
+
+  // Treated as stale: nothing is adopted, the patterns compile again and a good cache replaces the damaged one.
+  CHECK(load_rule_set_from_file(widePath, &ruleSet, &error));
+  CHECK(ruleSet.rules[0].patterns[0].code == NULL);
+  CHECK(ruleSet.cachePath != NULL);
+  NormalizedBuffer outputs[3];
+  normalize_inputs(&ruleSet, outputs);
+  CHECK_TEXT(outputs[0].text, outputs[0].length, L"_ 12_ _  \nwidth 3_; pxx");
+  for (size_t i = 0; i < 3; ++i) {
+    free(outputs[i].text);
+  }
+  compile_all(&ruleSet);
+  free_rule_set(&ruleSet);
+
+  CHECK(load_rule_set_from_file(widePath, &ruleSet, &error));
+  CHECK(ruleSet.rules[0].patterns[0].code != NULL);
+  free_rule_set(&ruleSet);
+
+  remove(cachePath);
+  remove(rulesPath);
+  rmdir(root);
+}
+
+static void test_read_only_directory_falls_back(void) {
+  char root[] = "/tmp/trim-cache-XXXXXX";
+  if (!mkdtemp(root)) {
+    CHECK(!"mkdtemp failed");
+    return;
+  }
+  char rulesPath[96];
+  char blockerPath[128];
+  char localAppData[96];
+  char fallbackDirectory[128];
+  snprintf(rulesPath, sizeof(rulesPath), "%s/trim.rules", root);
+  // A directory where the temporary cache file would go makes the rules directory refuse the cache, even for root.
+  snprintf(blockerPath, sizeof(blockerPath), "%s.cache.tmp", rulesPath);
+  snprintf(localAppData, sizeof(localAppData), "%s/local", root);
+  snprintf(fallbackDirectory, sizeof(fallbackDirectory), "%s/ClipTrim", localAppData);
+  write_text_file(rulesPath, kCachedRules);
+  CHECK(mkdir(blockerPath, 0755) == 0);
+  CHECK(mkdir(localAppData, 0755) == 0);
+  setenv("LOCALAPPDATA", localAppData, 1);
+
+  wchar_t widePath[96];
+  MultiByteToWideChar(CP_UTF8, 0, rulesPath, -1, widePath, 96);
+  RuleSet ruleSet = {0};
+  RuleLoadError error = {0};
+  CHECK(load_rule_set_from_file(widePath, &ruleSet, &error));
+  compile_all(&ruleSet);
+  free_rule_set(&ruleSet);
+
+  wchar_t* cachePath = concat_wide_strings(widePath, kRuleCacheSuffix);
+  wchar_t* fallbackPath = fallback_rule_cache_path(cachePath, false);
+  CHECK(fallbackPath != NULL);
+  char* fallbackUtf8 = fallbackPath ? utf8_from_wide(fallbackPath) : NULL;
+  if (fallbackUtf8) {
+    for (char* c = fallbackUtf8; *c; ++c) {
+      *c = *c == '\\' ? '/' : *c;
+    }
+    CHECK(file_exists(fallbackUtf8));
+  }
+
+  // The next load finds the cache there and adopts its codes.
+  CHECK(load_rule_set_from_file(widePath, &ruleSet, &error));
+  CHECK(ruleSet.rules[0].patterns[0].code != NULL);
+  CHECK(ruleSet.cachePath == NULL);
+  free_rule_set(&ruleSet);
+
+  if (fallbackUtf8) {
+    remove(fallbackUtf8);
+  }
+  free(fallbackUtf8);
+  free(fallbackPath);
+  free(cachePath);
+  unsetenv("LOCALAPPDATA");
+  rmdir(fallbackDirectory);
+  rmdir(localAppData);
+  rmdir(blockerPath);
+  remove(rulesPath);
+  rmdir(root);
+}
+
+int main(void) {
+  g_logLevel = LOG_LEVEL_ERROR;
+  test_round_trip();
+  test_damaged_payload_compiles_fresh();
+  test_read_only_directory_falls_back();
+  return finish_tests("test_rule_cache");
+}
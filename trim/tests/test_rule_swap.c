@@ -0,0 +1,132 @@
+// The rules swap between the watcher and the worker: a publisher thread keeps handing over freshly loaded rule sets
+// while this thread plays the worker, installing whatever is pending between jobs. Every job has to see one whole rule
+// set, versions only move forward, a superseded update is never installed, and the last one published wins.
+#include "../trim.c"
+#include "test.h"
+
+#define SWAP_VERSIONS 2000u
+
+static volatile LONG g_publisherDone = 0;
+
+// Even versions match with a regex, odd ones with a literal, and every tenth drops the rules altogether.
+static RuleUpdate* build_update(unsigned version) {
+  RuleUpdate* update = (RuleUpdate*) calloc(1, sizeof(RuleUpdate));
+  if (!update || version % 10 == 0) {
+    return update;
+  }
+  char rulesText[256];
+  snprintf(rulesText, sizeof(rulesText), "debounce %u\nrule\n%s <<EOF\n%s\nEOF\nreplace <<EOF\nv%u\nEOF\n",
+           version % 500u, version % 2 == 0 ? "pattern" : "literal", version % 2 == 0 ? "\\bversion\\b" : "version",
+           version);
+  RuleLoadError error = {0};
+  update->hasRules = load_rule_set_from_utf8(rulesText, &update->rules, &error);
+  update->path = duplicate_wide_string(L"trim.rules");
+  CHECK(update->hasRules && update->path != NULL);
+  return update;
+}
+
+static DWORD WINAPI run_publisher(LPVOID parameter) {
+  (void) parameter;
+  for (unsigned version = 1; version <= SWAP_VERSIONS; ++version) {
+    publish_rule_update(build_update(version));
+  }
+  InterlockedExchange(&g_publisherDone, 1);
+  SetEvent(g_worker.wakeEvent);
+  return 0;
+}
+
+// Runs one job with the installed rules and returns the version it normalized with, 0 for no rules.
+static unsigned run_job(void) {
+  static const wchar_t kInput[] = L"version";
+  NormalizedBuffer result = normalize_clipboard_text(kInput, wcslen(kInput), NULL);
+  unsigned version = 0;
+  size_t digits = 1;
+  // Parsed by hand: the host build's 16-bit wchar_t does not suit the C library's wide functions.
+  while (result.text && digits < result.length && result.text[digits] >= L'0' && result.text[digits] <= L'9') {
+    version = version * 10u + (unsigned) (result.text[digits++] - L'0');
+  }
+  if (!g_ruleConfig.hasActiveFile) {
+    CHECK_TEXT(result.text, result.length, kInput);
+    CHECK(g_rulesDebounceMs == -1);
+  } else if (!result.text || result.text[0] != L'v' || digits != result.length || version == 0) {
+    print_wide_text("unexpected job output", result.text ? result.text : L"", result.text ? result.length : 0);
+    g_testFailures++;
+  } else {
+    // The debounce setting is published with the rules it came from.
+    CHECK(g_rulesDebounceMs == (LONG) (version % 500u));
+  }
+  free(result.text);
+  return version;
+}
+
+static void test_swap_under_load(void) {
+  // Start from no rules, so the first version a job sees comes from this publisher.
+  clear_active_rule_config();
+  publish_rule_settings();
+  g_worker.wakeEvent = CreateEventW(NULL, FALSE, FALSE, NULL);
+  HANDLE publisher = CreateThread(NULL, 0, run_publisher, NULL, 0, NULL);
+  CHECK(publisher != NULL);
+  if (!publisher) {
+    return;
+  }
+
+  unsigned lastVersion = 0;
+  size_t installs = 0;
+  size_t jobs = 0;
+  for (;;) {
+    bool publisherDone = InterlockedCompareExchange(&g_publisherDone, 0, 0) != 0;
+    if (install_pending_rule_update()) {
+      installs++;
+    } else if (publisherDone) {
+      break;
+    }
+    unsigned version = run_job();
+    jobs++;
+    if (version != 0) {
+      CHECK(version >= lastVersion);
+      lastVersion = version;
+    }
+    if (jobs % 64 == 0) {
+      WaitForSingleObject(g_worker.wakeEvent, 1);
+    }
+  }
+  WaitForSingleObject(publisher, INFINITE);
+  CloseHandle(publisher);
+
+  CHECK(installs >= 1 && installs <= SWAP_VERSIONS);
+  CHECK(g_worker.pendingRules == NULL);
+  // SWAP_VERSIONS is a multiple of ten, so the last update published dropped the rules.
+  CHECK(!g_ruleConfig.hasActiveFile);
+  CHECK(run_job() == 0);
+
+  // A final update after that is installed as is.
+  publish_rule_update(build_update(SWAP_VERSIONS + 1));
+  CHECK(install_pending_rule_update());
+  CHECK(run_job() == SWAP_VERSIONS + 1);
+  CHECK(!install_pending_rule_update());
+
+  CloseHandle(g_worker.wakeEvent);
+  g_worker.wakeEvent = NULL;
+}
+
+static void test_superseded_update_is_dropped(void) {
+  g_worker.wakeEvent = CreateEventW(NULL, FALSE, FALSE, NULL);
+  publish_rule_update(build_update(3));
+  publish_rule_update(build_update(5));
+  CHECK(install_pending_rule_update());
+  CHECK(run_job() == 5);
+  CHECK(!install_pending_rule_update());
+  // Publishing nothing leaves the installed rules alone.
+  publish_rule_update(NULL);
+  CHECK(!install_pending_rule_update());
+  CHECK(run_job() == 5);
+  CloseHandle(g_worker.wakeEvent);
+  g_worker.wakeEvent = NULL;
+}
+
+int main(void) {
+  g_logLevel = LOG_LEVEL_ERROR;
+  test_superseded_update_is_dropped();
+  test_swap_under_load();
+  return finish_tests("test_rule_swap");
+}
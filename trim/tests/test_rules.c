@@ -0,0 +1,127 @@
+// The default rules and the basic rule syntax, end to end through normalize_clipboard_text.
+#include "../trim.c"
+#include "test.h"
+
+static void test_default_rules(void) {
+  if (!use_rules(kDefaultRulesFileContents)) {
+    return;
+  }
+  CHECK_NORMALIZED(L"hello   \r\nworld\t\t\nend \x3000", L"hello\r\nworld\nend");
+  CHECK_NORMALIZED(L"\x203Aquoted  ", L"quoted");
+  CHECK_NORMALIZED(L"\x00BBquoted\n\x00BBsecond", L"quoted\n\x00BBsecond");
+  CHECK_NORMALIZED(L"inner  spaces stay", L"inner  spaces stay");
+  CHECK_NORMALIZED(L"", L"");
+}
+
+static void test_replacement_and_order(void) {
+  if (!use_rules("rule\n"
+                 "pattern <<EOF\n"
+                 "colou?r\n"
+                 "EOF\n"
+                 "replace <<EOF\n"
+                 "hue\n"
+                 "EOF\n"
+                 "\n"
+                 "rule\n"
+                 "pattern <<EOF\n"
+                 "hue\n"
+                 "EOF\n"
+                 "replace <<EOF\n"
+                 "HUE\n"
+                 "EOF\n")) {
+    return;
+  }
+  // Rules run in file order, each on the previous one's output.
+  CHECK_NORMALIZED(L"color and colour", L"HUE and HUE");
+  CHECK_NORMALIZED(L"nothing to do", L"nothing to do");
+}
+
+static void test_literal_rules(void) {
+  if (!use_rules("rule\n"
+                 "literal <<EOF\n"
+                 "a.b\n"
+                 "EOF\n"
+                 "replace <<EOF\n"
+                 "x\n"
+                 "EOF\n"
+                 "\n"
+                 "rule\n"
+                 "literal <<EOF\n"
+                 "a.bc\n"
+                 "EOF\n"
+                 "replace <<EOF\n"
+                 "y\n"
+                 "EOF\n")) {
+    return;
+  }
+  // Leftmost, then longest; `.` is not a metacharacter.
+  CHECK_NORMALIZED(L"a.bc a.b axb", L"y x axb");
+}
+
+static void test_guards_measure_copied_text(void) {
+  if (!use_rules("rule\n"
+                 "pattern <<EOF\n"
+                 "x+\n"
+                 "EOF\n"
+                 "replace <<EOF\n"
+                 "EOF\n"
+                 "\n"
+                 "rule\n"
+                 "min-length 6\n"
+                 "max-length 8\n"
+                 "requires-line-count 2\n"
+                 "pattern <<EOF\n"
+                 "a\n"
+                 "EOF\n"
+                 "replace <<EOF\n"
+                 "A\n"
+                 "EOF\n")) {
+    return;
+  }
+  // Length and line count are both those of the text as copied, however short the first rule made it.
+  CHECK_NORMALIZED(L"xxxxa\nb", L"A\nb");
+  CHECK_NORMALIZED(L"xa\nb", L"a\nb");
+  CHECK_NORMALIZED(L"xxxxxxa\nb", L"a\nb");
+  CHECK_NORMALIZED(L"xxxxxa", L"a");
+}
+
+static void test_compacting_rule_keeps_partial_replacements(void) {
+  if (!use_rules("match-limit 2000\n"
+                 "rule\n"
+                 "pattern <<EOF\n"
+                 "b|(?:c+c+)+d\n"
+                 "EOF\n"
+                 "replace <<EOF\n"
+                 "y\n"
+                 "EOF\n"
+                 "\n"
+                 "rule\n"
+                 "pattern <<EOF\n"
+                 "y\n"
+                 "EOF\n"
+                 "replace <<EOF\n"
+                 "Y\n"
+                 "EOF\n")) {
+    return;
+  }
+  // The first rule writes over the text as it scans, so the `b`s it replaced before the run of `c`s blew the match
+  // limit stay replaced. They count as substitutions and their `y`s reach the presence map, so the next rule runs.
+  static const wchar_t kInput[] = L"bbbbz cccccccccccccccccccccccccccc";
+  NormalizedBuffer result = normalize_clipboard_text(kInput, wcslen(kInput), NULL);
+  CHECK_TEXT(result.text, result.length, L"YYYYz cccccccccccccccccccccccccccc");
+  CHECK(result.replacementStats.substitutionsApplied == 8);
+  CHECK(result.replacementStats.patternsTouched == 2);
+  CHECK(result.replacementStats.rulesTouched == 2);
+  CHECK(result.replacementStats.patternsIncomplete == 1);
+  free(result.text);
+}
+
+int main(void) {
+  g_logLevel = LOG_LEVEL_ERROR;
+  test_default_rules();
+  test_replacement_and_order();
+  test_literal_rules();
+  test_guards_measure_copied_text();
+  test_compacting_rule_keeps_partial_replacements();
+  return finish_tests("test_rules");
+}
@@ -0,0 +1,95 @@
+// The rules watcher over the shim's inotify-backed ReadDirectoryChangesW: saving trim.rules hands the worker freshly
+// loaded rules, deleting it hands over "no rules", and other files in the directory are ignored.
+#define _DEFAULT_SOURCE // mkdtemp
+#include "../trim.c"
+#include "test.h"
+
+#include <stdlib.h>
+#include <unistd.h>
+
+static void write_file(const char* path, const char* text) {
+  FILE* file = fopen(path, "wb");
+  CHECK(file != NULL);
+  if (file) {
+    fputs(text, file);
+    fclose(file);
+  }
+}
+
+// Waits for the watcher to publish an update, the way the worker would before its next job.
+static RuleUpdate* take_rule_update(DWORD timeoutMs) {
+  if (WaitForSingleObject(g_worker.wakeEvent, timeoutMs) != WAIT_OBJECT_0) {
+    return NULL;
+  }
+  return (RuleUpdate*) InterlockedExchangePointer((PVOID volatile*) &g_worker.pendingRules, NULL);
+}
+
+static void test_watcher_follows_rules_file(void) {
+  start_rules_watcher();
+  CHECK(g_rulesWatcher.thread != NULL);
+  if (!g_rulesWatcher.thread) {
+    return;
+  }
+
+  // Saved the way editors do, so the watcher never catches the file half written.
+  write_file("trim.rules.new", "rule\npattern <<EOF\na\nEOF\nreplace <<EOF\nb\nEOF\n");
+  CHECK(rename("trim.rules.new", "trim.rules") == 0);
+  RuleUpdate* update = take_rule_update(5000);
+  CHECK(update != NULL);
+  if (update) {
+    CHECK(update->hasRules);
+    CHECK(update->rules.ruleCount == 1);
+    install_rule_update(update);
+  }
+
+  write_file("notes.txt", "not a rules file");
+  CHECK(take_rule_update(300) == NULL);
+
+  remove("trim.rules");
+  update = take_rule_update(5000);
+  CHECK(update != NULL);
+  if (update) {
+    CHECK(!update->hasRules);
+    install_rule_update(update);
+    CHECK(!g_ruleConfig.hasActiveFile);
+  }
+
+  stop_rules_watcher();
+  CHECK(g_rulesWatcher.thread == NULL);
+  CHECK(g_rulesWatcher.directoryCount == 0);
+  remove("notes.txt");
+}
+
+static void test_notification_names(void) {
+  // A record for trim.rules matches whatever its case; an empty completion means the buffer overflowed.
+  WatchedDirectory directory = {0};
+  FILE_NOTIFY_INFORMATION* info = (FILE_NOTIFY_INFORMATION*) directory.buffer;
+  static const wchar_t kUpperName[] = L"TRIM.RULES";
+  info->FileNameLength = (DWORD) (sizeof(kUpperName) - sizeof(wchar_t));
+  memcpy(info->FileName, kUpperName, info->FileNameLength);
+  DWORD recordBytes = (DWORD) (offsetof(FILE_NOTIFY_INFORMATION, FileName) + info->FileNameLength);
+  CHECK(notification_mentions_rules_file(&directory, recordBytes));
+  CHECK(notification_mentions_rules_file(&directory, 0));
+  info->FileName[0] = L'x';
+  CHECK(!notification_mentions_rules_file(&directory, recordBytes));
+}
+
+int main(void) {
+  g_logLevel = LOG_LEVEL_ERROR;
+  char directory[] = "/tmp/trim-watch-XXXXXX";
+  if (!mkdtemp(directory) || chdir(directory) != 0) {
+    CHECK(!"temporary directory unavailable");
+    return finish_tests("test_rules_watcher");
+  }
+  g_worker.wakeEvent = CreateEventW(NULL, FALSE, FALSE, NULL);
+  test_watcher_follows_rules_file();
+  test_notification_names();
+  CloseHandle(g_worker.wakeEvent);
+  g_worker.wakeEvent = NULL;
+
+  remove("trim.rules.cache");
+  if (chdir("/tmp") == 0) {
+    rmdir(directory);
+  }
+  return finish_tests("test_rules_watcher");
+}
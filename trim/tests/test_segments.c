@@ -0,0 +1,150 @@
+// `scope line` rules split a large text between lanes; whatever the lane count, the stitched output has to be exactly
+// what a single serial pass produces, including for patterns that break the promise and match across lines.
+#include "../trim.c"
+#include "test.h"
+
+static const char kSegmentRules[] = "rule\n"
+                                    "scope line\n"
+                                    "pattern <<EOF\n"
+                                    "(?<=\\d),(?=\\d{3}\\b)\n"
+                                    "EOF\n"
+                                    "replace <<EOF\n"
+                                    "_\n"
+                                    "EOF\n"
+                                    "\n"
+                                    "rule\n"
+                                    "scope line\n"
+                                    "pattern <<EOF\n"
+                                    "(?m)^[ \\t]+\n"
+                                    "EOF\n"
+                                    "pattern <<EOF\n"
+                                    "(?i)\\b(?:warn|error)\\b\n"
+                                    "EOF\n"
+                                    "replace <<EOF\n"
+                                    "EOF\n"
+                                    "\n"
+                                    "rule\n"
+                                    "scope line\n"
+                                    "engine dfa\n"
+                                    "pattern <<EOF\n"
+                                    "\\d+(?:\\.\\d+)?\n"
+                                    "EOF\n"
+                                    "replace <<EOF\n"
+                                    "#\n"
+                                    "EOF\n"
+                                    "\n"
+                                    "# Breaks the promise: blank lines are matched across line ends.\n"
+                                    "rule\n"
+                                    "scope line\n"
+                                    "pattern <<EOF\n"
+                                    "(?:\\r?\\n){3,}\n"
+                                    "EOF\n"
+                                    "replace <<EOF\n"
+                                    "\n"
+                                    "\n"
+                                    "EOF\n"
+                                    "\n"
+                                    "rule\n"
+                                    "scope line\n"
+                                    "pattern <<EOF\n"
+                                    TRIM_TRAILING_PATTERN "\n"
+                                    "EOF\n"
+                                    "replace <<EOF\n"
+                                    "EOF\n";
+
+static const wchar_t* const kWords[] = {L"alpha", L"Error", L"1,234", L"3.14", L"\x00E9t\x00E9", L"warn", L"x",
+                                        L"\xD83D\xDE00", L"12,5", L"tab\there", L"WARNING", L"\x3000", L"7"};
+
+static uint32_t g_seed = 42u;
+
+static uint32_t next_random(void) {
+  g_seed = g_seed * 1103515245u + 12345u;
+  return g_seed >> 8;
+}
+
+// With `blankRuns`, every line is followed by blank lines, so every cut between segments falls inside a match.
+static wchar_t* build_text(size_t targetLength, bool blankRuns, size_t* outLength) {
+  wchar_t* text = (wchar_t*) malloc((targetLength + 64) * sizeof(wchar_t));
+  if (!text) {
+    return NULL;
+  }
+  size_t length = 0;
+  while (length < targetLength) {
+    if (next_random() % 4 == 0) {
+      text[length++] = next_random() % 2 ? L' ' : L'\t';
+    }
+    size_t wordCount = next_random() % 8;
+    for (size_t i = 0; i < wordCount; ++i) {
+      const wchar_t* word = kWords[next_random() % (sizeof(kWords) / sizeof(kWords[0]))];
+      size_t wordLength = wcslen(word);
+      wmemcpy(text + length, word, wordLength);
+      length += wordLength;
+      text[length++] = L' ';
+    }
+    if (next_random() % 3 == 0) {
+      text[length++] = 0x2003;
+    }
+    // Mostly single line ends, with runs of blank lines for the rule that matches across them.
+    size_t lineEnds = blankRuns ? 3 + next_random() % 3 : next_random() % 6 == 0 ? 1 + next_random() % 5 : 1;
+    bool crlf = next_random() % 2 == 0;
+    for (size_t i = 0; i < lineEnds; ++i) {
+      if (crlf) {
+        text[length++] = L'\r';
+      }
+      text[length++] = L'\n';
+    }
+  }
+  text[length] = L'\0';
+  *outLength = length;
+  return text;
+}
+
+static NormalizedBuffer normalize_with_lanes(const wchar_t* text, size_t length, DWORD processors) {
+  NormalizedBuffer result = {0};
+  host_set_processor_count(processors);
+  // Lanes are sized when a rule set first splits a text, so each lane count gets freshly loaded rules.
+  if (use_rules(kSegmentRules)) {
+    result = normalize_clipboard_text(text, length, NULL);
+    CHECK(result.replacementStats.patternsIncomplete == 0);
+  }
+  host_set_processor_count(0);
+  return result;
+}
+
+static void check_lanes_match_serial(bool blankRuns) {
+  size_t length = 0;
+  wchar_t* text = build_text(6 * SEGMENT_MIN_UNITS + 12345, blankRuns, &length);
+  CHECK(text != NULL);
+  if (!text) {
+    return;
+  }
+
+  NormalizedBuffer serial = normalize_with_lanes(text, length, 1);
+  CHECK(serial.text != NULL && serial.length < length);
+  static const DWORD kLaneCounts[] = {2, 3, 4, 6, 16};
+  for (size_t i = 0; serial.text && i < sizeof(kLaneCounts) / sizeof(kLaneCounts[0]); ++i) {
+    NormalizedBuffer segmented = normalize_with_lanes(text, length, kLaneCounts[i]);
+    CHECK(g_ruleConfig.activeRules.laneCount == kLaneCounts[i]);
+    size_t firstDifference = 0;
+    size_t common = segmented.length < serial.length ? segmented.length : serial.length;
+    while (segmented.text && firstDifference < common &&
+           segmented.text[firstDifference] == serial.text[firstDifference]) {
+      firstDifference++;
+    }
+    if (!segmented.text || segmented.length != serial.length || firstDifference != common) {
+      fprintf(stderr, "%lu lanes differ from the serial pass at unit %zu (%zu vs %zu units)\n",
+              (unsigned long) kLaneCounts[i], firstDifference, segmented.length, serial.length);
+      g_testFailures++;
+    }
+    free(segmented.text);
+  }
+  free(serial.text);
+  free(text);
+}
+
+int main(void) {
+  g_logLevel = LOG_LEVEL_ERROR;
+  check_lanes_match_serial(false);
+  check_lanes_match_serial(true);
+  return finish_tests("test_segments");
+}
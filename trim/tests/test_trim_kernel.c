@@ -0,0 +1,141 @@
+// The trim-trailing kernel stands in for TRIM_TRAILING_PATTERN, so every scanner it can use has to produce exactly
+// what PCRE2 produces for that pattern with an empty replacement.
+#include "../trim.c"
+#include "test.h"
+
+// Units around every boundary the scanners test: each member of the class, its neighbours, line ends, the narrow
+// and wide ranges the SIMD prefilters split on, and a surrogate pair.
+static const wchar_t kAlphabet[] = {
+    L'a',   L'Z',   L' ',   L'\t',  L'\f',  0x000B, 0x000A, 0x000D, 0x0008, 0x000E, 0x001F, 0x0021, 0x009F, 0x00A0,
+    0x00A1, 0x167F, 0x1680, 0x1681, 0x180E, 0x1FFF, 0x2000, 0x2005, 0x200A, 0x200B, 0x2027, 0x2028, 0x2029, 0x202F,
+    0x205F, 0x2060, 0x3000, 0x3001, 0xFFFF,
+};
+
+static uint32_t g_seed = 12345u;
+
+static uint32_t next_random(void) {
+  g_seed = g_seed * 1103515245u + 12345u;
+  return g_seed >> 8;
+}
+
+static size_t fill_random_text(wchar_t* text, size_t length) {
+  size_t used = 0;
+  while (used < length) {
+    uint32_t pick = next_random() % (sizeof(kAlphabet) / sizeof(kAlphabet[0]) + 1);
+    if (pick == sizeof(kAlphabet) / sizeof(kAlphabet[0])) {
+      if (used + 2 > length) {
+        break;
+      }
+      text[used++] = 0xD83D;
+      text[used++] = 0xDE00;
+      continue;
+    }
+    // Runs of whitespace are what the kernel is about, so repeat a pick now and then.
+    size_t repeat = next_random() % 4 == 0 ? 1 + next_random() % 20 : 1;
+    for (size_t i = 0; i < repeat && used < length; ++i) {
+      text[used++] = kAlphabet[pick];
+    }
+  }
+  return used;
+}
+
+static size_t trim_with_regex(pcre2_code* regex, pcre2_match_data* matchData, const wchar_t* text, size_t length,
+                              wchar_t* output, int* outCount) {
+  PCRE2_SIZE outputLength = length + 1;
+  *outCount = pcre2_substitute(regex, (PCRE2_SPTR) text, length, 0, PCRE2_SUBSTITUTE_GLOBAL, matchData, NULL,
+                               (PCRE2_SPTR) L"", 0, (PCRE2_UCHAR*) output, &outputLength);
+  return outputLength;
+}
+
+static void check_scanner(const char* name, TrimWhitespaceScanner scanner, const wchar_t* text, size_t length,
+                          const wchar_t* expected, size_t expectedLength, int expectedCount) {
+  wchar_t work[1100];
+  wmemcpy(work, text, length);
+  size_t runCount = 0;
+  size_t trimmedLength = trim_trailing_whitespace_in_place(work, length, scanner, &runCount);
+  if (trimmedLength != expectedLength || wmemcmp(work, expected, expectedLength) != 0 ||
+      runCount != (size_t) expectedCount) {
+    fprintf(stderr, "%s scanner disagrees with the regex (%zu runs, regex %d)\n", name, runCount, expectedCount);
+    print_wide_text("input", text, length);
+    print_wide_text("expected", expected, expectedLength);
+    print_wide_text("actual", work, trimmedLength);
+    g_testFailures++;
+  }
+}
+
+static void test_scanners_match_regex(void) {
+  int compileError = 0;
+  PCRE2_SIZE errorOffset = 0;
+  pcre2_code* regex = pcre2_compile((PCRE2_SPTR) kTrimTrailingPattern, PCRE2_ZERO_TERMINATED, PCRE2_UTF | PCRE2_UCP,
+                                    &compileError, &errorOffset, NULL);
+  pcre2_match_data* matchData = regex ? pcre2_match_data_create_from_pattern(regex, NULL) : NULL;
+  CHECK(matchData != NULL);
+  if (!matchData) {
+    pcre2_code_free(regex);
+    return;
+  }
+
+  bool haveSse2 = false;
+  bool haveAvx2 = false;
+#ifdef TRIM_HAVE_X86_KERNELS
+  __builtin_cpu_init();
+  haveSse2 = __builtin_cpu_supports("sse2");
+  haveAvx2 = __builtin_cpu_supports("avx2");
+#endif
+  if (!haveSse2 || !haveAvx2) {
+    fprintf(stderr, "test_trim_kernel: checking without%s%s\n", haveSse2 ? "" : " SSE2", haveAvx2 ? "" : " AVX2");
+  }
+
+  wchar_t text[1100];
+  wchar_t expected[1100];
+  for (int round = 0; round < 4000; ++round) {
+    // Mostly short texts, whose tails land on every offset within a vector, and some long enough for many vectors.
+    size_t length = fill_random_text(text, round % 8 == 0 ? 1024 : (size_t) (next_random() % 70));
+    int expectedCount = 0;
+    size_t expectedLength = trim_with_regex(regex, matchData, text, length, expected, &expectedCount);
+    CHECK(expectedCount >= 0);
+    check_scanner("scalar", find_trim_whitespace_scalar, text, length, expected, expectedLength, expectedCount);
+#ifdef TRIM_HAVE_X86_KERNELS
+    if (haveSse2) {
+      check_scanner("SSE2", find_trim_whitespace_sse2, text, length, expected, expectedLength, expectedCount);
+    }
+    if (haveAvx2) {
+      check_scanner("AVX2", find_trim_whitespace_avx2, text, length, expected, expectedLength, expectedCount);
+    }
+#endif
+  }
+  pcre2_match_data_free(matchData);
+  pcre2_code_free(regex);
+}
+
+static void test_rule_uses_kernel(void) {
+  if (!use_rules(kDefaultRulesFileContents)) {
+    return;
+  }
+  const RuleSet* rules = &g_ruleConfig.activeRules;
+  const RegexRule* rule = &rules->rules[rules->ruleCount - 1];
+  CHECK(rule->patterns[0].kernel == PATTERN_KERNEL_TRIM_TRAILING);
+  CHECK_NORMALIZED(L"a \x2000\t\r\nb\x3000\n c \x00A0", L"a\r\nb\n c");
+}
+
+// Under `surrogates reject` the kernel is skipped like the regex it stands in for, and the pass says so.
+static void test_kernel_respects_rejected_text(void) {
+  if (!use_rules("surrogates reject\nrule\npattern <<EOF\n" TRIM_TRAILING_PATTERN "\nEOF\nreplace <<EOF\nEOF\n")) {
+    return;
+  }
+  CHECK(g_ruleConfig.activeRules.rules[0].patterns[0].kernel == PATTERN_KERNEL_TRIM_TRAILING);
+  static const wchar_t kUnpaired[] = {L'x', 0xD800, L' ', L'\n', L'y', L' ', L'\0'};
+  NormalizedBuffer result = normalize_clipboard_text(kUnpaired, 6, NULL);
+  CHECK_TEXT(result.text, result.length, kUnpaired);
+  CHECK(result.replacementStats.patternsIncomplete == 1);
+  free(result.text);
+  CHECK_NORMALIZED(L"x \ny ", L"x\ny");
+}
+
+int main(void) {
+  g_logLevel = LOG_LEVEL_ERROR;
+  test_scanners_match_regex();
+  test_rule_uses_kernel();
+  test_kernel_respects_rejected_text();
+  return finish_tests("test_trim_kernel");
+}
@@ -9,6 +9,7 @@
 
 #include <windows.h>
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -19,13 +20,54 @@
 
 #include <mmsystem.h>
 
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define TRIM_HAVE_X86_KERNELS 1
+#endif
+
+#include "log_ring.h"
 #include "trim.h"
 
 #define WM_APP_EXIT (WM_APP + 1)
+#define WM_APP_NORMALIZED (WM_APP + 2)
+#define WM_APP_DUMP_STATS (WM_APP + 3)
+#define STATS_HOTKEY_ID 1
+#define STATS_DEFAULT_INTERVAL_S 60u
+#define STATS_MAX_INTERVAL_S 86400u
+#define COALESCE_TIMER_ID 1
+#define DEFAULT_DEBOUNCE_MS 30u
+#define MAX_DEBOUNCE_MS 10000u
+#define RENDER_WAIT_MS 1000u // longest a paste waits for normalized text before it gets the text as copied
 #define SINGLE_INSTANCE_MUTEX_NAME L"Local\\ClipTrimSingleton"
+#define JIT_STACK_START_SIZE (32u * 1024u)
+#define JIT_STACK_MAX_SIZE (1024u * 1024u)
+#define SCRATCH_RETAIN_LIMIT (1024u * 1024u)
+#define RULE_CACHE_FORMAT_VERSION 2u
+#define RULE_ARENA_FIRST_BLOCK_BYTES (16u * 1024u)
+#define MAX_TIME_LIMIT_MS 60000u
+#define BUDGET_CALLOUT_CHECK_INTERVAL 1024u
+#define DFA_WORKSPACE_START_SLOTS 1024u
+#define DFA_WORKSPACE_MAX_SLOTS (1024u * 1024u)
+#define COMPACT_MAX_GUARD_UNITS 64u // most code units before a match start a compacting pattern may read back
+#define SEGMENT_MIN_UNITS (1024u * 1024u)
+#define SEGMENT_MAX_LANES 64u
+#define FILTER_READ_SIZE (64u * 1024u)
+#define FILTER_DEFAULT_SEGMENT_KIB 0u // segmenting changes what whole-input patterns see, so it is opt-in
+#define FILTER_MAX_SEGMENT_KIB (1024u * 1024u)
+#define BENCH_DEFAULT_ITERATIONS 3u
+#define BENCH_MAX_ITERATIONS 1000u
+#define BENCH_MAX_MEGABYTES 1000u
+#define FINGERPRINT_STRIPE_BYTES 64u
+#define FINGERPRINT_BLOCK_STRIPES 16u
+#define LOG_SHUTDOWN_DRAIN_MS 200u
+#define TRIM_TRAILING_PATTERN                                                                                          \
+  "[ \\t\\f\\x0B\\x{00A0}\\x{1680}\\x{180E}\\x{2000}-\\x{200A}\\x{2028}\\x{2029}\\x{202F}\\x{205F}\\x{3000}]+(?=\\r\\n?|\\n|\\z)"
 
 static const wchar_t kWindowClassName[] = L"ClipboardTrimWatcher";
 static const wchar_t kRulesFileName[] = L"trim.rules";
+static const wchar_t kRuleCacheSuffix[] = L".cache";
+static const wchar_t kRuleCacheFallbackDirectory[] = L"ClipTrim"; // under %LOCALAPPDATA%
+static const wchar_t kTrimTrailingPattern[] = L"" TRIM_TRAILING_PATTERN;
 static const char kDefaultRulesFileContents[] =
     "# Copy this file to `trim.rules` in the launch directory to override the\n"
     "# executable-side default. If neither location has a config, ClipTrim generates\n"
@@ -37,6 +79,30 @@ static const char kDefaultRulesFileContents[] =
     "# - A block ends when a line exactly matches `TOKEN`.\n"
     "# - Block bodies do not include the terminator line break.\n"
     "# - Add a blank line before `TOKEN` if you need the replacement to end with a newline.\n"
+    "# - `builtin trim-trailing` inside a rule adds the trailing-whitespace pattern below, run by a native kernel.\n"
+    "# - `debounce <ms>` sets how long clipboard notification bursts are collapsed (default 30, 0 disables).\n"
+    "# - `surrogates repair` turns unpaired UTF-16 surrogates in copied text into U+FFFD before any rule runs;\n"
+    "#   with `surrogates reject`, the default, such text only goes through literal rules.\n"
+    "# - `match-limit <n>`, `depth-limit <n>`, `heap-limit <KiB>` and `time-limit <ms>` bound each pattern;\n"
+    "#   before the first rule they apply to every rule, inside a rule they override for that rule only.\n"
+    "#   A rule that exceeds a budget is skipped for that clipboard update, though a pattern whose replacement is\n"
+    "#   never longer than its match keeps the replacements it made before the budget ran out.\n"
+    "# - `engine dfa` before a `pattern` block or `builtin` runs that pattern with PCRE2's DFA matcher: it never\n"
+    "#   backtracks and takes the longest match at each position. Back references, \\K, (*VERB)s and conditions\n"
+    "#   on capture groups are rejected at load time.\n"
+    "# - `scope line` inside a rule promises that none of its matches spans a line break, so huge clipboards may be\n"
+    "#   split between lines and the rule run on each part in parallel (`--threads <n>` caps the threads). \\G is\n"
+    "#   rejected; a match that does cross a line reruns the rule on the whole text. `scope buffer` is the default.\n"
+    "# - `literal <<TOKEN` blocks match their body verbatim and cannot share a rule with `pattern` blocks.\n"
+    "#   Consecutive literal rules form one dictionary applied in a single left-to-right pass: the leftmost match\n"
+    "#   wins, then the longest, then the earlier rule, and replaced text is not searched again by the same\n"
+    "#   dictionary. Budgets and `scope line` do not apply to literal rules.\n"
+    "# - Guards inside a rule skip it for text that fails them: `min-length <n>` and `max-length <n>` bound its\n"
+    "#   length in code units and `requires-line-count <n>` asks for at least n lines, both counted on the text\n"
+    "#   as copied, before any rule ran; `if-contains <text>` (the rest of the line verbatim) asks for that text\n"
+    "#   when the rule comes up. With --filter they measure the whole input, or each segment with --segment-kib.\n"
+    "#   A held-back rule never reaches PCRE2. Consecutive literal rules share a dictionary only while their\n"
+    "#   guards are the same.\n"
     "# Rules run in file order. Patterns inside one rule share the same replacement.\n"
     "\n"
     "# Default rule: strip a leading quote marker from the full clipboard string.\n"
@@ -52,8 +118,8 @@ static const char kDefaultRulesFileContents[] =
     "\n"
     "# Default rule: trim the same trailing whitespace set the pre-regex trimmer used.\n"
     "rule\n"
-    "pattern <<EOF\n"
-    "[ \\t\\f\\x0B\\x{00A0}\\x{1680}\\x{180E}\\x{2000}-\\x{200A}\\x{2028}\\x{2029}\\x{202F}\\x{205F}\\x{3000}]+(?=\\r\\n?|\\n|\\z)\n"
+    "scope line\n"
+    "pattern <<EOF\n" TRIM_TRAILING_PATTERN "\n"
     "EOF\n"
     "replace <<EOF\n"
     "EOF\n";
@@ -64,26 +130,223 @@ static wchar_t* g_executableDirectory = NULL;
 typedef struct {
   wchar_t* text;
   size_t length; // number of wchar_t excluding null terminator
+  HGLOBAL handle; // set when `text` is the locked contents of a movable block rather than a heap allocation
 } ClipboardBuffer;
 
+// One code unit a match cannot exist without; `units` lists it together with its ASCII case partners.
+typedef struct {
+  uint16_t units[4];
+  size_t unitCount;
+} RequiredCodeUnit;
+
+typedef struct {
+  uint64_t units[65536 / 64];
+  uint8_t startUnits[32]; // PCRE2 start-bitmap layout: bit 0xFF stands for 0xFF and every wider code unit
+} PresenceMap;
+
+typedef enum {
+  PATTERN_KERNEL_NONE = 0,
+  PATTERN_KERNEL_TRIM_TRAILING, // TRIM_TRAILING_PATTERN with an empty replacement
+} PatternKernel;
+
+typedef enum {
+  SURROGATE_POLICY_REJECT = 0, // text with unpaired surrogates skips every pattern PCRE2 would run
+  SURROGATE_POLICY_REPAIR,     // unpaired surrogates become U+FFFD, which keeps the text length
+} SurrogatePolicy;
+
+typedef enum {
+  PATTERN_ENGINE_BACKTRACK = 0, // pcre2_match, JIT-compiled when available
+  PATTERN_ENGINE_DFA,           // pcre2_dfa_match: leftmost-longest, never backtracks
+  PATTERN_ENGINE_LITERAL,       // a `literal` block, matched verbatim by its run's LiteralAutomaton
+} PatternEngine;
+
+// Cumulative since the rule set was loaded; only the thread that normalizes with the rule set touches it.
+typedef struct {
+  uint64_t runs;
+  uint64_t prefilterSkips;
+  uint64_t ticks; // QueryPerformanceCounter units
+  uint64_t bytesScanned;
+  uint64_t matchCalls;
+  uint64_t substitutions;
+  int64_t outputGrowth; // code units added; negative when the pattern shrinks the text
+  uint64_t allocations;
+} PatternProfile;
+
 typedef struct {
   pcre2_code* code;
-  wchar_t* source;
+  wchar_t* source; // in the rule set's arena
   size_t sourceLength;
   size_t lineNumber;
+  bool jitCompiled;
+  bool compilePending; // checked at load, but compiled only once a text reaches it or the worker is idle
+  bool disabled;       // its compile failed after the rules were loaded, so it never runs
+  pcre2_match_data* matchData;
+  RequiredCodeUnit requiredUnits[2];
+  size_t requiredUnitCount;
+  const uint8_t* firstBitmap; // owned by `code`
+  PatternKernel kernel;
+  PatternEngine engine;
+  uint32_t compactGuardUnits; // nonzero when the pattern can compact the text in place; see pattern_compact_guard
+  PatternProfile profile;
 } RegexPattern;
 
+// Zero fields are unset: a rule inherits the rule set's value, and the rule set falls back to PCRE2's defaults.
+typedef struct {
+  uint32_t matchLimit;
+  uint32_t depthLimit;
+  uint32_t heapLimitKib; // the JIT ignores depth and heap limits; its stack is bounded by JIT_STACK_MAX_SIZE
+  uint32_t timeLimitMs;  // 0 means no deadline
+} MatchBudget;
+
+typedef struct {
+  const wchar_t* text; // a literal pattern's source
+  uint32_t length;
+  uint32_t ruleIndex;
+} LiteralEntry;
+
+typedef struct {
+  uint32_t firstEdge;
+  uint32_t edgeCount;
+  uint32_t failure;
+  uint32_t matchEntry; // 1 + index of the longest entry ending here, own or through failure links; 0 for none
+  uint32_t depth;
+} LiteralState;
+
+// Aho-Corasick automaton over the literal patterns of a run of consecutive literal rules. States are numbered
+// breadth-first with state 0 as the root, so each state's edges sit side by side in the edge arrays, sorted by code
+// unit, and the root has a dense row of its own since nearly every scan step starts there.
+typedef struct {
+  LiteralState* states;
+  size_t stateCount;
+  uint16_t* edgeUnits;
+  uint32_t* edgeTargets;
+  uint32_t* rootTargets; // 65536 entries; 0 where the root has no edge
+  LiteralEntry* entries; // sorted by text, then by rule
+  size_t entryCount;
+  size_t firstRule;
+  size_t ruleCount;
+  uint32_t* ruleStamps; // pass in which each rule of the run last substituted, to count distinct rules cheaply
+  uint32_t* entryStamps;
+  uint32_t pass;
+} LiteralAutomaton;
+
+// Preconditions checked before any pattern of the rule runs; zero fields are unset. Length and line count are both
+// those of the text as copied, so a guard does not depend on what earlier rules did.
 typedef struct {
-  RegexPattern* patterns;
+  size_t minLength; // code units
+  size_t maxLength;
+  size_t minLineCount;
+  wchar_t* requiredText; // `if-contains`; in the rule set's arena
+  size_t requiredTextLength;
+} RuleGuard;
+
+typedef struct {
+  RegexPattern* patterns; // in the rule set's arena once the rule is stored
   size_t patternCount;
-  wchar_t* replacement;
+  wchar_t* replacement; // in the rule set's arena
   size_t replacementLength;
   size_t replaceLineNumber;
+  size_t lineNumber;
+  MatchBudget budget;
+  RuleGuard guard; // on the first rule of a literal run, covers the whole run
+  bool lineScoped; // `scope line`: no match depends on another line, so the text may be split between lines
+  // Its output may hold unpaired surrogates even for valid input: \C can split a pair, and the replacement or a literal
+  // can carry a lone half itself. On the first rule of a literal run, covers the whole run.
+  bool mayBreakUtf;
+  LiteralAutomaton* literals; // set on the first rule of a run of literal rules; the rest of the run leave it NULL
 } RegexRule;
 
+// Wall-clock state for one substitution pass; PCRE2 calls back into it through auto-callouts.
+typedef struct {
+  ULONGLONG deadlineTick; // 0 when the pattern has no time limit
+  uint32_t timeLimitMs;
+  uint32_t calloutsUntilCheck;
+  bool exceeded; // a budget stopped the pattern, as opposed to a malformed match
+} MatchBudgetState;
+
+// Scratch state for pcre2_dfa_match, shared by every `engine dfa` pattern of a rule set.
+typedef struct {
+  int* slots;
+  size_t slotCount;
+} DfaWorkspace;
+
+// What one thread needs to run any pattern of a rule set. The normalizing thread passes NULL match data to use each
+// pattern's own; segment lanes bring theirs.
+typedef struct {
+  pcre2_match_data* matchData;
+  pcre2_match_context* matchContext;
+  DfaWorkspace* dfaWorkspace;
+  uint32_t subjectOptions; // PCRE2_NO_UTF_CHECK once the subject is known to be valid UTF-16
+} MatchScratch;
+
+// One thread-pool worker's share of a `scope line` pattern: private match state plus the segment it owns in the
+// current pass and what it produced there.
+typedef struct {
+  pcre2_match_data* matchData; // sized for the largest ovector among `scope line` patterns
+  pcre2_match_context* matchContext;
+  pcre2_jit_stack* jitStack;
+  DfaWorkspace dfaWorkspace;
+  wchar_t* output;
+  size_t outputCapacity;
+  size_t segmentStart;
+  size_t segmentEnd;
+  size_t outputLength;
+  size_t substitutions;
+  size_t matchCalls;
+  bool overrun; // a match ran past segmentEnd, so the split did not hold for this text
+  bool failed;
+  MatchBudgetState budget;
+  char errorMessage[256];
+} SegmentLane;
+
+// Storage for everything the parser produces: pattern sources, replacements, pattern arrays and the rule array.
+// Blocks are never moved, so pointers into them stay valid until the rule set is freed, and each new block is at
+// least twice the size of the previous one so a large rules file costs a logarithmic number of allocations.
+typedef struct RuleArenaBlock {
+  struct RuleArenaBlock* next;
+  size_t capacity;
+  size_t used;
+  max_align_t data[];
+} RuleArenaBlock;
+
+typedef struct {
+  RuleArenaBlock* head; // the block being filled; older blocks follow through `next`
+  size_t totalBytes;
+} RuleArena;
+
 typedef struct {
-  RegexRule* rules;
+  RegexRule* rules; // in `arena`
   size_t ruleCount;
+  size_t patternCount; // compiled by PCRE2; literal patterns are counted apart
+  size_t jitPatternCount;
+  size_t compilePendingCount;
+  size_t compileFailureCount;
+  size_t prewarmRule; // where the idle pre-warm looks for the next pending pattern
+  size_t dfaPatternCount;
+  size_t literalPatternCount;
+  size_t literalRunCount;
+  DfaWorkspace dfaWorkspace;
+  size_t lineScopedRuleCount;
+  uint32_t lineScopedOvectorPairs;
+  SegmentLane* lanes; // created on the first text large enough to split
+  size_t laneCount;
+  pcre2_jit_stack* jitStack;
+  pcre2_match_context* matchContext;
+  PresenceMap* presence; // only allocated when the rule set has patterns
+  wchar_t* scratchText; // ping-pong partner of NormalizedBuffer::text across patterns
+  size_t scratchCapacity;
+  bool hasDebounceSetting;
+  DWORD debounceMs;
+  SurrogatePolicy surrogatePolicy;
+  MatchBudget budget;
+  RuleArena arena;
+  // What compiling the pending patterns still needs; released once the last of them has compiled.
+  pcre2_compile_context* compileContext;
+  pcre2_general_context* matchMemory;
+  pcre2_code* casedProbe;
+  pcre2_match_data* probeData;
+  wchar_t* cachePath; // where to store the compiled patterns once all have compiled; NULL when the cache was current
+  uint64_t contentHash;
 } RuleSet;
 
 typedef struct {
@@ -91,19 +354,164 @@ typedef struct {
   char message[256];
 } RuleLoadError;
 
+// Sidecar cache header; the cache is machine-local, so fields are stored in native byte order.
+typedef struct {
+  char magic[4];
+  uint32_t formatVersion;
+  uint32_t pcre2Version;
+  uint32_t pointerSize;
+  uint64_t contentHash;
+  uint64_t patternCount;
+  uint64_t serializedLength;
+  uint64_t serializedHash; // of the pcre2_serialize_encode bytes, which PCRE2 decodes without validating
+} RuleCacheHeader;
+
 typedef struct {
   size_t substitutionsApplied;
   size_t patternsTouched;
   size_t rulesTouched;
+  size_t patternsEvaluated;
+  size_t patternsSkipped;
+  size_t rulesGuarded; // rules, or literal runs, whose guard held them back before any pattern ran
+  // Patterns that should have run but did not finish: rejected surrogates, a late compile error, a time limit or a
+  // match error. The rules may still change a text whose pass left any.
+  size_t patternsIncomplete;
 } ReplacementStats;
 
 typedef struct {
   wchar_t* text;
   size_t length;
-  size_t lineCount;
+  size_t capacity; // number of wchar_t available excluding null terminator
+  size_t lineCount;     // of the text as copied, like copiedLength; context excluded from both
+  size_t copiedLength;
+  size_t contextLength; // leading units that only serve as lookbehind context; no match starts inside them
   ReplacementStats replacementStats;
+  bool cancelled;
+  // The locked clipboard block the text started in. `text` stays inside it until a pass has to move the text into a
+  // heap buffer; the block itself is kept so the result can go back into it.
+  HGLOBAL clipboardBlock;
+  wchar_t* clipboardText;
+  size_t clipboardCapacity;
+  size_t peakBytes; // largest footprint of the text buffers during the pass
 } NormalizedBuffer;
 
+// Lets a normalization pass notice that the clipboard moved on and its result would be discarded anyway.
+typedef struct {
+  const volatile LONG* latestSequence;
+  LONG sequence;
+} NormalizationCancel;
+
+typedef struct {
+  DWORD sequence;
+  // Of the normalized text, computed on the worker so the window thread only publishes it; 0 when the pass left
+  // patterns unfinished.
+  uint64_t fingerprint;
+  LONG ruleGeneration;  // g_ruleGeneration the text was normalized under
+  HGLOBAL clipboardData; // the normalized text, ready for SetClipboardData; freed by whoever fails to hand it over
+  ReplacementStats replacementStats;
+  size_t peakBytes;
+} NormalizationResult;
+
+// Collapses bursts of WM_CLIPBOARDUPDATE into one update once the clipboard has been quiet for `quietWindowMs`.
+// Pure state machine: callers pass the current tick, which keeps it deterministic.
+typedef struct {
+  bool armed;
+  DWORD lastEventTick;
+  DWORD lastSequence;
+  size_t burstEvents;
+  size_t coalescedTotal;
+} UpdateCoalescer;
+
+// A rules change resolved off the normalization worker, waiting for the worker to install it between jobs.
+typedef struct {
+  bool hasRules; // false when the config is gone and the active rules are to be dropped
+  wchar_t* path;
+  FILETIME writeTime;
+  RuleSet rules;
+} RuleUpdate;
+
+typedef struct {
+  HWND hwnd;
+  HANDLE thread;
+  HANDLE wakeEvent;
+  SRWLOCK lock;
+  ClipboardBuffer pendingText; // guarded by lock
+  DWORD pendingSequence;       // guarded by lock
+  bool hasPendingJob;          // guarded by lock
+  bool stopRequested;          // guarded by lock
+  volatile LONG latestSequence;
+  RuleUpdate* volatile pendingRules; // published by the rules watcher; the worker installs it before its next job
+  volatile LONG statsRequested; // set by the window thread; the worker owns the profiles it reports
+  ClipboardBuffer renderText;   // guarded by lock; --on-paste text a paste is waiting on
+  bool hasRenderJob;            // guarded by lock
+  HGLOBAL renderedData;         // guarded by lock; written by the worker as it signals renderDoneEvent
+  bool renderAbandoned;         // guarded by lock; the paste stopped waiting, so the worker frees what it renders
+  HANDLE renderDoneEvent;
+} NormalizationWorker;
+
+// Clipboard text taken over with delayed rendering (--on-paste) and not normalized yet. Window thread only.
+typedef struct {
+  ClipboardBuffer original;
+  bool pending;
+  size_t rendered;
+  size_t avoided; // texts replaced on the clipboard before anyone pasted them, so never normalized
+} DeferredRender;
+
+typedef struct {
+  HANDLE handle;
+  HANDLE event;
+  OVERLAPPED overlapped;
+  DWORD buffer[4096]; // FILE_NOTIFY_INFORMATION records must be DWORD-aligned
+} WatchedDirectory;
+
+// Watches the launch and executable directories so trim.rules is only re-read after it actually changes, and compiles
+// the new rules on its own thread before handing them to the normalization worker.
+typedef struct {
+  WatchedDirectory directories[2];
+  size_t directoryCount;
+  HANDLE thread;
+  HANDLE stopEvent;
+} RulesWatcher;
+
+typedef enum { STREAM_ENCODING_UTF8, STREAM_ENCODING_UTF16LE } StreamEncoding;
+
+typedef struct {
+  bool enabled;
+  const wchar_t* inputPath; // NULL reads stdin
+  const wchar_t* rulesPath; // NULL resolves trim.rules the same way the clipboard listener does
+  size_t segmentBytes;      // 0 normalizes the whole input as one subject
+  bool lossy;               // replace malformed input with U+FFFD instead of failing
+} FilterOptions;
+
+typedef struct {
+  HANDLE input;
+  HANDLE output;
+  StreamEncoding encoding;
+  char* bytes; // raw input not yet normalized: at most one segment plus the read in progress
+  size_t byteCount;
+  size_t byteCapacity;
+  bool endOfInput;
+  wchar_t* wide;
+  size_t wideCapacity;
+  char* encoded;
+  size_t encodedCapacity;
+  uint64_t bytesRead;
+  uint64_t bytesWritten;
+  size_t segmentCount;
+  size_t lineCount;
+  ReplacementStats stats;
+} FilterStream;
+
+typedef struct {
+  bool enabled;
+  wchar_t** corpusPaths; // extra UTF-8 corpora, benchmarked after the generated ones
+  size_t corpusPathCount;
+  size_t megabytes; // 0 keeps each generated corpus at its default size
+  uint64_t iterations;
+} BenchOptions;
+
+// The active fields belong to the thread that normalizes: the normalization worker once it is running. The resolved
+// fields belong to the thread that resolves and loads trim.rules, which is the rules watcher while it runs.
 typedef struct {
   wchar_t* activePath;
   FILETIME activeWriteTime;
@@ -114,29 +522,210 @@ typedef struct {
   FILETIME lastResolvedWriteTime;
   bool lastResolvedExists;
   bool lastLoadFailed;
+  bool lastResolvedHasRules; // the last update handed out rules rather than dropping them
 } RuleConfigState;
 
 static RuleConfigState g_ruleConfig = {0};
+static NormalizationWorker g_worker = {0};
+static UpdateCoalescer g_coalescer = {0};
+static DeferredRender g_deferredRender = {0};
+static bool g_renderOnPaste = false; // --on-paste: normalize when an application asks for the text, not on copy
+static bool g_prewarmPatterns = true; // --no-prewarm clears it: the idle worker compiles patterns ahead of use
+static LARGE_INTEGER g_launchCounter = {0};
+static bool g_firstNormalizationLogged = false; // worker only
+static RulesWatcher g_rulesWatcher = {0};
+static volatile LONG g_rulesDebounceMs = -1; // published by whoever loads rules; -1 when the rules do not set it
+static LONG g_commandLineDebounceMs = -1;
+static DWORD g_lastWrittenSequence = 0;               // clipboard sequence number our own last write produced
+static volatile LONG64 g_normalizedFingerprint = 0; // fingerprint of the last text known to be normalized; 0 if none
+static volatile LONG g_ruleGeneration = 0;          // bumped whenever the active rules are dropped
+static FilterOptions g_filterOptions = {false, NULL, NULL, FILTER_DEFAULT_SEGMENT_KIB * 1024u, false};
+static BenchOptions g_benchOptions = {false, NULL, 0, 0, BENCH_DEFAULT_ITERATIONS};
+static volatile LONG g_engineAllocations = 0; // heap calls made by normalization and PCRE2 matching, for --bench
+static const wchar_t* g_statsFilePath = NULL; // --stats-file: JSON lines of rule profiles
+static bool g_dumpStatsRequested = false;      // --dump-stats: ask the running instance to log its profiles
+static DWORD g_statsIntervalMs = STATS_DEFAULT_INTERVAL_S * 1000u;
+static size_t g_segmentLaneLimit = 0; // --threads: caps segment lanes for `scope line` rules; 0 uses every processor
+static SRWLOCK g_logLock = SRWLOCK_INIT;
+static FILE* g_logStream = NULL; // stdout unless --filter needs stdout for its output
 
 _Static_assert(sizeof(wchar_t) == 2, "ClipTrim requires 16-bit wchar_t");
 
-static void log_time_prefix(void) {
-  SYSTEMTIME st;
-  GetLocalTime(&st);
-  printf("[%02u:%02u:%02u.%03u] ", (unsigned) st.wHour, (unsigned) st.wMinute, (unsigned) st.wSecond,
-         (unsigned) st.wMilliseconds);
+typedef enum { LOG_LEVEL_DEBUG, LOG_LEVEL_INFO, LOG_LEVEL_ERROR } LogLevel;
+
+// The Win32 side of the log queue in log_ring.h: a flusher thread that sleeps on an event between batches.
+typedef struct {
+  LogRing ring;
+  volatile LONG running;
+  volatile LONG stopRequested;
+  HANDLE wakeEvent;
+  HANDLE thread;
+  LogTimeCache timeCache; // touched only by the writer holding g_logLock
+} LogFlusher;
+
+static LogFlusher g_logFlusher;
+static LogLevel g_logLevel = LOG_LEVEL_INFO; // --log-level
+
+static uint64_t log_current_time(void) {
+  FILETIME now;
+  GetSystemTimeAsFileTime(&now);
+  return ((uint64_t) now.dwHighDateTime << 32) | now.dwLowDateTime;
+}
+
+static void log_local_time(uint64_t ticks, unsigned* hour, unsigned* minute, unsigned* second) {
+  FILETIME time = {(DWORD) (ticks & 0xFFFFFFFFu), (DWORD) (ticks >> 32)};
+  FILETIME localTime;
+  SYSTEMTIME st = {0};
+  if (FileTimeToLocalFileTime(&time, &localTime)) {
+    FileTimeToSystemTime(&localTime, &st);
+  }
+  *hour = st.wHour;
+  *minute = st.wMinute;
+  *second = st.wSecond;
+}
+
+// Writes one line as "[hh:mm:ss.mmm] text"; callers hold g_logLock.
+static void log_write_line(void* context, uint64_t time, const char* text, size_t length) {
+  FILE* stream = (FILE*) context;
+  char prefix[LOG_PREFIX_BYTES];
+  size_t prefixLength = log_format_prefix(&g_logFlusher.timeCache, time, log_local_time, prefix);
+  fwrite(prefix, 1, prefixLength, stream);
+  fwrite(text, 1, length, stream);
+  fputc('\n', stream);
+}
+
+// Writes every queued message in order; returns how many lines it wrote. Only the flusher thread calls this while the
+// ring is running. Callers hold g_logLock.
+static size_t log_flush_ring(FILE* stream) {
+  unsigned dropped = 0;
+  size_t written = log_ring_drain(&g_logFlusher.ring, log_write_line, stream, &dropped);
+  if (dropped > 0) {
+    char text[64];
+    int length = snprintf(text, sizeof(text), "Dropped %u log message%s while the log was full", dropped,
+                          dropped == 1 ? "" : "s");
+    log_write_line(stream, log_current_time(), text, (size_t) length);
+    written++;
+  }
+  return written;
+}
+
+static DWORD WINAPI log_flusher_main(LPVOID parameter) {
+  (void) parameter;
+  for (;;) {
+    AcquireSRWLockExclusive(&g_logLock);
+    FILE* stream = g_logStream ? g_logStream : stdout;
+    if (log_flush_ring(stream) > 0) {
+      fflush(stream);
+    }
+    ReleaseSRWLockExclusive(&g_logLock);
+
+    if (g_logFlusher.stopRequested) {
+      return 0;
+    }
+    if (log_ring_prepare_sleep(&g_logFlusher.ring)) {
+      WaitForSingleObject(g_logFlusher.wakeEvent, INFINITE);
+    }
+  }
+}
+
+static void log_message(LogLevel level, const char* fmt, va_list args) {
+  if (level < g_logLevel) {
+    return;
+  }
+  if (g_logFlusher.running) {
+    bool wake = false;
+    log_ring_push(&g_logFlusher.ring, log_current_time(), fmt, args, &wake);
+    if (wake) {
+      SetEvent(g_logFlusher.wakeEvent);
+    }
+    return;
+  }
+
+  // Before the flusher starts and after it stops, lines are written synchronously.
+  char text[LOG_MESSAGE_BYTES];
+  size_t length = log_format_message(text, fmt, args);
+  uint64_t now = log_current_time();
+  AcquireSRWLockExclusive(&g_logLock);
+  FILE* stream = g_logStream ? g_logStream : stdout;
+  log_write_line(stream, now, text, length);
+  fflush(stream);
+  ReleaseSRWLockExclusive(&g_logLock);
+}
+
+static void log_debug(const char* fmt, ...) {
+  va_list args;
+  va_start(args, fmt);
+  log_message(LOG_LEVEL_DEBUG, fmt, args);
+  va_end(args);
 }
 
 static void log_info(const char* fmt, ...) {
   va_list args;
   va_start(args, fmt);
-  log_time_prefix();
-  vprintf(fmt, args);
-  printf("\n");
-  fflush(stdout);
+  log_message(LOG_LEVEL_INFO, fmt, args);
+  va_end(args);
+}
+
+static void log_error(const char* fmt, ...) {
+  va_list args;
+  va_start(args, fmt);
+  log_message(LOG_LEVEL_ERROR, fmt, args);
   va_end(args);
 }
 
+// Ctrl+C ends the process right after this returns; give the flusher a moment to write what is still queued.
+static BOOL WINAPI log_console_control_handler(DWORD controlType) {
+  (void) controlType;
+  if (g_logFlusher.running) {
+    SetEvent(g_logFlusher.wakeEvent);
+    ULONGLONG deadline = GetTickCount64() + LOG_SHUTDOWN_DRAIN_MS;
+    while (!log_ring_empty(&g_logFlusher.ring) && GetTickCount64() < deadline) {
+      Sleep(5);
+    }
+  }
+  return FALSE;
+}
+
+static void start_log_flusher(void) {
+  log_ring_init(&g_logFlusher.ring);
+  g_logFlusher.wakeEvent = CreateEventW(NULL, FALSE, FALSE, NULL);
+  if (!g_logFlusher.wakeEvent) {
+    return;
+  }
+  g_logFlusher.thread = CreateThread(NULL, 0, log_flusher_main, NULL, 0, NULL);
+  if (!g_logFlusher.thread) {
+    CloseHandle(g_logFlusher.wakeEvent);
+    g_logFlusher.wakeEvent = NULL;
+    return;
+  }
+  InterlockedExchange(&g_logFlusher.running, 1);
+  SetConsoleCtrlHandler(log_console_control_handler, TRUE);
+}
+
+// Must run once no other thread logs any more; the flusher writes everything queued before it exits.
+static void stop_log_flusher(void) {
+  if (!g_logFlusher.thread) {
+    return;
+  }
+  InterlockedExchange(&g_logFlusher.running, 0);
+  InterlockedExchange(&g_logFlusher.stopRequested, 1);
+  SetEvent(g_logFlusher.wakeEvent);
+  WaitForSingleObject(g_logFlusher.thread, INFINITE);
+  SetConsoleCtrlHandler(log_console_control_handler, FALSE);
+  CloseHandle(g_logFlusher.thread);
+  CloseHandle(g_logFlusher.wakeEvent);
+  g_logFlusher.thread = NULL;
+  g_logFlusher.wakeEvent = NULL;
+
+  // A producer that saw the ring running just before it stopped may have published after the flusher's last pass.
+  AcquireSRWLockExclusive(&g_logLock);
+  FILE* stream = g_logStream ? g_logStream : stdout;
+  if (log_flush_ring(stream) > 0) {
+    fflush(stream);
+  }
+  ReleaseSRWLockExclusive(&g_logLock);
+}
+
 static char* utf8_from_wide_length(const wchar_t* text, size_t length) {
   if (!text) {
     return NULL;
@@ -174,7 +763,7 @@ static char* utf8_from_wide(const wchar_t* text) {
 static void log_wide_value(const char* label, const wchar_t* value) {
   char* utf8 = utf8_from_wide(value);
   if (!utf8) {
-    log_info("Failed to convert %s to UTF-8", label);
+    log_error("Failed to convert %s to UTF-8", label);
     return;
   }
 
@@ -194,6 +783,56 @@ static wchar_t* duplicate_wide_range(const wchar_t* text, size_t length) {
   return copy;
 }
 
+static bool reserve_wide_buffer(wchar_t** text, size_t* capacity, size_t required) {
+  if (*text && *capacity >= required) {
+    return true;
+  }
+
+  size_t grownCapacity = *capacity < 64 ? 64 : *capacity;
+  while (grownCapacity < required) {
+    if (grownCapacity > ((size_t) -1 / sizeof(wchar_t) - 1) / 2) {
+      grownCapacity = required;
+      break;
+    }
+    grownCapacity *= 2;
+  }
+  if (grownCapacity > (size_t) -1 / sizeof(wchar_t) - 1) {
+    return false;
+  }
+
+  wchar_t* grown = (wchar_t*) realloc(*text, (grownCapacity + 1) * sizeof(wchar_t));
+  if (!grown) {
+    return false;
+  }
+  InterlockedIncrement(&g_engineAllocations);
+  *text = grown;
+  *capacity = grownCapacity;
+  return true;
+}
+
+static bool reserve_byte_buffer(char** bytes, size_t* capacity, size_t required) {
+  if (*bytes && *capacity >= required) {
+    return true;
+  }
+
+  size_t grownCapacity = *capacity < 4096 ? 4096 : *capacity;
+  while (grownCapacity < required) {
+    if (grownCapacity > (size_t) -1 / 2) {
+      grownCapacity = required;
+      break;
+    }
+    grownCapacity *= 2;
+  }
+
+  char* grown = (char*) realloc(*bytes, grownCapacity);
+  if (!grown) {
+    return false;
+  }
+  *bytes = grown;
+  *capacity = grownCapacity;
+  return true;
+}
+
 static wchar_t* duplicate_wide_string(const wchar_t* text) {
   if (!text) {
     return NULL;
@@ -286,6 +925,22 @@ static wchar_t* join_path(const wchar_t* directory, const wchar_t* leaf) {
   return path;
 }
 
+static wchar_t* concat_wide_strings(const wchar_t* lhs, const wchar_t* rhs) {
+  if (!lhs || !rhs) {
+    return NULL;
+  }
+
+  size_t lhsLength = wcslen(lhs);
+  size_t rhsLength = wcslen(rhs);
+  wchar_t* joined = (wchar_t*) malloc((lhsLength + rhsLength + 1) * sizeof(wchar_t));
+  if (!joined) {
+    return NULL;
+  }
+  memcpy(joined, lhs, lhsLength * sizeof(wchar_t));
+  memcpy(joined + lhsLength, rhs, (rhsLength + 1) * sizeof(wchar_t));
+  return joined;
+}
+
 static bool get_file_last_write_time(const wchar_t* path, FILETIME* outWriteTime) {
   if (!path || !outWriteTime) {
     return false;
@@ -333,7 +988,7 @@ static size_t count_clipboard_lines(const wchar_t* text, size_t length) {
 static void log_current_working_directory(void) {
   wchar_t* cwd = get_current_directory_string();
   if (!cwd) {
-    log_info("GetCurrentDirectory failed (%lu)", GetLastError());
+    log_error("GetCurrentDirectory failed (%lu)", GetLastError());
     return;
   }
 
@@ -354,46 +1009,344 @@ static bool try_open_clipboard(HWND hwnd) {
 
 static void free_clipboard_buffer(ClipboardBuffer* buffer) {
   if (buffer && buffer->text) {
-    free(buffer->text);
+    if (buffer->handle) {
+      GlobalUnlock(buffer->handle);
+      GlobalFree(buffer->handle);
+      buffer->handle = NULL;
+    } else {
+      free(buffer->text);
+    }
     buffer->text = NULL;
     buffer->length = 0;
   }
 }
 
-static bool fetch_clipboard_text(HWND hwnd, ClipboardBuffer* outBuffer, bool* outWasUnicode) {
+// Allocates the movable block a normalization works in and finally hands to SetClipboardData, locked for writing.
+static bool allocate_clipboard_block(ClipboardBuffer* buffer, size_t length) {
+  if (length > (size_t) -1 / sizeof(wchar_t) - 1) {
+    return false;
+  }
+  buffer->handle = GlobalAlloc(GMEM_MOVEABLE, (length + 1) * sizeof(wchar_t));
+  if (!buffer->handle) {
+    return false;
+  }
+  buffer->text = (wchar_t*) GlobalLock(buffer->handle);
+  if (!buffer->text) {
+    GlobalFree(buffer->handle);
+    buffer->handle = NULL;
+    return false;
+  }
+  buffer->length = length;
+  buffer->text[length] = L'\0';
+  return true;
+}
+
+// 64-bit clipboard fingerprint in the style of XXH3: eight accumulator lanes take one 64-byte stripe per step, keyed
+// by a window into kFingerprintSecret that slides with the stripe's position in its block, and are scrambled after
+// every block so reordered stripes do not collide. The SIMD variants compute exactly the scalar result.
+static const uint64_t kFingerprintSecret[FINGERPRINT_BLOCK_STRIPES + 8] = {
+    0x0D89CCDA48E77DCAULL, 0x2B31FF5370D1B2BDULL, 0x32E13BE7315BF599ULL, 0x711EF6AF2B97E8FBULL,
+    0x85564D19B964DDB0ULL, 0x2DEDEEA7BC743197ULL, 0xDA0B2AEE1FB36B8BULL, 0x2CD38FBEB9957760ULL,
+    0xD233F3C18C246A4BULL, 0x34FB8A3D31D7E475ULL, 0xEBAC003CF5944010ULL, 0x3105B7B4F40362ACULL,
+    0x5D4718EA5F2C65A2ULL, 0x2DDE3E1BDABD3D9EULL, 0xE8B5BBABDB5DD534ULL, 0x0F983A15C5A4C661ULL,
+    0x430A0F7F7B5EF4C7ULL, 0x3C1EC933DBFD693DULL, 0x71083961841E44F8ULL, 0xA64CC1B7C65E519AULL,
+    0x65F5094A4A63D7F7ULL, 0xEB7E577A05AC3557ULL, 0xF20315E3304EFA05ULL, 0x338F2A33EB5B6E4AULL,
+};
+static const uint32_t kFingerprintScramblePrime = 0x9E3779B1u;
+
+// Accumulates `stripeCount` whole stripes; `firstStripe` is the index of the first one since the start of the text.
+typedef void (*FingerprintStripeKernel)(uint64_t acc[8], const uint8_t* data, size_t stripeCount, size_t firstStripe);
+
+static FingerprintStripeKernel g_fingerprintStripeKernel = NULL;
+
+static void fingerprint_stripes_scalar(uint64_t acc[8], const uint8_t* data, size_t stripeCount, size_t firstStripe) {
+  for (size_t stripe = 0; stripe < stripeCount; ++stripe) {
+    size_t keyIndex = (firstStripe + stripe) % FINGERPRINT_BLOCK_STRIPES;
+    const uint8_t* input = data + stripe * FINGERPRINT_STRIPE_BYTES;
+    for (size_t lane = 0; lane < 8; ++lane) {
+      uint64_t value;
+      memcpy(&value, input + lane * 8, sizeof(value));
+      uint64_t keyed = value ^ kFingerprintSecret[keyIndex + lane];
+      acc[lane ^ 1] += value;
+      acc[lane] += (keyed & 0xFFFFFFFFu) * (keyed >> 32);
+    }
+    if (keyIndex == FINGERPRINT_BLOCK_STRIPES - 1) {
+      for (size_t lane = 0; lane < 8; ++lane) {
+        uint64_t value = acc[lane] ^ (acc[lane] >> 47) ^ kFingerprintSecret[8 + lane];
+        acc[lane] = value * kFingerprintScramblePrime;
+      }
+    }
+  }
+}
+
+#ifdef TRIM_HAVE_X86_KERNELS
+__attribute__((target("sse2"))) static void fingerprint_stripes_sse2(uint64_t acc[8], const uint8_t* data,
+                                                                     size_t stripeCount, size_t firstStripe) {
+  const __m128i prime = _mm_set1_epi32((int) kFingerprintScramblePrime);
+  __m128i lanes[4];
+  for (size_t part = 0; part < 4; ++part) {
+    lanes[part] = _mm_loadu_si128((const __m128i*) (acc + part * 2));
+  }
+  for (size_t stripe = 0; stripe < stripeCount; ++stripe) {
+    size_t keyIndex = (firstStripe + stripe) % FINGERPRINT_BLOCK_STRIPES;
+    const uint8_t* input = data + stripe * FINGERPRINT_STRIPE_BYTES;
+    for (size_t part = 0; part < 4; ++part) {
+      __m128i value = _mm_loadu_si128((const __m128i*) (input + part * 16));
+      __m128i key = _mm_loadu_si128((const __m128i*) (kFingerprintSecret + keyIndex + part * 2));
+      __m128i keyed = _mm_xor_si128(value, key);
+      __m128i product = _mm_mul_epu32(keyed, _mm_srli_epi64(keyed, 32));
+      __m128i swapped = _mm_shuffle_epi32(value, _MM_SHUFFLE(1, 0, 3, 2));
+      lanes[part] = _mm_add_epi64(lanes[part], _mm_add_epi64(product, swapped));
+    }
+    if (keyIndex == FINGERPRINT_BLOCK_STRIPES - 1) {
+      for (size_t part = 0; part < 4; ++part) {
+        __m128i key = _mm_loadu_si128((const __m128i*) (kFingerprintSecret + 8 + part * 2));
+        __m128i value = _mm_xor_si128(_mm_xor_si128(lanes[part], _mm_srli_epi64(lanes[part], 47)), key);
+        __m128i low = _mm_mul_epu32(value, prime);
+        __m128i high = _mm_mul_epu32(_mm_srli_epi64(value, 32), prime);
+        lanes[part] = _mm_add_epi64(low, _mm_slli_epi64(high, 32));
+      }
+    }
+  }
+  for (size_t part = 0; part < 4; ++part) {
+    _mm_storeu_si128((__m128i*) (acc + part * 2), lanes[part]);
+  }
+}
+
+__attribute__((target("avx2"))) static void fingerprint_stripes_avx2(uint64_t acc[8], const uint8_t* data,
+                                                                     size_t stripeCount, size_t firstStripe) {
+  const __m256i prime = _mm256_set1_epi32((int) kFingerprintScramblePrime);
+  __m256i lanes[2];
+  for (size_t part = 0; part < 2; ++part) {
+    lanes[part] = _mm256_loadu_si256((const __m256i*) (acc + part * 4));
+  }
+  for (size_t stripe = 0; stripe < stripeCount; ++stripe) {
+    size_t keyIndex = (firstStripe + stripe) % FINGERPRINT_BLOCK_STRIPES;
+    const uint8_t* input = data + stripe * FINGERPRINT_STRIPE_BYTES;
+    for (size_t part = 0; part < 2; ++part) {
+      __m256i value = _mm256_loadu_si256((const __m256i*) (input + part * 32));
+      __m256i key = _mm256_loadu_si256((const __m256i*) (kFingerprintSecret + keyIndex + part * 4));
+      __m256i keyed = _mm256_xor_si256(value, key);
+      __m256i product = _mm256_mul_epu32(keyed, _mm256_srli_epi64(keyed, 32));
+      __m256i swapped = _mm256_shuffle_epi32(value, _MM_SHUFFLE(1, 0, 3, 2));
+      lanes[part] = _mm256_add_epi64(lanes[part], _mm256_add_epi64(product, swapped));
+    }
+    if (keyIndex == FINGERPRINT_BLOCK_STRIPES - 1) {
+      for (size_t part = 0; part < 2; ++part) {
+        __m256i key = _mm256_loadu_si256((const __m256i*) (kFingerprintSecret + 8 + part * 4));
+        __m256i value = _mm256_xor_si256(_mm256_xor_si256(lanes[part], _mm256_srli_epi64(lanes[part], 47)), key);
+        __m256i low = _mm256_mul_epu32(value, prime);
+        __m256i high = _mm256_mul_epu32(_mm256_srli_epi64(value, 32), prime);
+        lanes[part] = _mm256_add_epi64(low, _mm256_slli_epi64(high, 32));
+      }
+    }
+  }
+  for (size_t part = 0; part < 2; ++part) {
+    _mm256_storeu_si256((__m256i*) (acc + part * 4), lanes[part]);
+  }
+}
+#endif
+
+static FingerprintStripeKernel select_fingerprint_stripe_kernel(void) {
+  if (!g_fingerprintStripeKernel) {
+    FingerprintStripeKernel kernel = fingerprint_stripes_scalar;
+#ifdef TRIM_HAVE_X86_KERNELS
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+      kernel = fingerprint_stripes_avx2;
+    } else if (__builtin_cpu_supports("sse2")) {
+      kernel = fingerprint_stripes_sse2;
+    }
+#endif
+    g_fingerprintStripeKernel = kernel;
+  }
+  return g_fingerprintStripeKernel;
+}
+
+static uint64_t fingerprint_mix(uint64_t value) {
+  value ^= value >> 33;
+  value *= 0xFF51AFD7ED558CCDULL;
+  value ^= value >> 33;
+  value *= 0xC4CEB9FE1A85EC53ULL;
+  value ^= value >> 33;
+  return value;
+}
+
+// Never returns 0, which g_normalizedFingerprint reserves for "nothing known".
+static uint64_t fingerprint_text_with(FingerprintStripeKernel kernel, const wchar_t* text, size_t length) {
+  uint64_t acc[8];
+  for (size_t lane = 0; lane < 8; ++lane) {
+    acc[lane] = kFingerprintSecret[FINGERPRINT_BLOCK_STRIPES + lane];
+  }
+  const uint8_t* bytes = (const uint8_t*) text;
+  size_t byteLength = length * sizeof(wchar_t);
+  size_t stripeCount = byteLength / FINGERPRINT_STRIPE_BYTES;
+  kernel(acc, bytes, stripeCount, 0);
+  size_t tailBytes = byteLength - stripeCount * FINGERPRINT_STRIPE_BYTES;
+  if (tailBytes > 0) {
+    uint8_t tail[FINGERPRINT_STRIPE_BYTES] = {0};
+    memcpy(tail, bytes + stripeCount * FINGERPRINT_STRIPE_BYTES, tailBytes);
+    kernel(acc, tail, 1, stripeCount);
+  }
+
+  uint64_t hash = (uint64_t) byteLength * 0x9E3779B185EBCA87ULL;
+  for (size_t lane = 0; lane < 8; ++lane) {
+    hash = fingerprint_mix(hash ^ acc[lane]);
+  }
+  return hash != 0 ? hash : 1;
+}
+
+static uint64_t fingerprint_text(const wchar_t* text, size_t length) {
+  return fingerprint_text_with(select_fingerprint_stripe_kernel(), text, length);
+}
+
+typedef size_t (*SurrogateScanner)(const wchar_t* text, size_t position, size_t length);
+
+static SurrogateScanner g_surrogateScanner = NULL;
+
+static bool is_high_surrogate(wchar_t c) {
+  return ((uint16_t) c & 0xFC00u) == 0xD800u;
+}
+
+static bool is_low_surrogate(wchar_t c) {
+  return ((uint16_t) c & 0xFC00u) == 0xDC00u;
+}
+
+// Scanners return the first position at or after `position` holding a surrogate of either half.
+static size_t find_surrogate_scalar(const wchar_t* text, size_t position, size_t length) {
+  while (position < length && ((uint16_t) text[position] & 0xF800u) != 0xD800u) {
+    position++;
+  }
+  return position;
+}
+
+#ifdef TRIM_HAVE_X86_KERNELS
+__attribute__((target("sse2"))) static size_t find_surrogate_sse2(const wchar_t* text, size_t position,
+                                                                   size_t length) {
+  const __m128i mask = _mm_set1_epi16((short) 0xF800);
+  const __m128i surrogate = _mm_set1_epi16((short) 0xD800);
+  while (position + 8 <= length) {
+    __m128i units = _mm_loadu_si128((const __m128i*) (text + position));
+    int hits = _mm_movemask_epi8(_mm_cmpeq_epi16(_mm_and_si128(units, mask), surrogate));
+    if (hits != 0) {
+      return position + (size_t) (__builtin_ctz((unsigned) hits) / 2);
+    }
+    position += 8;
+  }
+  return find_surrogate_scalar(text, position, length);
+}
+
+__attribute__((target("avx2"))) static size_t find_surrogate_avx2(const wchar_t* text, size_t position,
+                                                                   size_t length) {
+  const __m256i mask = _mm256_set1_epi16((short) 0xF800);
+  const __m256i surrogate = _mm256_set1_epi16((short) 0xD800);
+  while (position + 16 <= length) {
+    __m256i units = _mm256_loadu_si256((const __m256i*) (text + position));
+    uint32_t hits = (uint32_t) _mm256_movemask_epi8(_mm256_cmpeq_epi16(_mm256_and_si256(units, mask), surrogate));
+    if (hits != 0) {
+      return position + (size_t) (__builtin_ctz(hits) / 2);
+    }
+    position += 16;
+  }
+  return find_surrogate_sse2(text, position, length);
+}
+#endif
+
+static SurrogateScanner select_surrogate_scanner(void) {
+  if (!g_surrogateScanner) {
+    SurrogateScanner scanner = find_surrogate_scalar;
+#ifdef TRIM_HAVE_X86_KERNELS
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+      scanner = find_surrogate_avx2;
+    } else if (__builtin_cpu_supports("sse2")) {
+      scanner = find_surrogate_sse2;
+    }
+#endif
+    g_surrogateScanner = scanner;
+  }
+  return g_surrogateScanner;
+}
+
+// Returns the position of the first unpaired surrogate at or after `position`, or `length` for valid UTF-16.
+static size_t find_unpaired_surrogate(const wchar_t* text, size_t position, size_t length) {
+  SurrogateScanner scanner = select_surrogate_scanner();
+  for (;;) {
+    position = scanner(text, position, length);
+    if (position >= length) {
+      return length;
+    }
+    if (!is_high_surrogate(text[position]) || position + 1 >= length || !is_low_surrogate(text[position + 1])) {
+      return position;
+    }
+    position += 2;
+  }
+}
+
+static uint64_t load_normalized_fingerprint(void) {
+  return (uint64_t) InterlockedCompareExchange64(&g_normalizedFingerprint, 0, 0);
+}
+
+static void publish_normalized_fingerprint(uint64_t fingerprint) {
+  InterlockedExchange64(&g_normalizedFingerprint, (LONG64) fingerprint);
+}
+
+// The text is copied once, straight from the locked clipboard data into the movable block the normalization works in
+// and eventually publishes. Lengths are bounded by GlobalSize, so data without a terminator cannot be overread. When
+// the Unicode text matches the last normalized fingerprint it is not copied at all: the buffer stays empty and
+// `*outAlreadyNormalized` is set instead.
+static bool fetch_clipboard_text(HWND hwnd, ClipboardBuffer* outBuffer, bool* outWasUnicode, DWORD* outSequence,
+                                 bool* outAlreadyNormalized) {
   if (!outBuffer) {
     return false;
   }
   outBuffer->text = NULL;
   outBuffer->length = 0;
+  outBuffer->handle = NULL;
   if (outWasUnicode) {
     *outWasUnicode = false;
   }
+  if (outAlreadyNormalized) {
+    *outAlreadyNormalized = false;
+  }
 
   if (!try_open_clipboard(hwnd)) {
-    log_info("Unable to open clipboard for reading");
+    log_error("Unable to open clipboard for reading");
     return false;
   }
+  // Nobody else can publish while we hold the clipboard open, so this number identifies the text read below.
+  if (outSequence) {
+    *outSequence = GetClipboardSequenceNumber();
+  }
 
   HANDLE hData = GetClipboardData(CF_UNICODETEXT);
   if (hData) {
     wchar_t* locked = (wchar_t*) GlobalLock(hData);
     if (!locked) {
       CloseClipboard();
-      log_info("Failed to lock Unicode clipboard data");
+      log_error("Failed to lock Unicode clipboard data");
       return false;
     }
-    size_t len = wcslen(locked);
-    wchar_t* copy = (wchar_t*) malloc((len + 1) * sizeof(wchar_t));
-    if (!copy) {
+    size_t unitCapacity = GlobalSize(hData) / sizeof(wchar_t);
+    const wchar_t* terminator = wmemchr(locked, L'\0', unitCapacity);
+    size_t len = terminator ? (size_t) (terminator - locked) : unitCapacity;
+    uint64_t knownFingerprint = load_normalized_fingerprint();
+    if (outAlreadyNormalized && knownFingerprint != 0 && fingerprint_text(locked, len) == knownFingerprint) {
+      GlobalUnlock(hData);
+      CloseClipboard();
+      *outAlreadyNormalized = true;
+      if (outWasUnicode) {
+        *outWasUnicode = true;
+      }
+      return true;
+    }
+    if (!allocate_clipboard_block(outBuffer, len)) {
       GlobalUnlock(hData);
       CloseClipboard();
-      log_info("Out of memory while copying clipboard data");
+      log_error("Out of memory while copying clipboard data");
       return false;
     }
-    memcpy(copy, locked, (len + 1) * sizeof(wchar_t));
-    outBuffer->text = copy;
-    outBuffer->length = len;
+    memcpy(outBuffer->text, locked, len * sizeof(wchar_t));
     if (outWasUnicode) {
       *outWasUnicode = true;
     }
@@ -410,26 +1363,33 @@ static bool fetch_clipboard_text(HWND hwnd, ClipboardBuffer* outBuffer, bool* ou
   char* lockedAnsi = (char*) GlobalLock(hAnsi);
   if (!lockedAnsi) {
     CloseClipboard();
-    log_info("Failed to lock ANSI clipboard data");
+    log_error("Failed to lock ANSI clipboard data");
     return false;
   }
-  int required = MultiByteToWideChar(CP_ACP, 0, lockedAnsi, -1, NULL, 0);
+  size_t ansiCapacity = GlobalSize(hAnsi);
+  const char* ansiTerminator = (const char*) memchr(lockedAnsi, '\0', ansiCapacity);
+  size_t ansiLength = ansiTerminator ? (size_t) (ansiTerminator - lockedAnsi) : ansiCapacity;
+  if (ansiLength == 0) {
+    GlobalUnlock(hAnsi);
+    CloseClipboard();
+    return allocate_clipboard_block(outBuffer, 0);
+  }
+  int required = ansiLength <= (size_t) INT_MAX
+                     ? MultiByteToWideChar(CP_ACP, 0, lockedAnsi, (int) ansiLength, NULL, 0)
+                     : 0;
   if (required <= 0) {
     GlobalUnlock(hAnsi);
     CloseClipboard();
-    log_info("Failed to convert ANSI clipboard data to Unicode");
+    log_error("Failed to convert ANSI clipboard data to Unicode");
     return false;
   }
-  wchar_t* copy = (wchar_t*) malloc((size_t) required * sizeof(wchar_t));
-  if (!copy) {
+  if (!allocate_clipboard_block(outBuffer, (size_t) required)) {
     GlobalUnlock(hAnsi);
     CloseClipboard();
-    log_info("Out of memory while converting clipboard data");
+    log_error("Out of memory while converting clipboard data");
     return false;
   }
-  MultiByteToWideChar(CP_ACP, 0, lockedAnsi, -1, copy, required);
-  outBuffer->text = copy;
-  outBuffer->length = wcslen(copy);
+  MultiByteToWideChar(CP_ACP, 0, lockedAnsi, (int) ansiLength, outBuffer->text, required);
   GlobalUnlock(hAnsi);
   CloseClipboard();
   return true;
@@ -447,36 +1407,165 @@ static void set_rule_load_error(RuleLoadError* error, size_t lineNumber, const c
   error->lineNumber = lineNumber;
 }
 
-static void free_regex_rule(RegexRule* rule) {
-  if (!rule) {
-    return;
+// Returns `bytes` of storage aligned for any type, or NULL when out of memory.
+static void* rule_arena_allocate(RuleArena* arena, size_t bytes) {
+  size_t alignedBytes = (bytes + sizeof(max_align_t) - 1) / sizeof(max_align_t) * sizeof(max_align_t);
+  if (alignedBytes < bytes) {
+    return NULL;
   }
 
-  for (size_t i = 0; i < rule->patternCount; ++i) {
-    pcre2_code_free(rule->patterns[i].code);
-    free(rule->patterns[i].source);
+  RuleArenaBlock* block = arena->head;
+  if (!block || block->capacity - block->used < alignedBytes) {
+    size_t capacity = block ? block->capacity * 2 : RULE_ARENA_FIRST_BLOCK_BYTES;
+    if (capacity < alignedBytes) {
+      capacity = alignedBytes;
+    }
+    if (capacity > (size_t) -1 - sizeof(RuleArenaBlock)) {
+      return NULL;
+    }
+    block = (RuleArenaBlock*) malloc(sizeof(RuleArenaBlock) + capacity);
+    if (!block) {
+      return NULL;
+    }
+    block->next = arena->head;
+    block->capacity = capacity;
+    block->used = 0;
+    arena->head = block;
+    arena->totalBytes += capacity;
   }
 
-  free(rule->patterns);
-  free(rule->replacement);
-  memset(rule, 0, sizeof(*rule));
+  void* allocation = (char*) block->data + block->used;
+  block->used += alignedBytes;
+  return allocation;
 }
 
-static void free_rule_set(RuleSet* ruleSet) {
-  if (!ruleSet) {
-    return;
+static wchar_t* rule_arena_duplicate_wide_range(RuleArena* arena, const wchar_t* text, size_t length) {
+  if (length > (size_t) -1 / sizeof(wchar_t) - 1) {
+    return NULL;
   }
-
-  for (size_t i = 0; i < ruleSet->ruleCount; ++i) {
-    free_regex_rule(&ruleSet->rules[i]);
+  wchar_t* copy = (wchar_t*) rule_arena_allocate(arena, (length + 1) * sizeof(wchar_t));
+  if (!copy) {
+    return NULL;
   }
-
-  free(ruleSet->rules);
-  ruleSet->rules = NULL;
-  ruleSet->ruleCount = 0;
+  if (length > 0) {
+    wmemcpy(copy, text, length);
+  }
+  copy[length] = L'\0';
+  return copy;
+}
+
+// Makes room for one more item in an arena array of `count` items by moving it to one twice as large; the old
+// copy is left in the arena, so the waste stays below the final size of the array.
+static void* rule_arena_reserve_item(RuleArena* arena, void* items, size_t count, size_t* capacity, size_t itemSize) {
+  if (count < *capacity) {
+    return items;
+  }
+
+  size_t grownCapacity = *capacity ? *capacity * 2 : 1;
+  if (grownCapacity < *capacity || grownCapacity > (size_t) -1 / itemSize) {
+    return NULL;
+  }
+  void* grown = rule_arena_allocate(arena, grownCapacity * itemSize);
+  if (!grown) {
+    return NULL;
+  }
+  if (count > 0) {
+    memcpy(grown, items, count * itemSize);
+  }
+  *capacity = grownCapacity;
+  return grown;
+}
+
+static void free_rule_arena(RuleArena* arena) {
+  while (arena->head) {
+    RuleArenaBlock* next = arena->head->next;
+    free(arena->head);
+    arena->head = next;
+  }
+  arena->totalBytes = 0;
+}
+
+static void free_literal_automaton(LiteralAutomaton* automaton) {
+  if (!automaton) {
+    return;
+  }
+  free(automaton->states);
+  free(automaton->edgeUnits);
+  free(automaton->edgeTargets);
+  free(automaton->rootTargets);
+  free(automaton->entries);
+  free(automaton->ruleStamps);
+  free(automaton->entryStamps);
+  free(automaton);
+}
+
+// Frees what PCRE2 and the literal automaton allocated for the rule; its text and pattern array belong to the rule
+// set's arena.
+static void free_regex_rule(RegexRule* rule) {
+  if (!rule) {
+    return;
+  }
+
+  for (size_t i = 0; i < rule->patternCount; ++i) {
+    pcre2_match_data_free(rule->patterns[i].matchData);
+    pcre2_code_free(rule->patterns[i].code);
+  }
+  free_literal_automaton(rule->literals);
+
+  memset(rule, 0, sizeof(*rule));
+}
+
+static void free_segment_lanes(RuleSet* ruleSet) {
+  for (size_t i = 0; i < ruleSet->laneCount; ++i) {
+    SegmentLane* lane = &ruleSet->lanes[i];
+    pcre2_match_data_free(lane->matchData);
+    pcre2_match_context_free(lane->matchContext);
+    pcre2_jit_stack_free(lane->jitStack);
+    free(lane->dfaWorkspace.slots);
+    free(lane->output);
+  }
+  free(ruleSet->lanes);
+  ruleSet->lanes = NULL;
+  ruleSet->laneCount = 0;
+}
+
+static void release_rule_compile_state(RuleSet* ruleSet) {
+  pcre2_match_data_free(ruleSet->probeData);
+  pcre2_code_free(ruleSet->casedProbe);
+  pcre2_compile_context_free(ruleSet->compileContext);
+  pcre2_general_context_free(ruleSet->matchMemory);
+  free(ruleSet->cachePath);
+  ruleSet->probeData = NULL;
+  ruleSet->casedProbe = NULL;
+  ruleSet->compileContext = NULL;
+  ruleSet->matchMemory = NULL;
+  ruleSet->cachePath = NULL;
+}
+
+static void free_rule_set(RuleSet* ruleSet) {
+  if (!ruleSet) {
+    return;
+  }
+
+  for (size_t i = 0; i < ruleSet->ruleCount; ++i) {
+    free_regex_rule(&ruleSet->rules[i]);
+  }
+
+  free(ruleSet->scratchText);
+  free(ruleSet->presence);
+  free(ruleSet->dfaWorkspace.slots);
+  free_segment_lanes(ruleSet);
+  pcre2_match_context_free(ruleSet->matchContext);
+  pcre2_jit_stack_free(ruleSet->jitStack);
+  release_rule_compile_state(ruleSet);
+  free_rule_arena(&ruleSet->arena);
+  memset(ruleSet, 0, sizeof(*ruleSet));
 }
 
 static void clear_active_rule_config(void) {
+  // Text that was normalized under the old rules may not be under the new ones.
+  InterlockedIncrement(&g_ruleGeneration);
+  publish_normalized_fingerprint(0);
   free(g_ruleConfig.activePath);
   g_ruleConfig.activePath = NULL;
   memset(&g_ruleConfig.activeWriteTime, 0, sizeof(g_ruleConfig.activeWriteTime));
@@ -491,10 +1580,22 @@ static void free_rule_config_state(void) {
   memset(&g_ruleConfig.lastResolvedWriteTime, 0, sizeof(g_ruleConfig.lastResolvedWriteTime));
   g_ruleConfig.lastResolvedExists = false;
   g_ruleConfig.lastLoadFailed = false;
+  g_ruleConfig.lastResolvedHasRules = false;
+}
+
+static void free_rule_update(RuleUpdate* update) {
+  if (!update) {
+    return;
+  }
+  free(update->path);
+  free_rule_set(&update->rules);
+  free(update);
 }
 
-static bool parse_block_header(const wchar_t* line, size_t length, const wchar_t* keyword, wchar_t** outToken) {
-  if (!line || !keyword || !outToken) {
+// On success `*outToken` points into `line`, which outlives the block it terminates.
+static bool parse_block_header(const wchar_t* line, size_t length, const wchar_t* keyword, const wchar_t** outToken,
+                               size_t* outTokenLength) {
+  if (!line || !keyword || !outToken || !outTokenLength) {
     return false;
   }
 
@@ -531,29 +1632,45 @@ static bool parse_block_header(const wchar_t* line, size_t length, const wchar_t
     }
   }
 
-  *outToken = duplicate_wide_range(line + tokenStart, tokenEnd - tokenStart);
-  return *outToken != NULL;
+  *outToken = line + tokenStart;
+  *outTokenLength = tokenEnd - tokenStart;
+  return true;
 }
 
-static bool append_pattern_to_rule(RegexRule* rule, wchar_t* source, size_t sourceLength, size_t lineNumber,
+static bool append_pattern_to_rule(RuleArena* arena, RegexRule* rule, size_t* patternCapacity, const wchar_t* source,
+                                   size_t sourceLength, size_t lineNumber, PatternEngine engine,
                                    RuleLoadError* error) {
-  RegexPattern* grown = (RegexPattern*) realloc(rule->patterns, (rule->patternCount + 1) * sizeof(RegexPattern));
-  if (!grown) {
-    free(source);
+  RegexPattern* grown = (RegexPattern*) rule_arena_reserve_item(arena, rule->patterns, rule->patternCount,
+                                                                patternCapacity, sizeof(RegexPattern));
+  wchar_t* sourceCopy = grown ? rule_arena_duplicate_wide_range(arena, source, sourceLength) : NULL;
+  if (!sourceCopy) {
     set_rule_load_error(error, lineNumber, "Out of memory while storing regex patterns");
     return false;
   }
 
   rule->patterns = grown;
-  rule->patterns[rule->patternCount].code = NULL;
-  rule->patterns[rule->patternCount].source = source;
+  memset(&rule->patterns[rule->patternCount], 0, sizeof(RegexPattern));
+  rule->patterns[rule->patternCount].source = sourceCopy;
   rule->patterns[rule->patternCount].sourceLength = sourceLength;
   rule->patterns[rule->patternCount].lineNumber = lineNumber;
+  rule->patterns[rule->patternCount].engine = engine;
   rule->patternCount++;
   return true;
 }
 
-static bool append_rule_to_set(RuleSet* ruleSet, RegexRule* rule, size_t ruleLineNumber, RuleLoadError* error) {
+static bool rule_is_literal(const RegexRule* rule) {
+  return rule->patternCount > 0 && rule->patterns[0].engine == PATTERN_ENGINE_LITERAL;
+}
+
+static bool rule_guards_equal(const RuleGuard* lhs, const RuleGuard* rhs) {
+  return lhs->minLength == rhs->minLength && lhs->maxLength == rhs->maxLength &&
+         lhs->minLineCount == rhs->minLineCount && lhs->requiredTextLength == rhs->requiredTextLength &&
+         (lhs->requiredTextLength == 0 ||
+          wmemcmp(lhs->requiredText, rhs->requiredText, lhs->requiredTextLength) == 0);
+}
+
+static bool append_rule_to_set(RuleSet* ruleSet, size_t* ruleCapacity, RegexRule* rule, size_t ruleLineNumber,
+                               RuleLoadError* error) {
   if (rule->patternCount == 0) {
     set_rule_load_error(error, ruleLineNumber, "Rule must contain at least one pattern block");
     return false;
@@ -562,26 +1679,32 @@ static bool append_rule_to_set(RuleSet* ruleSet, RegexRule* rule, size_t ruleLin
     set_rule_load_error(error, ruleLineNumber, "Rule must contain exactly one replace block");
     return false;
   }
+  if (rule->lineScoped && rule_is_literal(rule)) {
+    set_rule_load_error(error, ruleLineNumber, "Literal rules already run in one pass and do not take `scope line`");
+    return false;
+  }
+  if (rule->guard.maxLength != 0 && rule->guard.minLength > rule->guard.maxLength) {
+    set_rule_load_error(error, ruleLineNumber, "Rule's min-length exceeds its max-length");
+    return false;
+  }
 
-  RegexRule* grown = (RegexRule*) realloc(ruleSet->rules, (ruleSet->ruleCount + 1) * sizeof(RegexRule));
+  RegexRule* grown = (RegexRule*) rule_arena_reserve_item(&ruleSet->arena, ruleSet->rules, ruleSet->ruleCount,
+                                                          ruleCapacity, sizeof(RegexRule));
   if (!grown) {
     set_rule_load_error(error, ruleLineNumber, "Out of memory while storing parsed rules");
     return false;
   }
 
   ruleSet->rules = grown;
+  rule->lineNumber = ruleLineNumber;
   ruleSet->rules[ruleSet->ruleCount++] = *rule;
   memset(rule, 0, sizeof(*rule));
   return true;
 }
 
-static bool read_utf8_file(const wchar_t* path, ClipboardBuffer* outBuffer, RuleLoadError* error) {
-  if (!path || !outBuffer) {
-    return false;
-  }
-
-  outBuffer->text = NULL;
-  outBuffer->length = 0;
+static bool read_file_bytes(const wchar_t* path, char** outBytes, size_t* outLength, RuleLoadError* error) {
+  *outBytes = NULL;
+  *outLength = 0;
 
   HANDLE file = CreateFileW(path, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, NULL,
                             OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
@@ -630,6 +1753,24 @@ static bool read_utf8_file(const wchar_t* path, ClipboardBuffer* outBuffer, Rule
 
   CloseHandle(file);
   bytes[bytesReadTotal] = '\0';
+  *outBytes = bytes;
+  *outLength = bytesReadTotal;
+  return true;
+}
+
+static bool read_utf8_file(const wchar_t* path, ClipboardBuffer* outBuffer, RuleLoadError* error) {
+  if (!path || !outBuffer) {
+    return false;
+  }
+
+  outBuffer->text = NULL;
+  outBuffer->length = 0;
+
+  char* bytes = NULL;
+  size_t bytesReadTotal = 0;
+  if (!read_file_bytes(path, &bytes, &bytesReadTotal, error)) {
+    return false;
+  }
 
   size_t offset = 0;
   if (bytesReadTotal >= 3 && (unsigned char) bytes[0] == 0xEF && (unsigned char) bytes[1] == 0xBB &&
@@ -676,15 +1817,147 @@ static bool read_utf8_file(const wchar_t* path, ClipboardBuffer* outBuffer, Rule
   return true;
 }
 
+// Matches `keyword value` and returns the value with surrounding whitespace removed.
+static bool parse_directive(const wchar_t* line, size_t length, const wchar_t* keyword, const wchar_t** outValue,
+                            size_t* outValueLength) {
+  size_t keywordLength = wcslen(keyword);
+  if (length <= keywordLength || wmemcmp(line, keyword, keywordLength) != 0 || !iswspace(line[keywordLength])) {
+    return false;
+  }
+
+  size_t valueStart = keywordLength;
+  while (valueStart < length && iswspace(line[valueStart])) {
+    valueStart++;
+  }
+  *outValue = line + valueStart;
+  *outValueLength = length - valueStart;
+  return true;
+}
+
+static bool parse_unsigned_value(const wchar_t* text, size_t length, uint64_t maxValue, uint64_t* outValue) {
+  if (length == 0) {
+    return false;
+  }
+
+  uint64_t value = 0;
+  for (size_t i = 0; i < length; ++i) {
+    if (text[i] < L'0' || text[i] > L'9') {
+      return false;
+    }
+    value = value * 10u + (uint64_t) (text[i] - L'0');
+    if (value > maxValue) {
+      return false;
+    }
+  }
+  *outValue = value;
+  return true;
+}
+
+// Handles `match-limit`, `depth-limit`, `heap-limit` and `time-limit`. Returns false with `error` set for a bad value;
+// `*outHandled` reports whether `line` was a budget directive at all.
+static bool parse_budget_directive(const wchar_t* line, size_t length, MatchBudget* budget, size_t lineNumber,
+                                   RuleLoadError* error, bool* outHandled) {
+  static const struct {
+    const wchar_t* keyword;
+    size_t offset;
+    uint64_t maxValue;
+    const char* description;
+  } kBudgetDirectives[] = {
+      {L"match-limit", offsetof(MatchBudget, matchLimit), UINT32_MAX, "a match limit"},
+      {L"depth-limit", offsetof(MatchBudget, depthLimit), UINT32_MAX, "a depth limit"},
+      {L"heap-limit", offsetof(MatchBudget, heapLimitKib), UINT32_MAX, "a heap limit in KiB"},
+      {L"time-limit", offsetof(MatchBudget, timeLimitMs), MAX_TIME_LIMIT_MS, "a time limit in milliseconds"},
+  };
+
+  *outHandled = false;
+  for (size_t i = 0; i < sizeof(kBudgetDirectives) / sizeof(kBudgetDirectives[0]); ++i) {
+    const wchar_t* value = NULL;
+    size_t valueLength = 0;
+    if (!parse_directive(line, length, kBudgetDirectives[i].keyword, &value, &valueLength)) {
+      continue;
+    }
+
+    *outHandled = true;
+    uint64_t parsedValue = 0;
+    if (!parse_unsigned_value(value, valueLength, kBudgetDirectives[i].maxValue, &parsedValue) || parsedValue == 0) {
+      set_rule_load_error(error, lineNumber, "Expected %s from 1 to %llu", kBudgetDirectives[i].description,
+                          (unsigned long long) kBudgetDirectives[i].maxValue);
+      return false;
+    }
+    *(uint32_t*) ((char*) budget + kBudgetDirectives[i].offset) = (uint32_t) parsedValue;
+    return true;
+  }
+  return true;
+}
+
+// Handles `min-length`, `max-length`, `requires-line-count` and `if-contains`. `guard` is NULL outside a rule. Returns
+// false with `error` set for a bad directive; `*outHandled` reports whether `line` was a guard directive at all.
+static bool parse_guard_directive(const wchar_t* line, size_t length, RuleArena* arena, RuleGuard* guard,
+                                  size_t lineNumber, RuleLoadError* error, bool* outHandled) {
+  static const struct {
+    const wchar_t* keyword;
+    size_t offset;
+    const char* description;
+  } kGuardDirectives[] = {
+      {L"min-length", offsetof(RuleGuard, minLength), "a minimum length in code units"},
+      {L"max-length", offsetof(RuleGuard, maxLength), "a maximum length in code units"},
+      {L"requires-line-count", offsetof(RuleGuard, minLineCount), "a minimum line count"},
+  };
+
+  const wchar_t* value = NULL;
+  size_t valueLength = 0;
+  size_t directive = 0;
+  size_t directiveCount = sizeof(kGuardDirectives) / sizeof(kGuardDirectives[0]);
+  while (directive < directiveCount &&
+         !parse_directive(line, length, kGuardDirectives[directive].keyword, &value, &valueLength)) {
+    directive++;
+  }
+  *outHandled = directive < directiveCount || parse_directive(line, length, L"if-contains", &value, &valueLength);
+  if (!*outHandled) {
+    return true;
+  }
+  if (!guard) {
+    set_rule_load_error(error, lineNumber, "Guard directives must appear inside a rule");
+    return false;
+  }
+
+  if (directive == directiveCount) {
+    if (guard->requiredText) {
+      set_rule_load_error(error, lineNumber, "Rule may contain only one if-contains directive");
+      return false;
+    }
+    guard->requiredText = rule_arena_duplicate_wide_range(arena, value, valueLength);
+    if (!guard->requiredText) {
+      set_rule_load_error(error, lineNumber, "Out of memory while reading rule guard");
+      return false;
+    }
+    guard->requiredTextLength = valueLength;
+    return true;
+  }
+
+  uint64_t parsedValue = 0;
+  if (!parse_unsigned_value(value, valueLength, SIZE_MAX, &parsedValue) || parsedValue == 0) {
+    set_rule_load_error(error, lineNumber, "Expected %s of at least 1", kGuardDirectives[directive].description);
+    return false;
+  }
+  *(size_t*) ((char*) guard + kGuardDirectives[directive].offset) = (size_t) parsedValue;
+  return true;
+}
+
 static bool parse_rule_set_text(const wchar_t* text, size_t length, RuleSet* outRuleSet, RuleLoadError* error) {
   RuleSet parsed = {0};
   RegexRule currentRule = {0};
   bool hasOpenRule = false;
   size_t currentRuleLineNumber = 0;
-  wchar_t* blockToken = NULL;
+  size_t ruleCapacity = 0;
+  size_t patternCapacity = 0; // of currentRule.patterns
+  const wchar_t* blockToken = NULL;
+  size_t blockTokenLength = 0;
   size_t blockBodyStart = 0;
   size_t blockLineNumber = 0;
-  enum { BLOCK_NONE, BLOCK_PATTERN, BLOCK_REPLACE } blockType = BLOCK_NONE;
+  enum { BLOCK_NONE, BLOCK_PATTERN, BLOCK_LITERAL, BLOCK_REPLACE } blockType = BLOCK_NONE;
+  PatternEngine pendingEngine = PATTERN_ENGINE_BACKTRACK;
+  size_t pendingEngineLineNumber = 0; // nonzero while an `engine` directive waits for its pattern
 
   size_t position = 0;
   size_t lineNumber = 1;
@@ -705,7 +1978,7 @@ static bool parse_rule_set_text(const wchar_t* text, size_t length, RuleSet* out
 
     if (blockType != BLOCK_NONE) {
       size_t rawLength = lineEnd - lineStart;
-      if (rawLength == wcslen(blockToken) && wmemcmp(text + lineStart, blockToken, rawLength) == 0) {
+      if (rawLength == blockTokenLength && wmemcmp(text + lineStart, blockToken, rawLength) == 0) {
         size_t bodyLength = lineStart - blockBodyStart;
         if (bodyLength > 0) {
           if (text[lineStart - 1] == L'\n') {
@@ -717,23 +1990,32 @@ static bool parse_rule_set_text(const wchar_t* text, size_t length, RuleSet* out
             bodyLength--;
           }
         }
-        wchar_t* body = duplicate_wide_range(text + blockBodyStart, bodyLength);
-        if (!body) {
-          set_rule_load_error(error, blockLineNumber, "Out of memory while reading rule block");
-          goto fail;
-        }
-
         if (blockType == BLOCK_PATTERN) {
-          if (!append_pattern_to_rule(&currentRule, body, bodyLength, blockLineNumber, error)) {
+          if (!append_pattern_to_rule(&parsed.arena, &currentRule, &patternCapacity, text + blockBodyStart,
+                                      bodyLength, blockLineNumber, pendingEngine, error)) {
+            goto fail;
+          }
+          pendingEngine = PATTERN_ENGINE_BACKTRACK;
+          pendingEngineLineNumber = 0;
+        } else if (blockType == BLOCK_LITERAL) {
+          if (bodyLength == 0) {
+            set_rule_load_error(error, blockLineNumber, "Literal block must not be empty");
+            goto fail;
+          }
+          if (!append_pattern_to_rule(&parsed.arena, &currentRule, &patternCapacity, text + blockBodyStart,
+                                      bodyLength, blockLineNumber, PATTERN_ENGINE_LITERAL, error)) {
             goto fail;
           }
         } else {
-          currentRule.replacement = body;
+          currentRule.replacement = rule_arena_duplicate_wide_range(&parsed.arena, text + blockBodyStart, bodyLength);
+          if (!currentRule.replacement) {
+            set_rule_load_error(error, blockLineNumber, "Out of memory while reading rule block");
+            goto fail;
+          }
           currentRule.replacementLength = bodyLength;
           currentRule.replaceLineNumber = blockLineNumber;
         }
 
-        free(blockToken);
         blockToken = NULL;
         blockType = BLOCK_NONE;
       }
@@ -760,37 +2042,153 @@ static bool parse_rule_set_text(const wchar_t* text, size_t length, RuleSet* out
 
     const wchar_t* trimmed = text + trimmedStart;
     size_t trimmedLength = trimmedEnd - trimmedStart;
+    const wchar_t* directiveValue = NULL;
+    size_t directiveValueLength = 0;
+    bool isBudgetDirective = false;
+    // Budgets before the first rule apply to the whole rule set; inside a rule they override it for that rule.
+    if (!parse_budget_directive(trimmed, trimmedLength, hasOpenRule ? &currentRule.budget : &parsed.budget, lineNumber,
+                                error, &isBudgetDirective)) {
+      goto fail;
+    }
+    if (isBudgetDirective) {
+      lineNumber++;
+      position = nextLineStart;
+      continue;
+    }
+    bool isGuardDirective = false;
+    if (!parse_guard_directive(trimmed, trimmedLength, &parsed.arena, hasOpenRule ? &currentRule.guard : NULL,
+                               lineNumber, error, &isGuardDirective)) {
+      goto fail;
+    }
+    if (isGuardDirective) {
+      lineNumber++;
+      position = nextLineStart;
+      continue;
+    }
 
     if (trimmedLength == 4 && wmemcmp(trimmed, L"rule", 4) == 0) {
-      if (hasOpenRule && !append_rule_to_set(&parsed, &currentRule, currentRuleLineNumber, error)) {
+      if (pendingEngineLineNumber != 0) {
+        set_rule_load_error(error, pendingEngineLineNumber, "Engine directive must be followed by a pattern block");
+        goto fail;
+      }
+      if (hasOpenRule && !append_rule_to_set(&parsed, &ruleCapacity, &currentRule, currentRuleLineNumber, error)) {
         goto fail;
       }
+      patternCapacity = 0;
       hasOpenRule = true;
       currentRuleLineNumber = lineNumber;
+    } else if (parse_directive(trimmed, trimmedLength, L"debounce", &directiveValue, &directiveValueLength)) {
+      uint64_t debounceMs = 0;
+      if (!parse_unsigned_value(directiveValue, directiveValueLength, MAX_DEBOUNCE_MS, &debounceMs)) {
+        set_rule_load_error(error, lineNumber, "Debounce must be a whole number of milliseconds from 0 to %u",
+                            MAX_DEBOUNCE_MS);
+        goto fail;
+      }
+      parsed.hasDebounceSetting = true;
+      parsed.debounceMs = (DWORD) debounceMs;
+    } else if (parse_directive(trimmed, trimmedLength, L"surrogates", &directiveValue, &directiveValueLength)) {
+      if (directiveValueLength == 6 && wmemcmp(directiveValue, L"repair", 6) == 0) {
+        parsed.surrogatePolicy = SURROGATE_POLICY_REPAIR;
+      } else if (directiveValueLength == 6 && wmemcmp(directiveValue, L"reject", 6) == 0) {
+        parsed.surrogatePolicy = SURROGATE_POLICY_REJECT;
+      } else {
+        set_rule_load_error(error, lineNumber,
+                            "Unknown surrogate policy; expected `surrogates repair` or `surrogates reject`");
+        goto fail;
+      }
+    } else if (parse_directive(trimmed, trimmedLength, L"builtin", &directiveValue, &directiveValueLength)) {
+      if (!hasOpenRule) {
+        set_rule_load_error(error, lineNumber, "Builtin directive must appear inside a rule");
+        goto fail;
+      }
+      if (directiveValueLength != 13 || wmemcmp(directiveValue, L"trim-trailing", 13) != 0) {
+        set_rule_load_error(error, lineNumber, "Unknown builtin; expected `builtin trim-trailing`");
+        goto fail;
+      }
+      if (rule_is_literal(&currentRule)) {
+        set_rule_load_error(error, lineNumber, "Rule cannot mix literal blocks with pattern blocks");
+        goto fail;
+      }
+      size_t sourceLength = sizeof(kTrimTrailingPattern) / sizeof(kTrimTrailingPattern[0]) - 1;
+      if (!append_pattern_to_rule(&parsed.arena, &currentRule, &patternCapacity, kTrimTrailingPattern, sourceLength,
+                                  lineNumber, pendingEngine, error)) {
+        goto fail;
+      }
+      pendingEngine = PATTERN_ENGINE_BACKTRACK;
+      pendingEngineLineNumber = 0;
+    } else if (parse_directive(trimmed, trimmedLength, L"scope", &directiveValue, &directiveValueLength)) {
+      if (!hasOpenRule) {
+        set_rule_load_error(error, lineNumber, "Scope directive must appear inside a rule");
+        goto fail;
+      }
+      if (directiveValueLength == 4 && wmemcmp(directiveValue, L"line", 4) == 0) {
+        currentRule.lineScoped = true;
+      } else if (directiveValueLength == 6 && wmemcmp(directiveValue, L"buffer", 6) == 0) {
+        currentRule.lineScoped = false;
+      } else {
+        set_rule_load_error(error, lineNumber, "Unknown scope; expected `scope line` or `scope buffer`");
+        goto fail;
+      }
+    } else if (parse_directive(trimmed, trimmedLength, L"engine", &directiveValue, &directiveValueLength)) {
+      if (!hasOpenRule) {
+        set_rule_load_error(error, lineNumber, "Engine directive must appear inside a rule");
+        goto fail;
+      }
+      if (directiveValueLength == 3 && wmemcmp(directiveValue, L"dfa", 3) == 0) {
+        pendingEngine = PATTERN_ENGINE_DFA;
+      } else if (directiveValueLength == 9 && wmemcmp(directiveValue, L"backtrack", 9) == 0) {
+        pendingEngine = PATTERN_ENGINE_BACKTRACK;
+      } else {
+        set_rule_load_error(error, lineNumber, "Unknown engine; expected `engine dfa` or `engine backtrack`");
+        goto fail;
+      }
+      pendingEngineLineNumber = lineNumber;
     } else {
-      wchar_t* token = NULL;
-      if (parse_block_header(trimmed, trimmedLength, L"pattern", &token)) {
+      const wchar_t* token = NULL;
+      size_t tokenLength = 0;
+      if (parse_block_header(trimmed, trimmedLength, L"pattern", &token, &tokenLength)) {
         if (!hasOpenRule) {
-          free(token);
           set_rule_load_error(error, lineNumber, "Pattern block must appear inside a rule");
           goto fail;
         }
+        if (rule_is_literal(&currentRule)) {
+          set_rule_load_error(error, lineNumber, "Rule cannot mix literal blocks with pattern blocks");
+          goto fail;
+        }
         blockToken = token;
+        blockTokenLength = tokenLength;
         blockType = BLOCK_PATTERN;
         blockBodyStart = nextLineStart;
         blockLineNumber = lineNumber;
-      } else if (parse_block_header(trimmed, trimmedLength, L"replace", &token)) {
+      } else if (parse_block_header(trimmed, trimmedLength, L"literal", &token, &tokenLength)) {
+        if (!hasOpenRule) {
+          set_rule_load_error(error, lineNumber, "Literal block must appear inside a rule");
+          goto fail;
+        }
+        if (pendingEngineLineNumber != 0) {
+          set_rule_load_error(error, pendingEngineLineNumber, "Engine directive must be followed by a pattern block");
+          goto fail;
+        }
+        if (currentRule.patternCount > 0 && !rule_is_literal(&currentRule)) {
+          set_rule_load_error(error, lineNumber, "Rule cannot mix literal blocks with pattern blocks");
+          goto fail;
+        }
+        blockToken = token;
+        blockTokenLength = tokenLength;
+        blockType = BLOCK_LITERAL;
+        blockBodyStart = nextLineStart;
+        blockLineNumber = lineNumber;
+      } else if (parse_block_header(trimmed, trimmedLength, L"replace", &token, &tokenLength)) {
         if (!hasOpenRule) {
-          free(token);
           set_rule_load_error(error, lineNumber, "Replace block must appear inside a rule");
           goto fail;
         }
         if (currentRule.replacement) {
-          free(token);
           set_rule_load_error(error, lineNumber, "Rule may contain only one replace block");
           goto fail;
         }
         blockToken = token;
+        blockTokenLength = tokenLength;
         blockType = BLOCK_REPLACE;
         blockBodyStart = nextLineStart;
         blockLineNumber = lineNumber;
@@ -808,8 +2206,12 @@ static bool parse_rule_set_text(const wchar_t* text, size_t length, RuleSet* out
     set_rule_load_error(error, blockLineNumber, "Unterminated block");
     goto fail;
   }
+  if (pendingEngineLineNumber != 0) {
+    set_rule_load_error(error, pendingEngineLineNumber, "Engine directive must be followed by a pattern block");
+    goto fail;
+  }
 
-  if (hasOpenRule && !append_rule_to_set(&parsed, &currentRule, currentRuleLineNumber, error)) {
+  if (hasOpenRule && !append_rule_to_set(&parsed, &ruleCapacity, &currentRule, currentRuleLineNumber, error)) {
     goto fail;
   }
 
@@ -817,466 +2219,4421 @@ static bool parse_rule_set_text(const wchar_t* text, size_t length, RuleSet* out
   return true;
 
 fail:
-  free(blockToken);
-  free_regex_rule(&currentRule);
   free_rule_set(&parsed);
   return false;
 }
 
-static bool compile_rule_set(RuleSet* ruleSet, RuleLoadError* error) {
-  pcre2_compile_context* context = pcre2_compile_context_create(NULL);
-  if (!context) {
-    set_rule_load_error(error, 1, "Out of memory while creating regex compile context");
-    return false;
-  }
-
-  if (pcre2_set_newline(context, PCRE2_NEWLINE_ANY) != 0) {
-    pcre2_compile_context_free(context);
-    set_rule_load_error(error, 1, "Unable to configure regex newline mode");
-    return false;
+static bool code_unit_has_case(pcre2_code* casedProbe, pcre2_match_data* probeData, uint32_t unit) {
+  if (unit >= 0xD800 && unit <= 0xDFFF) {
+    // A lone surrogate says nothing about the case of the full character it belongs to.
+    return true;
   }
+  PCRE2_UCHAR subject[1] = {(PCRE2_UCHAR) unit};
+  return pcre2_match(casedProbe, subject, 1, 0, 0, probeData, NULL) >= 0;
+}
 
-  for (size_t ruleIndex = 0; ruleIndex < ruleSet->ruleCount; ++ruleIndex) {
-    RegexRule* rule = &ruleSet->rules[ruleIndex];
-    for (size_t patternIndex = 0; patternIndex < rule->patternCount; ++patternIndex) {
-      RegexPattern* pattern = &rule->patterns[patternIndex];
-      int compileError = 0;
-      PCRE2_SIZE errorOffset = 0;
-
-      pattern->code = pcre2_compile((PCRE2_SPTR) pattern->source, pattern->sourceLength, PCRE2_UTF | PCRE2_UCP,
-                                    &compileError, &errorOffset, context);
-      if (!pattern->code) {
-        PCRE2_UCHAR messageBuffer[256];
-        int messageLength = pcre2_get_error_message(compileError, messageBuffer,
-                                                    sizeof(messageBuffer) / sizeof(messageBuffer[0]));
-        char* utf8Message = NULL;
-        if (messageLength > 0) {
-          utf8Message = utf8_from_wide_length((const wchar_t*) messageBuffer, (size_t) messageLength);
-        }
-
-        set_rule_load_error(error, pattern->lineNumber, "Pattern compile error at offset %zu: %s",
-                            (size_t) errorOffset, utf8Message ? utf8Message : "Unknown regex error");
-        free(utf8Message);
-        pcre2_compile_context_free(context);
-        return false;
-      }
+static bool describe_required_code_unit(pcre2_code* casedProbe, pcre2_match_data* probeData, uint32_t unit,
+                                        RequiredCodeUnit* outRequired) {
+  // PCRE2 may mark a first or last code unit caseless even without (?i), e.g. for [Ww]ord, and pattern_info does
+  // not say so. ASCII letters therefore also accept their case partners, including the two non-ASCII characters
+  // that Unicode folds onto k and s. Other cased units are not used for prefiltering.
+  outRequired->unitCount = 0;
+  outRequired->units[outRequired->unitCount++] = (uint16_t) unit;
+  if ((unit >= L'a' && unit <= L'z') || (unit >= L'A' && unit <= L'Z')) {
+    outRequired->units[outRequired->unitCount++] = (uint16_t) (unit ^ 0x20u);
+    if (unit == L'k' || unit == L'K') {
+      outRequired->units[outRequired->unitCount++] = 0x212A;
+    } else if (unit == L's' || unit == L'S') {
+      outRequired->units[outRequired->unitCount++] = 0x017F;
     }
+    return true;
   }
-
-  pcre2_compile_context_free(context);
-  return true;
+  return !code_unit_has_case(casedProbe, probeData, unit);
 }
 
-static bool load_rule_set_from_file(const wchar_t* path, RuleSet* outRuleSet, RuleLoadError* error) {
-  ClipboardBuffer fileContents = {0};
-  RuleSet parsed = {0};
-
-  if (!read_utf8_file(path, &fileContents, error)) {
-    return false;
+static void extract_pattern_prefilter(RegexPattern* pattern, pcre2_code* casedProbe, pcre2_match_data* probeData) {
+  uint32_t codeType = 0;
+  uint32_t codeUnit = 0;
+  if (pcre2_pattern_info(pattern->code, PCRE2_INFO_FIRSTCODETYPE, &codeType) == 0 && codeType == 1 &&
+      pcre2_pattern_info(pattern->code, PCRE2_INFO_FIRSTCODEUNIT, &codeUnit) == 0 &&
+      describe_required_code_unit(casedProbe, probeData, codeUnit,
+                                  &pattern->requiredUnits[pattern->requiredUnitCount])) {
+    pattern->requiredUnitCount++;
   }
-  if (!parse_rule_set_text(fileContents.text, fileContents.length, &parsed, error)) {
-    free_clipboard_buffer(&fileContents);
-    return false;
+
+  uint32_t lastCodeUnit = 0;
+  if (pcre2_pattern_info(pattern->code, PCRE2_INFO_LASTCODETYPE, &codeType) == 0 && codeType == 1 &&
+      pcre2_pattern_info(pattern->code, PCRE2_INFO_LASTCODEUNIT, &lastCodeUnit) == 0 &&
+      (pattern->requiredUnitCount == 0 || lastCodeUnit != codeUnit) &&
+      describe_required_code_unit(casedProbe, probeData, lastCodeUnit,
+                                  &pattern->requiredUnits[pattern->requiredUnitCount])) {
+    pattern->requiredUnitCount++;
   }
-  if (!compile_rule_set(&parsed, error)) {
-    free_clipboard_buffer(&fileContents);
-    free_rule_set(&parsed);
-    return false;
+
+  const uint8_t* firstBitmap = NULL;
+  if (pcre2_pattern_info(pattern->code, PCRE2_INFO_FIRSTBITMAP, &firstBitmap) == 0) {
+    pattern->firstBitmap = firstBitmap;
   }
+}
 
-  free_clipboard_buffer(&fileContents);
-  *outRuleSet = parsed;
-  return true;
+static bool source_has_prefix(const wchar_t* text, size_t length, const wchar_t* prefix) {
+  size_t prefixLength = wcslen(prefix);
+  return length >= prefixLength && wmemcmp(text, prefix, prefixLength) == 0;
 }
 
-static bool generate_default_rules_file(void) {
-  if (!g_executableDirectory) {
-    log_info("Unable to generate default replacement config: executable directory unavailable");
-    return false;
+// True when the source holds `\<letter>` as an escape, i.e. preceded by an odd number of backslashes.
+static bool pattern_source_has_escape(const RegexPattern* pattern, wchar_t letter) {
+  for (size_t i = 0; i + 1 < pattern->sourceLength; ++i) {
+    if (pattern->source[i] == L'\\') {
+      if (pattern->source[i + 1] == letter) {
+        return true;
+      }
+      ++i;
+    }
   }
+  return false;
+}
 
-  wchar_t* path = join_path(g_executableDirectory, kRulesFileName);
-  if (!path) {
-    log_info("Out of memory while preparing default replacement config path");
-    return false;
+// A pattern whose replacement is never longer than its shortest match can write its output over the text it scans,
+// provided nothing it overwrites is read again. Later matches only look behind their start through lookbehinds, \b
+// and \B (all counted by MAXLOOKBEHIND, in characters of up to two units each) and multiline ^, which checks up to
+// two units for a newline; the result is how many units before a match start to leave untouched. MINLENGTH ignores
+// \K, which can shorten a match below it, so such patterns are left out. Returns 0 when the pattern cannot compact.
+static uint32_t pattern_compact_guard(const RegexPattern* pattern, size_t replacementLength) {
+  uint32_t minLength = 0;
+  uint32_t maxLookbehind = 0;
+  if (pcre2_pattern_info(pattern->code, PCRE2_INFO_MINLENGTH, &minLength) != 0 ||
+      pcre2_pattern_info(pattern->code, PCRE2_INFO_MAXLOOKBEHIND, &maxLookbehind) != 0) {
+    return 0;
+  }
+  if (replacementLength > minLength || maxLookbehind > (COMPACT_MAX_GUARD_UNITS - 2) / 2 ||
+      pattern_source_has_escape(pattern, L'K')) {
+    return 0;
   }
+  return 2 * maxLookbehind + 2;
+}
 
-  HANDLE file = CreateFileW(path, GENERIC_WRITE, 0, NULL, CREATE_NEW, FILE_ATTRIBUTE_NORMAL, NULL);
-  if (file == INVALID_HANDLE_VALUE) {
-    DWORD lastError = GetLastError();
-    if (lastError == ERROR_FILE_EXISTS || lastError == ERROR_ALREADY_EXISTS) {
-      free(path);
-      return true;
+// pcre2_dfa_match only reports an unsupported item once a match attempt reaches it, so `engine dfa` patterns are
+// checked when the rules load instead, before they are compiled, by scanning the source. The scan skips \Q...\E and
+// character classes and may over-reject inside (?x) comments; find_dfa_unsupported_code backs it up once the pattern
+// compiles, and anything both miss still fails cleanly at match time. Returns NULL when the pattern is safe to run
+// with the DFA matcher.
+static const char* find_dfa_unsupported_construct(const RegexPattern* pattern) {
+  static const struct {
+    const wchar_t* prefix;
+    const char* description;
+  } kUnsupportedGroups[] = {
+      {L"(*ACCEPT", "backtracking control verbs"},
+      {L"(*COMMIT", "backtracking control verbs"},
+      {L"(*PRUNE", "backtracking control verbs"},
+      {L"(*SKIP", "backtracking control verbs"},
+      {L"(*THEN", "backtracking control verbs"},
+      {L"(*MARK", "backtracking control verbs"},
+      {L"(*:", "backtracking control verbs"},
+      {L"(?*", "non-atomic assertions"},
+      {L"(?<*", "non-atomic assertions"},
+      {L"(*napla:", "non-atomic assertions"},
+      {L"(*naplb:", "non-atomic assertions"},
+      {L"(*non_atomic_", "non-atomic assertions"},
+      {L"(*sr:", "script runs"},
+      {L"(*asr:", "script runs"},
+      {L"(*script_run:", "script runs"},
+      {L"(*atomic_script_run:", "script runs"},
+      {L"(*scs:", "scan substring assertions"},
+      {L"(*scan_substring:", "scan substring assertions"},
+      {L"(?P=", "back references"},
+  };
+
+  const wchar_t* source = pattern->source;
+  size_t length = pattern->sourceLength;
+  size_t i = 0;
+  while (i < length) {
+    if (source[i] == L'\\' && i + 1 < length) {
+      wchar_t escape = source[i + 1];
+      wchar_t next = i + 2 < length ? source[i + 2] : L'\0';
+      if (escape == L'K') {
+        return "\\K";
+      }
+      if (escape == L'C') {
+        return "\\C";
+      }
+      if ((escape >= L'1' && escape <= L'9') ||
+          (escape == L'g' && ((next >= L'0' && next <= L'9') || next == L'{' || next == L'-' || next == L'+')) ||
+          (escape == L'k' && (next == L'<' || next == L'\'' || next == L'{'))) {
+        return "back references";
+      }
+      if (escape == L'Q') {
+        i += 2;
+        while (i < length && !(source[i] == L'\\' && i + 1 < length && source[i + 1] == L'E')) {
+          i++;
+        }
+      }
+      i += 2;
+      continue;
     }
-
-    char* utf8Path = utf8_from_wide(path);
+    if (source[i] == L'[') {
+      // A `]` right after `[` or `[^` is a literal member; POSIX names like [:alpha:] nest one level.
+      i++;
+      if (i < length && source[i] == L'^') {
+        i++;
+      }
+      if (i < length && source[i] == L']') {
+        i++;
+      }
+      while (i < length && source[i] != L']') {
+        if (source[i] == L'\\') {
+          i++;
+        } else if (source[i] == L'[' && i + 1 < length && source[i + 1] == L':') {
+          i += 2;
+          while (i < length && !(source[i] == L':' && i + 1 < length && source[i + 1] == L']')) {
+            i++;
+          }
+          i++;
+        }
+        i++;
+      }
+      i++;
+      continue;
+    }
+    if (source[i] == L'(') {
+      const wchar_t* group = source + i;
+      size_t remaining = length - i;
+      for (size_t j = 0; j < sizeof(kUnsupportedGroups) / sizeof(kUnsupportedGroups[0]); ++j) {
+        if (source_has_prefix(group, remaining, kUnsupportedGroups[j].prefix)) {
+          return kUnsupportedGroups[j].description;
+        }
+      }
+      // (?(?=...) assertion conditions, (?(R) and (?(DEFINE) are supported; tests of groups or named recursions are not.
+      if (source_has_prefix(group, remaining, L"(?(") && !source_has_prefix(group, remaining, L"(?(?") &&
+          !source_has_prefix(group, remaining, L"(?(R)") && !source_has_prefix(group, remaining, L"(?(DEFINE)")) {
+        return "conditions on capture groups";
+      }
+    }
+    i++;
+  }
+  return NULL;
+}
+
+// The compiled counterpart of find_dfa_unsupported_construct, for what the source scan can only approximate.
+static const char* find_dfa_unsupported_code(const RegexPattern* pattern) {
+  uint32_t backReferenceMax = 0;
+  if (pcre2_pattern_info(pattern->code, PCRE2_INFO_BACKREFMAX, &backReferenceMax) == 0 && backReferenceMax > 0) {
+    return "back references";
+  }
+  uint32_t hasBackslashC = 0;
+  if (pcre2_pattern_info(pattern->code, PCRE2_INFO_HASBACKSLASHC, &hasBackslashC) == 0 && hasBackslashC) {
+    return "\\C";
+  }
+  return NULL;
+}
+
+// Catches the mistakes a rules file most often holds without compiling the pattern: a trailing backslash, an
+// unterminated character class and unbalanced parentheses. It skips escapes, \Q...\E, classes and (?#...) comments,
+// and stops at the first option setting that holds `x`, since extended-mode comments can hold anything. Whatever
+// it lets through is reported when the pattern compiles. Returns NULL when it finds nothing, else the error, with
+// its offset in `outOffset`.
+static const char* find_pattern_syntax_error(const RegexPattern* pattern, size_t* outOffset) {
+  const wchar_t* source = pattern->source;
+  size_t length = pattern->sourceLength;
+  size_t depth = 0;
+  size_t i = 0;
+  while (i < length) {
+    if (source[i] == L'\\') {
+      if (i + 1 == length) {
+        *outOffset = i;
+        return "\\ at end of pattern";
+      }
+      if (source[i + 1] == L'Q') {
+        i += 2;
+        while (i < length && !(source[i] == L'\\' && i + 1 < length && source[i + 1] == L'E')) {
+          i++;
+        }
+      } else if (source[i + 1] == L'c') {
+        i++; // \c takes the next character, whatever it is, as its argument
+      }
+      i += 2;
+      continue;
+    }
+    if (source[i] == L'[') {
+      size_t classStart = i;
+      i++;
+      if (i < length && source[i] == L'^') {
+        i++;
+      }
+      if (i < length && source[i] == L']') {
+        i++;
+      }
+      while (i < length && source[i] != L']') {
+        if (source[i] == L'\\') {
+          i++;
+        } else if (source[i] == L'[' && i + 1 < length && source[i + 1] == L':') {
+          size_t close = i + 2;
+          while (close + 1 < length && !(source[close] == L':' && source[close + 1] == L']')) {
+            close++;
+          }
+          if (close + 1 < length) {
+            i = close + 1;
+          }
+        }
+        i++;
+      }
+      if (i >= length) {
+        *outOffset = classStart;
+        return "missing terminating ] for character class";
+      }
+      i++;
+      continue;
+    }
+    if (source[i] == L'(') {
+      if (source_has_prefix(source + i, length - i, L"(?#")) {
+        size_t commentStart = i;
+        while (i < length && source[i] != L')') {
+          i++;
+        }
+        if (i == length) {
+          *outOffset = commentStart;
+          return "missing ) after (?# comment";
+        }
+        i++;
+        continue;
+      }
+      if (source_has_prefix(source + i, length - i, L"(?")) {
+        size_t option = i + 2;
+        while (option < length && ((source[option] >= L'a' && source[option] <= L'z') ||
+                                   (source[option] >= L'A' && source[option] <= L'Z') || source[option] == L'-' ||
+                                   source[option] == L'^')) {
+          if (source[option] == L'x') {
+            return NULL;
+          }
+          option++;
+        }
+      }
+      depth++;
+    } else if (source[i] == L')') {
+      if (depth == 0) {
+        *outOffset = i;
+        return "unmatched closing parenthesis";
+      }
+      depth--;
+    }
+    i++;
+  }
+  if (depth > 0) {
+    *outOffset = length;
+    return "missing closing parenthesis";
+  }
+  return NULL;
+}
+
+static int compare_literal_entries(const void* lhs, const void* rhs) {
+  const LiteralEntry* left = (const LiteralEntry*) lhs;
+  const LiteralEntry* right = (const LiteralEntry*) rhs;
+  uint32_t commonLength = left->length < right->length ? left->length : right->length;
+  for (uint32_t i = 0; i < commonLength; ++i) {
+    if (left->text[i] != right->text[i]) {
+      return (uint16_t) left->text[i] < (uint16_t) right->text[i] ? -1 : 1;
+    }
+  }
+  if (left->length != right->length) {
+    return left->length < right->length ? -1 : 1;
+  }
+  return left->ruleIndex < right->ruleIndex ? -1 : left->ruleIndex > right->ruleIndex ? 1 : 0;
+}
+
+// Returns the state reached from `state` over an edge labelled `unit`, or 0 when there is no such edge.
+static uint32_t literal_state_child(const LiteralAutomaton* automaton, uint32_t state, uint16_t unit) {
+  const LiteralState* from = &automaton->states[state];
+  const uint16_t* units = automaton->edgeUnits + from->firstEdge;
+  uint32_t low = 0;
+  uint32_t high = from->edgeCount;
+  while (low < high) {
+    uint32_t middle = low + (high - low) / 2;
+    if (units[middle] < unit) {
+      low = middle + 1;
+    } else {
+      high = middle;
+    }
+  }
+  return low < from->edgeCount && units[low] == unit ? automaton->edgeTargets[from->firstEdge + low] : 0;
+}
+
+static uint32_t literal_automaton_step(const LiteralAutomaton* automaton, uint32_t state, uint16_t unit) {
+  while (state != 0) {
+    uint32_t child = literal_state_child(automaton, state, unit);
+    if (child != 0) {
+      return child;
+    }
+    state = automaton->states[state].failure;
+  }
+  return automaton->rootTargets[unit];
+}
+
+// Builds the automaton for rules [firstRule, firstRule + ruleCount), which must all be literal rules. Sorting the
+// entries first lets the trie be laid out breadth-first in one pass: every state owns the contiguous range of
+// entries that share its prefix, and its children split that range by the next code unit.
+static LiteralAutomaton* build_literal_automaton(const RuleSet* ruleSet, size_t firstRule, size_t ruleCount,
+                                                 RuleLoadError* error) {
+  LiteralAutomaton* automaton = (LiteralAutomaton*) calloc(1, sizeof(LiteralAutomaton));
+  size_t entryCount = 0;
+  size_t maxStates = 1;
+  for (size_t i = firstRule; i < firstRule + ruleCount; ++i) {
+    const RegexRule* rule = &ruleSet->rules[i];
+    entryCount += rule->patternCount;
+    for (size_t j = 0; j < rule->patternCount; ++j) {
+      maxStates += rule->patterns[j].sourceLength;
+    }
+  }
+  // Rules files are capped at INT_MAX bytes, so state, edge and entry numbers always fit in 32 bits.
+  if (automaton) {
+    automaton->entries = (LiteralEntry*) malloc(entryCount * sizeof(LiteralEntry));
+    automaton->states = (LiteralState*) calloc(maxStates, sizeof(LiteralState));
+    automaton->edgeUnits = (uint16_t*) malloc(maxStates * sizeof(uint16_t));
+    automaton->edgeTargets = (uint32_t*) malloc(maxStates * sizeof(uint32_t));
+    automaton->rootTargets = (uint32_t*) calloc(65536, sizeof(uint32_t));
+    automaton->ruleStamps = (uint32_t*) calloc(ruleCount, sizeof(uint32_t));
+    automaton->entryStamps = (uint32_t*) calloc(entryCount, sizeof(uint32_t));
+  }
+  // The entries each state covers during construction: range starts in the first half, range ends in the second.
+  uint32_t* ranges = (uint32_t*) malloc(maxStates * 2 * sizeof(uint32_t));
+  if (!automaton || !automaton->entries || !automaton->states || !automaton->edgeUnits || !automaton->edgeTargets ||
+      !automaton->rootTargets || !automaton->ruleStamps || !automaton->entryStamps || !ranges) {
+    free(ranges);
+    free_literal_automaton(automaton);
+    set_rule_load_error(error, ruleSet->rules[firstRule].lineNumber, "Out of memory while building literal rules");
+    return NULL;
+  }
+  automaton->firstRule = firstRule;
+  automaton->ruleCount = ruleCount;
+  automaton->entryCount = entryCount;
+
+  size_t entryIndex = 0;
+  for (size_t i = firstRule; i < firstRule + ruleCount; ++i) {
+    const RegexRule* rule = &ruleSet->rules[i];
+    for (size_t j = 0; j < rule->patternCount; ++j) {
+      automaton->entries[entryIndex].text = rule->patterns[j].source;
+      automaton->entries[entryIndex].length = (uint32_t) rule->patterns[j].sourceLength;
+      automaton->entries[entryIndex].ruleIndex = (uint32_t) i;
+      entryIndex++;
+    }
+  }
+  qsort(automaton->entries, entryCount, sizeof(LiteralEntry), compare_literal_entries);
+
+  const LiteralEntry* entries = automaton->entries;
+  LiteralState* states = automaton->states;
+  uint32_t* rangeStarts = ranges;
+  uint32_t* rangeEnds = ranges + maxStates;
+  size_t stateCount = 1;
+  size_t edgeCount = 0;
+  rangeStarts[0] = 0;
+  rangeEnds[0] = (uint32_t) entryCount;
+  for (size_t state = 0; state < stateCount; ++state) {
+    uint32_t depth = states[state].depth;
+    uint32_t position = rangeStarts[state];
+    uint32_t end = rangeEnds[state];
+    // Entries that end here sort first; the first of them belongs to the earliest rule.
+    if (position < end && entries[position].length == depth) {
+      states[state].matchEntry = position + 1;
+      while (position < end && entries[position].length == depth) {
+        position++;
+      }
+    }
+    states[state].firstEdge = (uint32_t) edgeCount;
+    while (position < end) {
+      uint16_t unit = (uint16_t) entries[position].text[depth];
+      uint32_t childEnd = position + 1;
+      while (childEnd < end && (uint16_t) entries[childEnd].text[depth] == unit) {
+        childEnd++;
+      }
+      states[stateCount].depth = depth + 1;
+      rangeStarts[stateCount] = position;
+      rangeEnds[stateCount] = childEnd;
+      automaton->edgeUnits[edgeCount] = unit;
+      automaton->edgeTargets[edgeCount] = (uint32_t) stateCount;
+      if (state == 0) {
+        automaton->rootTargets[unit] = (uint32_t) stateCount;
+      }
+      edgeCount++;
+      stateCount++;
+      position = childEnd;
+    }
+    states[state].edgeCount = (uint32_t) edgeCount - states[state].firstEdge;
+  }
+  free(ranges);
+
+  // Breadth-first order means a state's failure target, which is shallower, is final before the state is reached.
+  for (size_t state = 0; state < stateCount; ++state) {
+    for (uint32_t edge = 0; edge < states[state].edgeCount; ++edge) {
+      uint16_t unit = automaton->edgeUnits[states[state].firstEdge + edge];
+      uint32_t child = automaton->edgeTargets[states[state].firstEdge + edge];
+      uint32_t failure = state == 0 ? 0 : literal_automaton_step(automaton, states[state].failure, unit);
+      states[child].failure = failure;
+      if (states[child].matchEntry == 0) {
+        states[child].matchEntry = states[failure].matchEntry;
+      }
+    }
+  }
+
+  // Shared prefixes leave the worst-case arrays partly unused.
+  LiteralState* trimmedStates = (LiteralState*) realloc(states, stateCount * sizeof(LiteralState));
+  if (trimmedStates) {
+    automaton->states = trimmedStates;
+  }
+  automaton->stateCount = stateCount;
+  if (edgeCount > 0) {
+    uint16_t* trimmedUnits = (uint16_t*) realloc(automaton->edgeUnits, edgeCount * sizeof(uint16_t));
+    uint32_t* trimmedTargets = (uint32_t*) realloc(automaton->edgeTargets, edgeCount * sizeof(uint32_t));
+    if (trimmedUnits) {
+      automaton->edgeUnits = trimmedUnits;
+    }
+    if (trimmedTargets) {
+      automaton->edgeTargets = trimmedTargets;
+    }
+  }
+  return automaton;
+}
+
+// Gives the first rule of every run of consecutive literal rules the automaton for the whole run.
+static bool build_literal_runs(RuleSet* ruleSet, RuleLoadError* error) {
+  size_t ruleIndex = 0;
+  while (ruleIndex < ruleSet->ruleCount) {
+    if (!rule_is_literal(&ruleSet->rules[ruleIndex])) {
+      ruleIndex++;
+      continue;
+    }
+    size_t runEnd = ruleIndex + 1;
+    // The run's guard is checked once for the whole dictionary, so a different guard starts a new run.
+    while (runEnd < ruleSet->ruleCount && rule_is_literal(&ruleSet->rules[runEnd]) &&
+           rule_guards_equal(&ruleSet->rules[ruleIndex].guard, &ruleSet->rules[runEnd].guard)) {
+      runEnd++;
+    }
+    ruleSet->rules[ruleIndex].literals = build_literal_automaton(ruleSet, ruleIndex, runEnd - ruleIndex, error);
+    if (!ruleSet->rules[ruleIndex].literals) {
+      return false;
+    }
+    for (size_t i = ruleIndex + 1; i < runEnd; ++i) {
+      ruleSet->rules[ruleIndex].mayBreakUtf |= ruleSet->rules[i].mayBreakUtf;
+    }
+    ruleSet->literalRunCount++;
+    ruleIndex = runEnd;
+  }
+  return true;
+}
+
+static void* counting_pcre2_malloc(PCRE2_SIZE size, void* data) {
+  (void) data;
+  InterlockedIncrement(&g_engineAllocations);
+  return malloc(size);
+}
+
+static void counting_pcre2_free(void* block, void* data) {
+  (void) data;
+  free(block);
+}
+
+// Checks every pattern and builds the automata for literal rules, but leaves pcre2_compile to
+// ensure_pattern_compiled: a large rules file compiles for longer than it takes to parse, and most of its patterns
+// may never meet a text. What can be told from the source alone is checked here, so common mistakes still fail the
+// load. `precompiled` (one code per non-literal pattern in file order, e.g. from the rule cache) is adopted instead
+// of compiling; adopted codes are moved out of the array, so the caller frees only the entries still left non-NULL.
+static bool compile_rule_set(RuleSet* ruleSet, pcre2_code** precompiled, RuleLoadError* error) {
+  ruleSet->compileContext = pcre2_compile_context_create(NULL);
+  // Match data and match context allocate through this, so heap frames show up in g_engineAllocations.
+  ruleSet->matchMemory = pcre2_general_context_create(counting_pcre2_malloc, counting_pcre2_free, NULL);
+  if (!ruleSet->compileContext || !ruleSet->matchMemory) {
+    set_rule_load_error(error, 1, "Out of memory while creating regex compile context");
+    return false;
+  }
+
+  if (pcre2_set_newline(ruleSet->compileContext, PCRE2_NEWLINE_ANY) != 0) {
+    set_rule_load_error(error, 1, "Unable to configure regex newline mode");
+    return false;
+  }
+
+  int probeError = 0;
+  PCRE2_SIZE probeErrorOffset = 0;
+  static const wchar_t kCasedProbe[] = L"\\p{Changes_When_Casemapped}";
+  ruleSet->casedProbe = pcre2_compile((PCRE2_SPTR) kCasedProbe, PCRE2_ZERO_TERMINATED,
+                                      PCRE2_UTF | PCRE2_UCP | PCRE2_ANCHORED, &probeError, &probeErrorOffset, NULL);
+  ruleSet->probeData =
+      ruleSet->casedProbe ? pcre2_match_data_create_from_pattern(ruleSet->casedProbe, NULL) : NULL;
+  if (!ruleSet->probeData) {
+    set_rule_load_error(error, 1, "Out of memory while preparing regex prefilter");
+    return false;
+  }
+  size_t flatPatternIndex = 0;
+
+  for (size_t ruleIndex = 0; ruleIndex < ruleSet->ruleCount; ++ruleIndex) {
+    RegexRule* rule = &ruleSet->rules[ruleIndex];
+    if (rule->lineScoped) {
+      ruleSet->lineScopedRuleCount++;
+    }
+    rule->mayBreakUtf =
+        find_unpaired_surrogate(rule->replacement, 0, rule->replacementLength) != rule->replacementLength;
+    for (size_t patternIndex = 0; patternIndex < rule->patternCount; ++patternIndex) {
+      RegexPattern* pattern = &rule->patterns[patternIndex];
+
+      if (pattern->engine == PATTERN_ENGINE_LITERAL) {
+        if (find_unpaired_surrogate(pattern->source, 0, pattern->sourceLength) != pattern->sourceLength) {
+          rule->mayBreakUtf = true;
+        }
+        ruleSet->literalPatternCount++;
+        continue;
+      }
+      if (precompiled) {
+        pattern->code = precompiled[flatPatternIndex];
+        precompiled[flatPatternIndex++] = NULL;
+      } else {
+        size_t errorOffset = 0;
+        const char* syntaxError = find_pattern_syntax_error(pattern, &errorOffset);
+        if (syntaxError) {
+          set_rule_load_error(error, pattern->lineNumber, "Pattern compile error at offset %zu: %s", errorOffset,
+                              syntaxError);
+          return false;
+        }
+      }
+
+      if (pattern->engine == PATTERN_ENGINE_DFA) {
+        const char* unsupported = find_dfa_unsupported_construct(pattern);
+        if (unsupported) {
+          set_rule_load_error(error, pattern->lineNumber, "Pattern uses %s, which `engine dfa` does not support",
+                              unsupported);
+          return false;
+        }
+        ruleSet->dfaPatternCount++;
+      }
+
+      // \G anchors at wherever a search starts, and segment lanes start searches where serial execution would not.
+      if (rule->lineScoped && pattern_source_has_escape(pattern, L'G')) {
+        set_rule_load_error(error, pattern->lineNumber, "Pattern uses \\G, which `scope line` does not support");
+        return false;
+      }
+
+      if (pattern_source_has_escape(pattern, L'C')) {
+        rule->mayBreakUtf = true;
+      }
+      if (rule->replacementLength == 0 &&
+          pattern->sourceLength == sizeof(kTrimTrailingPattern) / sizeof(kTrimTrailingPattern[0]) - 1 &&
+          wmemcmp(pattern->source, kTrimTrailingPattern, pattern->sourceLength) == 0) {
+        pattern->kernel = PATTERN_KERNEL_TRIM_TRAILING;
+      }
+      pattern->compilePending = true;
+      ruleSet->compilePendingCount++;
+      ruleSet->patternCount++;
+    }
+  }
+
+  if (!build_literal_runs(ruleSet, error)) {
+    return false;
+  }
+
+  ruleSet->matchContext = pcre2_match_context_create(ruleSet->matchMemory);
+  if (ruleSet->budget.matchLimit == 0) {
+    pcre2_config(PCRE2_CONFIG_MATCHLIMIT, &ruleSet->budget.matchLimit);
+  }
+  if (ruleSet->budget.depthLimit == 0) {
+    pcre2_config(PCRE2_CONFIG_DEPTHLIMIT, &ruleSet->budget.depthLimit);
+  }
+  if (ruleSet->budget.heapLimitKib == 0) {
+    pcre2_config(PCRE2_CONFIG_HEAPLIMIT, &ruleSet->budget.heapLimitKib);
+  }
+  // Which patterns can be prefiltered is only known once they compile, so any rule set with patterns gets the map.
+  if (ruleSet->patternCount > 0) {
+    ruleSet->presence = (PresenceMap*) malloc(sizeof(PresenceMap));
+    if (!ruleSet->presence) {
+      set_rule_load_error(error, 1, "Out of memory while preparing regex prefilter");
+      return false;
+    }
+  }
+
+  if (!ruleSet->matchContext) {
+    set_rule_load_error(error, 1, "Out of memory while creating regex match context");
+    return false;
+  }
+
+  if (ruleSet->dfaPatternCount > 0) {
+    ruleSet->dfaWorkspace.slots = (int*) malloc(DFA_WORKSPACE_START_SLOTS * sizeof(int));
+    if (!ruleSet->dfaWorkspace.slots) {
+      set_rule_load_error(error, 1, "Out of memory while creating the DFA workspace");
+      return false;
+    }
+    ruleSet->dfaWorkspace.slotCount = DFA_WORKSPACE_START_SLOTS;
+  }
+
+  if (ruleSet->patternCount > 0) {
+    // Without a dedicated stack, JIT matching is capped at PCRE2's 32 KiB machine-stack default.
+    ruleSet->jitStack = pcre2_jit_stack_create(JIT_STACK_START_SIZE, JIT_STACK_MAX_SIZE, NULL);
+    if (ruleSet->jitStack) {
+      pcre2_jit_stack_assign(ruleSet->matchContext, NULL, ruleSet->jitStack);
+    }
+  }
+  if (ruleSet->compilePendingCount == 0) {
+    release_rule_compile_state(ruleSet);
+  }
+  return true;
+}
+
+// 64-bit FNV-1a.
+static uint64_t hash_bytes(const void* data, size_t length) {
+  uint64_t hash = 14695981039346656037ull;
+  const unsigned char* bytes = (const unsigned char*) data;
+  for (size_t i = 0; i < length; ++i) {
+    hash ^= bytes[i];
+    hash *= 1099511628211ull;
+  }
+  return hash;
+}
+
+static uint64_t hash_rule_text(const wchar_t* text, size_t length) {
+  return hash_bytes(text, length * sizeof(wchar_t));
+}
+
+static void init_rule_cache_header(RuleCacheHeader* header, uint64_t contentHash, size_t patternCount) {
+  memset(header, 0, sizeof(*header));
+  memcpy(header->magic, "CTRC", sizeof(header->magic));
+  header->formatVersion = RULE_CACHE_FORMAT_VERSION;
+  header->pcre2Version = ((uint32_t) PCRE2_MAJOR << 16) | (uint32_t) PCRE2_MINOR;
+  header->pointerSize = (uint32_t) sizeof(void*);
+  header->contentHash = contentHash;
+  header->patternCount = (uint64_t) patternCount;
+}
+
+// Counts the patterns PCRE2 compiles, which are the ones the cache holds.
+static size_t count_rule_set_patterns(const RuleSet* ruleSet) {
+  size_t patternCount = 0;
+  for (size_t i = 0; i < ruleSet->ruleCount; ++i) {
+    if (!rule_is_literal(&ruleSet->rules[i])) {
+      patternCount += ruleSet->rules[i].patternCount;
+    }
+  }
+  return patternCount;
+}
+
+// Produces the cache image for a compiled rule set: a RuleCacheHeader followed by pcre2_serialize_encode output.
+static bool encode_rule_cache(const RuleSet* ruleSet, uint64_t contentHash, uint8_t** outBytes, size_t* outLength) {
+  size_t patternCount = count_rule_set_patterns(ruleSet);
+  if (patternCount == 0 || patternCount > INT32_MAX) {
+    return false;
+  }
+
+  const pcre2_code** codes = (const pcre2_code**) malloc(patternCount * sizeof(*codes));
+  if (!codes) {
+    return false;
+  }
+  size_t flatPatternIndex = 0;
+  for (size_t i = 0; i < ruleSet->ruleCount; ++i) {
+    for (size_t j = 0; j < ruleSet->rules[i].patternCount && !rule_is_literal(&ruleSet->rules[i]); ++j) {
+      codes[flatPatternIndex++] = ruleSet->rules[i].patterns[j].code;
+    }
+  }
+
+  uint8_t* serialized = NULL;
+  PCRE2_SIZE serializedLength = 0;
+  int32_t rc = pcre2_serialize_encode(codes, (int32_t) patternCount, &serialized, &serializedLength, NULL);
+  free(codes);
+  if (rc < 0) {
+    return false;
+  }
+
+  uint8_t* bytes = (uint8_t*) malloc(sizeof(RuleCacheHeader) + serializedLength);
+  if (!bytes) {
+    pcre2_serialize_free(serialized);
+    return false;
+  }
+
+  RuleCacheHeader header;
+  init_rule_cache_header(&header, contentHash, patternCount);
+  header.serializedLength = (uint64_t) serializedLength;
+  header.serializedHash = hash_bytes(serialized, serializedLength);
+  memcpy(bytes, &header, sizeof(header));
+  memcpy(bytes + sizeof(header), serialized, serializedLength);
+  pcre2_serialize_free(serialized);
+
+  *outBytes = bytes;
+  *outLength = sizeof(header) + serializedLength;
+  return true;
+}
+
+// Returns decoded codes for a parsed rule set, or NULL when the cache image is stale, foreign or corrupt.
+static pcre2_code** decode_rule_cache(const uint8_t* bytes, size_t length, uint64_t contentHash, size_t patternCount) {
+  RuleCacheHeader expected;
+  RuleCacheHeader header;
+  init_rule_cache_header(&expected, contentHash, patternCount);
+  if (length < sizeof(header) || patternCount == 0 || patternCount > INT32_MAX) {
+    return NULL;
+  }
+  memcpy(&header, bytes, sizeof(header));
+  expected.serializedLength = header.serializedLength;
+  expected.serializedHash = header.serializedHash;
+  if (memcmp(&header, &expected, sizeof(header)) != 0 || header.serializedLength != length - sizeof(header)) {
+    return NULL;
+  }
+  // pcre2_serialize_decode only checks its own small header, and damaged bytecode could crash a later match.
+  if (hash_bytes(bytes + sizeof(header), length - sizeof(header)) != header.serializedHash) {
+    return NULL;
+  }
+
+  pcre2_code** codes = (pcre2_code**) calloc(patternCount, sizeof(*codes));
+  if (!codes) {
+    return NULL;
+  }
+  int32_t rc = pcre2_serialize_decode(codes, (int32_t) patternCount, bytes + sizeof(header), NULL);
+  if (rc != (int32_t) patternCount) {
+    for (size_t i = 0; i < patternCount; ++i) {
+      pcre2_code_free(codes[i]);
+    }
+    free(codes);
+    return NULL;
+  }
+  return codes;
+}
+
+// Where the cache for `cachePath` goes when the rules file's own directory cannot take it, e.g. because it is
+// read-only: %LOCALAPPDATA%\ClipTrim, under a name derived from the hash of `cachePath`. NULL without LOCALAPPDATA.
+static wchar_t* fallback_rule_cache_path(const wchar_t* cachePath, bool createDirectory) {
+  wchar_t localAppData[MAX_PATH];
+  DWORD length = GetEnvironmentVariableW(L"LOCALAPPDATA", localAppData, MAX_PATH);
+  if (length == 0 || length >= MAX_PATH) {
+    return NULL;
+  }
+  wchar_t* directory = join_path(localAppData, kRuleCacheFallbackDirectory);
+  if (!directory || (createDirectory && !CreateDirectoryW(directory, NULL) && GetLastError() != ERROR_ALREADY_EXISTS)) {
+    free(directory);
+    return NULL;
+  }
+
+  static const wchar_t kHexDigits[] = L"0123456789abcdef";
+  uint64_t hash = hash_rule_text(cachePath, wcslen(cachePath));
+  wchar_t leaf[] = L"rules-0000000000000000.cache";
+  for (size_t i = 0; i < 16; ++i) {
+    leaf[6 + i] = kHexDigits[(hash >> (60 - 4 * i)) & 0xFu];
+  }
+  wchar_t* path = join_path(directory, leaf);
+  free(directory);
+  return path;
+}
+
+static pcre2_code** load_rule_cache_file(const wchar_t* path, uint64_t contentHash, size_t patternCount) {
+  char* bytes = NULL;
+  size_t length = 0;
+  if (!path || !read_file_bytes(path, &bytes, &length, NULL)) {
+    return NULL;
+  }
+  pcre2_code** codes = decode_rule_cache((const uint8_t*) bytes, length, contentHash, patternCount);
+  free(bytes);
+  return codes;
+}
+
+static pcre2_code** load_rule_cache(const wchar_t* cachePath, uint64_t contentHash, size_t patternCount) {
+  pcre2_code** codes = load_rule_cache_file(cachePath, contentHash, patternCount);
+  if (!codes && cachePath) {
+    wchar_t* fallbackPath = fallback_rule_cache_path(cachePath, false);
+    codes = load_rule_cache_file(fallbackPath, contentHash, patternCount);
+    free(fallbackPath);
+  }
+  return codes;
+}
+
+// Writes through a temporary file so a reader never sees half a cache. On failure GetLastError() says why.
+static bool write_rule_cache_file(const wchar_t* path, const uint8_t* bytes, size_t length) {
+  wchar_t* temporaryPath = concat_wide_strings(path, L".tmp");
+  if (!temporaryPath) {
+    SetLastError(ERROR_NOT_ENOUGH_MEMORY);
+    return false;
+  }
+
+  HANDLE file = CreateFileW(temporaryPath, GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+  bool stored = false;
+  if (file != INVALID_HANDLE_VALUE) {
+    DWORD bytesWritten = 0;
+    bool writeOk = length <= (size_t) MAXDWORD && WriteFile(file, bytes, (DWORD) length, &bytesWritten, NULL) != 0 &&
+                   bytesWritten == (DWORD) length;
+    DWORD writeError = GetLastError();
+    CloseHandle(file);
+    stored = writeOk && MoveFileExW(temporaryPath, path, MOVEFILE_REPLACE_EXISTING);
+    if (!stored) {
+      writeError = writeOk ? GetLastError() : writeError;
+      DeleteFileW(temporaryPath);
+      SetLastError(writeError);
+    }
+  }
+  free(temporaryPath);
+  return stored;
+}
+
+// Stores the cache beside the rules file, or under %LOCALAPPDATA% when that fails. A directory that cannot take it
+// will not start taking it on the next reload, so the failure is only logged once per process.
+static void store_rule_cache(const wchar_t* cachePath, const RuleSet* ruleSet, uint64_t contentHash) {
+  static bool failureLogged = false;
+  uint8_t* bytes = NULL;
+  size_t length = 0;
+  if (!cachePath || !encode_rule_cache(ruleSet, contentHash, &bytes, &length)) {
+    return;
+  }
+
+  bool stored = write_rule_cache_file(cachePath, bytes, length);
+  DWORD lastError = stored ? ERROR_SUCCESS : GetLastError();
+  if (!stored) {
+    wchar_t* fallbackPath = fallback_rule_cache_path(cachePath, true);
+    stored = fallbackPath && write_rule_cache_file(fallbackPath, bytes, length);
+    if (stored) {
+      log_debug("Rules directory refused the compiled rule cache (%lu); stored it under %%LOCALAPPDATA%%", lastError);
+    }
+    free(fallbackPath);
+  }
+  if (!stored && !failureLogged) {
+    failureLogged = true;
+    log_error("Unable to write compiled rule cache (%lu); rules will be compiled on every load", lastError);
+  }
+  free(bytes);
+}
+
+// Compiles `pattern` the first time a text reaches it, or the idle worker gets to it, and derives what the matchers
+// need from the code. A pattern that fails to compile is logged and disabled; the rest of its rule still runs. Once
+// the last pending pattern has compiled, the codes go to the rule cache and the compile state is released. Only the
+// thread that normalizes with the rule set may call this. Returns whether the pattern can run.
+static bool ensure_pattern_compiled(RuleSet* ruleSet, RegexRule* rule, RegexPattern* pattern) {
+  if (!pattern->compilePending) {
+    return !pattern->disabled;
+  }
+  pattern->compilePending = false;
+  ruleSet->compilePendingCount--;
+
+  char failure[256] = {0};
+  if (!pattern->code) {
+    // A deadline can only interrupt a running match from a callout, so timed patterns get one before every item.
+    uint32_t options = PCRE2_UTF | PCRE2_UCP;
+    if (rule->budget.timeLimitMs != 0 || ruleSet->budget.timeLimitMs != 0) {
+      options |= PCRE2_AUTO_CALLOUT;
+    }
+    // Segment lanes search the whole text but stop match starts at their segment end through the offset limit.
+    if (rule->lineScoped) {
+      options |= PCRE2_USE_OFFSET_LIMIT;
+    }
+    int compileError = 0;
+    PCRE2_SIZE errorOffset = 0;
+    pattern->code = pcre2_compile((PCRE2_SPTR) pattern->source, pattern->sourceLength, options, &compileError,
+                                  &errorOffset, ruleSet->compileContext);
+    if (!pattern->code) {
+      PCRE2_UCHAR messageBuffer[256];
+      int messageLength =
+          pcre2_get_error_message(compileError, messageBuffer, sizeof(messageBuffer) / sizeof(messageBuffer[0]));
+      char* utf8Message =
+          messageLength > 0 ? utf8_from_wide_length((const wchar_t*) messageBuffer, (size_t) messageLength) : NULL;
+      snprintf(failure, sizeof(failure), "compile error at offset %zu: %s", (size_t) errorOffset,
+               utf8Message ? utf8Message : "Unknown regex error");
+      free(utf8Message);
+    }
+  }
+  if (pattern->code) {
+    pattern->matchData = pcre2_match_data_create_from_pattern(pattern->code, ruleSet->matchMemory);
+    const char* unsupported = pattern->engine == PATTERN_ENGINE_DFA ? find_dfa_unsupported_code(pattern) : NULL;
+    if (!pattern->matchData) {
+      snprintf(failure, sizeof(failure), "out of memory while creating regex match data");
+    } else if (unsupported) {
+      snprintf(failure, sizeof(failure), "uses %s, which `engine dfa` does not support", unsupported);
+    }
+  }
+
+  if (failure[0] != '\0') {
+    log_error("Disabled pattern on line %zu: %s", pattern->lineNumber, failure);
+    pcre2_match_data_free(pattern->matchData);
+    pcre2_code_free(pattern->code);
+    pattern->matchData = NULL;
+    pattern->code = NULL;
+    pattern->disabled = true;
+    ruleSet->compileFailureCount++;
+  } else {
+    if (rule->lineScoped) {
+      uint32_t captureCount = 0;
+      pcre2_pattern_info(pattern->code, PCRE2_INFO_CAPTURECOUNT, &captureCount);
+      if (captureCount + 1 > ruleSet->lineScopedOvectorPairs) {
+        ruleSet->lineScopedOvectorPairs = captureCount + 1;
+        // Lanes size their match data for the patterns compiled so far; the next split recreates them.
+        free_segment_lanes(ruleSet);
+      }
+    }
+    uint32_t hasBackslashC = 0;
+    if (pcre2_pattern_info(pattern->code, PCRE2_INFO_HASBACKSLASHC, &hasBackslashC) == 0 && hasBackslashC) {
+      rule->mayBreakUtf = true;
+    }
+    extract_pattern_prefilter(pattern, ruleSet->casedProbe, ruleSet->probeData);
+    if (pattern->kernel == PATTERN_KERNEL_NONE) {
+      pattern->compactGuardUnits = pattern_compact_guard(pattern, rule->replacementLength);
+    }
+    // pcre2_dfa_match never uses JIT code and native kernels never call PCRE2 at all. JIT is best-effort: builds
+    // without SUPPORT_JIT or patterns the JIT rejects stay on the interpreter.
+    if (pattern->engine == PATTERN_ENGINE_BACKTRACK && pattern->kernel == PATTERN_KERNEL_NONE) {
+      pattern->jitCompiled = pcre2_jit_compile(pattern->code, PCRE2_JIT_COMPLETE) == 0;
+      if (pattern->jitCompiled) {
+        ruleSet->jitPatternCount++;
+      }
+    }
+  }
+
+  if (ruleSet->compilePendingCount == 0) {
+    if (ruleSet->compileFailureCount == 0) {
+      store_rule_cache(ruleSet->cachePath, ruleSet, ruleSet->contentHash);
+    }
+    release_rule_compile_state(ruleSet);
+  }
+  return !pattern->disabled;
+}
+
+// Compiles the next pattern no text has reached yet, so an idle thread can warm the rule set one pattern at a time.
+// Returns whether any pattern is still pending.
+static bool prewarm_next_pattern(RuleSet* ruleSet) {
+  for (; ruleSet->prewarmRule < ruleSet->ruleCount; ++ruleSet->prewarmRule) {
+    RegexRule* rule = &ruleSet->rules[ruleSet->prewarmRule];
+    for (size_t i = 0; i < rule->patternCount; ++i) {
+      if (rule->patterns[i].compilePending) {
+        ensure_pattern_compiled(ruleSet, rule, &rule->patterns[i]);
+        return ruleSet->compilePendingCount > 0;
+      }
+    }
+  }
+  return false;
+}
+
+static bool load_rule_set_from_file(const wchar_t* path, RuleSet* outRuleSet, RuleLoadError* error) {
+  ClipboardBuffer fileContents = {0};
+  RuleSet parsed = {0};
+
+  if (!read_utf8_file(path, &fileContents, error)) {
+    return false;
+  }
+  if (!parse_rule_set_text(fileContents.text, fileContents.length, &parsed, error)) {
+    free_clipboard_buffer(&fileContents);
+    return false;
+  }
+
+  uint64_t contentHash = hash_rule_text(fileContents.text, fileContents.length);
+  size_t patternCount = count_rule_set_patterns(&parsed);
+  free_clipboard_buffer(&fileContents);
+
+  wchar_t* cachePath = concat_wide_strings(path, kRuleCacheSuffix);
+  pcre2_code** cachedCodes = load_rule_cache(cachePath, contentHash, patternCount);
+  bool compiled = compile_rule_set(&parsed, cachedCodes, error);
+  if (cachedCodes) {
+    for (size_t i = 0; i < patternCount; ++i) {
+      pcre2_code_free(cachedCodes[i]);
+    }
+    free(cachedCodes);
+  }
+  if (!compiled) {
+    free(cachePath);
+    free_rule_set(&parsed);
+    return false;
+  }
+
+  if (cachedCodes) {
+    log_info("Reused %zu compiled pattern%s from rule cache", patternCount, patternCount == 1 ? "" : "s");
+    free(cachePath);
+  } else if (parsed.compilePendingCount > 0) {
+    // Stored by ensure_pattern_compiled once every pattern has compiled.
+    parsed.cachePath = cachePath;
+    parsed.contentHash = contentHash;
+  } else {
+    free(cachePath);
+  }
+
+  *outRuleSet = parsed;
+  return true;
+}
+
+static bool generate_default_rules_file(void) {
+  if (!g_executableDirectory) {
+    log_error("Unable to generate default replacement config: executable directory unavailable");
+    return false;
+  }
+
+  wchar_t* path = join_path(g_executableDirectory, kRulesFileName);
+  if (!path) {
+    log_error("Out of memory while preparing default replacement config path");
+    return false;
+  }
+
+  HANDLE file = CreateFileW(path, GENERIC_WRITE, 0, NULL, CREATE_NEW, FILE_ATTRIBUTE_NORMAL, NULL);
+  if (file == INVALID_HANDLE_VALUE) {
+    DWORD lastError = GetLastError();
+    if (lastError == ERROR_FILE_EXISTS || lastError == ERROR_ALREADY_EXISTS) {
+      free(path);
+      return true;
+    }
+
+    char* utf8Path = utf8_from_wide(path);
+    if (utf8Path) {
+      log_error("Failed to generate default replacement config %s (%lu)", utf8Path, lastError);
+      free(utf8Path);
+    } else {
+      log_error("Failed to generate default replacement config (%lu)", lastError);
+    }
+    free(path);
+    return false;
+  }
+
+  DWORD bytesWritten = 0;
+  DWORD bytesToWrite = (DWORD) strlen(kDefaultRulesFileContents);
+  bool writeOk = WriteFile(file, kDefaultRulesFileContents, bytesToWrite, &bytesWritten, NULL) != 0 &&
+                 bytesWritten == bytesToWrite;
+  DWORD writeError = writeOk ? ERROR_SUCCESS : GetLastError();
+  CloseHandle(file);
+
+  if (!writeOk) {
+    DeleteFileW(path);
+
+    char* utf8Path = utf8_from_wide(path);
+    if (utf8Path) {
+      log_error("Failed to write default replacement config %s (%lu)", utf8Path, writeError);
+      free(utf8Path);
+    } else {
+      log_error("Failed to write default replacement config (%lu)", writeError);
+    }
+    free(path);
+    return false;
+  }
+
+  char* utf8Path = utf8_from_wide(path);
+  if (utf8Path) {
+    log_info("Generated default replacement config %s", utf8Path);
+    free(utf8Path);
+  } else {
+    log_info("Generated default replacement config");
+  }
+
+  free(path);
+  return true;
+}
+
+static bool resolve_rules_config_path(wchar_t** outPath, FILETIME* outWriteTime) {
+  wchar_t* currentDirectory = get_current_directory_string();
+  if (currentDirectory) {
+    wchar_t* currentPath = join_path(currentDirectory, kRulesFileName);
+    free(currentDirectory);
+    if (currentPath) {
+      if (get_file_last_write_time(currentPath, outWriteTime)) {
+        *outPath = currentPath;
+        return true;
+      }
+      free(currentPath);
+    }
+  }
+
+  if (!g_executableDirectory) {
+    return false;
+  }
+
+  wchar_t* executablePath = join_path(g_executableDirectory, kRulesFileName);
+  if (!executablePath) {
+    return false;
+  }
+  if (!get_file_last_write_time(executablePath, outWriteTime)) {
+    free(executablePath);
+    return false;
+  }
+
+  *outPath = executablePath;
+  return true;
+}
+
+static void publish_rule_settings(void) {
+  const RuleSet* rules = &g_ruleConfig.activeRules;
+  LONG debounceMs = g_ruleConfig.hasActiveFile && rules->hasDebounceSetting ? (LONG) rules->debounceMs : -1;
+  InterlockedExchange(&g_rulesDebounceMs, debounceMs);
+}
+
+// Resolves trim.rules and loads it if it changed since the last resolution. Returns the update for the normalizing
+// thread to install, or NULL when the active rules stay as they are, which includes a config that failed to load.
+// Only the resolved fields of g_ruleConfig are touched, so the rules watcher can run this while the worker keeps
+// normalizing with the previous rules.
+static RuleUpdate* resolve_rule_update(void) {
+  wchar_t* resolvedPath = NULL;
+  FILETIME resolvedTime = {0};
+
+  if (!resolve_rules_config_path(&resolvedPath, &resolvedTime)) {
+    bool generatedDefaultRules = generate_default_rules_file();
+    if (generatedDefaultRules && resolve_rules_config_path(&resolvedPath, &resolvedTime)) {
+      // Continue below and load the generated executable-side config.
+    } else {
+      bool hadRules = g_ruleConfig.lastResolvedHasRules;
+      bool shouldLog = g_ruleConfig.lastResolvedExists || hadRules || g_ruleConfig.lastLoadFailed;
+
+      free(g_ruleConfig.lastResolvedPath);
+      g_ruleConfig.lastResolvedPath = NULL;
+      memset(&g_ruleConfig.lastResolvedWriteTime, 0, sizeof(g_ruleConfig.lastResolvedWriteTime));
+      g_ruleConfig.lastResolvedExists = false;
+      g_ruleConfig.lastLoadFailed = false;
+      g_ruleConfig.lastResolvedHasRules = false;
+
+      if (shouldLog || !generatedDefaultRules) {
+        log_info("No replacement config found; normalization rules are inactive");
+      }
+      return hadRules ? (RuleUpdate*) calloc(1, sizeof(RuleUpdate)) : NULL;
+    }
+  }
+
+  if (g_ruleConfig.lastResolvedExists && paths_equal_ignore_case(resolvedPath, g_ruleConfig.lastResolvedPath) &&
+      filetime_equal(resolvedTime, g_ruleConfig.lastResolvedWriteTime)) {
+    free(resolvedPath);
+    return NULL;
+  }
+
+  RuleUpdate* update = (RuleUpdate*) calloc(1, sizeof(RuleUpdate));
+  if (!update) {
+    log_error("Out of memory while loading replacement config");
+    free(resolvedPath);
+    return NULL;
+  }
+
+  RuleLoadError loadError = {0};
+  if (!load_rule_set_from_file(resolvedPath, &update->rules, &loadError)) {
+    char* utf8Path = utf8_from_wide(resolvedPath);
     if (utf8Path) {
-      log_info("Failed to generate default replacement config %s (%lu)", utf8Path, lastError);
+      log_error("Failed to load replacement config %s at line %zu: %s", utf8Path,
+               loadError.lineNumber == 0 ? 1u : loadError.lineNumber, loadError.message);
       free(utf8Path);
     } else {
-      log_info("Failed to generate default replacement config (%lu)", lastError);
+      log_error("Failed to load replacement config at line %zu: %s", loadError.lineNumber == 0 ? 1u : loadError.lineNumber,
+               loadError.message);
+    }
+
+    free(update);
+    free(g_ruleConfig.lastResolvedPath);
+    g_ruleConfig.lastResolvedPath = resolvedPath;
+    g_ruleConfig.lastResolvedWriteTime = resolvedTime;
+    g_ruleConfig.lastResolvedExists = true;
+    g_ruleConfig.lastLoadFailed = true;
+    return NULL;
+  }
+
+  update->hasRules = true;
+  update->path = resolvedPath;
+  update->writeTime = resolvedTime;
+
+  free(g_ruleConfig.lastResolvedPath);
+  g_ruleConfig.lastResolvedPath = duplicate_wide_string(resolvedPath);
+  g_ruleConfig.lastResolvedWriteTime = resolvedTime;
+  g_ruleConfig.lastResolvedExists = g_ruleConfig.lastResolvedPath != NULL;
+  g_ruleConfig.lastLoadFailed = false;
+  g_ruleConfig.lastResolvedHasRules = true;
+
+  const RuleSet* rules = &update->rules;
+  char* utf8Path = utf8_from_wide(resolvedPath);
+  if (utf8Path) {
+    log_info("Loaded replacement config %s (%zu rule%s, %zu/%zu pattern%s to compile on first use, %zu literal%s)",
+             utf8Path, rules->ruleCount, rules->ruleCount == 1 ? "" : "s", rules->compilePendingCount, rules->patternCount,
+             rules->patternCount == 1 ? "" : "s", rules->literalPatternCount,
+             rules->literalPatternCount == 1 ? "" : "s");
+    free(utf8Path);
+  } else {
+    log_info("Loaded replacement config (%zu rule%s, %zu/%zu pattern%s to compile on first use, %zu literal%s)",
+             rules->ruleCount, rules->ruleCount == 1 ? "" : "s", rules->compilePendingCount, rules->patternCount,
+             rules->patternCount == 1 ? "" : "s", rules->literalPatternCount,
+             rules->literalPatternCount == 1 ? "" : "s");
+  }
+  return update;
+}
+
+// Swaps `update` in as the active rules and frees it along with the rules it replaces. Must run on the thread that
+// normalizes, between jobs, so nothing still matches with the old rules.
+static void install_rule_update(RuleUpdate* update) {
+  clear_active_rule_config();
+  if (update->hasRules) {
+    g_ruleConfig.activePath = update->path;
+    g_ruleConfig.activeWriteTime = update->writeTime;
+    g_ruleConfig.activeRules = update->rules;
+    g_ruleConfig.hasActiveFile = true;
+  }
+  free(update);
+}
+
+// Installs the update the rules watcher published last, if any. Jobs only ever run on the worker thread, so between two
+// of them nothing still matches with the rules being replaced and install_rule_update can free them on the spot.
+static bool install_pending_rule_update(void) {
+  RuleUpdate* update = (RuleUpdate*) InterlockedExchangePointer((PVOID volatile*) &g_worker.pendingRules, NULL);
+  if (!update) {
+    return false;
+  }
+  install_rule_update(update);
+  publish_rule_settings();
+  return true;
+}
+
+static void refresh_replacement_config(void) {
+  RuleUpdate* update = resolve_rule_update();
+  if (update) {
+    install_rule_update(update);
+  }
+}
+
+static void describe_regex_error(int rc, char* errorMessage, size_t errorMessageSize, const char* fallback) {
+  PCRE2_UCHAR messageBuffer[256];
+  int messageLength = pcre2_get_error_message(rc, messageBuffer, sizeof(messageBuffer) / sizeof(messageBuffer[0]));
+  char* utf8Message = NULL;
+  if (messageLength > 0) {
+    utf8Message = utf8_from_wide_length((const wchar_t*) messageBuffer, (size_t) messageLength);
+  }
+  snprintf(errorMessage, errorMessageSize, "%s", utf8Message ? utf8Message : fallback);
+  free(utf8Message);
+}
+
+static bool append_wide_range(wchar_t** output, size_t* outputCapacity, size_t* outputLength, const wchar_t* text,
+                              size_t length) {
+  if (length == 0) {
+    return true;
+  }
+  if (length > (size_t) -1 - *outputLength || !reserve_wide_buffer(output, outputCapacity, *outputLength + length)) {
+    return false;
+  }
+  memcpy(*output + *outputLength, text, length * sizeof(wchar_t));
+  *outputLength += length;
+  return true;
+}
+
+static bool match_budget_expired(MatchBudgetState* budget) {
+  if (budget->deadlineTick != 0 && GetTickCount64() >= budget->deadlineTick) {
+    budget->exceeded = true;
+  }
+  return budget->exceeded;
+}
+
+// Auto-callouts fire before every pattern item, so only every BUDGET_CALLOUT_CHECK_INTERVAL-th one reads the clock.
+static int match_budget_callout(pcre2_callout_block* block, void* data) {
+  (void) block;
+  MatchBudgetState* budget = (MatchBudgetState*) data;
+  if (!budget || --budget->calloutsUntilCheck != 0) {
+    return 0;
+  }
+  budget->calloutsUntilCheck = BUDGET_CALLOUT_CHECK_INTERVAL;
+  return match_budget_expired(budget) ? PCRE2_ERROR_CALLOUT : 0;
+}
+
+static bool normalization_cancelled(const NormalizationCancel* cancel) {
+  return cancel && *cancel->latestSequence != cancel->sequence;
+}
+
+// Leftmost-longest match for `engine dfa` patterns. Doubles the workspace while PCRE2 reports it too small.
+static int run_dfa_match(const RegexPattern* pattern, pcre2_match_data* matchData, DfaWorkspace* workspace,
+                         const wchar_t* subject, size_t subjectLength, PCRE2_SIZE startOffset, uint32_t options,
+                         pcre2_match_context* matchContext) {
+  for (;;) {
+    int rc = pcre2_dfa_match(pattern->code, (PCRE2_SPTR) subject, subjectLength, startOffset, options, matchData,
+                             matchContext, workspace->slots, workspace->slotCount);
+    if (rc != PCRE2_ERROR_DFA_WSSIZE || workspace->slotCount >= DFA_WORKSPACE_MAX_SLOTS) {
+      // 0 only says the ovector could not hold every alternative match; the longest is still in its first pair.
+      return rc == 0 ? 1 : rc;
+    }
+    int* grown = (int*) realloc(workspace->slots, workspace->slotCount * 2 * sizeof(int));
+    if (!grown) {
+      return PCRE2_ERROR_NOMEMORY;
+    }
+    InterlockedIncrement(&g_engineAllocations);
+    workspace->slots = grown;
+    workspace->slotCount *= 2;
+  }
+}
+
+// Output of a substitution that writes over the text it reads. The next match may look back up to `guard` units
+// before where it starts, so output bound for those units waits in `hold` until the scan has moved past them.
+// `consumed` is how far the subject has been copied or replaced; the rest is still the original text.
+typedef struct {
+  wchar_t* text;
+  size_t written;
+  size_t consumed;
+  size_t guard;
+  wchar_t hold[COMPACT_MAX_GUARD_UNITS];
+  size_t holdLength;
+} CompactWriter;
+
+// Appends `count` units to the output without writing at or past `limit`. Output never overtakes `consumed`, so
+// whatever cannot be written yet fits in `hold`.
+static void compact_writer_emit(CompactWriter* writer, const wchar_t* units, size_t count, size_t limit) {
+  size_t room = limit > writer->written ? limit - writer->written : 0;
+  if (writer->holdLength > 0) {
+    size_t flushed = writer->holdLength < room ? writer->holdLength : room;
+    wmemcpy(writer->text + writer->written, writer->hold, flushed);
+    writer->written += flushed;
+    writer->holdLength -= flushed;
+    room -= flushed;
+    if (writer->holdLength > 0) {
+      wmemmove(writer->hold, writer->hold + flushed, writer->holdLength);
+      wmemcpy(writer->hold + writer->holdLength, units, count);
+      writer->holdLength += count;
+      return;
+    }
+  }
+  size_t direct = count < room ? count : room;
+  if (direct > 0 && writer->text + writer->written != units) {
+    wmemmove(writer->text + writer->written, units, direct);
+  }
+  writer->written += direct;
+  wmemcpy(writer->hold, units + direct, count - direct);
+  writer->holdLength = count - direct;
+}
+
+// Copies the unconsumed rest of the text into place and returns the new length. Also used after a failed scan, which
+// leaves the matches replaced so far in the text.
+static size_t compact_writer_finish(CompactWriter* writer, size_t length) {
+  compact_writer_emit(writer, writer->text + writer->consumed, length - writer->consumed, (size_t) -1);
+  writer->consumed = length;
+  return writer->written;
+}
+
+// Runs one global literal substitution over matches starting in [searchStart, searchEnd) in a single scan; the
+// output is subject[copyStart, searchEnd) with those matches replaced. Output is written into the caller-owned
+// growable buffer only once the first match is found, so a pattern that never matches copies nothing. A match that
+// ends past `searchEnd` (or starts before `copyStart`) stops the scan with `*outOverrun` set and no usable output.
+// With `compact` the output goes over the subject instead, through the writer, and the caller finishes it. Those
+// replacements cannot be taken back, so `*outCount` counts them even when the scan fails part way.
+static bool substitute_pattern_literal(const RegexPattern* pattern, const MatchScratch* scratch,
+                                       const NormalizationCancel* cancel, MatchBudgetState* budget,
+                                       const wchar_t* replacement, size_t replacementLength, const wchar_t* subject,
+                                       size_t subjectLength, size_t copyStart, size_t searchStart, size_t searchEnd,
+                                       CompactWriter* compact, wchar_t** output, size_t* outputCapacity,
+                                       size_t* outLength, size_t* outCount, size_t* outMatchCalls, bool* outOverrun,
+                                       char* errorMessage, size_t errorMessageSize) {
+  *outLength = 0;
+  *outCount = 0;
+  *outMatchCalls = 0;
+  *outOverrun = false;
+  pcre2_match_context* matchContext = scratch->matchContext;
+  if (budget && matchContext) {
+    budget->calloutsUntilCheck = BUDGET_CALLOUT_CHECK_INTERVAL;
+    budget->exceeded = false;
+    pcre2_set_callout(matchContext, match_budget_callout, budget);
+  }
+
+  pcre2_match_data* matchData = scratch->matchData ? scratch->matchData : pattern->matchData;
+  PCRE2_SIZE* ovector = pcre2_get_ovector_pointer(matchData);
+  PCRE2_SIZE startOffset = searchStart;
+  PCRE2_SIZE copiedOffset = copyStart;
+  uint32_t matchOptions = 0;
+  uint32_t engineOptions = 0;
+  size_t outputLength = 0;
+  size_t count = 0;
+
+  while (startOffset < searchEnd || (startOffset == searchEnd && searchEnd == subjectLength)) {
+    if (normalization_cancelled(cancel)) {
+      snprintf(errorMessage, errorMessageSize, "Cancelled because the clipboard changed");
+      return false;
+    }
+    if (budget && match_budget_expired(budget)) {
+      snprintf(errorMessage, errorMessageSize, "Time limit of %u ms exceeded", (unsigned) budget->timeLimitMs);
+      return false;
+    }
+
+    ++*outMatchCalls;
+    int rc = pattern->engine == PATTERN_ENGINE_DFA
+                 ? run_dfa_match(pattern, matchData, scratch->dfaWorkspace, subject, subjectLength, startOffset,
+                                 matchOptions | scratch->subjectOptions, matchContext)
+                 : pcre2_match(pattern->code, (PCRE2_SPTR) subject, subjectLength, startOffset,
+                               matchOptions | engineOptions | scratch->subjectOptions, matchData, matchContext);
+    if (rc == PCRE2_ERROR_JIT_STACKLIMIT && engineOptions == 0) {
+      // The interpreter keeps its backtracking frames on the heap, so it can finish what the JIT stack could not.
+      log_info("JIT stack exhausted for pattern on line %zu; retrying with the interpreter", pattern->lineNumber);
+      engineOptions = PCRE2_NO_JIT;
+      continue;
+    }
+    if (rc == PCRE2_ERROR_NOMATCH) {
+      break;
+    }
+    if (rc == PCRE2_ERROR_CALLOUT && budget && budget->exceeded) {
+      snprintf(errorMessage, errorMessageSize, "Time limit of %u ms exceeded", (unsigned) budget->timeLimitMs);
+      return false;
+    }
+    if (rc == PCRE2_ERROR_MATCHLIMIT || rc == PCRE2_ERROR_DEPTHLIMIT || rc == PCRE2_ERROR_HEAPLIMIT) {
+      if (budget) {
+        budget->exceeded = true;
+      }
+      describe_regex_error(rc, errorMessage, errorMessageSize, "Regex match budget exceeded");
+      return false;
+    }
+    if (rc < 0) {
+      describe_regex_error(rc, errorMessage, errorMessageSize, "Unknown regex substitution error");
+      return false;
+    }
+    if (pcre2_get_startchar(matchData) >= searchEnd && searchEnd < subjectLength) {
+      break; // the next segment owns this match
+    }
+    if (ovector[1] > searchEnd || ovector[0] < copyStart) {
+      *outOverrun = true;
+      return true;
+    }
+
+    // Mirror pcre2_substitute: \K inside a lookaround can report a match that starts outside the unread region.
+    if (ovector[0] > ovector[1] || ovector[0] < copiedOffset) {
+      describe_regex_error(PCRE2_ERROR_BADSUBSPATTERN, errorMessage, errorMessageSize,
+                           "Unsupported \\K usage in pattern");
+      return false;
+    }
+
+    if (compact) {
+      size_t gapLength = ovector[0] - copiedOffset;
+      if (compact->written + compact->holdLength + gapLength + replacementLength > ovector[1]) {
+        snprintf(errorMessage, errorMessageSize, "Replacement is longer than the match it replaces");
+        return false;
+      }
+      // Everything from limit on may be looked at again when the next match starts at or after ovector[1].
+      size_t limit = ovector[1] > compact->guard ? ovector[1] - compact->guard : 0;
+      compact_writer_emit(compact, subject + copiedOffset, gapLength, limit);
+      compact_writer_emit(compact, replacement, replacementLength, limit);
+      compact->consumed = ovector[1];
+    } else if (!append_wide_range(output, outputCapacity, &outputLength, subject + copiedOffset,
+                                  ovector[0] - copiedOffset) ||
+               !append_wide_range(output, outputCapacity, &outputLength, replacement, replacementLength)) {
+      snprintf(errorMessage, errorMessageSize, "Out of memory while applying regex replacement");
+      return false;
+    }
+    copiedOffset = ovector[1];
+    count++;
+    if (compact) {
+      *outCount = count;
+    }
+
+    if (!pcre2_next_match(matchData, &startOffset, &matchOptions)) {
+      break;
+    }
+  }
+
+  if (count == 0 || compact) {
+    return true;
+  }
+
+  if (!append_wide_range(output, outputCapacity, &outputLength, subject + copiedOffset, searchEnd - copiedOffset) ||
+      !reserve_wide_buffer(output, outputCapacity, outputLength)) {
+    snprintf(errorMessage, errorMessageSize, "Out of memory while applying regex replacement");
+    return false;
+  }
+
+  (*output)[outputLength] = L'\0';
+  *outLength = outputLength;
+  *outCount = count;
+  return true;
+}
+
+typedef size_t (*TrimWhitespaceScanner)(const wchar_t* text, size_t position, size_t length);
+
+static TrimWhitespaceScanner g_trimWhitespaceScanner = NULL;
+
+// Exactly the character class of TRIM_TRAILING_PATTERN.
+static bool is_trim_whitespace(wchar_t c) {
+  switch (c) {
+  case L' ':
+  case L'\t':
+  case L'\f':
+  case 0x000B:
+  case 0x00A0:
+  case 0x1680:
+  case 0x180E:
+  case 0x2028:
+  case 0x2029:
+  case 0x202F:
+  case 0x205F:
+  case 0x3000:
+    return true;
+  default:
+    return c >= 0x2000 && c <= 0x200A;
+  }
+}
+
+// Scanners return the first position at or after `position` that may hold trim whitespace; the SIMD variants may
+// stop early on wide code units, which the caller re-checks with is_trim_whitespace.
+static size_t find_trim_whitespace_scalar(const wchar_t* text, size_t position, size_t length) {
+  while (position < length && !is_trim_whitespace(text[position])) {
+    position++;
+  }
+  return position;
+}
+
+#ifdef TRIM_HAVE_X86_KERNELS
+__attribute__((target("sse2"))) static size_t find_trim_whitespace_sse2(const wchar_t* text, size_t position,
+                                                                         size_t length) {
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i space = _mm_set1_epi16(0x20);
+  const __m128i tab = _mm_set1_epi16(0x09);
+  const __m128i verticalTab = _mm_set1_epi16(0x0B);
+  const __m128i formFeed = _mm_set1_epi16(0x0C);
+  const __m128i noBreakSpace = _mm_set1_epi16(0xA0);
+  const __m128i wideFloor = _mm_set1_epi16(0x167F);
+
+  while (position + 8 <= length) {
+    __m128i units = _mm_loadu_si128((const __m128i*) (text + position));
+    __m128i hits = _mm_or_si128(_mm_cmpeq_epi16(units, space), _mm_cmpeq_epi16(units, tab));
+    hits = _mm_or_si128(hits, _mm_cmpeq_epi16(units, verticalTab));
+    hits = _mm_or_si128(hits, _mm_cmpeq_epi16(units, formFeed));
+    hits = _mm_or_si128(hits, _mm_cmpeq_epi16(units, noBreakSpace));
+    __m128i narrow = _mm_cmpeq_epi16(_mm_subs_epu16(units, wideFloor), zero);
+    int mask = _mm_movemask_epi8(hits) | (~_mm_movemask_epi8(narrow) & 0xFFFF);
+    if (mask != 0) {
+      return position + (size_t) (__builtin_ctz((unsigned) mask) / 2);
+    }
+    position += 8;
+  }
+  return find_trim_whitespace_scalar(text, position, length);
+}
+
+__attribute__((target("avx2"))) static size_t find_trim_whitespace_avx2(const wchar_t* text, size_t position,
+                                                                         size_t length) {
+  const __m256i zero = _mm256_setzero_si256();
+  const __m256i space = _mm256_set1_epi16(0x20);
+  const __m256i tab = _mm256_set1_epi16(0x09);
+  const __m256i verticalTab = _mm256_set1_epi16(0x0B);
+  const __m256i formFeed = _mm256_set1_epi16(0x0C);
+  const __m256i noBreakSpace = _mm256_set1_epi16(0xA0);
+  const __m256i wideFloor = _mm256_set1_epi16(0x167F);
+
+  while (position + 16 <= length) {
+    __m256i units = _mm256_loadu_si256((const __m256i*) (text + position));
+    __m256i hits = _mm256_or_si256(_mm256_cmpeq_epi16(units, space), _mm256_cmpeq_epi16(units, tab));
+    hits = _mm256_or_si256(hits, _mm256_cmpeq_epi16(units, verticalTab));
+    hits = _mm256_or_si256(hits, _mm256_cmpeq_epi16(units, formFeed));
+    hits = _mm256_or_si256(hits, _mm256_cmpeq_epi16(units, noBreakSpace));
+    __m256i narrow = _mm256_cmpeq_epi16(_mm256_subs_epu16(units, wideFloor), zero);
+    uint32_t mask = (uint32_t) _mm256_movemask_epi8(hits) | ~(uint32_t) _mm256_movemask_epi8(narrow);
+    if (mask != 0) {
+      return position + (size_t) (__builtin_ctz(mask) / 2);
+    }
+    position += 16;
+  }
+  return find_trim_whitespace_sse2(text, position, length);
+}
+#endif
+
+static TrimWhitespaceScanner select_trim_whitespace_scanner(void) {
+  if (!g_trimWhitespaceScanner) {
+    TrimWhitespaceScanner scanner = find_trim_whitespace_scalar;
+#ifdef TRIM_HAVE_X86_KERNELS
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+      scanner = find_trim_whitespace_avx2;
+    } else if (__builtin_cpu_supports("sse2")) {
+      scanner = find_trim_whitespace_sse2;
+    }
+#endif
+    g_trimWhitespaceScanner = scanner;
+  }
+  return g_trimWhitespaceScanner;
+}
+
+// In-place equivalent of substituting TRIM_TRAILING_PATTERN with an empty string: every maximal whitespace run that
+// is followed by CR, LF or the end of the text is dropped. Returns the new length.
+static size_t trim_trailing_whitespace_in_place(wchar_t* text, size_t length, TrimWhitespaceScanner scanner,
+                                                size_t* outRunCount) {
+  size_t read = 0;
+  size_t write = 0;
+  size_t runCount = 0;
+
+  while (read < length) {
+    size_t candidate = scanner(text, read, length);
+    if (write != read && candidate > read) {
+      memmove(text + write, text + read, (candidate - read) * sizeof(wchar_t));
+    }
+    write += candidate - read;
+    read = candidate;
+    if (read == length) {
+      break;
+    }
+
+    size_t runEnd = read;
+    while (runEnd < length && is_trim_whitespace(text[runEnd])) {
+      runEnd++;
+    }
+    if (runEnd == read) {
+      text[write++] = text[read++];
+      continue;
+    }
+
+    if (runEnd == length || text[runEnd] == L'\r' || text[runEnd] == L'\n') {
+      runCount++;
+    } else {
+      if (write != read) {
+        memmove(text + write, text + read, (runEnd - read) * sizeof(wchar_t));
+      }
+      write += runEnd - read;
+    }
+    read = runEnd;
+  }
+
+  *outRunCount = runCount;
+  return write;
+}
+
+static void presence_map_add_range(PresenceMap* presence, const wchar_t* text, size_t length) {
+  uint64_t* units = presence->units;
+  size_t position = 0;
+  for (; position + 4 <= length; position += 4) {
+    uint16_t a = (uint16_t) text[position];
+    uint16_t b = (uint16_t) text[position + 1];
+    uint16_t c = (uint16_t) text[position + 2];
+    uint16_t d = (uint16_t) text[position + 3];
+    units[a >> 6] |= 1ull << (a & 63u);
+    units[b >> 6] |= 1ull << (b & 63u);
+    units[c >> 6] |= 1ull << (c & 63u);
+    units[d >> 6] |= 1ull << (d & 63u);
+  }
+  for (; position < length; ++position) {
+    uint16_t unit = (uint16_t) text[position];
+    units[unit >> 6] |= 1ull << (unit & 63u);
+  }
+
+  uint64_t wide = units[3] >> 63;
+  for (size_t word = 4; word < sizeof(presence->units) / sizeof(presence->units[0]); ++word) {
+    wide |= units[word];
+  }
+  for (size_t byte = 0; byte < 31; ++byte) {
+    presence->startUnits[byte] = (uint8_t) (units[byte / 8] >> ((byte % 8) * 8));
+  }
+  presence->startUnits[31] = (uint8_t) (units[3] >> 56) | (wide ? 0x80u : 0u);
+}
+
+static void build_presence_map(PresenceMap* presence, const wchar_t* text, size_t length) {
+  memset(presence, 0, sizeof(*presence));
+  presence_map_add_range(presence, text, length);
+}
+
+static bool presence_map_contains(const PresenceMap* presence, uint16_t unit) {
+  return (presence->units[unit >> 6] >> (unit & 63u)) & 1u;
+}
+
+static bool pattern_cannot_match(const RegexPattern* pattern, const PresenceMap* presence) {
+  for (size_t i = 0; i < pattern->requiredUnitCount; ++i) {
+    const RequiredCodeUnit* required = &pattern->requiredUnits[i];
+    bool found = false;
+    for (size_t j = 0; j < required->unitCount && !found; ++j) {
+      found = presence_map_contains(presence, required->units[j]);
+    }
+    if (!found) {
+      return true;
+    }
+  }
+
+  if (pattern->firstBitmap) {
+    for (size_t byte = 0; byte < 32; ++byte) {
+      if (pattern->firstBitmap[byte] & presence->startUnits[byte]) {
+        return false;
+      }
+    }
+    return true;
+  }
+  return false;
+}
+
+static MatchBudget effective_match_budget(const RuleSet* ruleSet, const RegexRule* rule) {
+  MatchBudget budget = ruleSet->budget;
+  if (rule->budget.matchLimit != 0) {
+    budget.matchLimit = rule->budget.matchLimit;
+  }
+  if (rule->budget.depthLimit != 0) {
+    budget.depthLimit = rule->budget.depthLimit;
+  }
+  if (rule->budget.heapLimitKib != 0) {
+    budget.heapLimitKib = rule->budget.heapLimitKib;
+  }
+  if (rule->budget.timeLimitMs != 0) {
+    budget.timeLimitMs = rule->budget.timeLimitMs;
+  }
+  return budget;
+}
+
+static void record_pattern_profile(PatternProfile* profile, LARGE_INTEGER started, LONG allocationsBefore,
+                                   size_t unitsScanned, int64_t growth, size_t matchCalls, size_t substitutions) {
+  LARGE_INTEGER finished = {0};
+  QueryPerformanceCounter(&finished);
+  profile->runs++;
+  profile->ticks += (uint64_t) (finished.QuadPart - started.QuadPart);
+  profile->bytesScanned += (uint64_t) unitsScanned * sizeof(wchar_t);
+  profile->matchCalls += matchCalls;
+  profile->substitutions += substitutions;
+  profile->outputGrowth += growth;
+  profile->allocations += (uint64_t) (g_engineAllocations - allocationsBefore);
+}
+
+// Creates one lane per processor, capped by --threads, the first time a rule set meets a text worth splitting.
+static bool ensure_segment_lanes(RuleSet* ruleSet) {
+  if (ruleSet->lanes) {
+    return true;
+  }
+  SYSTEM_INFO systemInfo;
+  GetSystemInfo(&systemInfo);
+  size_t laneCount = systemInfo.dwNumberOfProcessors;
+  if (g_segmentLaneLimit != 0 && laneCount > g_segmentLaneLimit) {
+    laneCount = g_segmentLaneLimit;
+  }
+  if (laneCount > SEGMENT_MAX_LANES) {
+    laneCount = SEGMENT_MAX_LANES;
+  }
+  if (laneCount < 2) {
+    return false;
+  }
+
+  ruleSet->lanes = (SegmentLane*) calloc(laneCount, sizeof(SegmentLane));
+  if (!ruleSet->lanes) {
+    return false;
+  }
+  ruleSet->laneCount = laneCount;
+  pcre2_general_context* laneMemory = pcre2_general_context_create(counting_pcre2_malloc, counting_pcre2_free, NULL);
+  bool created = laneMemory != NULL;
+  for (size_t i = 0; created && i < laneCount; ++i) {
+    SegmentLane* lane = &ruleSet->lanes[i];
+    lane->matchData = pcre2_match_data_create(ruleSet->lineScopedOvectorPairs, laneMemory);
+    lane->matchContext = pcre2_match_context_create(laneMemory);
+    created = lane->matchData && lane->matchContext;
+    if (created && ruleSet->patternCount > 0) {
+      // JIT stacks must not be shared between threads; without one a lane falls back to the 32 KiB machine stack.
+      lane->jitStack = pcre2_jit_stack_create(JIT_STACK_START_SIZE, JIT_STACK_MAX_SIZE, NULL);
+      if (lane->jitStack) {
+        pcre2_jit_stack_assign(lane->matchContext, NULL, lane->jitStack);
+      }
+    }
+    if (created && ruleSet->dfaPatternCount > 0) {
+      lane->dfaWorkspace.slots = (int*) malloc(DFA_WORKSPACE_START_SLOTS * sizeof(int));
+      lane->dfaWorkspace.slotCount = DFA_WORKSPACE_START_SLOTS;
+      created = lane->dfaWorkspace.slots != NULL;
+    }
+  }
+  pcre2_general_context_free(laneMemory);
+  if (!created) {
+    free_segment_lanes(ruleSet);
+    log_error("Out of memory while creating segment lanes; scope line rules run serially");
+  }
+  return created;
+}
+
+// Splits the matchable part of the text into at most one segment per lane, each ending just after a line feed and
+// none shorter than SEGMENT_MIN_UNITS. Boundaries only affect speed: lanes still search the whole text.
+static size_t plan_text_segments(RuleSet* ruleSet, const wchar_t* text, size_t length, size_t contextLength) {
+  size_t segmentCount = (length - contextLength) / SEGMENT_MIN_UNITS;
+  if (segmentCount > ruleSet->laneCount) {
+    segmentCount = ruleSet->laneCount;
+  }
+
+  size_t planned = 0;
+  size_t start = contextLength;
+  while (planned < segmentCount && start < length) {
+    size_t end = length;
+    if (planned + 1 < segmentCount) {
+      end = start + (length - start) / (segmentCount - planned);
+      while (end < length && text[end - 1] != L'\n') {
+        end++;
+      }
+    }
+    ruleSet->lanes[planned].segmentStart = start;
+    ruleSet->lanes[planned].segmentEnd = end;
+    planned++;
+    start = end;
+  }
+  return planned;
+}
+
+typedef struct {
+  RuleSet* ruleSet;
+  const RegexRule* rule;
+  const RegexPattern* pattern;
+  const NormalizationCancel* cancel;
+  MatchBudget budget;
+  ULONGLONG deadlineTick;
+  TrimWhitespaceScanner scanner;
+  wchar_t* text;
+  size_t length;
+  size_t contextLength;
+  volatile LONG nextLane;
+} SegmentPass;
+
+static VOID CALLBACK run_segment_lane(PTP_CALLBACK_INSTANCE instance, PVOID context, PTP_WORK work) {
+  (void) instance;
+  (void) work;
+  SegmentPass* pass = (SegmentPass*) context;
+  SegmentLane* lane = &pass->ruleSet->lanes[InterlockedIncrement(&pass->nextLane) - 1];
+  const RegexPattern* pattern = pass->pattern;
+  lane->outputLength = 0;
+  lane->substitutions = 0;
+  lane->matchCalls = 0;
+  lane->overrun = false;
+  lane->errorMessage[0] = '\0';
+  memset(&lane->budget, 0, sizeof(lane->budget));
+
+  if (pattern->kernel == PATTERN_KERNEL_TRIM_TRAILING) {
+    // Segments end after a line feed, so no whitespace run the kernel removes can straddle two of them.
+    lane->outputLength =
+        trim_trailing_whitespace_in_place(pass->text + lane->segmentStart, lane->segmentEnd - lane->segmentStart,
+                                          pass->scanner, &lane->substitutions);
+    lane->failed = false;
+    return;
+  }
+
+  pcre2_set_match_limit(lane->matchContext, pass->budget.matchLimit);
+  pcre2_set_depth_limit(lane->matchContext, pass->budget.depthLimit);
+  pcre2_set_heap_limit(lane->matchContext, pass->budget.heapLimitKib);
+  pcre2_set_offset_limit(lane->matchContext, lane->segmentEnd < pass->length ? lane->segmentEnd - 1 : PCRE2_UNSET);
+  lane->budget.timeLimitMs = pass->budget.timeLimitMs;
+  lane->budget.deadlineTick = pass->deadlineTick;
+  // The first lane also carries the lookbehind-only context, so the stitched text starts where the buffer does.
+  size_t copyStart = lane->segmentStart == pass->contextLength ? 0 : lane->segmentStart;
+  // apply_configured_replacements validated the text before any pattern reached PCRE2.
+  MatchScratch scratch = {lane->matchData, lane->matchContext, &lane->dfaWorkspace, PCRE2_NO_UTF_CHECK};
+  lane->failed = !substitute_pattern_literal(
+      pattern, &scratch, pass->cancel, &lane->budget, pass->rule->replacement, pass->rule->replacementLength,
+      pass->text, pass->length, copyStart, lane->segmentStart, lane->segmentEnd, NULL, &lane->output,
+      &lane->outputCapacity, &lane->outputLength, &lane->substitutions, &lane->matchCalls, &lane->overrun,
+      lane->errorMessage, sizeof(lane->errorMessage));
+}
+
+// Makes the scratch buffer, which now holds a pass's output, the current text and recycles the previous text as
+// scratch. The clipboard block is never recycled, since realloc cannot grow it; the scratch slot is emptied instead.
+static void swap_in_scratch_text(RuleSet* ruleSet, NormalizedBuffer* buffer, size_t length) {
+  wchar_t* previousText = buffer->text;
+  size_t previousCapacity = buffer->capacity;
+  buffer->text = ruleSet->scratchText;
+  buffer->capacity = ruleSet->scratchCapacity;
+  buffer->length = length;
+  if (previousText == buffer->clipboardText) {
+    ruleSet->scratchText = NULL;
+    ruleSet->scratchCapacity = 0;
+  } else {
+    ruleSet->scratchText = previousText;
+    ruleSet->scratchCapacity = previousCapacity;
+  }
+}
+
+// Bytes held by the text buffers of one normalization: its text, the rule set's scratch and lane outputs, and the
+// clipboard block whenever the text has moved out of it.
+static size_t normalization_text_bytes(const RuleSet* ruleSet, const NormalizedBuffer* buffer) {
+  size_t units = buffer->capacity + 1;
+  if (ruleSet->scratchText) {
+    units += ruleSet->scratchCapacity + 1;
+  }
+  for (size_t i = 0; i < ruleSet->laneCount; ++i) {
+    if (ruleSet->lanes[i].output) {
+      units += ruleSet->lanes[i].outputCapacity + 1;
+    }
+  }
+  if (buffer->clipboardText && buffer->text != buffer->clipboardText) {
+    units += buffer->clipboardCapacity + 1;
+  }
+  return units * sizeof(wchar_t);
+}
+
+typedef enum { SEGMENTED_SERIAL, SEGMENTED_APPLIED, SEGMENTED_FAILED } SegmentedOutcome;
+
+// Runs one pattern of a `scope line` rule on every segment through the process thread pool and stitches the
+// results into `buffer`. Returns SEGMENTED_SERIAL, leaving `buffer` untouched, when the text is too small to split
+// or some match crossed a segment boundary; the caller then runs the pattern on the whole text as usual.
+static SegmentedOutcome apply_pattern_in_segments(RuleSet* ruleSet, const RegexRule* rule,
+                                                  const RegexPattern* pattern, const MatchBudget* budget,
+                                                  MatchBudgetState* budgetState, NormalizedBuffer* buffer,
+                                                  const NormalizationCancel* cancel, size_t* outSubstitutions,
+                                                  size_t* outMatchCalls, char* errorMessage, size_t errorMessageSize) {
+  if (buffer->length - buffer->contextLength < 2 * SEGMENT_MIN_UNITS || !ensure_segment_lanes(ruleSet)) {
+    return SEGMENTED_SERIAL;
+  }
+  size_t segmentCount = plan_text_segments(ruleSet, buffer->text, buffer->length, buffer->contextLength);
+  if (segmentCount < 2) {
+    return SEGMENTED_SERIAL;
+  }
+
+  SegmentPass pass = {ruleSet, rule, pattern, cancel, *budget, budgetState->deadlineTick,
+                      select_trim_whitespace_scanner(), buffer->text, buffer->length, buffer->contextLength, 0};
+  PTP_WORK work = CreateThreadpoolWork(run_segment_lane, &pass, NULL);
+  if (!work) {
+    return SEGMENTED_SERIAL;
+  }
+  for (size_t i = 0; i < segmentCount; ++i) {
+    SubmitThreadpoolWork(work);
+  }
+  WaitForThreadpoolWorkCallbacks(work, FALSE);
+  CloseThreadpoolWork(work);
+
+  size_t substitutions = 0;
+  size_t stitchedLength = 0;
+  bool overrun = false;
+  *outMatchCalls = 0;
+  for (size_t i = 0; i < segmentCount; ++i) {
+    const SegmentLane* lane = &ruleSet->lanes[i];
+    *outMatchCalls += lane->matchCalls;
+    if (lane->failed) {
+      budgetState->exceeded = lane->budget.exceeded;
+      snprintf(errorMessage, errorMessageSize, "%s", lane->errorMessage);
+      return SEGMENTED_FAILED;
+    }
+    overrun = overrun || lane->overrun;
+    substitutions += lane->substitutions;
+    size_t copyStart = i == 0 ? 0 : lane->segmentStart;
+    stitchedLength += lane->substitutions > 0 ? lane->outputLength : lane->segmentEnd - copyStart;
+  }
+
+  if (pattern->kernel == PATTERN_KERNEL_TRIM_TRAILING) {
+    // Each lane compacted its own segment in place; close the gaps they left.
+    size_t writeOffset = ruleSet->lanes[0].segmentStart + ruleSet->lanes[0].outputLength;
+    for (size_t i = 1; i < segmentCount; ++i) {
+      const SegmentLane* lane = &ruleSet->lanes[i];
+      memmove(buffer->text + writeOffset, buffer->text + lane->segmentStart, lane->outputLength * sizeof(wchar_t));
+      writeOffset += lane->outputLength;
+    }
+    buffer->length = writeOffset;
+    buffer->text[buffer->length] = L'\0';
+    *outSubstitutions = substitutions;
+    return SEGMENTED_APPLIED;
+  }
+
+  if (overrun) {
+    log_info("Pattern on line %zu matched across a line in a `scope line` rule; ran it on the whole text",
+             pattern->lineNumber);
+    return SEGMENTED_SERIAL;
+  }
+  if (substitutions == 0) {
+    return SEGMENTED_APPLIED;
+  }
+
+  if (!reserve_wide_buffer(&ruleSet->scratchText, &ruleSet->scratchCapacity, stitchedLength)) {
+    snprintf(errorMessage, errorMessageSize, "Out of memory while applying regex replacement");
+    return SEGMENTED_FAILED;
+  }
+  size_t stitched = 0;
+  for (size_t i = 0; i < segmentCount; ++i) {
+    const SegmentLane* lane = &ruleSet->lanes[i];
+    size_t copyStart = i == 0 ? 0 : lane->segmentStart;
+    const wchar_t* source = lane->substitutions > 0 ? lane->output : buffer->text + copyStart;
+    size_t sourceLength = lane->substitutions > 0 ? lane->outputLength : lane->segmentEnd - copyStart;
+    memcpy(ruleSet->scratchText + stitched, source, sourceLength * sizeof(wchar_t));
+    stitched += sourceLength;
+  }
+  ruleSet->scratchText[stitched] = L'\0';
+  swap_in_scratch_text(ruleSet, buffer, stitched);
+  *outSubstitutions = substitutions;
+  return SEGMENTED_APPLIED;
+}
+
+// Replaces the leftmost-longest literal matches starting in subject[searchStart, subjectLength) in one left-to-right
+// scan, writing subject with those matches replaced into the caller-owned growable buffer once the first match is
+// found. A candidate match is committed once the automaton state no longer reaches back to its start, since no
+// earlier or longer match can follow; scanning then resumes at its end, rereading at most one literal's length.
+// `outRulesTouched` counts distinct rules, whose replacements are added to `presence` when it is not NULL.
+static bool substitute_literals(LiteralAutomaton* automaton, const RuleSet* ruleSet, PresenceMap* presence,
+                                const NormalizationCancel* cancel, const wchar_t* subject, size_t subjectLength,
+                                size_t searchStart, wchar_t** output, size_t* outputCapacity, size_t* outLength,
+                                size_t* outCount, size_t* outRulesTouched, size_t* outEntriesTouched,
+                                char* errorMessage, size_t errorMessageSize) {
+  *outLength = 0;
+  *outCount = 0;
+  *outRulesTouched = 0;
+  *outEntriesTouched = 0;
+  if (++automaton->pass == 0) {
+    memset(automaton->ruleStamps, 0, automaton->ruleCount * sizeof(uint32_t));
+    memset(automaton->entryStamps, 0, automaton->entryCount * sizeof(uint32_t));
+    automaton->pass = 1;
+  }
+
+  const LiteralState* states = automaton->states;
+  size_t outputLength = 0;
+  size_t copiedOffset = 0;
+  size_t count = 0;
+  size_t position = searchStart;
+  uint32_t state = 0;
+  uint32_t candidateEntry = 0; // 1 + entry index, 0 while there is no candidate
+  size_t candidateStart = 0;
+  size_t candidateEnd = 0;
+  for (;;) {
+    while (position < subjectLength) {
+      if ((position & 0xFFFFu) == 0 && normalization_cancelled(cancel)) {
+        snprintf(errorMessage, errorMessageSize, "Cancelled because the clipboard changed");
+        return false;
+      }
+      state = literal_automaton_step(automaton, state, (uint16_t) subject[position++]);
+      uint32_t matchEntry = states[state].matchEntry;
+      if (matchEntry != 0) {
+        size_t matchStart = position - automaton->entries[matchEntry - 1].length;
+        if (candidateEntry == 0 || matchStart < candidateStart ||
+            (matchStart == candidateStart && position > candidateEnd)) {
+          candidateEntry = matchEntry;
+          candidateStart = matchStart;
+          candidateEnd = position;
+        }
+      }
+      if (candidateEntry != 0 && position - states[state].depth > candidateStart) {
+        break;
+      }
+    }
+    if (candidateEntry == 0) {
+      break;
+    }
+
+    uint32_t entryIndex = candidateEntry - 1;
+    uint32_t ruleIndex = automaton->entries[entryIndex].ruleIndex;
+    const RegexRule* rule = &ruleSet->rules[ruleIndex];
+    if (!append_wide_range(output, outputCapacity, &outputLength, subject + copiedOffset,
+                           candidateStart - copiedOffset) ||
+        !append_wide_range(output, outputCapacity, &outputLength, rule->replacement, rule->replacementLength)) {
+      snprintf(errorMessage, errorMessageSize, "Out of memory while applying literal replacement");
+      return false;
+    }
+    if (automaton->entryStamps[entryIndex] != automaton->pass) {
+      automaton->entryStamps[entryIndex] = automaton->pass;
+      ++*outEntriesTouched;
+    }
+    if (automaton->ruleStamps[ruleIndex - automaton->firstRule] != automaton->pass) {
+      automaton->ruleStamps[ruleIndex - automaton->firstRule] = automaton->pass;
+      ++*outRulesTouched;
+      if (presence) {
+        presence_map_add_range(presence, rule->replacement, rule->replacementLength);
+      }
+    }
+    copiedOffset = candidateEnd;
+    count++;
+    position = candidateEnd;
+    state = 0;
+    candidateEntry = 0;
+  }
+
+  if (count == 0) {
+    return true;
+  }
+
+  if (!append_wide_range(output, outputCapacity, &outputLength, subject + copiedOffset,
+                         subjectLength - copiedOffset) ||
+      !reserve_wide_buffer(output, outputCapacity, outputLength)) {
+    snprintf(errorMessage, errorMessageSize, "Out of memory while applying literal replacement");
+    return false;
+  }
+
+  (*output)[outputLength] = L'\0';
+  *outLength = outputLength;
+  *outCount = count;
+  return true;
+}
+
+// Runs the literal rules starting at `rule` as one pass. Their profile is kept on the run's first pattern. Returns
+// false when the normalization was cancelled.
+static bool apply_literal_run(RuleSet* ruleSet, RegexRule* rule, NormalizedBuffer* buffer,
+                              const NormalizationCancel* cancel) {
+  LiteralAutomaton* automaton = rule->literals;
+  RegexPattern* profiled = &rule->patterns[0];
+  buffer->replacementStats.patternsEvaluated += automaton->entryCount;
+
+  LARGE_INTEGER started = {0};
+  QueryPerformanceCounter(&started);
+  LONG allocationsBefore = g_engineAllocations;
+  size_t lengthBefore = buffer->length;
+  size_t replacedLength = 0;
+  size_t substitutionCount = 0;
+  size_t rulesTouched = 0;
+  size_t entriesTouched = 0;
+  char errorMessage[256] = {0};
+  bool substituted = substitute_literals(automaton, ruleSet, ruleSet->presence, cancel, buffer->text, buffer->length,
+                                         buffer->contextLength, &ruleSet->scratchText, &ruleSet->scratchCapacity,
+                                         &replacedLength, &substitutionCount, &rulesTouched, &entriesTouched,
+                                         errorMessage, sizeof(errorMessage));
+  if (substituted && substitutionCount > 0) {
+    swap_in_scratch_text(ruleSet, buffer, replacedLength);
+  }
+  if (!substituted && normalization_cancelled(cancel)) {
+    buffer->cancelled = true;
+    return false;
+  }
+  record_pattern_profile(&profiled->profile, started, allocationsBefore, lengthBefore - buffer->contextLength,
+                         (int64_t) buffer->length - (int64_t) lengthBefore, 1, substitutionCount);
+
+  if (!substituted) {
+    log_error("Literal replacement failed for rules on lines %zu to %zu: %s", rule->lineNumber,
+              ruleSet->rules[automaton->firstRule + automaton->ruleCount - 1].lineNumber, errorMessage);
+    buffer->replacementStats.patternsIncomplete++;
+    return true;
+  }
+  buffer->replacementStats.substitutionsApplied += substitutionCount;
+  buffer->replacementStats.patternsTouched += entriesTouched;
+  buffer->replacementStats.rulesTouched += rulesTouched;
+  return true;
+}
+
+// Applies the rule set's surrogate policy to the text. Returns whether regex patterns may run, PCRE2 then skipping its
+// own UTF check: always after a repair, and under `surrogates reject` only when nothing was unpaired. Patterns
+// served by a kernel count as regex patterns here, so a rejected text comes back the same whichever runs them.
+static bool prepare_utf16_text(const RuleSet* ruleSet, NormalizedBuffer* buffer) {
+  size_t position = find_unpaired_surrogate(buffer->text, 0, buffer->length);
+  if (position == buffer->length) {
+    return true;
+  }
+  if (ruleSet->surrogatePolicy == SURROGATE_POLICY_REJECT) {
+    log_info("Text holds an unpaired surrogate at offset %zu; skipped regex patterns (`surrogates repair` fixes it)",
+             position);
+    return false;
+  }
+
+  size_t repaired = 0;
+  while (position < buffer->length) {
+    buffer->text[position] = (wchar_t) 0xFFFD;
+    repaired++;
+    position = find_unpaired_surrogate(buffer->text, position + 1, buffer->length);
+  }
+  // A repair after a rule ran adds a code unit the presence map built at the start of the pass has not seen.
+  if (ruleSet->presence) {
+    static const wchar_t kReplacementCharacter = (wchar_t) 0xFFFD;
+    presence_map_add_range(ruleSet->presence, &kReplacementCharacter, 1);
+  }
+  log_info("Replaced %zu unpaired surrogate%s with U+FFFD", repaired, repaired == 1 ? "" : "s");
+  return true;
+}
+
+// Decides from what the pass already tracks whether `guard` lets its rule run. `if-contains` first asks the presence
+// map, a superset of the text's code units, so a missing unit skips the rule without a scan.
+static bool rule_guard_allows(const RuleGuard* guard, const NormalizedBuffer* buffer, const PresenceMap* presence) {
+  if (buffer->copiedLength < guard->minLength || (guard->maxLength != 0 && buffer->copiedLength > guard->maxLength) ||
+      buffer->lineCount < guard->minLineCount) {
+    return false;
+  }
+  size_t length = buffer->length - buffer->contextLength;
+  size_t needleLength = guard->requiredTextLength;
+  if (needleLength == 0) {
+    return true;
+  }
+  if (needleLength > length) {
+    return false;
+  }
+  const wchar_t* needle = guard->requiredText;
+  for (size_t i = 0; presence && i < needleLength; ++i) {
+    if (!presence_map_contains(presence, (uint16_t) needle[i])) {
+      return false;
+    }
+  }
+
+  const wchar_t* candidate = buffer->text + buffer->contextLength;
+  const wchar_t* lastStart = candidate + (length - needleLength);
+  while ((candidate = wmemchr(candidate, needle[0], (size_t) (lastStart - candidate) + 1)) != NULL) {
+    if (wmemcmp(candidate + 1, needle + 1, needleLength - 1) == 0) {
+      return true;
+    }
+    if (candidate++ == lastStart) {
+      break;
+    }
+  }
+  return false;
+}
+
+static void apply_configured_replacements(NormalizedBuffer* buffer, const NormalizationCancel* cancel) {
+  if (!buffer || !buffer->text || !g_ruleConfig.hasActiveFile || g_ruleConfig.activeRules.ruleCount == 0) {
+    return;
+  }
+
+  RuleSet* ruleSet = &g_ruleConfig.activeRules;
+  // PCRE2 would otherwise validate everything from the start offset on at every match call; one scan here replaces
+  // all of them, and only rules that can break the encoding need another.
+  bool textValid = prepare_utf16_text(ruleSet, buffer);
+  if (ruleSet->presence) {
+    build_presence_map(ruleSet->presence, buffer->text, buffer->length);
+  }
+
+  for (size_t ruleIndex = 0; ruleIndex < ruleSet->ruleCount; ++ruleIndex) {
+    RegexRule* rule = &ruleSet->rules[ruleIndex];
+    bool ruleChanged = false;
+
+    if (!rule_guard_allows(&rule->guard, buffer, ruleSet->presence)) {
+      buffer->replacementStats.rulesGuarded++;
+      if (rule->literals) {
+        ruleIndex += rule->literals->ruleCount - 1;
+      }
+      continue;
+    }
+
+    if (rule->literals) {
+      if (normalization_cancelled(cancel) || !apply_literal_run(ruleSet, rule, buffer, cancel)) {
+        buffer->cancelled = true;
+        return;
+      }
+      if (rule->mayBreakUtf) {
+        textValid = prepare_utf16_text(ruleSet, buffer);
+      }
+      ruleIndex += rule->literals->ruleCount - 1;
+      continue;
+    }
+
+    MatchBudget budget = effective_match_budget(ruleSet, rule);
+    pcre2_set_match_limit(ruleSet->matchContext, budget.matchLimit);
+    pcre2_set_depth_limit(ruleSet->matchContext, budget.depthLimit);
+    pcre2_set_heap_limit(ruleSet->matchContext, budget.heapLimitKib);
+
+    for (size_t patternIndex = 0; patternIndex < rule->patternCount; ++patternIndex) {
+      RegexPattern* pattern = &rule->patterns[patternIndex];
+      if (normalization_cancelled(cancel)) {
+        buffer->cancelled = true;
+        return;
+      }
+
+      if (!textValid) {
+        buffer->replacementStats.patternsIncomplete++;
+        continue;
+      }
+      if (!ensure_pattern_compiled(ruleSet, rule, pattern)) {
+        buffer->replacementStats.patternsIncomplete++;
+        continue;
+      }
+      buffer->replacementStats.patternsEvaluated++;
+      if (ruleSet->presence && pattern_cannot_match(pattern, ruleSet->presence)) {
+        buffer->replacementStats.patternsSkipped++;
+        pattern->profile.prefilterSkips++;
+        continue;
+      }
+
+      LARGE_INTEGER patternStarted = {0};
+      QueryPerformanceCounter(&patternStarted);
+      LONG allocationsBefore = g_engineAllocations;
+      size_t lengthBefore = buffer->length;
+      size_t replacedLength = 0;
+      size_t substitutionCount = 0;
+      size_t matchCalls = 0;
+      bool substituted = true;
+      char errorMessage[256] = {0};
+      MatchBudgetState budgetState = {0};
+      budgetState.timeLimitMs = budget.timeLimitMs;
+      if (budget.timeLimitMs != 0 && pattern->kernel == PATTERN_KERNEL_NONE) {
+        budgetState.deadlineTick = GetTickCount64() + budget.timeLimitMs;
+      }
+
+      SegmentedOutcome segmented = SEGMENTED_SERIAL;
+      if (rule->lineScoped) {
+        segmented = apply_pattern_in_segments(ruleSet, rule, pattern, &budget, &budgetState, buffer, cancel,
+                                              &substitutionCount, &matchCalls, errorMessage, sizeof(errorMessage));
+      }
+
+      if (segmented != SEGMENTED_SERIAL) {
+        substituted = segmented == SEGMENTED_APPLIED;
+      } else if (pattern->kernel == PATTERN_KERNEL_TRIM_TRAILING) {
+        size_t context = buffer->contextLength;
+        buffer->length = context + trim_trailing_whitespace_in_place(buffer->text + context, buffer->length - context,
+                                                                     select_trim_whitespace_scanner(),
+                                                                     &substitutionCount);
+        buffer->text[buffer->length] = L'\0';
+      } else if (pattern->compactGuardUnits != 0) {
+        // No scratch copy: the output overwrites the text as the scan goes. A scan that stops early (budget, deadline,
+        // error) still leaves a valid text with the matches it got to replaced; those are counted like any others,
+        // and the rule's remaining patterns are skipped as usual.
+        MatchScratch scratch = {NULL, ruleSet->matchContext, &ruleSet->dfaWorkspace, PCRE2_NO_UTF_CHECK};
+        CompactWriter writer = {0};
+        writer.text = buffer->text;
+        writer.guard = pattern->compactGuardUnits;
+        bool overrun = false;
+        size_t segmentMatchCalls = matchCalls;
+        substituted = substitute_pattern_literal(
+            pattern, &scratch, cancel, &budgetState, rule->replacement, rule->replacementLength, buffer->text,
+            buffer->length, 0, buffer->contextLength, buffer->length, &writer, NULL, NULL, &replacedLength,
+            &substitutionCount, &matchCalls, &overrun, errorMessage, sizeof(errorMessage));
+        matchCalls += segmentMatchCalls;
+        buffer->length = compact_writer_finish(&writer, buffer->length);
+        buffer->text[buffer->length] = L'\0';
+      } else {
+        MatchScratch scratch = {NULL, ruleSet->matchContext, &ruleSet->dfaWorkspace, PCRE2_NO_UTF_CHECK};
+        bool overrun = false;
+        size_t segmentMatchCalls = matchCalls;
+        substituted = substitute_pattern_literal(
+            pattern, &scratch, cancel, &budgetState, rule->replacement, rule->replacementLength, buffer->text,
+            buffer->length, 0, buffer->contextLength, buffer->length, NULL, &ruleSet->scratchText,
+            &ruleSet->scratchCapacity, &replacedLength, &substitutionCount, &matchCalls, &overrun, errorMessage,
+            sizeof(errorMessage));
+        matchCalls += segmentMatchCalls;
+        if (substituted && substitutionCount > 0) {
+          swap_in_scratch_text(ruleSet, buffer, replacedLength);
+        }
+      }
+
+      if (!substituted && normalization_cancelled(cancel)) {
+        buffer->cancelled = true;
+        return;
+      }
+      record_pattern_profile(&pattern->profile, patternStarted, allocationsBefore, lengthBefore - buffer->contextLength,
+                             (int64_t) buffer->length - (int64_t) lengthBefore, matchCalls, substitutionCount);
+
+      // A failed scan only reports substitutions it already wrote into the text, which a compacting scan does.
+      if (substitutionCount > 0) {
+        buffer->replacementStats.substitutionsApplied += substitutionCount;
+        buffer->replacementStats.patternsTouched++;
+        ruleChanged = true;
+        // Replacements can only remove code units or add ones from the replacement text, so the map stays a
+        // superset. The rule's next pattern already runs on this output, so the map has to follow it now.
+        if (ruleSet->presence) {
+          presence_map_add_range(ruleSet->presence, rule->replacement, rule->replacementLength);
+        }
+      }
+
+      if (!substituted) {
+        if (budgetState.exceeded) {
+          // Patterns already applied keep their result; the rest of this rule waits for the next clipboard update.
+          log_info("Skipped rule on line %zu for this clipboard: pattern on line %zu: %s", rule->lineNumber,
+                   pattern->lineNumber, errorMessage);
+          buffer->replacementStats.patternsIncomplete += rule->patternCount - patternIndex;
+          break;
+        }
+        log_error("Regex replacement failed for pattern on line %zu: %s", pattern->lineNumber, errorMessage);
+        buffer->replacementStats.patternsIncomplete++;
+        continue;
+      }
+    }
+
+    if (ruleChanged) {
+      buffer->replacementStats.rulesTouched++;
+      if (rule->mayBreakUtf) {
+        textValid = prepare_utf16_text(ruleSet, buffer);
+      }
+    }
+  }
+
+  // Buffers only grow during a pass, so their footprint peaks here, before oversized ones are released.
+  size_t textBytes = normalization_text_bytes(ruleSet, buffer);
+  if (textBytes > buffer->peakBytes) {
+    buffer->peakBytes = textBytes;
+  }
+
+  // Keep the scratch buffer across updates so the steady state allocates nothing, but do not pin a huge paste.
+  if (ruleSet->scratchCapacity > SCRATCH_RETAIN_LIMIT) {
+    free(ruleSet->scratchText);
+    ruleSet->scratchText = NULL;
+    ruleSet->scratchCapacity = 0;
+  }
+  for (size_t i = 0; i < ruleSet->laneCount; ++i) {
+    if (ruleSet->lanes[i].outputCapacity > SCRATCH_RETAIN_LIMIT) {
+      free(ruleSet->lanes[i].output);
+      ruleSet->lanes[i].output = NULL;
+      ruleSet->lanes[i].outputCapacity = 0;
+    }
+  }
+}
+
+// `contextLength` leading units of `input` are kept only so lookbehinds can see them; matching starts after them,
+// which also keeps \A from matching at the start of a later segment of a stream.
+static NormalizedBuffer normalize_text_segment(const wchar_t* input, size_t length, size_t contextLength,
+                                               const NormalizationCancel* cancel) {
+  NormalizedBuffer result = {0};
+  if (!input) {
+    return result;
+  }
+
+  result.text = duplicate_wide_range(input, length);
+  if (!result.text) {
+    return result;
+  }
+  InterlockedIncrement(&g_engineAllocations);
+
+  result.length = length;
+  result.capacity = length;
+  result.contextLength = contextLength;
+  result.lineCount = count_clipboard_lines(input + contextLength, length - contextLength);
+  result.copiedLength = length - contextLength;
+  result.peakBytes = (length + 1) * sizeof(wchar_t);
+  apply_configured_replacements(&result, cancel);
+  return result;
+}
+
+static NormalizedBuffer normalize_clipboard_text(const wchar_t* input, size_t length,
+                                                 const NormalizationCancel* cancel) {
+  return normalize_text_segment(input, length, 0, cancel);
+}
+
+// Normalizes the fetched clipboard block without copying it: in-place passes keep working inside the block, and
+// the result is later put back into it by finish_clipboard_block. Takes ownership of `original`.
+static NormalizedBuffer normalize_clipboard_block(ClipboardBuffer* original, const NormalizationCancel* cancel) {
+  NormalizedBuffer result = {0};
+  result.text = original->text;
+  result.length = original->length;
+  result.capacity = original->length;
+  result.clipboardBlock = original->handle;
+  result.clipboardText = original->text;
+  result.clipboardCapacity = original->length;
+  result.lineCount = count_clipboard_lines(result.text, result.length);
+  result.copiedLength = result.length;
+  result.peakBytes = (result.length + 1) * sizeof(wchar_t);
+  original->text = NULL;
+  original->length = 0;
+  original->handle = NULL;
+  apply_configured_replacements(&result, cancel);
+  return result;
+}
+
+static void free_normalized_buffer(NormalizedBuffer* buffer) {
+  if (buffer->text != buffer->clipboardText) {
+    free(buffer->text);
+  }
+  if (buffer->clipboardBlock) {
+    GlobalUnlock(buffer->clipboardBlock);
+    GlobalFree(buffer->clipboardBlock);
+  }
+  buffer->text = NULL;
+  buffer->clipboardBlock = NULL;
+  buffer->clipboardText = NULL;
+}
+
+// Returns the clipboard block holding the normalized text, unlocked and sized to it, and releases everything else.
+// Text that moved into a heap buffer is copied back, the only copy on the way out; text that never left the block
+// is already in place. Returns NULL on failure, with the buffer freed either way.
+static HGLOBAL finish_clipboard_block(NormalizedBuffer* buffer) {
+  HGLOBAL block = buffer->clipboardBlock;
+  size_t bytes = (buffer->length + 1) * sizeof(wchar_t);
+  if (buffer->text != buffer->clipboardText) {
+    if (buffer->length > buffer->clipboardCapacity) {
+      GlobalUnlock(block);
+      HGLOBAL grown = GlobalReAlloc(block, bytes, GMEM_MOVEABLE);
+      if (grown) {
+        block = grown;
+        buffer->clipboardBlock = grown;
+      }
+      buffer->clipboardText = (wchar_t*) GlobalLock(block);
+      if (!grown || !buffer->clipboardText) {
+        free_normalized_buffer(buffer);
+        return NULL;
+      }
+      buffer->clipboardCapacity = buffer->length;
+      size_t footprint = (buffer->capacity + 1) * sizeof(wchar_t) + bytes;
+      if (footprint > buffer->peakBytes) {
+        buffer->peakBytes = footprint;
+      }
+    }
+    memcpy(buffer->clipboardText, buffer->text, bytes);
+    free(buffer->text);
+    buffer->text = buffer->clipboardText;
+  }
+  buffer->text[buffer->length] = L'\0';
+  GlobalUnlock(block);
+  if (buffer->length < buffer->clipboardCapacity) {
+    // Shrinking an unlocked movable block happens in place; a failure just leaves the slack.
+    HGLOBAL shrunk = GlobalReAlloc(block, bytes, 0);
+    if (shrunk) {
+      block = shrunk;
+    }
+  }
+  buffer->text = NULL;
+  buffer->clipboardBlock = NULL;
+  buffer->clipboardText = NULL;
+  return block;
+}
+
+static void reset_rule_profiles(RuleSet* ruleSet) {
+  for (size_t ruleIndex = 0; ruleIndex < ruleSet->ruleCount; ++ruleIndex) {
+    RegexRule* rule = &ruleSet->rules[ruleIndex];
+    for (size_t patternIndex = 0; patternIndex < rule->patternCount; ++patternIndex) {
+      memset(&rule->patterns[patternIndex].profile, 0, sizeof(PatternProfile));
+    }
+  }
+}
+
+typedef struct {
+  const RegexRule* rule;
+  const RegexPattern* pattern;
+} ProfiledPattern;
+
+static int compare_profiled_patterns_by_time(const void* lhs, const void* rhs) {
+  uint64_t lhsTicks = ((const ProfiledPattern*) lhs)->pattern->profile.ticks;
+  uint64_t rhsTicks = ((const ProfiledPattern*) rhs)->pattern->profile.ticks;
+  return lhsTicks < rhsTicks ? 1 : lhsTicks > rhsTicks ? -1 : 0;
+}
+
+// Returns the active patterns ordered by cumulative time, slowest first, or NULL when there is nothing to report. A
+// run of literal rules is reported once, under its first pattern.
+static ProfiledPattern* collect_profiled_patterns(size_t* outCount) {
+  const RuleSet* ruleSet = &g_ruleConfig.activeRules;
+  size_t capacity = ruleSet->patternCount + ruleSet->literalRunCount;
+  *outCount = 0;
+  if (!g_ruleConfig.hasActiveFile || capacity == 0) {
+    return NULL;
+  }
+
+  ProfiledPattern* patterns = (ProfiledPattern*) malloc(capacity * sizeof(ProfiledPattern));
+  if (!patterns) {
+    return NULL;
+  }
+  size_t count = 0;
+  for (size_t ruleIndex = 0; ruleIndex < ruleSet->ruleCount; ++ruleIndex) {
+    const RegexRule* rule = &ruleSet->rules[ruleIndex];
+    size_t patternCount = rule->literals ? 1 : rule_is_literal(rule) ? 0 : rule->patternCount;
+    for (size_t patternIndex = 0; patternIndex < patternCount && count < capacity; ++patternIndex) {
+      patterns[count].rule = rule;
+      patterns[count].pattern = &rule->patterns[patternIndex];
+      count++;
+    }
+  }
+  qsort(patterns, count, sizeof(ProfiledPattern), compare_profiled_patterns_by_time);
+  *outCount = count;
+  return patterns;
+}
+
+static double profile_ticks_to_ms(uint64_t ticks) {
+  LARGE_INTEGER frequency = {0};
+  QueryPerformanceFrequency(&frequency);
+  return frequency.QuadPart > 0 ? 1000.0 * (double) ticks / (double) frequency.QuadPart : 0.0;
+}
+
+static void log_rule_profiles(const char* reason) {
+  size_t count = 0;
+  ProfiledPattern* patterns = collect_profiled_patterns(&count);
+  if (!patterns) {
+    log_info("Rule profile %s: no active rules", reason);
+    return;
+  }
+
+  log_info("Rule profile %s (%zu pattern%s, slowest first):", reason, count, count == 1 ? "" : "s");
+  for (size_t i = 0; i < count; ++i) {
+    const PatternProfile* profile = &patterns[i].pattern->profile;
+    log_info("  rule %zu pattern %zu: %.3f ms over %llu run%s (%llu prefiltered), %.2f MB scanned, %llu match call%s, "
+             "%llu substitution%s, %+lld units, %llu allocation%s",
+             patterns[i].rule->lineNumber, patterns[i].pattern->lineNumber, profile_ticks_to_ms(profile->ticks),
+             (unsigned long long) profile->runs, profile->runs == 1 ? "" : "s",
+             (unsigned long long) profile->prefilterSkips, (double) profile->bytesScanned / 1000000.0,
+             (unsigned long long) profile->matchCalls, profile->matchCalls == 1 ? "" : "s",
+             (unsigned long long) profile->substitutions, profile->substitutions == 1 ? "" : "s",
+             (long long) profile->outputGrowth, (unsigned long long) profile->allocations,
+             profile->allocations == 1 ? "" : "s");
+  }
+  free(patterns);
+}
+
+static bool append_format(char** buffer, size_t* capacity, size_t* length, const char* fmt, ...) {
+  va_list args;
+  va_start(args, fmt);
+  int required = vsnprintf(NULL, 0, fmt, args);
+  va_end(args);
+  if (required < 0 || !reserve_byte_buffer(buffer, capacity, *length + (size_t) required + 1)) {
+    return false;
+  }
+
+  va_start(args, fmt);
+  vsnprintf(*buffer + *length, (size_t) required + 1, fmt, args);
+  va_end(args);
+  *length += (size_t) required;
+  return true;
+}
+
+static bool append_json_string(char** buffer, size_t* capacity, size_t* length, const char* text) {
+  if (!append_format(buffer, capacity, length, "\"")) {
+    return false;
+  }
+  for (const unsigned char* c = (const unsigned char*) text; *c; ++c) {
+    bool ok = *c == '"' || *c == '\\' ? append_format(buffer, capacity, length, "\\%c", *c)
+              : *c < 0x20         ? append_format(buffer, capacity, length, "\\u%04x", *c)
+                                  : append_format(buffer, capacity, length, "%c", *c);
+    if (!ok) {
+      return false;
+    }
+  }
+  return append_format(buffer, capacity, length, "\"");
+}
+
+// Appends one JSON object per call to the --stats-file, so a long-running instance leaves a time series behind.
+static void write_rule_profile_json(const char* reason) {
+  if (!g_statsFilePath) {
+    return;
+  }
+
+  size_t count = 0;
+  ProfiledPattern* patterns = collect_profiled_patterns(&count);
+  char* line = NULL;
+  size_t capacity = 0;
+  size_t length = 0;
+  SYSTEMTIME now;
+  GetSystemTime(&now);
+  char* rulesPath = utf8_from_wide(g_ruleConfig.activePath);
+
+  bool ok = append_format(&line, &capacity, &length,
+                          "{\"time\":\"%04u-%02u-%02uT%02u:%02u:%02u.%03uZ\",\"reason\":", (unsigned) now.wYear,
+                          (unsigned) now.wMonth, (unsigned) now.wDay, (unsigned) now.wHour, (unsigned) now.wMinute,
+                          (unsigned) now.wSecond, (unsigned) now.wMilliseconds) &&
+            append_json_string(&line, &capacity, &length, reason) &&
+            append_format(&line, &capacity, &length, ",\"rules\":") &&
+            append_json_string(&line, &capacity, &length, rulesPath ? rulesPath : "") &&
+            append_format(&line, &capacity, &length, ",\"patterns\":[");
+  for (size_t i = 0; ok && i < count; ++i) {
+    const PatternProfile* profile = &patterns[i].pattern->profile;
+    ok = append_format(&line, &capacity, &length,
+                       "%s{\"rule\":%zu,\"line\":%zu,\"runs\":%llu,\"prefiltered\":%llu,\"ms\":%.3f,\"bytes\":%llu,"
+                       "\"matchCalls\":%llu,\"substitutions\":%llu,\"growth\":%lld,\"allocations\":%llu}",
+                       i == 0 ? "" : ",", patterns[i].rule->lineNumber, patterns[i].pattern->lineNumber,
+                       (unsigned long long) profile->runs, (unsigned long long) profile->prefilterSkips,
+                       profile_ticks_to_ms(profile->ticks), (unsigned long long) profile->bytesScanned,
+                       (unsigned long long) profile->matchCalls, (unsigned long long) profile->substitutions,
+                       (long long) profile->outputGrowth, (unsigned long long) profile->allocations);
+  }
+  ok = ok && append_format(&line, &capacity, &length, "]}\n");
+  free(rulesPath);
+  free(patterns);
+  if (!ok) {
+    free(line);
+    log_error("Out of memory while formatting rule profile");
+    return;
+  }
+
+  HANDLE file = CreateFileW(g_statsFilePath, FILE_APPEND_DATA, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, OPEN_ALWAYS,
+                            FILE_ATTRIBUTE_NORMAL, NULL);
+  DWORD written = 0;
+  if (file == INVALID_HANDLE_VALUE || !WriteFile(file, line, (DWORD) length, &written, NULL) || written != length) {
+    log_error("Unable to append rule profile to stats file (%lu)", GetLastError());
+  }
+  if (file != INVALID_HANDLE_VALUE) {
+    CloseHandle(file);
+  }
+  free(line);
+}
+
+// Must run on the thread that owns g_ruleConfig: the worker, or the main thread once the worker has stopped.
+static void report_rule_profiles(const char* reason) {
+  log_rule_profiles(reason);
+  write_rule_profile_json(reason);
+}
+
+// Hands `data`, a movable block the worker already filled, to the clipboard; the clipboard is only held open for the
+// handover. On failure the caller still owns `data`. `*outWrittenSequence` receives the sequence number of our own
+// write so its WM_CLIPBOARDUPDATE can be recognised.
+static bool set_clipboard_data(HWND hwnd, HGLOBAL data, DWORD expectedSequence, bool* outStale,
+                               DWORD* outWrittenSequence) {
+  *outStale = false;
+  if (!data) {
+    return false;
+  }
+
+  if (!try_open_clipboard(hwnd)) {
+    log_error("Unable to open clipboard for writing");
+    return false;
+  }
+
+  if (GetClipboardSequenceNumber() != expectedSequence) {
+    CloseClipboard();
+    *outStale = true;
+    return false;
+  }
+
+  if (!EmptyClipboard()) {
+    CloseClipboard();
+    log_error("Failed to empty clipboard before writing");
+    return false;
+  }
+
+  if (!SetClipboardData(CF_UNICODETEXT, data)) {
+    CloseClipboard();
+    log_error("SetClipboardData failed");
+    return false;
+  }
+
+  // Still open, so nobody else can have bumped the number past our write yet.
+  if (outWrittenSequence) {
+    *outWrittenSequence = GetClipboardSequenceNumber();
+  }
+  CloseClipboard();
+  return true;
+}
+
+static void refresh_unwatched_rule_config(void) {
+  if (!g_rulesWatcher.thread) {
+    // Without change notifications the only way to notice an edited config is to check it on every update.
+    refresh_replacement_config();
+    publish_rule_settings();
+  }
+}
+
+static void process_normalization_job(HWND hwnd, ClipboardBuffer* original, DWORD sequence) {
+  refresh_unwatched_rule_config();
+
+  NormalizationCancel cancel = {&g_worker.latestSequence, (LONG) sequence};
+  // The text is normalized in place, so whatever decides "unchanged" later has to be taken now.
+  size_t originalLength = original->length;
+  uint64_t originalFingerprint = fingerprint_text(original->text, original->length);
+  NormalizedBuffer normalized = normalize_clipboard_block(original, &cancel);
+  if (normalized.cancelled) {
+    log_info("Clipboard changed while normalizing; abandoned stale update");
+    free_normalized_buffer(&normalized);
+    return;
+  }
+  if (normalized.replacementStats.patternsEvaluated > 0) {
+    log_debug("Prefilter skipped %zu of %zu pattern%s (%.0f%%)", normalized.replacementStats.patternsSkipped,
+             normalized.replacementStats.patternsEvaluated,
+             normalized.replacementStats.patternsEvaluated == 1 ? "" : "s",
+             100.0 * (double) normalized.replacementStats.patternsSkipped /
+                 (double) normalized.replacementStats.patternsEvaluated);
+  }
+  if (normalized.replacementStats.rulesGuarded > 0) {
+    log_debug("Rule guards held back %zu rule%s", normalized.replacementStats.rulesGuarded,
+              normalized.replacementStats.rulesGuarded == 1 ? "" : "s");
+  }
+
+  // Without a substitution the text is untouched; with one it can still come out identical, e.g. `a` -> `a`.
+  uint64_t fingerprint = originalFingerprint;
+  bool changed = false;
+  if (normalized.replacementStats.substitutionsApplied > 0) {
+    fingerprint = fingerprint_text(normalized.text, normalized.length);
+    changed = normalized.length != originalLength || fingerprint != originalFingerprint;
+  }
+  // Only a pass that ran every pattern it should have may vouch for its output; 0 withdraws the last fingerprint.
+  size_t incomplete = normalized.replacementStats.patternsIncomplete;
+  uint64_t publishedFingerprint = incomplete == 0 ? fingerprint : 0;
+
+  if (!changed) {
+    if (incomplete == 0) {
+      log_info("Clipboard text already normalized (%zu line%s)", normalized.lineCount,
+               normalized.lineCount == 1 ? "" : "s");
+    } else {
+      log_info("Clipboard text left as is; %zu pattern%s did not finish, so it is checked again if copied again",
+               incomplete, incomplete == 1 ? "" : "s");
     }
-    free(path);
+    publish_normalized_fingerprint(publishedFingerprint);
+    free_normalized_buffer(&normalized);
+    return;
+  }
+
+  NormalizationResult* result = (NormalizationResult*) malloc(sizeof(NormalizationResult));
+  if (!result) {
+    log_error("Out of memory while publishing normalized clipboard text");
+    free_normalized_buffer(&normalized);
+    return;
+  }
+  result->sequence = sequence;
+  result->fingerprint = publishedFingerprint;
+  result->ruleGeneration = g_ruleGeneration;
+  result->replacementStats = normalized.replacementStats;
+  result->clipboardData = finish_clipboard_block(&normalized);
+  result->peakBytes = normalized.peakBytes;
+  if (!result->clipboardData) {
+    log_error("Out of memory while preparing normalized clipboard text");
+    free(result);
+    return;
+  }
+  if (!PostMessageW(hwnd, WM_APP_NORMALIZED, 0, (LPARAM) result)) {
+    GlobalFree(result->clipboardData);
+    free(result);
+  }
+}
+
+// Normalizes text taken over for delayed rendering. A paste is blocked on the result, so it is never cancelled, and
+// the block comes back for rendering whether or not a rule changed anything.
+static HGLOBAL render_normalization_job(ClipboardBuffer* original) {
+  refresh_unwatched_rule_config();
+  NormalizedBuffer normalized = normalize_clipboard_block(original, NULL);
+  const ReplacementStats* stats = &normalized.replacementStats;
+  log_info("Applied %zu regex replacement%s across %zu rule%s on paste (peak %zu KiB of text buffers)",
+           stats->substitutionsApplied, stats->substitutionsApplied == 1 ? "" : "s", stats->rulesTouched,
+           stats->rulesTouched == 1 ? "" : "s", (normalized.peakBytes + 1023) / 1024);
+  // Rendering may notify clipboard listeners, us included; the fingerprint lets that notification skip the text.
+  publish_normalized_fingerprint(stats->patternsIncomplete == 0 ? fingerprint_text(normalized.text, normalized.length)
+                                                                : 0);
+  HGLOBAL data = finish_clipboard_block(&normalized);
+  if (!data) {
+    log_error("Out of memory while rendering normalized clipboard text");
+  }
+  return data;
+}
+
+// The first job pays for compiling whatever patterns it reaches that the pre-warm has not got to yet.
+static void log_first_normalization(LARGE_INTEGER jobStarted) {
+  g_firstNormalizationLogged = true;
+  LARGE_INTEGER now = {0};
+  QueryPerformanceCounter(&now);
+  const RuleSet* rules = &g_ruleConfig.activeRules;
+  log_info("First normalization took %.1f ms, finished %.1f ms after launch (%zu/%zu pattern%s compiled)",
+           profile_ticks_to_ms((uint64_t) (now.QuadPart - jobStarted.QuadPart)),
+           profile_ticks_to_ms((uint64_t) (now.QuadPart - g_launchCounter.QuadPart)),
+           rules->patternCount - rules->compilePendingCount, rules->patternCount, rules->patternCount == 1 ? "" : "s");
+}
+
+static DWORD WINAPI normalization_worker_main(LPVOID parameter) {
+  (void) parameter;
+  ULONGLONG nextStatsTick = GetTickCount64() + g_statsIntervalMs;
+  for (;;) {
+    DWORD waitMs = INFINITE;
+    if (g_statsFilePath) {
+      ULONGLONG now = GetTickCount64();
+      if (now >= nextStatsTick) {
+        write_rule_profile_json("interval");
+        nextStatsTick = now + g_statsIntervalMs;
+      }
+      waitMs = (DWORD) (nextStatsTick - now);
+    }
+    // While idle, compile the patterns no text has reached yet, one per wait so a new job is held up by at most one
+    // compilation.
+    RuleSet* rules = &g_ruleConfig.activeRules;
+    bool prewarming = g_prewarmPatterns && g_ruleConfig.hasActiveFile && rules->compilePendingCount > 0;
+    if (prewarming) {
+      waitMs = 0;
+    }
+    if (WaitForSingleObject(g_worker.wakeEvent, waitMs) == WAIT_TIMEOUT) {
+      if (prewarming && !prewarm_next_pattern(rules)) {
+        log_debug("Pre-warm finished: %zu/%zu pattern%s compiled", rules->patternCount - rules->compileFailureCount,
+                  rules->patternCount, rules->patternCount == 1 ? "" : "s");
+      }
+      continue;
+    }
+
+    AcquireSRWLockExclusive(&g_worker.lock);
+    if (g_worker.stopRequested) {
+      ReleaseSRWLockExclusive(&g_worker.lock);
+      return 0;
+    }
+    ClipboardBuffer original = g_worker.pendingText;
+    DWORD sequence = g_worker.pendingSequence;
+    bool hasJob = g_worker.hasPendingJob;
+    g_worker.pendingText.text = NULL;
+    g_worker.pendingText.length = 0;
+    g_worker.hasPendingJob = false;
+    ClipboardBuffer renderText = g_worker.renderText;
+    bool hasRenderJob = g_worker.hasRenderJob;
+    memset(&g_worker.renderText, 0, sizeof(g_worker.renderText));
+    g_worker.hasRenderJob = false;
+    ReleaseSRWLockExclusive(&g_worker.lock);
+
+    if (InterlockedExchange(&g_worker.statsRequested, 0) != 0) {
+      report_rule_profiles("on request");
+    }
+
+    install_pending_rule_update();
+
+    LARGE_INTEGER jobStarted = {0};
+    QueryPerformanceCounter(&jobStarted);
+    if (hasRenderJob) {
+      HGLOBAL rendered = render_normalization_job(&renderText);
+      // Signalled under the lock, so a paste that gives up either sees the result or has it freed here.
+      AcquireSRWLockExclusive(&g_worker.lock);
+      bool abandoned = g_worker.renderAbandoned;
+      g_worker.renderAbandoned = false;
+      if (!abandoned) {
+        g_worker.renderedData = rendered;
+        SetEvent(g_worker.renderDoneEvent);
+      }
+      ReleaseSRWLockExclusive(&g_worker.lock);
+      if (abandoned) {
+        GlobalFree(rendered);
+      }
+    }
+
+    if (hasJob) {
+      process_normalization_job(g_worker.hwnd, &original, sequence);
+      free_clipboard_buffer(&original);
+    }
+    if ((hasJob || hasRenderJob) && !g_firstNormalizationLogged) {
+      log_first_normalization(jobStarted);
+    }
+  }
+}
+
+static bool start_normalization_worker(HWND hwnd) {
+  InitializeSRWLock(&g_worker.lock);
+  g_worker.hwnd = hwnd;
+  g_worker.wakeEvent = CreateEventW(NULL, FALSE, FALSE, NULL);
+  g_worker.renderDoneEvent = CreateEventW(NULL, FALSE, FALSE, NULL);
+  if (g_worker.wakeEvent && g_worker.renderDoneEvent) {
+    g_worker.thread = CreateThread(NULL, 0, normalization_worker_main, NULL, 0, NULL);
+  }
+  if (!g_worker.thread) {
+    if (g_worker.wakeEvent) {
+      CloseHandle(g_worker.wakeEvent);
+    }
+    if (g_worker.renderDoneEvent) {
+      CloseHandle(g_worker.renderDoneEvent);
+    }
+    g_worker.wakeEvent = NULL;
+    g_worker.renderDoneEvent = NULL;
+    return false;
+  }
+  return true;
+}
+
+static void stop_normalization_worker(void) {
+  if (!g_worker.thread) {
+    return;
+  }
+
+  AcquireSRWLockExclusive(&g_worker.lock);
+  g_worker.stopRequested = true;
+  ReleaseSRWLockExclusive(&g_worker.lock);
+  // Any in-flight job is now stale; make it bail out at its next cancellation check.
+  InterlockedIncrement(&g_worker.latestSequence);
+  SetEvent(g_worker.wakeEvent);
+  WaitForSingleObject(g_worker.thread, INFINITE);
+
+  CloseHandle(g_worker.thread);
+  CloseHandle(g_worker.wakeEvent);
+  CloseHandle(g_worker.renderDoneEvent);
+  free_clipboard_buffer(&g_worker.pendingText);
+  free_clipboard_buffer(&g_worker.renderText);
+  free_rule_update((RuleUpdate*) InterlockedExchangePointer((PVOID volatile*) &g_worker.pendingRules, NULL));
+  g_worker.thread = NULL;
+  g_worker.wakeEvent = NULL;
+  g_worker.renderDoneEvent = NULL;
+  g_worker.hasPendingJob = false;
+  g_worker.hasRenderJob = false;
+  g_worker.renderAbandoned = false;
+}
+
+static bool issue_directory_watch(WatchedDirectory* directory) {
+  memset(&directory->overlapped, 0, sizeof(directory->overlapped));
+  directory->overlapped.hEvent = directory->event;
+  return ReadDirectoryChangesW(directory->handle, directory->buffer, sizeof(directory->buffer), FALSE,
+                               FILE_NOTIFY_CHANGE_FILE_NAME | FILE_NOTIFY_CHANGE_LAST_WRITE | FILE_NOTIFY_CHANGE_SIZE,
+                               NULL, &directory->overlapped, NULL) != 0;
+}
+
+static bool notification_mentions_rules_file(const WatchedDirectory* directory, DWORD bytesTransferred) {
+  if (bytesTransferred == 0) {
+    // The change buffer overflowed, so anything may have happened.
+    return true;
+  }
+
+  size_t rulesNameLength = sizeof(kRulesFileName) / sizeof(kRulesFileName[0]) - 1;
+  const unsigned char* cursor = (const unsigned char*) directory->buffer;
+  const unsigned char* end = cursor + bytesTransferred;
+  while (cursor + sizeof(FILE_NOTIFY_INFORMATION) <= end) {
+    const FILE_NOTIFY_INFORMATION* info = (const FILE_NOTIFY_INFORMATION*) cursor;
+    if (info->FileNameLength / sizeof(wchar_t) == rulesNameLength &&
+        _wcsnicmp(info->FileName, kRulesFileName, rulesNameLength) == 0) {
+      return true;
+    }
+    if (info->NextEntryOffset == 0) {
+      break;
+    }
+    cursor += info->NextEntryOffset;
+  }
+  return false;
+}
+
+// Compiling here rather than on the worker keeps clipboard updates flowing with the previous rules until the new ones
+// are ready. An update the worker has not picked up yet is superseded and freed, since no job ever saw it.
+static void publish_rule_update(RuleUpdate* update) {
+  if (!update) {
+    return;
+  }
+  free_rule_update((RuleUpdate*) InterlockedExchangePointer((PVOID volatile*) &g_worker.pendingRules, update));
+  SetEvent(g_worker.wakeEvent);
+}
+
+static DWORD WINAPI rules_watcher_main(LPVOID parameter) {
+  (void) parameter;
+  HANDLE waitHandles[3];
+  waitHandles[0] = g_rulesWatcher.stopEvent;
+  for (size_t i = 0; i < g_rulesWatcher.directoryCount; ++i) {
+    waitHandles[i + 1] = g_rulesWatcher.directories[i].event;
+  }
+
+  for (;;) {
+    DWORD waitResult = WaitForMultipleObjects((DWORD) g_rulesWatcher.directoryCount + 1, waitHandles, FALSE, INFINITE);
+    if (waitResult == WAIT_OBJECT_0 || waitResult == WAIT_FAILED) {
+      return 0;
+    }
+
+    WatchedDirectory* directory = &g_rulesWatcher.directories[waitResult - WAIT_OBJECT_0 - 1];
+    DWORD bytesTransferred = 0;
+    bool completed = GetOverlappedResult(directory->handle, &directory->overlapped, &bytesTransferred, FALSE) != 0;
+    bool rulesChanged = !completed || notification_mentions_rules_file(directory, bytesTransferred);
+    // Re-arm before compiling so edits saved while a large config compiles queue up instead of being missed.
+    if (!issue_directory_watch(directory)) {
+      log_info("Stopped watching a rules directory (%lu); edits there need a restart", GetLastError());
+      // Leave the event unsignaled forever rather than spinning on a dead handle.
+      ResetEvent(directory->event);
+    }
+    if (rulesChanged) {
+      publish_rule_update(resolve_rule_update());
+    }
+  }
+}
+
+static bool add_watched_directory(const wchar_t* path) {
+  size_t capacity = sizeof(g_rulesWatcher.directories) / sizeof(g_rulesWatcher.directories[0]);
+  if (!path || g_rulesWatcher.directoryCount >= capacity) {
+    return false;
+  }
+
+  HANDLE handle = CreateFileW(path, FILE_LIST_DIRECTORY, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, NULL,
+                              OPEN_EXISTING, FILE_FLAG_BACKUP_SEMANTICS | FILE_FLAG_OVERLAPPED, NULL);
+  if (handle == INVALID_HANDLE_VALUE) {
+    return false;
+  }
+  HANDLE event = CreateEventW(NULL, TRUE, FALSE, NULL);
+  if (!event) {
+    CloseHandle(handle);
+    return false;
+  }
+
+  WatchedDirectory* directory = &g_rulesWatcher.directories[g_rulesWatcher.directoryCount];
+  directory->handle = handle;
+  directory->event = event;
+  if (!issue_directory_watch(directory)) {
+    CloseHandle(event);
+    CloseHandle(handle);
+    directory->handle = NULL;
+    directory->event = NULL;
     return false;
   }
+  g_rulesWatcher.directoryCount++;
+  return true;
+}
+
+static void release_watched_directories(void) {
+  for (size_t i = 0; i < g_rulesWatcher.directoryCount; ++i) {
+    WatchedDirectory* directory = &g_rulesWatcher.directories[i];
+    DWORD bytesTransferred = 0;
+    if (CancelIoEx(directory->handle, &directory->overlapped)) {
+      GetOverlappedResult(directory->handle, &directory->overlapped, &bytesTransferred, TRUE);
+    }
+    CloseHandle(directory->handle);
+    CloseHandle(directory->event);
+    directory->handle = NULL;
+    directory->event = NULL;
+  }
+  g_rulesWatcher.directoryCount = 0;
+}
+
+static void start_rules_watcher(void) {
+  wchar_t* currentDirectory = get_current_directory_string();
+  bool watchingCurrent = add_watched_directory(currentDirectory);
+  bool watchingExecutable = false;
+  if (g_executableDirectory && !paths_equal_ignore_case(currentDirectory, g_executableDirectory)) {
+    watchingExecutable = add_watched_directory(g_executableDirectory);
+  }
+  free(currentDirectory);
+
+  if (!watchingCurrent && !watchingExecutable) {
+    log_error("Unable to watch rules directories (%lu); checking trim.rules on every clipboard update", GetLastError());
+    return;
+  }
+
+  g_rulesWatcher.stopEvent = CreateEventW(NULL, TRUE, FALSE, NULL);
+  if (g_rulesWatcher.stopEvent) {
+    g_rulesWatcher.thread = CreateThread(NULL, 0, rules_watcher_main, NULL, 0, NULL);
+  }
+  if (!g_rulesWatcher.thread) {
+    log_error("Failed to start rules watcher (%lu); checking trim.rules on every clipboard update", GetLastError());
+    if (g_rulesWatcher.stopEvent) {
+      CloseHandle(g_rulesWatcher.stopEvent);
+      g_rulesWatcher.stopEvent = NULL;
+    }
+    release_watched_directories();
+    return;
+  }
+  log_info("Watching %zu director%s for trim.rules changes", g_rulesWatcher.directoryCount,
+           g_rulesWatcher.directoryCount == 1 ? "y" : "ies");
+}
+
+static void stop_rules_watcher(void) {
+  if (!g_rulesWatcher.thread) {
+    return;
+  }
+
+  SetEvent(g_rulesWatcher.stopEvent);
+  WaitForSingleObject(g_rulesWatcher.thread, INFINITE);
+  CloseHandle(g_rulesWatcher.thread);
+  CloseHandle(g_rulesWatcher.stopEvent);
+  g_rulesWatcher.thread = NULL;
+  g_rulesWatcher.stopEvent = NULL;
+  release_watched_directories();
+}
+
+static void submit_normalization_job(ClipboardBuffer* original, DWORD sequence) {
+  InterlockedExchange(&g_worker.latestSequence, (LONG) sequence);
+
+  AcquireSRWLockExclusive(&g_worker.lock);
+  // A job the worker has not picked up yet is already stale; replace it rather than queueing behind it.
+  free_clipboard_buffer(&g_worker.pendingText);
+  g_worker.pendingText = *original;
+  g_worker.pendingSequence = sequence;
+  g_worker.hasPendingJob = true;
+  ReleaseSRWLockExclusive(&g_worker.lock);
+
+  original->text = NULL;
+  original->length = 0;
+  SetEvent(g_worker.wakeEvent);
+}
+
+// Returns an unlocked clipboard block holding a copy of `text`, or NULL when out of memory.
+static HGLOBAL copy_to_clipboard_block(const wchar_t* text, size_t length) {
+  ClipboardBuffer copy = {0};
+  if (!allocate_clipboard_block(&copy, length)) {
+    return NULL;
+  }
+  wmemcpy(copy.text, text, length);
+  GlobalUnlock(copy.handle);
+  return copy.handle;
+}
+
+// Takes back a render job the paste stopped waiting for. Returns the result if the worker finished in the meantime;
+// otherwise the worker frees whatever it renders.
+static HGLOBAL abandon_render_job(void) {
+  HGLOBAL data = NULL;
+  AcquireSRWLockExclusive(&g_worker.lock);
+  if (g_worker.hasRenderJob) {
+    free_clipboard_buffer(&g_worker.renderText);
+    g_worker.hasRenderJob = false;
+  } else if (WaitForSingleObject(g_worker.renderDoneEvent, 0) == WAIT_OBJECT_0) {
+    data = g_worker.renderedData;
+    g_worker.renderedData = NULL;
+  } else {
+    g_worker.renderAbandoned = true;
+  }
+  ReleaseSRWLockExclusive(&g_worker.lock);
+  return data;
+}
+
+// Hands the taken-over text to the worker, which owns the rules, and waits for it to be normalized: the application
+// pasting is itself blocked in GetClipboardData until the window thread returns from WM_RENDERFORMAT. A paste always
+// gets text: without a worker, when rendering fails, or after RENDER_WAIT_MS it gets the text as copied.
+static HGLOBAL render_deferred_text(void) {
+  if (!g_deferredRender.pending) {
+    return NULL;
+  }
+  ClipboardBuffer original = g_deferredRender.original;
+  memset(&g_deferredRender.original, 0, sizeof(g_deferredRender.original));
+  g_deferredRender.pending = false;
+  g_deferredRender.rendered++;
+
+  // The worker normalizes in place, so the text as copied is set aside first.
+  HGLOBAL fallback = copy_to_clipboard_block(original.text, original.length);
+  if (!g_worker.thread || !fallback) {
+    free_clipboard_buffer(&original);
+    if (!fallback) {
+      log_error("Out of memory while rendering clipboard text");
+    }
+    return fallback;
+  }
+
+  AcquireSRWLockExclusive(&g_worker.lock);
+  g_worker.renderText = original;
+  g_worker.hasRenderJob = true;
+  ReleaseSRWLockExclusive(&g_worker.lock);
+  SetEvent(g_worker.wakeEvent);
+
+  HGLOBAL data = NULL;
+  if (WaitForSingleObject(g_worker.renderDoneEvent, RENDER_WAIT_MS) == WAIT_OBJECT_0) {
+    AcquireSRWLockExclusive(&g_worker.lock);
+    data = g_worker.renderedData;
+    g_worker.renderedData = NULL;
+    ReleaseSRWLockExclusive(&g_worker.lock);
+  } else {
+    data = abandon_render_job();
+    if (!data) {
+      log_info("Normalizing for paste took longer than %u ms; pasted the text as copied", RENDER_WAIT_MS);
+    }
+  }
+  if (!data) {
+    return fallback;
+  }
+  GlobalFree(fallback);
+  return data;
+}
+
+// WM_RENDERFORMAT runs inside the pasting application's GetClipboardData, with the clipboard already open for it.
+static void handle_render_format(UINT format) {
+  if (format != CF_UNICODETEXT) {
+    return;
+  }
+  HGLOBAL data = render_deferred_text();
+  if (data && !SetClipboardData(CF_UNICODETEXT, data)) {
+    GlobalFree(data);
+    log_error("SetClipboardData failed while rendering normalized text");
+  }
+}
 
-  DWORD bytesWritten = 0;
-  DWORD bytesToWrite = (DWORD) strlen(kDefaultRulesFileContents);
-  bool writeOk = WriteFile(file, kDefaultRulesFileContents, bytesToWrite, &bytesWritten, NULL) != 0 &&
-                 bytesWritten == bytesToWrite;
-  DWORD writeError = writeOk ? ERROR_SUCCESS : GetLastError();
-  CloseHandle(file);
+// Sent before the window goes away while a promise is still on the clipboard; unlike WM_RENDERFORMAT we have to open
+// the clipboard ourselves, and someone may have taken it over in between.
+static void handle_render_all_formats(HWND hwnd) {
+  if (!g_deferredRender.pending || !try_open_clipboard(hwnd)) {
+    return;
+  }
+  if (GetClipboardOwner() == hwnd) {
+    handle_render_format(CF_UNICODETEXT);
+  }
+  CloseClipboard();
+}
 
-  if (!writeOk) {
-    DeleteFileW(path);
+// WM_DESTROYCLIPBOARD: whoever emptied the clipboard replaced the promise, so the text it stood for is never needed.
+static void handle_destroy_clipboard(void) {
+  if (!g_deferredRender.pending) {
+    return;
+  }
+  free_clipboard_buffer(&g_deferredRender.original);
+  g_deferredRender.pending = false;
+  g_deferredRender.avoided++;
+  log_debug("Clipboard text replaced before it was pasted; skipped normalizing it (%zu so far)",
+           g_deferredRender.avoided);
+}
 
-    char* utf8Path = utf8_from_wide(path);
-    if (utf8Path) {
-      log_info("Failed to write default replacement config %s (%lu)", utf8Path, writeError);
-      free(utf8Path);
-    } else {
-      log_info("Failed to write default replacement config (%lu)", writeError);
+// Whether the open clipboard holds nothing but text, counting the formats Windows synthesizes from it.
+static bool clipboard_holds_only_text(void) {
+  for (UINT format = EnumClipboardFormats(0); format != 0; format = EnumClipboardFormats(format)) {
+    if (format != CF_UNICODETEXT && format != CF_TEXT && format != CF_OEMTEXT && format != CF_LOCALE) {
+      return false;
     }
-    free(path);
-    return false;
   }
+  return true;
+}
 
-  char* utf8Path = utf8_from_wide(path);
-  if (utf8Path) {
-    log_info("Generated default replacement config %s", utf8Path);
-    free(utf8Path);
+// Replaces the copied text with a delayed-rendering promise for CF_UNICODETEXT and keeps the text until someone
+// pastes. The promise empties the clipboard before anyone knows whether a rule changes the text, so a copy that also
+// offers rich text, HTML or images is normalized right away instead, which leaves it alone unless the text changes.
+static void defer_clipboard_text(HWND hwnd, ClipboardBuffer* original, DWORD sequence) {
+  if (!try_open_clipboard(hwnd)) {
+    log_error("Unable to open clipboard for delayed rendering");
+    free_clipboard_buffer(original);
+    return;
+  }
+  if (GetClipboardSequenceNumber() != sequence) {
+    CloseClipboard();
+    free_clipboard_buffer(original);
+    log_info("Clipboard changed before it could be taken over; skipped stale update");
+    return;
+  }
+  if (!clipboard_holds_only_text()) {
+    CloseClipboard();
+    log_debug("Clipboard holds more than text; normalizing now instead of on paste");
+    submit_normalization_job(original, sequence);
+    return;
+  }
+
+  g_isUpdatingClipboard = true;
+  // Emptying sends WM_DESTROYCLIPBOARD for a previous promise of ours, which counts it as avoided.
+  bool promised = EmptyClipboard() != 0;
+  if (promised) {
+    // A delayed-rendering SetClipboardData returns NULL on success too; only the last error tells them apart.
+    SetLastError(ERROR_SUCCESS);
+    SetClipboardData(CF_UNICODETEXT, NULL);
+    promised = GetLastError() == ERROR_SUCCESS;
+  }
+  if (promised) {
+    g_lastWrittenSequence = GetClipboardSequenceNumber();
+  }
+  CloseClipboard();
+  g_isUpdatingClipboard = false;
+
+  if (!promised) {
+    free_clipboard_buffer(original);
+    log_error("Failed to take over clipboard text for delayed rendering");
+    return;
+  }
+  g_deferredRender.original = *original;
+  g_deferredRender.pending = true;
+  memset(original, 0, sizeof(*original));
+  log_debug("Took over %zu character%s of clipboard text; normalizing on paste", g_deferredRender.original.length,
+           g_deferredRender.original.length == 1 ? "" : "s");
+}
+
+static void handle_clipboard_update(HWND hwnd) {
+  if (g_isUpdatingClipboard) {
+    return;
+  }
+  // Reading our own promise back would render it just to look at it.
+  if (g_deferredRender.pending && GetClipboardOwner() == hwnd) {
+    return;
+  }
+
+  ClipboardBuffer original = {0};
+  bool wasUnicode = false;
+  DWORD sequence = 0;
+  bool alreadyNormalized = false;
+  if (!fetch_clipboard_text(hwnd, &original, &wasUnicode, &sequence, &alreadyNormalized)) {
+    log_info("Clipboard update contained no compatible text");
+    return;
+  }
+  if (alreadyNormalized) {
+    log_debug("Clipboard text matches the last normalized output; skipped");
+    return;
+  }
+
+  if (g_renderOnPaste) {
+    defer_clipboard_text(hwnd, &original, sequence);
+    return;
+  }
+  submit_normalization_job(&original, sequence);
+}
+
+static DWORD effective_debounce_ms(void) {
+  if (g_commandLineDebounceMs >= 0) {
+    return (DWORD) g_commandLineDebounceMs;
+  }
+  LONG rulesDebounceMs = g_rulesDebounceMs;
+  return rulesDebounceMs >= 0 ? (DWORD) rulesDebounceMs : DEFAULT_DEBOUNCE_MS;
+}
+
+// Records a notification and returns how long to wait before normalizing; 0 means run now.
+static DWORD coalescer_on_event(UpdateCoalescer* coalescer, DWORD now, DWORD sequence, DWORD quietWindowMs) {
+  coalescer->lastEventTick = now;
+  coalescer->lastSequence = sequence;
+  coalescer->burstEvents++;
+  coalescer->armed = quietWindowMs > 0;
+  return quietWindowMs;
+}
+
+// Returns 0 once the burst has been quiet long enough (the caller then runs one update), else the remaining delay.
+static DWORD coalescer_on_timer(UpdateCoalescer* coalescer, DWORD now, DWORD quietWindowMs) {
+  if (!coalescer->armed) {
+    return 0;
+  }
+  // GetTickCount wraps at 32 bits, and the host build's DWORD is wider than that.
+  DWORD elapsed = (uint32_t) (now - coalescer->lastEventTick);
+  if (elapsed < quietWindowMs) {
+    return quietWindowMs - elapsed;
+  }
+  coalescer->armed = false;
+  return 0;
+}
+
+// Closes the current burst; returns how many notifications it absorbed beyond the one that runs.
+static size_t coalescer_take_burst(UpdateCoalescer* coalescer) {
+  size_t coalesced = coalescer->burstEvents > 0 ? coalescer->burstEvents - 1 : 0;
+  coalescer->coalescedTotal += coalesced;
+  coalescer->burstEvents = 0;
+  return coalesced;
+}
+
+static void run_coalesced_update(HWND hwnd) {
+  size_t coalesced = coalescer_take_burst(&g_coalescer);
+  if (coalesced > 0) {
+    log_debug("Coalesced %zu clipboard notification%s into sequence %lu (%zu total)", coalesced,
+             coalesced == 1 ? "" : "s", (unsigned long) g_coalescer.lastSequence, g_coalescer.coalescedTotal);
+  }
+  handle_clipboard_update(hwnd);
+}
+
+static void handle_clipboard_notification(HWND hwnd) {
+  if (g_isUpdatingClipboard) {
+    return;
+  }
+  // Our own SetClipboardData posts this notification after g_isUpdatingClipboard is already cleared.
+  DWORD currentSequence = GetClipboardSequenceNumber();
+  if (g_lastWrittenSequence != 0 && currentSequence == g_lastWrittenSequence) {
+    return;
+  }
+
+  DWORD quietWindowMs = effective_debounce_ms();
+  DWORD delay = coalescer_on_event(&g_coalescer, GetTickCount(), currentSequence, quietWindowMs);
+  if (delay == 0) {
+    run_coalesced_update(hwnd);
+    return;
+  }
+  SetTimer(hwnd, COALESCE_TIMER_ID, delay, NULL);
+}
+
+static void handle_coalesce_timer(HWND hwnd) {
+  DWORD remaining = coalescer_on_timer(&g_coalescer, GetTickCount(), effective_debounce_ms());
+  if (remaining > 0) {
+    SetTimer(hwnd, COALESCE_TIMER_ID, remaining, NULL);
+    return;
+  }
+  KillTimer(hwnd, COALESCE_TIMER_ID);
+  run_coalesced_update(hwnd);
+}
+
+static void handle_normalization_result(HWND hwnd, NormalizationResult* result) {
+  const ReplacementStats* stats = &result->replacementStats;
+  bool stale = false;
+
+  g_isUpdatingClipboard = true;
+  DWORD writtenSequence = 0;
+  if (set_clipboard_data(hwnd, result->clipboardData, result->sequence, &stale, &writtenSequence)) {
+    result->clipboardData = NULL; // the clipboard owns it now
+    g_lastWrittenSequence = writtenSequence;
+    if (result->ruleGeneration == g_ruleGeneration) {
+      publish_normalized_fingerprint(result->fingerprint);
+    }
+    log_info("Applied %zu regex replacement%s across %zu rule%s (peak %zu KiB of text buffers)",
+             stats->substitutionsApplied, stats->substitutionsApplied == 1 ? "" : "s", stats->rulesTouched,
+             stats->rulesTouched == 1 ? "" : "s", (result->peakBytes + 1023) / 1024);
+    if (!PlaySoundW(L"SystemNotification", NULL, SND_ALIAS | SND_ASYNC | SND_NODEFAULT)) {
+      MessageBeep(MB_ICONASTERISK);
+    }
+  } else if (stale) {
+    log_info("Clipboard changed while normalizing; discarded stale result");
   } else {
-    log_info("Generated default replacement config");
+    log_error("Failed to set normalized text back onto clipboard");
   }
+  g_isUpdatingClipboard = false;
 
-  free(path);
+  if (result->clipboardData) {
+    GlobalFree(result->clipboardData);
+  }
+  free(result);
+}
+
+// Reads whatever the next ReadFile returns; a closed pipe counts as the end of input like a zero-byte read.
+static bool filter_read_more(FilterStream* stream) {
+  if (!reserve_byte_buffer(&stream->bytes, &stream->byteCapacity, stream->byteCount + FILTER_READ_SIZE)) {
+    log_error("Out of memory while reading filter input");
+    return false;
+  }
+
+  DWORD chunkRead = 0;
+  if (!ReadFile(stream->input, stream->bytes + stream->byteCount, FILTER_READ_SIZE, &chunkRead, NULL)) {
+    DWORD lastError = GetLastError();
+    if (lastError != ERROR_BROKEN_PIPE) {
+      log_error("Unable to read filter input (%lu)", lastError);
+      return false;
+    }
+    chunkRead = 0;
+  }
+  if (chunkRead == 0) {
+    stream->endOfInput = true;
+  }
+  stream->byteCount += (size_t) chunkRead;
+  stream->bytesRead += chunkRead;
   return true;
 }
 
-static bool resolve_rules_config_path(wchar_t** outPath, FILETIME* outWriteTime) {
-  wchar_t* currentDirectory = get_current_directory_string();
-  if (currentDirectory) {
-    wchar_t* currentPath = join_path(currentDirectory, kRulesFileName);
-    free(currentDirectory);
-    if (currentPath) {
-      if (get_file_last_write_time(currentPath, outWriteTime)) {
-        *outPath = currentPath;
-        return true;
-      }
-      free(currentPath);
+static bool filter_write_bytes(FilterStream* stream, const void* bytes, size_t length) {
+  const char* cursor = (const char*) bytes;
+  while (length > 0) {
+    DWORD chunkSize = length > MAXDWORD ? MAXDWORD : (DWORD) length;
+    DWORD chunkWritten = 0;
+    if (!WriteFile(stream->output, cursor, chunkSize, &chunkWritten, NULL) || chunkWritten == 0) {
+      log_error("Unable to write filter output (%lu)", GetLastError());
+      return false;
     }
+    cursor += chunkWritten;
+    length -= chunkWritten;
+    stream->bytesWritten += chunkWritten;
   }
+  return true;
+}
 
-  if (!g_executableDirectory) {
-    return false;
+static bool filter_write_text(FilterStream* stream, const wchar_t* text, size_t length) {
+  if (length == 0) {
+    return true;
+  }
+  if (stream->encoding == STREAM_ENCODING_UTF16LE) {
+    return filter_write_bytes(stream, text, length * sizeof(wchar_t));
   }
 
-  wchar_t* executablePath = join_path(g_executableDirectory, kRulesFileName);
-  if (!executablePath) {
+  if (length > (size_t) INT_MAX) {
+    log_error("Filter segment is too large to convert to UTF-8");
     return false;
   }
-  if (!get_file_last_write_time(executablePath, outWriteTime)) {
-    free(executablePath);
+  int utf8Bytes = WideCharToMultiByte(CP_UTF8, 0, text, (int) length, NULL, 0, NULL, NULL);
+  if (utf8Bytes <= 0 || !reserve_byte_buffer(&stream->encoded, &stream->encodedCapacity, (size_t) utf8Bytes)) {
+    log_error("Failed to convert filter output to UTF-8");
+    return false;
+  }
+  if (WideCharToMultiByte(CP_UTF8, 0, text, (int) length, stream->encoded, utf8Bytes, NULL, NULL) <= 0) {
+    log_error("Failed to convert filter output to UTF-8 (%lu)", GetLastError());
     return false;
   }
+  return filter_write_bytes(stream, stream->encoded, (size_t) utf8Bytes);
+}
 
-  *outPath = executablePath;
+// Reads the BOM, if any, and echoes it so the output keeps the input's encoding. Input without a BOM is UTF-8.
+static bool filter_detect_encoding(FilterStream* stream) {
+  while (!stream->endOfInput && stream->byteCount < 3) {
+    if (!filter_read_more(stream)) {
+      return false;
+    }
+  }
+
+  const unsigned char* bytes = (const unsigned char*) stream->bytes;
+  size_t bomLength = 0;
+  if (stream->byteCount >= 2 && bytes[0] == 0xFF && bytes[1] == 0xFE) {
+    stream->encoding = STREAM_ENCODING_UTF16LE;
+    bomLength = 2;
+  } else if (stream->byteCount >= 3 && bytes[0] == 0xEF && bytes[1] == 0xBB && bytes[2] == 0xBF) {
+    bomLength = 3;
+  }
+  if (bomLength == 0) {
+    return true;
+  }
+
+  if (!filter_write_bytes(stream, stream->bytes, bomLength)) {
+    return false;
+  }
+  memmove(stream->bytes, stream->bytes + bomLength, stream->byteCount - bomLength);
+  stream->byteCount -= bomLength;
   return true;
 }
 
-static void refresh_replacement_config(void) {
-  wchar_t* resolvedPath = NULL;
-  FILETIME resolvedTime = {0};
-
-  if (!resolve_rules_config_path(&resolvedPath, &resolvedTime)) {
-    bool generatedDefaultRules = generate_default_rules_file();
-    if (generatedDefaultRules && resolve_rules_config_path(&resolvedPath, &resolvedTime)) {
-      // Continue below and load the generated executable-side config.
-    } else {
-      bool shouldLog = g_ruleConfig.lastResolvedExists || g_ruleConfig.hasActiveFile || g_ruleConfig.lastLoadFailed;
+// Returns the byte length of the longest prefix of the pending input that ends with a line feed, or 0 if the
+// pending input does not hold a complete line yet.
+static size_t filter_find_segment_end(const FilterStream* stream) {
+  const unsigned char* bytes = (const unsigned char*) stream->bytes;
+  if (stream->encoding == STREAM_ENCODING_UTF16LE) {
+    for (size_t position = stream->byteCount & ~(size_t) 1; position >= 2; position -= 2) {
+      if (bytes[position - 2] == 0x0A && bytes[position - 1] == 0x00) {
+        return position;
+      }
+    }
+    return 0;
+  }
 
-      clear_active_rule_config();
-      free(g_ruleConfig.lastResolvedPath);
-      g_ruleConfig.lastResolvedPath = NULL;
-      memset(&g_ruleConfig.lastResolvedWriteTime, 0, sizeof(g_ruleConfig.lastResolvedWriteTime));
-      g_ruleConfig.lastResolvedExists = false;
-      g_ruleConfig.lastLoadFailed = false;
+  // A line feed byte never occurs inside a multi-byte UTF-8 sequence, so this cut is always a character boundary.
+  for (size_t position = stream->byteCount; position > 0; --position) {
+    if (bytes[position - 1] == '\n') {
+      return position;
+    }
+  }
+  return 0;
+}
 
-      if (shouldLog || !generatedDefaultRules) {
-        log_info("No replacement config found; normalization rules are inactive");
+// Decodes `byteLength` bytes of pending input into stream->wide after `contextLength` units. Malformed input fails
+// the filter unless --lossy asked for it to be replaced, since a silent U+FFFD would change bytes no rule touched.
+static bool filter_decode_segment(FilterStream* stream, size_t byteLength, size_t contextLength,
+                                  size_t* outLength) {
+  size_t unitCount = 0;
+  // stream->bytes starts this many bytes into the input, counting a BOM.
+  unsigned long long segmentOffset = (unsigned long long) (stream->bytesRead - stream->byteCount);
+  if (stream->encoding == STREAM_ENCODING_UTF16LE) {
+    if (byteLength % 2 != 0) {
+      if (!g_filterOptions.lossy) {
+        log_error("Filter input ends with an incomplete UTF-16 code unit; pass --lossy to drop the final byte");
+        return false;
       }
-      return;
+      log_info("Filter input ends with an incomplete UTF-16 code unit; dropped the final byte");
+      byteLength--;
+    }
+    unitCount = byteLength / 2;
+    if (!reserve_wide_buffer(&stream->wide, &stream->wideCapacity, contextLength + unitCount)) {
+      log_error("Out of memory while decoding filter input");
+      return false;
+    }
+    memcpy(stream->wide + contextLength, stream->bytes, byteLength);
+  } else if (byteLength > 0) {
+    if (byteLength > (size_t) INT_MAX) {
+      log_error("Filter segment is too large to convert from UTF-8");
+      return false;
+    }
+    DWORD decodeFlags = g_filterOptions.lossy ? 0 : MB_ERR_INVALID_CHARS;
+    int required = MultiByteToWideChar(CP_UTF8, decodeFlags, stream->bytes, (int) byteLength, NULL, 0);
+    if (required <= 0 && GetLastError() == ERROR_NO_UNICODE_TRANSLATION) {
+      log_error("Filter input is not valid UTF-8 in the %zu bytes from byte %llu; pass --lossy to replace invalid "
+                "sequences with U+FFFD",
+                byteLength, segmentOffset);
+      return false;
     }
+    if (required <= 0 || !reserve_wide_buffer(&stream->wide, &stream->wideCapacity, contextLength + (size_t) required)) {
+      log_error("Failed to decode filter input as UTF-8");
+      return false;
+    }
+    if (MultiByteToWideChar(CP_UTF8, decodeFlags, stream->bytes, (int) byteLength, stream->wide + contextLength,
+                            required) <= 0) {
+      log_error("Failed to decode filter input as UTF-8 (%lu)", GetLastError());
+      return false;
+    }
+    unitCount = (size_t) required;
+  } else if (!reserve_wide_buffer(&stream->wide, &stream->wideCapacity, contextLength)) {
+    log_error("Out of memory while decoding filter input");
+    return false;
   }
 
-  if (g_ruleConfig.lastResolvedExists && paths_equal_ignore_case(resolvedPath, g_ruleConfig.lastResolvedPath) &&
-      filetime_equal(resolvedTime, g_ruleConfig.lastResolvedWriteTime)) {
-    free(resolvedPath);
-    return;
+  *outLength = contextLength + unitCount;
+  return true;
+}
+
+static bool filter_process_segment(FilterStream* stream, size_t byteLength) {
+  // Every segment after the first follows a line feed; keeping that one unit as context lets lookbehinds see the
+  // line start and stops \A from matching anywhere but the start of the input.
+  size_t contextLength = stream->segmentCount > 0 ? 1 : 0;
+  size_t length = 0;
+  if (!filter_decode_segment(stream, byteLength, contextLength, &length)) {
+    return false;
+  }
+  if (contextLength > 0) {
+    stream->wide[0] = L'\n';
+  }
+
+  NormalizedBuffer normalized = normalize_text_segment(stream->wide, length, contextLength, NULL);
+  if (!normalized.text) {
+    log_error("Failed to allocate memory while normalizing filter input");
+    return false;
+  }
+
+  stream->stats.substitutionsApplied += normalized.replacementStats.substitutionsApplied;
+  stream->stats.patternsEvaluated += normalized.replacementStats.patternsEvaluated;
+  stream->stats.patternsSkipped += normalized.replacementStats.patternsSkipped;
+  stream->lineCount += normalized.lineCount;
+  stream->segmentCount++;
+
+  bool written = filter_write_text(stream, normalized.text + contextLength, normalized.length - contextLength);
+  free(normalized.text);
+  return written;
+}
+
+static bool load_filter_rules(void) {
+  if (!g_filterOptions.rulesPath) {
+    refresh_replacement_config();
+    return true;
   }
 
   RuleSet loadedRules = {0};
   RuleLoadError loadError = {0};
-  if (!load_rule_set_from_file(resolvedPath, &loadedRules, &loadError)) {
-    char* utf8Path = utf8_from_wide(resolvedPath);
-    if (utf8Path) {
-      log_info("Failed to load replacement config %s at line %zu: %s", utf8Path,
-               loadError.lineNumber == 0 ? 1u : loadError.lineNumber, loadError.message);
-      free(utf8Path);
-    } else {
-      log_info("Failed to load replacement config at line %zu: %s", loadError.lineNumber == 0 ? 1u : loadError.lineNumber,
-               loadError.message);
-    }
-
-    free(g_ruleConfig.lastResolvedPath);
-    g_ruleConfig.lastResolvedPath = resolvedPath;
-    g_ruleConfig.lastResolvedWriteTime = resolvedTime;
-    g_ruleConfig.lastResolvedExists = true;
-    g_ruleConfig.lastLoadFailed = true;
-    return;
+  if (!load_rule_set_from_file(g_filterOptions.rulesPath, &loadedRules, &loadError)) {
+    log_error("Failed to load replacement config at line %zu: %s", loadError.lineNumber == 0 ? 1u : loadError.lineNumber,
+             loadError.message);
+    return false;
   }
 
   clear_active_rule_config();
-  g_ruleConfig.activePath = resolvedPath;
-  g_ruleConfig.activeWriteTime = resolvedTime;
+  g_ruleConfig.activePath = duplicate_wide_string(g_filterOptions.rulesPath);
   g_ruleConfig.activeRules = loadedRules;
   g_ruleConfig.hasActiveFile = true;
+  log_info("Loaded replacement config (%zu rule%s, %zu/%zu pattern%s to compile on first use, %zu literal%s)",
+           loadedRules.ruleCount, loadedRules.ruleCount == 1 ? "" : "s", loadedRules.compilePendingCount,
+           loadedRules.patternCount, loadedRules.patternCount == 1 ? "" : "s", loadedRules.literalPatternCount,
+           loadedRules.literalPatternCount == 1 ? "" : "s");
+  return true;
+}
 
-  free(g_ruleConfig.lastResolvedPath);
-  g_ruleConfig.lastResolvedPath = duplicate_wide_string(g_ruleConfig.activePath);
-  g_ruleConfig.lastResolvedWriteTime = g_ruleConfig.activeWriteTime;
-  g_ruleConfig.lastResolvedExists = g_ruleConfig.lastResolvedPath != NULL;
-  g_ruleConfig.lastLoadFailed = false;
+// Segments end at the last line feed read so far; a line longer than the segment size grows the segment instead.
+static bool filter_stream(FilterStream* stream) {
+  LARGE_INTEGER frequency = {0};
+  LARGE_INTEGER started = {0};
+  QueryPerformanceFrequency(&frequency);
+  QueryPerformanceCounter(&started);
+
+  bool ok = filter_detect_encoding(stream);
+  size_t segmentBytes = g_filterOptions.segmentBytes == 0 ? (size_t) -1 : g_filterOptions.segmentBytes;
+  size_t target = segmentBytes;
+  while (ok && (stream->byteCount > 0 || !stream->endOfInput)) {
+    while (ok && !stream->endOfInput && stream->byteCount < target) {
+      ok = filter_read_more(stream);
+    }
+    if (!ok) {
+      break;
+    }
 
-  char* utf8Path = utf8_from_wide(g_ruleConfig.activePath);
-  if (utf8Path) {
-    log_info("Loaded replacement config %s (%zu rule%s)", utf8Path, g_ruleConfig.activeRules.ruleCount,
-             g_ruleConfig.activeRules.ruleCount == 1 ? "" : "s");
-    free(utf8Path);
+    size_t segmentEnd = stream->endOfInput ? stream->byteCount : filter_find_segment_end(stream);
+    if (segmentEnd == 0) {
+      // The pending line is longer than a segment; keep reading until it ends.
+      target = stream->byteCount + 1;
+      continue;
+    }
+
+    ok = filter_process_segment(stream, segmentEnd);
+    memmove(stream->bytes, stream->bytes + segmentEnd, stream->byteCount - segmentEnd);
+    stream->byteCount -= segmentEnd;
+    target = segmentBytes;
+  }
+
+  LARGE_INTEGER finished = {0};
+  QueryPerformanceCounter(&finished);
+  double elapsedMs = frequency.QuadPart > 0
+                         ? 1000.0 * (double) (finished.QuadPart - started.QuadPart) / (double) frequency.QuadPart
+                         : 0.0;
+  if (ok) {
+    log_info("Filtered %llu bytes (%zu line%s, %zu segment%s) into %llu bytes with %zu substitution%s in %.1f ms "
+             "(%.1f MB/s); prefilter skipped %zu of %zu pattern runs",
+             (unsigned long long) stream->bytesRead, stream->lineCount, stream->lineCount == 1 ? "" : "s",
+             stream->segmentCount, stream->segmentCount == 1 ? "" : "s", (unsigned long long) stream->bytesWritten,
+             stream->stats.substitutionsApplied, stream->stats.substitutionsApplied == 1 ? "" : "s", elapsedMs,
+             elapsedMs > 0.0 ? (double) stream->bytesRead / 1000.0 / elapsedMs : 0.0, stream->stats.patternsSkipped,
+             stream->stats.patternsEvaluated);
+  }
+
+  return ok;
+}
+
+// Headless mode: runs stdin or a file through the active rules to stdout. By default the whole input is one subject,
+// exactly as if it had been copied; --segment-kib streams it in segments of whole lines instead, so memory stays
+// proportional to the segment size (or the longest line) rather than to the input.
+static int run_filter(void) {
+  if (!load_filter_rules()) {
+    return 1;
+  }
+
+  FilterStream stream = {0};
+  stream.output = GetStdHandle(STD_OUTPUT_HANDLE);
+  if (g_filterOptions.inputPath) {
+    stream.input = CreateFileW(g_filterOptions.inputPath, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING,
+                               FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    if (stream.input == INVALID_HANDLE_VALUE) {
+      log_error("Unable to open filter input (%lu)", GetLastError());
+      free_rule_config_state();
+      return 1;
+    }
   } else {
-    log_info("Loaded replacement config (%zu rule%s)", g_ruleConfig.activeRules.ruleCount,
-             g_ruleConfig.activeRules.ruleCount == 1 ? "" : "s");
+    stream.input = GetStdHandle(STD_INPUT_HANDLE);
+  }
+
+  bool ok = filter_stream(&stream);
+  if (ok) {
+    report_rule_profiles("after filter");
+  }
+  if (g_filterOptions.inputPath) {
+    CloseHandle(stream.input);
   }
+  free(stream.bytes);
+  free(stream.wide);
+  free(stream.encoded);
+  free_rule_config_state();
+  return ok ? 0 : 1;
 }
 
-static bool substitute_pattern_literal(const RegexPattern* pattern, const wchar_t* replacement, size_t replacementLength,
-                                       const wchar_t* subject, size_t subjectLength, wchar_t** outText, size_t* outLength,
-                                       int* outCount, char* errorMessage, size_t errorMessageSize) {
-  *outText = NULL;
-  *outLength = 0;
-  *outCount = 0;
+typedef bool (*BenchLineWriter)(wchar_t** text, size_t* capacity, size_t* length, uint32_t* random);
 
-  pcre2_match_data* matchData = pcre2_match_data_create_from_pattern(pattern->code, NULL);
-  if (!matchData) {
-    snprintf(errorMessage, errorMessageSize, "Out of memory while creating regex match data");
+typedef struct {
+  const char* name;
+  BenchLineWriter appendLine;
+  size_t defaultMegabytes;
+} BenchCorpusGenerator;
+
+static uint32_t bench_next_random(uint32_t* state) {
+  uint32_t x = *state;
+  x ^= x << 13;
+  x ^= x >> 17;
+  x ^= x << 5;
+  *state = x;
+  return x;
+}
+
+static bool append_ascii(wchar_t** text, size_t* capacity, size_t* length, const char* ascii) {
+  size_t asciiLength = strlen(ascii);
+  if (!reserve_wide_buffer(text, capacity, *length + asciiLength)) {
     return false;
   }
-
-  PCRE2_SIZE outputLength = subjectLength + replacementLength + 1;
-  if (outputLength < 64) {
-    outputLength = 64;
+  for (size_t i = 0; i < asciiLength; ++i) {
+    (*text)[(*length)++] = (wchar_t) (unsigned char) ascii[i];
   }
+  return true;
+}
 
-  wchar_t* output = NULL;
-  int rc = 0;
-  for (;;) {
-    output = (wchar_t*) malloc(((size_t) outputLength + 1) * sizeof(wchar_t));
-    if (!output) {
-      snprintf(errorMessage, errorMessageSize, "Out of memory while applying regex replacement");
-      pcre2_match_data_free(matchData);
-      return false;
-    }
-
-    PCRE2_SIZE actualLength = outputLength;
-    rc = pcre2_substitute(pattern->code, (PCRE2_SPTR) subject, subjectLength, 0,
-                          PCRE2_SUBSTITUTE_GLOBAL | PCRE2_SUBSTITUTE_LITERAL | PCRE2_SUBSTITUTE_OVERFLOW_LENGTH,
-                          matchData, NULL, (PCRE2_SPTR) replacement, replacementLength, (PCRE2_UCHAR*) output,
-                          &actualLength);
-    if (rc == PCRE2_ERROR_NOMEMORY) {
-      free(output);
-      output = NULL;
-      outputLength = actualLength + 1;
-      continue;
-    }
-
-    if (rc < 0) {
-      PCRE2_UCHAR messageBuffer[256];
-      int messageLength = pcre2_get_error_message(rc, messageBuffer, sizeof(messageBuffer) / sizeof(messageBuffer[0]));
-      char* utf8Message = NULL;
-      if (messageLength > 0) {
-        utf8Message = utf8_from_wide_length((const wchar_t*) messageBuffer, (size_t) messageLength);
-      }
-      snprintf(errorMessage, errorMessageSize, "%s", utf8Message ? utf8Message : "Unknown regex substitution error");
-      free(utf8Message);
-      free(output);
-      pcre2_match_data_free(matchData);
+static bool append_bench_trailing_whitespace(wchar_t** text, size_t* capacity, size_t* length, uint32_t* random) {
+  static const wchar_t kTrailing[] = {L' ', L' ', L'\t', 0x00A0, 0x3000};
+  size_t count = bench_next_random(random) % 4;
+  for (size_t i = 0; i < count; ++i) {
+    wchar_t c = kTrailing[bench_next_random(random) % (sizeof(kTrailing) / sizeof(kTrailing[0]))];
+    if (!append_wide_range(text, capacity, length, &c, 1)) {
       return false;
     }
-
-    output[actualLength] = L'\0';
-    *outText = output;
-    *outLength = (size_t) actualLength;
-    *outCount = rc;
-    pcre2_match_data_free(matchData);
-    return true;
   }
+  return true;
 }
 
-static void apply_configured_replacements(NormalizedBuffer* buffer) {
-  if (!buffer || !buffer->text || !g_ruleConfig.hasActiveFile || g_ruleConfig.activeRules.ruleCount == 0) {
-    return;
-  }
-
-  for (size_t ruleIndex = 0; ruleIndex < g_ruleConfig.activeRules.ruleCount; ++ruleIndex) {
-    const RegexRule* rule = &g_ruleConfig.activeRules.rules[ruleIndex];
-    bool ruleChanged = false;
+static bool append_bench_log_line(wchar_t** text, size_t* capacity, size_t* length, uint32_t* random) {
+  static const char* const kLevels[] = {"INFO", "INFO", "DEBUG", "WARN", "ERROR"};
+  char line[160];
+  uint32_t r = bench_next_random(random);
+  snprintf(line, sizeof(line), "2026-10-16T%02u:%02u:%02u.%03uZ %-5s worker[%u] request %u completed in %ums",
+           (unsigned) (r % 24), (unsigned) (r / 24 % 60), (unsigned) (r / 1440 % 60), (unsigned) (r % 1000),
+           kLevels[r % 5], (unsigned) (r % 64), (unsigned) (r / 64 % 100000), (unsigned) (r % 2000));
+  return append_ascii(text, capacity, length, line) &&
+         append_bench_trailing_whitespace(text, capacity, length, random) &&
+         append_ascii(text, capacity, length, "\r\n");
+}
 
-    for (size_t patternIndex = 0; patternIndex < rule->patternCount; ++patternIndex) {
-      const RegexPattern* pattern = &rule->patterns[patternIndex];
-      wchar_t* replacedText = NULL;
-      size_t replacedLength = 0;
-      int substitutionCount = 0;
-      char errorMessage[256] = {0};
+static bool append_bench_source_line(wchar_t** text, size_t* capacity, size_t* length, uint32_t* random) {
+  static const char* const kStatements[] = {
+      "if (buffer->length == 0) {", "return false;", "}", "size_t count = 0;",
+      "for (size_t i = 0; i < ruleSet->ruleCount; ++i) {", "// Keep the scratch buffer across updates.",
+      "log_info(\"Loaded %zu rules\", count);", "",
+  };
+  uint32_t r = bench_next_random(random);
+  char indent[16];
+  size_t depth = r % 4 * 2;
+  memset(indent, ' ', depth);
+  indent[depth] = '\0';
+  return append_ascii(text, capacity, length, indent) &&
+         append_ascii(text, capacity, length, kStatements[r / 4 % (sizeof(kStatements) / sizeof(kStatements[0]))]) &&
+         append_bench_trailing_whitespace(text, capacity, length, random) &&
+         append_ascii(text, capacity, length, "\n");
+}
 
-      if (!substitute_pattern_literal(pattern, rule->replacement, rule->replacementLength, buffer->text, buffer->length,
-                                      &replacedText, &replacedLength, &substitutionCount, errorMessage,
-                                      sizeof(errorMessage))) {
-        log_info("Regex replacement failed for pattern on line %zu: %s", pattern->lineNumber, errorMessage);
-        continue;
-      }
+static bool append_bench_csv_line(wchar_t** text, size_t* capacity, size_t* length, uint32_t* random) {
+  static const char* const kNames[] = {"alpha", "\"bravo, inc\"", "charlie", "delta ", "\"echo \"\"x\"\"\""};
+  char line[128];
+  uint32_t r = bench_next_random(random);
+  snprintf(line, sizeof(line), "%u,%s,%u.%02u,%s", (unsigned) (r % 1000000), kNames[r % 5], (unsigned) (r % 10000),
+           (unsigned) (r % 100), r % 3 == 0 ? "" : "ok");
+  return append_ascii(text, capacity, length, line) &&
+         append_bench_trailing_whitespace(text, capacity, length, random) &&
+         append_ascii(text, capacity, length, "\r\n");
+}
 
-      if (substitutionCount == 0) {
-        free(replacedText);
-        continue;
-      }
+// Words and inner whitespace only: the whole corpus is one line, which stresses per-match rather than per-line work.
+static bool append_bench_single_line_words(wchar_t** text, size_t* capacity, size_t* length, uint32_t* random) {
+  static const char* const kWords[] = {"lorem ", "ipsum  ", "dolor\t", "sit ", "amet, ", "consectetur "};
+  return append_ascii(text, capacity, length, kWords[bench_next_random(random) % 6]);
+}
 
-      free(buffer->text);
-      buffer->text = replacedText;
-      buffer->length = replacedLength;
-      buffer->replacementStats.substitutionsApplied += (size_t) substitutionCount;
-      buffer->replacementStats.patternsTouched++;
-      ruleChanged = true;
+static bool append_bench_emoji_line(wchar_t** text, size_t* capacity, size_t* length, uint32_t* random) {
+  size_t count = 4 + bench_next_random(random) % 24;
+  for (size_t i = 0; i < count; ++i) {
+    uint32_t codePoint = 0x1F300 + bench_next_random(random) % 0x800;
+    wchar_t pair[3] = {(wchar_t) (0xD800 + ((codePoint - 0x10000) >> 10)),
+                       (wchar_t) (0xDC00 + ((codePoint - 0x10000) & 0x3FF)), 0x200D};
+    size_t units = bench_next_random(random) % 5 == 0 ? 3 : 2;
+    if (!append_wide_range(text, capacity, length, pair, units)) {
+      return false;
     }
+  }
+  return append_bench_trailing_whitespace(text, capacity, length, random) &&
+         append_ascii(text, capacity, length, "\n");
+}
 
-    if (ruleChanged) {
-      buffer->replacementStats.rulesTouched++;
+// Runs of short words whose only `:` and `;` lead the line, so the prefilter cannot rule them out but nothing after
+// them matches: every start position makes a nested quantifier try each way of splitting the line before it fails.
+static bool append_bench_adversarial_line(wchar_t** text, size_t* capacity, size_t* length, uint32_t* random) {
+  if (!append_ascii(text, capacity, length, ":; ")) {
+    return false;
+  }
+  size_t words = 16 + bench_next_random(random) % 16;
+  for (size_t i = 0; i < words; ++i) {
+    static const char* const kWords[] = {"a ", "ab ", "abc\t", "a1 ", "b_ ", "xyz "};
+    if (!append_ascii(text, capacity, length, kWords[bench_next_random(random) % 6])) {
+      return false;
     }
   }
+  return append_ascii(text, capacity, length, "end\n");
 }
 
-static NormalizedBuffer normalize_clipboard_text(const wchar_t* input, size_t length) {
-  NormalizedBuffer result = {0};
-  if (!input) {
-    return result;
+// Sized like a large copy rather than a file, so a default run finishes in seconds; --bench-mb scales them all up.
+static const BenchCorpusGenerator kBenchCorpora[] = {
+    {"logs", append_bench_log_line, 4},
+    {"source", append_bench_source_line, 4},
+    {"csv", append_bench_csv_line, 4},
+    {"single-line", append_bench_single_line_words, 8},
+    {"emoji", append_bench_emoji_line, 4},
+    {"adversarial", append_bench_adversarial_line, 1},
+};
+
+// Rules that exercise the interpreter paths the default rules avoid: caseless words, line anchors, lookbehind,
+// Unicode properties and an alternation that backtracks.
+static const char kBenchStressRules[] = "rule\n"
+                                        "pattern <<EOF\n"
+                                        "(?i)\\b(?:error|warn(?:ing)?|fatal)\\b\n"
+                                        "EOF\n"
+                                        "replace <<EOF\n"
+                                        "LEVEL\n"
+                                        "EOF\n"
+                                        "\n"
+                                        "rule\n"
+                                        "pattern <<EOF\n"
+                                        "(?m)^[ \\t]+\n"
+                                        "EOF\n"
+                                        "replace <<EOF\n"
+                                        "EOF\n"
+                                        "\n"
+                                        "rule\n"
+                                        "pattern <<EOF\n"
+                                        "(?<=\\d),(?=\\d)\n"
+                                        "EOF\n"
+                                        "replace <<EOF\n"
+                                        ";\n"
+                                        "EOF\n"
+                                        "\n"
+                                        "rule\n"
+                                        "pattern <<EOF\n"
+                                        "\\p{So}\\x{200D}\n"
+                                        "EOF\n"
+                                        "replace <<EOF\n"
+                                        "EOF\n"
+                                        "\n"
+                                        "rule\n"
+                                        "pattern <<EOF\n"
+                                        "\\w+(?:[ \\t]+\\w+)*:\n"
+                                        "EOF\n"
+                                        "replace <<EOF\n"
+                                        ":\n"
+                                        "EOF\n"
+                                        "\n"
+                                        "rule\n"
+                                        "builtin trim-trailing\n"
+                                        "replace <<EOF\n"
+                                        "EOF\n";
+
+// The same backtracking-prone patterns twice, once per engine, so the CSV compares them row for row. The backtracking
+// run is expected to hit the match limit and skip the rule; the DFA run never backtracks.
+#define BENCH_ADVERSARIAL_RULES(engine)                                                                                \
+  "rule\n" engine "pattern <<EOF\n"                                                                                    \
+  "(?:\\w+[ \\t]?)+:\n"                                                                                                \
+  "EOF\n"                                                                                                              \
+  "replace <<EOF\n"                                                                                                    \
+  ":\n"                                                                                                                \
+  "EOF\n"                                                                                                              \
+  "\n"                                                                                                                 \
+  "rule\n" engine "pattern <<EOF\n"                                                                                    \
+  "(?:[ \\t]*\\w)+[ \\t]*;\n"                                                                                          \
+  "EOF\n"                                                                                                              \
+  "replace <<EOF\n"                                                                                                    \
+  ";\n"                                                                                                                \
+  "EOF\n"                                                                                                              \
+  "\n"                                                                                                                 \
+  "rule\n" engine "pattern <<EOF\n"                                                                                    \
+  "[\\x{200B}\\x{FEFF}]+\n"                                                                                            \
+  "EOF\n"                                                                                                              \
+  "replace <<EOF\n"                                                                                                    \
+  "EOF\n"
+
+static const char kBenchAdversarialRules[] = BENCH_ADVERSARIAL_RULES("");
+static const char kBenchAdversarialDfaRules[] = BENCH_ADVERSARIAL_RULES("engine dfa\n");
+
+static bool generate_bench_corpus(const BenchCorpusGenerator* generator, size_t megabytes, ClipboardBuffer* out) {
+  // Sizes count UTF-16 bytes, the same unit CF_UNICODETEXT occupies on the clipboard.
+  size_t targetUnits = megabytes * 1000u * 1000u / sizeof(wchar_t);
+  wchar_t* text = NULL;
+  size_t capacity = 0;
+  size_t length = 0;
+  uint32_t random = 0x9E3779B9u;
+  if (!reserve_wide_buffer(&text, &capacity, targetUnits + 64)) {
+    return false;
   }
-
-  result.text = duplicate_wide_range(input, length);
-  if (!result.text) {
-    return result;
+  while (length < targetUnits) {
+    if (!generator->appendLine(&text, &capacity, &length, &random)) {
+      free(text);
+      return false;
+    }
+  }
+  if (generator->appendLine == append_bench_single_line_words &&
+      !append_bench_trailing_whitespace(&text, &capacity, &length, &random)) {
+    free(text);
+    return false;
   }
 
-  result.length = length;
-  result.lineCount = count_clipboard_lines(input, length);
-  apply_configured_replacements(&result);
-  return result;
+  text[length] = L'\0';
+  out->text = text;
+  out->length = length;
+  return true;
 }
 
-static bool set_clipboard_text(HWND hwnd, const wchar_t* text, size_t length) {
-  if (!text) {
+// Generates a terminology dictionary of `entryCount` rules: stems that occur in the generated corpora, then numbered
+// variants of them, so most entries share a prefix with words of the text without matching. Each entry swaps the case
+// of its first letter. With `regex`, every entry is a `\b...\b` pattern instead of a literal.
+static bool generate_bench_dictionary_text(size_t entryCount, bool regex, wchar_t** outText, size_t* outLength) {
+  static const char* const kStems[] = {
+      "INFO", "WARN", "ERROR", "DEBUG", "worker", "request", "completed", "return", "false", "count", "buffer",
+      "length", "ruleSet", "alpha", "bravo", "charlie", "delta", "echo", "lorem", "ipsum", "dolor", "amet",
+      "consectetur", "abc", "xyz", "end",
+  };
+  size_t stemCount = sizeof(kStems) / sizeof(kStems[0]);
+  wchar_t* text = NULL;
+  size_t capacity = 0;
+  size_t length = 0;
+  bool ok = true;
+  for (size_t i = 0; ok && i < entryCount; ++i) {
+    char literal[64];
+    if (i < stemCount) {
+      snprintf(literal, sizeof(literal), "%s", kStems[i]);
+    } else {
+      snprintf(literal, sizeof(literal), "%s-%zu", kStems[i % stemCount], i / stemCount);
+    }
+    char replacement[64];
+    memcpy(replacement, literal, sizeof(replacement));
+    replacement[0] = (char) (replacement[0] ^ 0x20);
+    ok = append_ascii(&text, &capacity, &length, regex ? "rule\npattern <<EOF\n\\b" : "rule\nliteral <<EOF\n") &&
+         append_ascii(&text, &capacity, &length, literal) &&
+         append_ascii(&text, &capacity, &length, regex ? "\\b\nEOF\nreplace <<EOF\n" : "\nEOF\nreplace <<EOF\n") &&
+         append_ascii(&text, &capacity, &length, replacement) && append_ascii(&text, &capacity, &length, "\nEOF\n");
+  }
+  if (!ok) {
+    free(text);
     return false;
   }
+  *outText = text;
+  *outLength = length;
+  return true;
+}
 
-  if (!try_open_clipboard(hwnd)) {
-    log_info("Unable to open clipboard for writing");
+// Loading is timed, since building the rules is part of what large dictionaries cost.
+static bool load_bench_dictionary_rules(size_t entryCount, RuleSet* outRuleSet, RuleLoadError* error) {
+  wchar_t* text = NULL;
+  size_t length = 0;
+  if (!generate_bench_dictionary_text(entryCount, false, &text, &length)) {
+    set_rule_load_error(error, 1, "Out of memory while generating benchmark rules");
     return false;
   }
 
-  if (!EmptyClipboard()) {
-    CloseClipboard();
-    log_info("Failed to empty clipboard before writing");
+  LARGE_INTEGER frequency = {0};
+  LARGE_INTEGER started = {0};
+  LARGE_INTEGER parsed = {0};
+  LARGE_INTEGER compiled = {0};
+  QueryPerformanceFrequency(&frequency);
+  QueryPerformanceCounter(&started);
+  bool loaded = parse_rule_set_text(text, length, outRuleSet, error);
+  QueryPerformanceCounter(&parsed);
+  loaded = loaded && compile_rule_set(outRuleSet, NULL, error);
+  QueryPerformanceCounter(&compiled);
+  free(text);
+  if (!loaded) {
+    free_rule_set(outRuleSet);
     return false;
   }
+  log_info("Loaded %zu-entry literal dictionary: parsed in %.1f ms, automaton built in %.1f ms", entryCount,
+           1000.0 * (double) (parsed.QuadPart - started.QuadPart) / (double) frequency.QuadPart,
+           1000.0 * (double) (compiled.QuadPart - parsed.QuadPart) / (double) frequency.QuadPart);
+  return true;
+}
 
-  size_t bytes = (length + 1) * sizeof(wchar_t);
-  HGLOBAL hMem = GlobalAlloc(GMEM_MOVEABLE, bytes);
-  if (!hMem) {
-    CloseClipboard();
-    log_info("Failed to allocate global memory for clipboard");
+// Times loading a generated rules file of `entryCount` entries: parsing plus the load-time checks (the literal
+// automaton, or the syntax check of every lazily compiled pattern). Prints one `parse` row, best iteration, whose size
+// is the rules text and whose last column is the number of rules loaded.
+static bool run_bench_rule_parse(const char* name, size_t entryCount, bool regex) {
+  wchar_t* text = NULL;
+  size_t length = 0;
+  if (!generate_bench_dictionary_text(entryCount, regex, &text, &length)) {
+    log_error("Out of memory while generating the %s rules", name);
     return false;
   }
 
-  void* dest = GlobalLock(hMem);
-  if (!dest) {
-    GlobalFree(hMem);
-    CloseClipboard();
-    log_info("Failed to lock global memory for clipboard");
-    return false;
+  LARGE_INTEGER frequency = {0};
+  QueryPerformanceFrequency(&frequency);
+  bool ok = true;
+  double bestMs = 0.0;
+  size_t ruleCount = 0;
+  for (uint64_t iteration = 0; ok && iteration < g_benchOptions.iterations; ++iteration) {
+    RuleSet ruleSet = {0};
+    RuleLoadError loadError = {0};
+    LARGE_INTEGER started = {0};
+    LARGE_INTEGER finished = {0};
+    QueryPerformanceCounter(&started);
+    ok = parse_rule_set_text(text, length, &ruleSet, &loadError) && compile_rule_set(&ruleSet, NULL, &loadError);
+    QueryPerformanceCounter(&finished);
+    ruleCount = ruleSet.ruleCount;
+    free_rule_set(&ruleSet);
+    if (!ok) {
+      log_error("Failed to load the %s rules at line %zu: %s", name, loadError.lineNumber, loadError.message);
+      break;
+    }
+    double elapsedMs = 1000.0 * (double) (finished.QuadPart - started.QuadPart) / (double) frequency.QuadPart;
+    if (iteration == 0 || elapsedMs < bestMs) {
+      bestMs = elapsedMs;
+    }
   }
-  memcpy(dest, text, bytes);
-  GlobalUnlock(hMem);
+  if (ok) {
+    double bytes = (double) length * sizeof(wchar_t);
+    printf("parse,,%s,,%.0f,%llu,%.3f,%.1f,0.0,%zu\n", name, bytes, (unsigned long long) g_benchOptions.iterations,
+           bestMs, bestMs > 0.0 ? bytes / 1000.0 / bestMs : 0.0, ruleCount);
+    fflush(stdout);
+  }
+  free(text);
+  return ok;
+}
 
-  if (!SetClipboardData(CF_UNICODETEXT, hMem)) {
-    GlobalFree(hMem);
-    CloseClipboard();
-    log_info("SetClipboardData failed");
+static bool load_rule_set_from_utf8(const char* utf8, RuleSet* outRuleSet, RuleLoadError* error) {
+  int required = MultiByteToWideChar(CP_UTF8, MB_ERR_INVALID_CHARS, utf8, -1, NULL, 0);
+  wchar_t* text = required > 0 ? (wchar_t*) malloc((size_t) required * sizeof(wchar_t)) : NULL;
+  if (!text || MultiByteToWideChar(CP_UTF8, MB_ERR_INVALID_CHARS, utf8, -1, text, required) <= 0) {
+    free(text);
+    set_rule_load_error(error, 1, "Unable to decode built-in rules");
     return false;
   }
 
-  CloseClipboard();
+  bool loaded = parse_rule_set_text(text, (size_t) required - 1, outRuleSet, error) &&
+                compile_rule_set(outRuleSet, NULL, error);
+  free(text);
+  if (!loaded) {
+    free_rule_set(outRuleSet);
+  }
+  return loaded;
+}
+
+// Runs one corpus through the active rules and prints a total row plus one row per rule or run of literal rules.
+static bool run_bench_case(const char* corpusName, const ClipboardBuffer* corpus, const char* rulesName) {
+  RuleSet* ruleSet = &g_ruleConfig.activeRules;
+  uint64_t iterations = g_benchOptions.iterations;
+  reset_rule_profiles(ruleSet);
+
+  LARGE_INTEGER frequency = {0};
+  QueryPerformanceFrequency(&frequency);
+  double bestMs = 0.0;
+  LONG allocations = 0;
+  size_t substitutions = 0;
+  for (uint64_t iteration = 0; iteration < iterations; ++iteration) {
+    LONG allocationsBefore = g_engineAllocations;
+    LARGE_INTEGER started = {0};
+    LARGE_INTEGER finished = {0};
+    QueryPerformanceCounter(&started);
+    NormalizedBuffer normalized = normalize_clipboard_text(corpus->text, corpus->length, NULL);
+    QueryPerformanceCounter(&finished);
+    if (!normalized.text) {
+      log_error("Out of memory while benchmarking %s with %s rules", corpusName, rulesName);
+      return false;
+    }
+
+    double elapsedMs = 1000.0 * (double) (finished.QuadPart - started.QuadPart) / (double) frequency.QuadPart;
+    if (iteration == 0 || elapsedMs < bestMs) {
+      bestMs = elapsedMs;
+    }
+    allocations += g_engineAllocations - allocationsBefore;
+    substitutions = normalized.replacementStats.substitutionsApplied;
+    free(normalized.text);
+  }
+
+  double bytes = (double) corpus->length * sizeof(wchar_t);
+  printf("total,%s,%s,,%.0f,%llu,%.3f,%.1f,%.1f,%zu\n", corpusName, rulesName, bytes, (unsigned long long) iterations,
+         bestMs, bestMs > 0.0 ? bytes / 1000.0 / bestMs : 0.0, (double) allocations / (double) iterations,
+         substitutions);
+  for (size_t ruleIndex = 0; ruleIndex < ruleSet->ruleCount; ++ruleIndex) {
+    const RegexRule* rule = &ruleSet->rules[ruleIndex];
+    if (rule_is_literal(rule) && !rule->literals) {
+      continue; // reported with the first rule of its literal run
+    }
+    PatternProfile total = {0};
+    for (size_t patternIndex = 0; patternIndex < rule->patternCount; ++patternIndex) {
+      const PatternProfile* profile = &rule->patterns[patternIndex].profile;
+      total.ticks += profile->ticks;
+      total.allocations += profile->allocations;
+      total.substitutions += profile->substitutions;
+    }
+    double ruleMs = 1000.0 * (double) total.ticks / (double) frequency.QuadPart / (double) iterations;
+    printf("rule,%s,%s,%zu,%.0f,%llu,%.3f,%.1f,%.1f,%llu\n", corpusName, rulesName, rule->lineNumber, bytes,
+           (unsigned long long) iterations, ruleMs, ruleMs > 0.0 ? bytes / 1000.0 / ruleMs : 0.0,
+           (double) total.allocations / (double) iterations,
+           (unsigned long long) (total.substitutions / iterations));
+  }
+  fflush(stdout);
   return true;
 }
 
-static void handle_clipboard_update(HWND hwnd) {
-  if (g_isUpdatingClipboard) {
-    return;
+// Installs `ruleSet` as the active rules and benchmarks every corpus with it. Takes ownership of `ruleSet`.
+static bool run_bench_rule_set(RuleSet* ruleSet, const char* rulesName, const ClipboardBuffer* corpora,
+                               const char** corpusNames, size_t corpusCount) {
+  clear_active_rule_config();
+  g_ruleConfig.activeRules = *ruleSet;
+  g_ruleConfig.hasActiveFile = true;
+  memset(ruleSet, 0, sizeof(*ruleSet));
+
+  // The numbers describe the steady state, so compilation happens here rather than inside the first iteration.
+  RuleSet* active = &g_ruleConfig.activeRules;
+  while (prewarm_next_pattern(active)) {
+  }
+  log_info("Benchmarking %s rules (%zu rule%s, %zu/%zu pattern%s compiled, %zu JIT, %zu DFA, %zu literal%s)",
+           rulesName, active->ruleCount, active->ruleCount == 1 ? "" : "s",
+           active->patternCount - active->compileFailureCount, active->patternCount,
+           active->patternCount == 1 ? "" : "s", active->jitPatternCount, active->dfaPatternCount,
+           active->literalPatternCount, active->literalPatternCount == 1 ? "" : "s");
+
+  for (size_t i = 0; i < corpusCount; ++i) {
+    if (!run_bench_case(corpusNames[i], &corpora[i], rulesName)) {
+      return false;
+    }
   }
+  return true;
+}
 
-  ClipboardBuffer original = {0};
-  bool wasUnicode = false;
-  if (!fetch_clipboard_text(hwnd, &original, &wasUnicode)) {
-    log_info("Clipboard update contained no compatible text");
-    return;
+// Times every trim-trailing scanner this processor can run, and the regex the kernel stands in for, on each corpus.
+// Rows use the `kernel` scope with the variant in the rules column; the kernel works in place, so every iteration
+// trims a fresh copy, and the copy is not timed.
+static bool run_bench_trim_kernels(const ClipboardBuffer* corpora, const char** corpusNames, size_t corpusCount) {
+  struct {
+    const char* name;
+    TrimWhitespaceScanner scanner; // NULL for the regex
+  } variants[4];
+  size_t variantCount = 0;
+  variants[variantCount].name = "trim-scalar";
+  variants[variantCount++].scanner = find_trim_whitespace_scalar;
+#ifdef TRIM_HAVE_X86_KERNELS
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("sse2")) {
+    variants[variantCount].name = "trim-sse2";
+    variants[variantCount++].scanner = find_trim_whitespace_sse2;
+  }
+  if (__builtin_cpu_supports("avx2")) {
+    variants[variantCount].name = "trim-avx2";
+    variants[variantCount++].scanner = find_trim_whitespace_avx2;
+  }
+#endif
+  variants[variantCount].name = "trim-regex";
+  variants[variantCount++].scanner = NULL;
+
+  int compileError = 0;
+  PCRE2_SIZE errorOffset = 0;
+  pcre2_code* regex = pcre2_compile((PCRE2_SPTR) kTrimTrailingPattern, PCRE2_ZERO_TERMINATED, PCRE2_UTF | PCRE2_UCP,
+                                    &compileError, &errorOffset, NULL);
+  pcre2_match_data* matchData = regex ? pcre2_match_data_create_from_pattern(regex, NULL) : NULL;
+  if (!matchData) {
+    pcre2_code_free(regex);
+    log_error("Unable to compile the trim-trailing pattern for the kernel benchmark");
+    return false;
   }
 
-  refresh_replacement_config();
+  LARGE_INTEGER frequency = {0};
+  QueryPerformanceFrequency(&frequency);
+  bool ok = true;
+  for (size_t corpusIndex = 0; ok && corpusIndex < corpusCount; ++corpusIndex) {
+    const ClipboardBuffer* corpus = &corpora[corpusIndex];
+    wchar_t* work = (wchar_t*) malloc((corpus->length + 1) * sizeof(wchar_t));
+    wchar_t* output = (wchar_t*) malloc((corpus->length + 1) * sizeof(wchar_t));
+    ok = work && output;
+    for (size_t v = 0; ok && v < variantCount; ++v) {
+      double bestMs = 0.0;
+      size_t substitutions = 0;
+      for (uint64_t iteration = 0; ok && iteration < g_benchOptions.iterations; ++iteration) {
+        wmemcpy(work, corpus->text, corpus->length);
+        LARGE_INTEGER started = {0};
+        LARGE_INTEGER finished = {0};
+        QueryPerformanceCounter(&started);
+        if (variants[v].scanner) {
+          trim_trailing_whitespace_in_place(work, corpus->length, variants[v].scanner, &substitutions);
+        } else {
+          PCRE2_SIZE outputLength = corpus->length + 1;
+          int rc = pcre2_substitute(regex, (PCRE2_SPTR) work, corpus->length, 0, PCRE2_SUBSTITUTE_GLOBAL, matchData,
+                                    NULL, (PCRE2_SPTR) L"", 0, (PCRE2_UCHAR*) output, &outputLength);
+          ok = rc >= 0;
+          substitutions = ok ? (size_t) rc : 0;
+        }
+        QueryPerformanceCounter(&finished);
+        double elapsedMs = 1000.0 * (double) (finished.QuadPart - started.QuadPart) / (double) frequency.QuadPart;
+        if (iteration == 0 || elapsedMs < bestMs) {
+          bestMs = elapsedMs;
+        }
+      }
+      double bytes = (double) corpus->length * sizeof(wchar_t);
+      printf("kernel,%s,%s,,%.0f,%llu,%.3f,%.1f,0.0,%zu\n", corpusNames[corpusIndex], variants[v].name, bytes,
+             (unsigned long long) g_benchOptions.iterations, bestMs, bestMs > 0.0 ? bytes / 1000.0 / bestMs : 0.0,
+             substitutions);
+    }
+    if (!ok) {
+      log_error("Kernel benchmark failed on the %s corpus", corpusNames[corpusIndex]);
+    }
+    free(work);
+    free(output);
+  }
+  fflush(stdout);
+  pcre2_match_data_free(matchData);
+  pcre2_code_free(regex);
+  return ok;
+}
 
-  NormalizedBuffer normalized = normalize_clipboard_text(original.text, original.length);
-  if (!normalized.text) {
-    log_info("Failed to allocate memory while normalizing clipboard text");
-    free_clipboard_buffer(&original);
-    return;
+// Times the same patterns on the interpreter and the JIT on each corpus: one `jit` row per corpus, pattern and engine,
+// with `<pattern>-interpreter` or `<pattern>-jit` in the rules column and the match count in the last column. Builds
+// without SUPPORT_JIT (no sljit under PCRE2's deps/) print the interpreter rows only.
+static bool run_bench_jit(const ClipboardBuffer* corpora, const char** corpusNames, size_t corpusCount) {
+  static const struct {
+    const char* name;
+    const wchar_t* pattern;
+  } kPatterns[] = {
+      {"levels", L"(?i)\\b(?:error|warn(?:ing)?|fatal)\\b"},
+      {"indent", L"(?m)^[ \\t]+"},
+      {"trailing", L"(?m)[ \\t]+$"},
+      {"numbers", L"\\d+(?:[.,]\\d+)*"},
+  };
+  uint32_t jitAvailable = 0;
+  pcre2_config(PCRE2_CONFIG_JIT, &jitAvailable);
+  if (!jitAvailable) {
+    log_info("This build has no JIT, so the jit rows cover the interpreter only");
   }
 
-  bool changed = false;
-  if (normalized.length != original.length) {
-    changed = true;
-  } else if (wcsncmp(normalized.text, original.text, normalized.length) != 0) {
-    changed = true;
+  LARGE_INTEGER frequency = {0};
+  QueryPerformanceFrequency(&frequency);
+  bool ok = true;
+  for (size_t p = 0; ok && p < sizeof(kPatterns) / sizeof(kPatterns[0]); ++p) {
+    int compileError = 0;
+    PCRE2_SIZE errorOffset = 0;
+    pcre2_code* regex = pcre2_compile((PCRE2_SPTR) kPatterns[p].pattern, PCRE2_ZERO_TERMINATED, PCRE2_UTF | PCRE2_UCP,
+                                      &compileError, &errorOffset, NULL);
+    pcre2_match_data* matchData = regex ? pcre2_match_data_create_from_pattern(regex, NULL) : NULL;
+    if (!matchData) {
+      pcre2_code_free(regex);
+      log_error("Unable to compile the %s pattern for the JIT benchmark", kPatterns[p].name);
+      return false;
+    }
+    bool jitCompiled = jitAvailable && pcre2_jit_compile(regex, PCRE2_JIT_COMPLETE) == 0;
+    for (size_t corpusIndex = 0; ok && corpusIndex < corpusCount; ++corpusIndex) {
+      const ClipboardBuffer* corpus = &corpora[corpusIndex];
+      for (int engine = 0; ok && engine < (jitCompiled ? 2 : 1); ++engine) {
+        uint32_t options = engine == 0 ? PCRE2_NO_JIT : 0;
+        double bestMs = 0.0;
+        size_t matches = 0;
+        for (uint64_t iteration = 0; ok && iteration < g_benchOptions.iterations; ++iteration) {
+          LARGE_INTEGER started = {0};
+          LARGE_INTEGER finished = {0};
+          matches = 0;
+          QueryPerformanceCounter(&started);
+          PCRE2_SIZE offset = 0;
+          uint32_t matchOptions = options;
+          while (offset <= corpus->length) {
+            int rc =
+                pcre2_match(regex, (PCRE2_SPTR) corpus->text, corpus->length, offset, matchOptions, matchData, NULL);
+            if (rc < 0) {
+              ok = rc == PCRE2_ERROR_NOMATCH;
+              break;
+            }
+            const PCRE2_SIZE* ovector = pcre2_get_ovector_pointer(matchData);
+            matches++;
+            matchOptions = options | PCRE2_NO_UTF_CHECK; // checked once, not again for every match
+            // None of these patterns matches empty, but step past one anyway rather than loop on it.
+            offset = ovector[1] > ovector[0] ? ovector[1] : ovector[1] + 1;
+          }
+          QueryPerformanceCounter(&finished);
+          double elapsedMs = 1000.0 * (double) (finished.QuadPart - started.QuadPart) / (double) frequency.QuadPart;
+          if (iteration == 0 || elapsedMs < bestMs) {
+            bestMs = elapsedMs;
+          }
+        }
+        double bytes = (double) corpus->length * sizeof(wchar_t);
+        printf("jit,%s,%s-%s,,%.0f,%llu,%.3f,%.1f,0.0,%zu\n", corpusNames[corpusIndex], kPatterns[p].name,
+               engine == 0 ? "interpreter" : "jit", bytes, (unsigned long long) g_benchOptions.iterations, bestMs,
+               bestMs > 0.0 ? bytes / 1000.0 / bestMs : 0.0, matches);
+      }
+      if (!ok) {
+        log_error("JIT benchmark failed on the %s corpus with the %s pattern", corpusNames[corpusIndex],
+                  kPatterns[p].name);
+      }
+    }
+    pcre2_match_data_free(matchData);
+    pcre2_code_free(regex);
   }
+  fflush(stdout);
+  return ok;
+}
 
-  if (!changed) {
-    log_info("Clipboard text already normalized (%zu line%s)", normalized.lineCount,
-             normalized.lineCount == 1 ? "" : "s");
-    free(normalized.text);
-    free_clipboard_buffer(&original);
-    return;
+// Prints CSV to stdout: one `kernel` row per corpus and trim-trailing scanner, one `jit` row per corpus, pattern and
+// engine, one `parse` row per generated 100k-entry rules file, one `total` row per corpus and rule set (all best
+// iteration) and one `rule` row per rule or run of literal rules (mean per iteration, from the pattern profiles). Sizes
+// are UTF-16 bytes; allocations are engine and PCRE2 heap calls per iteration.
+static int run_bench(void) {
+  size_t generatedCount = sizeof(kBenchCorpora) / sizeof(kBenchCorpora[0]);
+  size_t corpusCount = generatedCount + g_benchOptions.corpusPathCount;
+  ClipboardBuffer* corpora = (ClipboardBuffer*) calloc(corpusCount, sizeof(ClipboardBuffer));
+  const char** corpusNames = (const char**) calloc(corpusCount, sizeof(char*)); // only file names are owned
+  bool ok = corpora && corpusNames;
+
+  for (size_t i = 0; ok && i < generatedCount; ++i) {
+    size_t megabytes = g_benchOptions.megabytes ? g_benchOptions.megabytes : kBenchCorpora[i].defaultMegabytes;
+    corpusNames[i] = kBenchCorpora[i].name;
+    ok = generate_bench_corpus(&kBenchCorpora[i], megabytes, &corpora[i]);
+    if (!ok) {
+      log_error("Out of memory while generating the %s corpus", kBenchCorpora[i].name);
+    }
+  }
+  for (size_t i = 0; ok && i < g_benchOptions.corpusPathCount; ++i) {
+    const wchar_t* path = g_benchOptions.corpusPaths[i];
+    RuleLoadError loadError = {0};
+    char* name = utf8_from_wide(path);
+    corpusNames[generatedCount + i] = name;
+    ok = name && read_utf8_file(path, &corpora[generatedCount + i], &loadError);
+    if (!ok) {
+      log_error("Unable to load corpus %s: %s", name ? name : "?", loadError.message);
+    }
   }
 
-  g_isUpdatingClipboard = true;
-  if (set_clipboard_text(hwnd, normalized.text, normalized.length)) {
-    log_info("Applied %zu regex replacement%s across %zu rule%s", normalized.replacementStats.substitutionsApplied,
-             normalized.replacementStats.substitutionsApplied == 1 ? "" : "s",
-             normalized.replacementStats.rulesTouched, normalized.replacementStats.rulesTouched == 1 ? "" : "s");
-    if (!PlaySoundW(L"SystemNotification", NULL, SND_ALIAS | SND_ASYNC | SND_NODEFAULT)) {
-      MessageBeep(MB_ICONASTERISK);
+  if (ok) {
+    printf("scope,corpus,rules,rule_line,utf16_bytes,iterations,ms,mb_per_s,allocations,substitutions\n");
+    RuleSet ruleSet = {0};
+    RuleLoadError loadError = {0};
+    ok = run_bench_trim_kernels(corpora, corpusNames, corpusCount) &&
+         run_bench_jit(corpora, corpusNames, corpusCount) && run_bench_rule_parse("literal-100k", 100000, false) &&
+         run_bench_rule_parse("regex-100k", 100000, true) &&
+         load_rule_set_from_utf8(kDefaultRulesFileContents, &ruleSet, &loadError) &&
+         run_bench_rule_set(&ruleSet, "default", corpora, corpusNames, corpusCount);
+    if (ok) {
+      ok = load_rule_set_from_utf8(kBenchStressRules, &ruleSet, &loadError) &&
+           run_bench_rule_set(&ruleSet, "stress", corpora, corpusNames, corpusCount);
+    }
+    if (ok) {
+      ok = load_rule_set_from_utf8(kBenchAdversarialRules, &ruleSet, &loadError) &&
+           run_bench_rule_set(&ruleSet, "adversarial-backtrack", corpora, corpusNames, corpusCount);
+    }
+    if (ok) {
+      ok = load_rule_set_from_utf8(kBenchAdversarialDfaRules, &ruleSet, &loadError) &&
+           run_bench_rule_set(&ruleSet, "adversarial-dfa", corpora, corpusNames, corpusCount);
+    }
+    static const struct {
+      const char* name;
+      size_t entryCount;
+    } kBenchDictionaries[] = {{"literal-1k", 1000}, {"literal-10k", 10000}, {"literal-100k", 100000}};
+    for (size_t i = 0; ok && i < sizeof(kBenchDictionaries) / sizeof(kBenchDictionaries[0]); ++i) {
+      ok = load_bench_dictionary_rules(kBenchDictionaries[i].entryCount, &ruleSet, &loadError) &&
+           run_bench_rule_set(&ruleSet, kBenchDictionaries[i].name, corpora, corpusNames, corpusCount);
+    }
+    if (ok && g_filterOptions.rulesPath) {
+      ok = load_rule_set_from_file(g_filterOptions.rulesPath, &ruleSet, &loadError) &&
+           run_bench_rule_set(&ruleSet, "custom", corpora, corpusNames, corpusCount);
+    }
+    if (!ok && loadError.message[0] != '\0') {
+      log_error("Failed to load benchmark rules at line %zu: %s", loadError.lineNumber == 0 ? 1u : loadError.lineNumber,
+               loadError.message);
     }
-  } else {
-    log_info("Failed to set normalized text back onto clipboard");
   }
-  g_isUpdatingClipboard = false;
 
-  free(normalized.text);
-  free_clipboard_buffer(&original);
+  for (size_t i = 0; i < corpusCount; ++i) {
+    if (corpora) {
+      free(corpora[i].text);
+    }
+    if (corpusNames && i >= generatedCount) {
+      free((char*) corpusNames[i]);
+    }
+  }
+  free(corpora);
+  free(corpusNames);
+  free_rule_config_state();
+  return ok ? 0 : 1;
 }
 
 static void release_single_instance_mutex(void) {
@@ -1309,26 +6666,104 @@ static void request_previous_instance_shutdown(void) {
   log_info("Previous instance did not exit within timeout; continuing startup");
 }
 
+// The worker owns the profiles, so the window thread only asks it to report them.
+static void request_rule_profile_report(void) {
+  InterlockedExchange(&g_worker.statsRequested, 1);
+  SetEvent(g_worker.wakeEvent);
+}
+
+static bool request_running_instance_stats(void) {
+  HWND existing = FindWindowW(kWindowClassName, NULL);
+  if (!existing) {
+    log_info("No running ClipTrim instance to report rule profiles");
+    return false;
+  }
+  DWORD existingPid = 0;
+  GetWindowThreadProcessId(existing, &existingPid);
+  if (!PostMessageW(existing, WM_APP_DUMP_STATS, 0, 0)) {
+    log_error("PostMessage to PID %lu failed (%lu)", (unsigned long) existingPid, GetLastError());
+    return false;
+  }
+  log_info("Asked the running instance (PID %lu) to log its rule profiles", (unsigned long) existingPid);
+  return true;
+}
+
 static LRESULT CALLBACK window_proc(HWND hwnd, UINT msg, WPARAM wParam, LPARAM lParam) {
   switch (msg) {
   case WM_CREATE:
+    if (!start_normalization_worker(hwnd)) {
+      log_error("Failed to start normalization worker (%lu)", GetLastError());
+      return -1;
+    }
+    start_rules_watcher();
     if (!AddClipboardFormatListener(hwnd)) {
-      log_info("AddClipboardFormatListener failed");
+      log_error("AddClipboardFormatListener failed");
+      stop_rules_watcher();
+      stop_normalization_worker();
       return -1;
     }
-    log_info("Clipboard listener registered");
+    LARGE_INTEGER registered = {0};
+    QueryPerformanceCounter(&registered);
+    log_info("Clipboard listener registered %.1f ms after launch",
+             profile_ticks_to_ms((uint64_t) (registered.QuadPart - g_launchCounter.QuadPart)));
+    if (g_renderOnPaste) {
+      log_info("Normalizing on paste; copied text that is never pasted is left alone");
+    }
+    if (RegisterHotKey(hwnd, STATS_HOTKEY_ID, MOD_CONTROL | MOD_ALT | MOD_SHIFT | MOD_NOREPEAT, 'T')) {
+      log_info("Press Ctrl+Alt+Shift+T to log rule profiles");
+    } else {
+      log_error("RegisterHotKey failed (%lu); use `trim --dump-stats` to log rule profiles", GetLastError());
+    }
     return 0;
   case WM_APP_EXIT:
     log_info("Received shutdown request from newer instance");
     DestroyWindow(hwnd);
     return 0;
   case WM_CLIPBOARDUPDATE:
-    handle_clipboard_update(hwnd);
+    handle_clipboard_notification(hwnd);
+    return 0;
+  case WM_TIMER:
+    if (wParam == COALESCE_TIMER_ID) {
+      handle_coalesce_timer(hwnd);
+      return 0;
+    }
+    return DefWindowProc(hwnd, msg, wParam, lParam);
+  case WM_APP_NORMALIZED:
+    handle_normalization_result(hwnd, (NormalizationResult*) lParam);
+    return 0;
+  case WM_RENDERFORMAT:
+    handle_render_format((UINT) wParam);
+    return 0;
+  case WM_RENDERALLFORMATS:
+    handle_render_all_formats(hwnd);
+    return 0;
+  case WM_DESTROYCLIPBOARD:
+    handle_destroy_clipboard();
+    return 0;
+  case WM_HOTKEY:
+    if (wParam == STATS_HOTKEY_ID) {
+      request_rule_profile_report();
+      return 0;
+    }
+    return DefWindowProc(hwnd, msg, wParam, lParam);
+  case WM_APP_DUMP_STATS:
+    request_rule_profile_report();
     return 0;
   case WM_DESTROY:
     RemoveClipboardFormatListener(hwnd);
     PostQuitMessage(0);
     log_info("Shutting down");
+    KillTimer(hwnd, COALESCE_TIMER_ID);
+    UnregisterHotKey(hwnd, STATS_HOTKEY_ID);
+    // Normally done already by WM_RENDERALLFORMATS; the worker it needs is about to stop.
+    handle_render_all_formats(hwnd);
+    if (g_renderOnPaste) {
+      log_info("Normalized %zu pasted clipboard text%s; skipped %zu that were never pasted", g_deferredRender.rendered,
+               g_deferredRender.rendered == 1 ? "" : "s", g_deferredRender.avoided);
+    }
+    stop_rules_watcher();
+    stop_normalization_worker();
+    report_rule_profiles("at exit");
     free_rule_config_state();
     free(g_executableDirectory);
     g_executableDirectory = NULL;
@@ -1339,20 +6774,195 @@ static LRESULT CALLBACK window_proc(HWND hwnd, UINT msg, WPARAM wParam, LPARAM l
   }
 }
 
-int wmain(void) {
+static bool parse_args(int argc, wchar_t** argv) {
+  bool sawFilterOption = false;
+  bool sawBenchOption = false;
+  for (int i = 1; i < argc; ++i) {
+    const wchar_t* arg = argv[i];
+    if (!arg) {
+      continue;
+    }
+
+    if (wcscmp(arg, L"--debounce") == 0) {
+      uint64_t debounceMs = 0;
+      if (i + 1 >= argc || !parse_unsigned_value(argv[i + 1], wcslen(argv[i + 1]), MAX_DEBOUNCE_MS, &debounceMs)) {
+        log_error("--debounce requires a number of milliseconds from 0 to %u", MAX_DEBOUNCE_MS);
+        return false;
+      }
+      g_commandLineDebounceMs = (LONG) debounceMs;
+      ++i;
+    } else if (wcscmp(arg, L"--filter") == 0) {
+      g_filterOptions.enabled = true;
+      // The input path is optional; "-" or no path reads stdin.
+      if (i + 1 < argc && argv[i + 1] && wcsncmp(argv[i + 1], L"--", 2) != 0) {
+        ++i;
+        g_filterOptions.inputPath = wcscmp(argv[i], L"-") == 0 ? NULL : argv[i];
+      }
+    } else if (wcscmp(arg, L"--bench") == 0) {
+      g_benchOptions.enabled = true;
+      // Any following arguments up to the next option are extra corpus files.
+      g_benchOptions.corpusPaths = argv + i + 1;
+      while (i + 1 < argc && argv[i + 1] && wcsncmp(argv[i + 1], L"--", 2) != 0) {
+        g_benchOptions.corpusPathCount++;
+        ++i;
+      }
+    } else if (wcscmp(arg, L"--bench-mb") == 0) {
+      uint64_t megabytes = 0;
+      if (i + 1 >= argc ||
+          !parse_unsigned_value(argv[i + 1], wcslen(argv[i + 1]), BENCH_MAX_MEGABYTES, &megabytes) || megabytes == 0) {
+        log_error("--bench-mb requires a corpus size from 1 to %u MB", BENCH_MAX_MEGABYTES);
+        return false;
+      }
+      g_benchOptions.megabytes = (size_t) megabytes;
+      sawBenchOption = true;
+      ++i;
+    } else if (wcscmp(arg, L"--bench-iterations") == 0) {
+      uint64_t iterations = 0;
+      if (i + 1 >= argc ||
+          !parse_unsigned_value(argv[i + 1], wcslen(argv[i + 1]), BENCH_MAX_ITERATIONS, &iterations) ||
+          iterations == 0) {
+        log_error("--bench-iterations requires a number from 1 to %u", BENCH_MAX_ITERATIONS);
+        return false;
+      }
+      g_benchOptions.iterations = iterations;
+      sawBenchOption = true;
+      ++i;
+    } else if (wcscmp(arg, L"--stats-file") == 0) {
+      if (i + 1 >= argc || !argv[i + 1] || argv[i + 1][0] == L'\0') {
+        log_error("--stats-file requires a path");
+        return false;
+      }
+      g_statsFilePath = argv[++i];
+    } else if (wcscmp(arg, L"--stats-interval") == 0) {
+      uint64_t intervalSeconds = 0;
+      if (i + 1 >= argc ||
+          !parse_unsigned_value(argv[i + 1], wcslen(argv[i + 1]), STATS_MAX_INTERVAL_S, &intervalSeconds) ||
+          intervalSeconds == 0) {
+        log_error("--stats-interval requires a number of seconds from 1 to %u", STATS_MAX_INTERVAL_S);
+        return false;
+      }
+      g_statsIntervalMs = (DWORD) intervalSeconds * 1000u;
+      ++i;
+    } else if (wcscmp(arg, L"--dump-stats") == 0) {
+      g_dumpStatsRequested = true;
+    } else if (wcscmp(arg, L"--on-paste") == 0) {
+      g_renderOnPaste = true;
+    } else if (wcscmp(arg, L"--no-prewarm") == 0) {
+      g_prewarmPatterns = false;
+    } else if (wcscmp(arg, L"--rules") == 0) {
+      if (i + 1 >= argc || !argv[i + 1] || argv[i + 1][0] == L'\0') {
+        log_error("--rules requires a path to a rules file");
+        return false;
+      }
+      g_filterOptions.rulesPath = argv[++i];
+    } else if (wcscmp(arg, L"--segment-kib") == 0) {
+      uint64_t segmentKib = 0;
+      if (i + 1 >= argc ||
+          !parse_unsigned_value(argv[i + 1], wcslen(argv[i + 1]), FILTER_MAX_SEGMENT_KIB, &segmentKib)) {
+        log_error("--segment-kib requires a number of KiB from 0 to %u (0 reads the whole input at once)",
+                 FILTER_MAX_SEGMENT_KIB);
+        return false;
+      }
+      g_filterOptions.segmentBytes = (size_t) segmentKib * 1024u;
+      sawFilterOption = true;
+      ++i;
+    } else if (wcscmp(arg, L"--lossy") == 0) {
+      g_filterOptions.lossy = true;
+      sawFilterOption = true;
+    } else if (wcscmp(arg, L"--log-level") == 0) {
+      const wchar_t* level = i + 1 < argc ? argv[i + 1] : NULL;
+      if (level && wcscmp(level, L"debug") == 0) {
+        g_logLevel = LOG_LEVEL_DEBUG;
+      } else if (level && wcscmp(level, L"info") == 0) {
+        g_logLevel = LOG_LEVEL_INFO;
+      } else if (level && wcscmp(level, L"error") == 0) {
+        g_logLevel = LOG_LEVEL_ERROR;
+      } else {
+        log_error("--log-level requires debug, info or error");
+        return false;
+      }
+      ++i;
+    } else if (wcscmp(arg, L"--threads") == 0) {
+      uint64_t threads = 0;
+      if (i + 1 >= argc || !parse_unsigned_value(argv[i + 1], wcslen(argv[i + 1]), SEGMENT_MAX_LANES, &threads) ||
+          threads == 0) {
+        log_error("--threads requires a number from 1 to %u (1 runs `scope line` rules on a single thread)",
+                 SEGMENT_MAX_LANES);
+        return false;
+      }
+      g_segmentLaneLimit = (size_t) threads;
+      ++i;
+    } else {
+      char* utf8Arg = utf8_from_wide(arg);
+      log_error("Unknown argument: %s", utf8Arg ? utf8Arg : "?");
+      free(utf8Arg);
+      return false;
+    }
+  }
+
+  if (g_filterOptions.enabled && g_benchOptions.enabled) {
+    log_error("--filter and --bench cannot be combined");
+    return false;
+  }
+  if (!g_filterOptions.enabled && sawFilterOption) {
+    log_error("--segment-kib and --lossy only apply together with --filter");
+    return false;
+  }
+  if (!g_benchOptions.enabled && sawBenchOption) {
+    log_error("--bench-mb and --bench-iterations only apply together with --bench");
+    return false;
+  }
+  if ((g_filterOptions.enabled || g_benchOptions.enabled) && g_renderOnPaste) {
+    log_error("--on-paste only applies to the clipboard normalizer");
+    return false;
+  }
+  if ((g_filterOptions.enabled || g_benchOptions.enabled) && !g_prewarmPatterns) {
+    log_error("--no-prewarm only applies to the clipboard normalizer");
+    return false;
+  }
+  if (!g_filterOptions.enabled && !g_benchOptions.enabled && g_filterOptions.rulesPath) {
+    log_error("--rules only applies together with --filter or --bench");
+    return false;
+  }
+  return true;
+}
+
+static int run_clip_trim(int argc, wchar_t** argv) {
+  QueryPerformanceCounter(&g_launchCounter);
   SetConsoleOutputCP(CP_UTF8);
+  // Decide where logs go before the first one, since --filter and --bench write their results to stdout.
+  for (int i = 1; i < argc; ++i) {
+    if (argv[i] && (wcscmp(argv[i], L"--filter") == 0 || wcscmp(argv[i], L"--bench") == 0)) {
+      g_logStream = stderr;
+    }
+  }
   log_info("\xC2\xA9 2026 Elefunc, Inc. All rights reserved.");
   log_info("https://elefunc.com");
-  log_info("Starting ClipTrim clipboard normalizer");
+  if (!parse_args(argc, argv)) {
+    return 1;
+  }
+  log_info(g_filterOptions.enabled  ? "Starting ClipTrim in filter mode"
+           : g_benchOptions.enabled ? "Starting ClipTrim rule-engine benchmark"
+                                    : "Starting ClipTrim clipboard normalizer");
   log_current_working_directory();
   if (!initialize_executable_directory()) {
-    log_info("GetModuleFileName failed (%lu)", GetLastError());
+    log_error("GetModuleFileName failed (%lu)", GetLastError());
+  }
+  if (g_dumpStatsRequested) {
+    return request_running_instance_stats() ? 0 : 1;
+  }
+  if (g_filterOptions.enabled) {
+    return run_filter();
+  }
+  if (g_benchOptions.enabled) {
+    return run_bench();
   }
   refresh_replacement_config();
+  publish_rule_settings();
 
   g_singleInstanceMutex = CreateMutexW(NULL, FALSE, SINGLE_INSTANCE_MUTEX_NAME);
   if (!g_singleInstanceMutex) {
-    log_info("CreateMutex failed (%lu)", GetLastError());
+    log_error("CreateMutex failed (%lu)", GetLastError());
     return 1;
   }
 
@@ -1367,7 +6977,7 @@ int wmain(void) {
     g_singleInstanceMutex = NULL;
     return 1;
   } else if (waitResult == WAIT_FAILED) {
-    log_info("WaitForSingleObject on singleton mutex failed (%lu)", GetLastError());
+    log_error("WaitForSingleObject on singleton mutex failed (%lu)", GetLastError());
     CloseHandle(g_singleInstanceMutex);
     g_singleInstanceMutex = NULL;
     return 1;
@@ -1389,7 +6999,7 @@ int wmain(void) {
   wc.hIconSm = (HICON) LoadImageW(hInstance, MAKEINTRESOURCEW(IDI_APP), IMAGE_ICON, 16, 16, 0);
 
   if (!RegisterClassExW(&wc)) {
-    log_info("RegisterClassEx failed (%lu)", GetLastError());
+    log_error("RegisterClassEx failed (%lu)", GetLastError());
     return 1;
   }
 
@@ -1397,7 +7007,7 @@ int wmain(void) {
                               CW_USEDEFAULT, CW_USEDEFAULT, CW_USEDEFAULT, CW_USEDEFAULT, NULL, NULL, hInstance, NULL);
 
   if (!hwnd) {
-    log_info("CreateWindowEx failed (%lu)", GetLastError());
+    log_error("CreateWindowEx failed (%lu)", GetLastError());
     return 1;
   }
 
@@ -1413,3 +7023,10 @@ int wmain(void) {
 
   return 0;
 }
+
+int wmain(int argc, wchar_t** argv) {
+  start_log_flusher();
+  int exitCode = run_clip_trim(argc, argv);
+  stop_log_flusher();
+  return exitCode;
+}